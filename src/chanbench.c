@@ -0,0 +1,142 @@
+/* Usage: chanbench [members [churn]]
+ *
+ * Puts members users into one big channel (and each of them into a
+ * handful of small ones, like a typical network), then has random
+ * members part and rejoin the big channel.  Each round trip does the
+ * GetUserMode() lookups of a JOIN plus the list removal of a PART.
+ * For comparison, the same lookups are also done by scanning the
+ * user's channel list the way GetUserMode() used to.
+ */
+
+#include "common.h"
+#include "hash.h"
+#include "helpfile.h"
+#include "log.h"
+#include "proto.h"
+
+/* hash.c is tied in to the protocol and logging code; stub it out. */
+
+time_t now;
+const char *hidden_host_suffix;
+struct log_type *MAIN_LOG;
+struct language *lang_C;
+
+void log_module(UNUSED_ARG(struct log_type *lt), UNUSED_ARG(enum log_severity ls), UNUSED_ARG(const char *format), ...) { }
+const char *language_find_message(UNUSED_ARG(struct language *lang), const char *msgid) { return msgid; }
+void reg_exit_func(UNUSED_ARG(exit_func_t handler), UNUSED_ARG(void *extra)) { }
+void DelServer(UNUSED_ARG(struct server *serv), UNUSED_ARG(int announce), UNUSED_ARG(const char *message)) { }
+int IsChannelName(const char *name) { return *name == '#'; }
+void irc_user(UNUSED_ARG(struct userNode *user)) { }
+void irc_nick(UNUSED_ARG(struct userNode *user), UNUSED_ARG(const char *old_nick)) { }
+void irc_join(UNUSED_ARG(struct userNode *who), UNUSED_ARG(struct chanNode *what)) { }
+void irc_kick(UNUSED_ARG(struct userNode *who), UNUSED_ARG(struct userNode *target), UNUSED_ARG(struct chanNode *from), UNUSED_ARG(const char *msg)) { }
+void irc_part(UNUSED_ARG(struct userNode *who), UNUSED_ARG(struct chanNode *what), UNUSED_ARG(const char *reason)) { }
+void irc_topic(UNUSED_ARG(struct userNode *service), UNUSED_ARG(struct userNode *who), UNUSED_ARG(struct chanNode *what), UNUSED_ARG(const char *topic)) { }
+void irc_account(UNUSED_ARG(struct userNode *user), UNUSED_ARG(const char *stamp), UNUSED_ARG(time_t timestamp)) { }
+void irc_fakehost(UNUSED_ARG(struct userNode *user), UNUSED_ARG(const char *host)) { }
+void free_string_list(UNUSED_ARG(struct string_list *slist)) { }
+struct mod_chanmode *mod_chanmode_alloc(UNUSED_ARG(unsigned int argc)) { return NULL; }
+void mod_chanmode_announce(UNUSED_ARG(struct userNode *who), UNUSED_ARG(struct chanNode *channel), UNUSED_ARG(struct mod_chanmode *change)) { }
+void mod_chanmode_free(UNUSED_ARG(struct mod_chanmode *change)) { }
+int mod_chanmode(UNUSED_ARG(struct userNode *who), UNUSED_ARG(struct chanNode *channel), UNUSED_ARG(char **modes), UNUSED_ARG(unsigned int argc), UNUSED_ARG(unsigned int flags)) { return 0; }
+
+static double
+elapsed(struct timeval *start)
+{
+    struct timeval stop;
+    gettimeofday(&stop, NULL);
+    return (stop.tv_sec - start->tv_sec) + (stop.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+/* What GetUserMode() did before the membership index. */
+static struct modeNode *
+scan_user_mode(struct chanNode *channel, struct userNode *user)
+{
+    unsigned int n;
+
+    if (channel->members.used < user->channels.used) {
+        for (n=0; n<channel->members.used; n++)
+            if (user == channel->members.list[n]->user)
+                return channel->members.list[n];
+    } else {
+        for (n=0; n<user->channels.used; n++)
+            if (channel == user->channels.list[n]->channel)
+                return user->channels.list[n];
+    }
+    return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct userNode **users, *user;
+    struct chanNode *big, *small[64];
+    struct timeval start;
+    unsigned int count, churn, found, ii, jj;
+    char name[32];
+    double secs;
+
+    count = (argc > 1) ? strtoul(argv[1], NULL, 0) : 50000;
+    churn = (argc > 2) ? strtoul(argv[2], NULL, 0) : 200000;
+    if (!count) {
+        fprintf(stderr, "usage: %s [members [churn]]\n", argv[0]);
+        return 1;
+    }
+    tools_init();
+    init_structs();
+    big = AddChannel("#big", now, "+nt", NULL, NULL);
+    for (ii = 0; ii < ArrayLength(small); ii++) {
+        snprintf(name, sizeof(name), "#small%u", ii);
+        small[ii] = AddChannel(name, now, "+nt", NULL, NULL);
+    }
+    users = calloc(count, sizeof(*users));
+    srandom(1);
+    for (ii = 0; ii < count; ii++) {
+        users[ii] = user = calloc(1, sizeof(*user));
+        snprintf(name, sizeof(name), "user%u", ii);
+        user->nick = strdup(name);
+        user->uplink = (struct server*)users; /* anything but self */
+        modeList_init(&user->channels);
+        for (jj = 0; jj < 50; jj++)
+            AddChannelUser(user, small[random() % ArrayLength(small)]);
+        AddChannelUser(user, big);
+    }
+    printf("%u members in #big, %u channel memberships\n", big->members.used, count * 51);
+
+    srandom(2);
+    gettimeofday(&start, NULL);
+    for (ii = found = 0; ii < churn; ii++) {
+        user = users[random() % count];
+        DelChannelUser(user, big, NULL, 0);
+        found += !GetUserMode(big, user);
+        AddChannelUser(user, big);
+        found += !!GetUserMode(big, user);
+    }
+    secs = elapsed(&start);
+    printf("part/join churn:   %u round trips in %.3fs (%.2f us each)%s\n",
+           churn, secs, secs * 1000000.0 / churn,
+           (found == 2 * churn && big->members.used == count) ? "" : " MEMBERSHIP BROKEN");
+
+    srandom(3);
+    gettimeofday(&start, NULL);
+    for (ii = found = 0; ii < churn; ii++) {
+        user = users[random() % count];
+        found += (GetUserMode(big, user) != NULL);
+        found += (GetUserMode(small[random() % ArrayLength(small)], user) != NULL);
+    }
+    secs = elapsed(&start);
+    printf("indexed lookup:    %u lookups in %.3fs (%.3f us each, %u hits)\n",
+           churn * 2, secs, secs * 1000000.0 / (churn * 2), found);
+
+    srandom(3);
+    gettimeofday(&start, NULL);
+    for (ii = found = 0; ii < churn; ii++) {
+        user = users[random() % count];
+        found += (scan_user_mode(big, user) != NULL);
+        found += (scan_user_mode(small[random() % ArrayLength(small)], user) != NULL);
+    }
+    secs = elapsed(&start);
+    printf("list scan lookup:  %u lookups in %.3fs (%.3f us each, %u hits)\n",
+           churn * 2, secs, secs * 1000000.0 / (churn * 2), found);
+    return 0;
+}
@@ -1366,6 +1366,7 @@ chanserv_expire_tempuser(void *data)
     char *handle;
 
     if (data) {
+        uData->access_timer = NULL;
         handle = strdup(uData->handle->handle);
         if (uData->accessexpiry > 0) {
             if (uData->present) {
@@ -1408,6 +1409,7 @@ chanserv_expire_tempclvl(void *data)
     char *handle;
 
     if (data) {
+        uData->clvl_timer = NULL;
         handle = strdup(uData->handle->handle);
         if (uData->clvlexpiry > 0) {
             int changemodes = 0;
@@ -1471,8 +1473,10 @@ del_channel_user(struct userData *user, int do_gc)
     channel->userCount--;
     userCount--;
 
-    timeq_del(0, chanserv_expire_tempuser, user, TIMEQ_IGNORE_WHEN);
-    timeq_del(0, chanserv_expire_tempclvl, user, TIMEQ_IGNORE_WHEN);
+    if (user->access_timer)
+        timeq_cancel(user->access_timer);
+    if (user->clvl_timer)
+        timeq_cancel(user->clvl_timer);
 
     if(user->prev)
         user->prev->next = user->next;
@@ -1644,12 +1648,15 @@ add_channel_ban(struct chanData *channel, const char *mask, char *owner, time_t
         mask = new_mask;
     }
     safestrncpy(bd->mask, mask, sizeof(bd->mask));
+    bd->matcher = glob_matcher_compile(bd->mask, MATCH_USENICK);
     if(owner)
         safestrncpy(bd->owner, owner, sizeof(bd->owner));
     bd->reason = strdup(reason);
 
     if(expires)
-    timeq_add(expires, expire_ban, bd);
+        bd->expire_timer = timeq_add(expires, expire_ban, bd);
+    else
+        bd->expire_timer = NULL;
 
     bd->prev = NULL;
     bd->next = channel->bans; /* lamers */
@@ -1676,12 +1683,13 @@ del_channel_ban(struct banData *ban)
     if(ban->next)
         ban->next->prev = ban->prev;
 
-    if(ban->expires)
-    timeq_del(0, expire_ban, ban, TIMEQ_IGNORE_WHEN);
+    if(ban->expire_timer)
+        timeq_cancel(ban->expire_timer);
 
     if(ban->reason)
         free(ban->reason);
 
+    glob_matcher_free(ban->matcher);
     free(ban);
 }
 
@@ -1689,6 +1697,7 @@ static void
 expire_ban(void *data) /* lamer.. */
 {
     struct banData *bd = data;
+    bd->expire_timer = NULL;
     if(!IsSuspended(bd->channel))
     {
         struct banList bans;
@@ -1733,7 +1742,8 @@ unregister_channel(struct chanData *channel, const char *reason)
     if(!channel)
     return;
 
-    timeq_del(0, NULL, channel, TIMEQ_IGNORE_FUNC | TIMEQ_IGNORE_WHEN);
+    if(channel->limit_timer)
+        timeq_cancel(channel->limit_timer);
 
     if(off_channel > 0)
     {
@@ -3198,7 +3208,7 @@ static CHANSERV_FUNC(cmd_adduser)
     scan_user_presence(actee, NULL);
 
     if (duration > 0)
-        timeq_add(accessexpiry, chanserv_expire_tempuser, actee);
+        actee->access_timer = timeq_add(accessexpiry, chanserv_expire_tempuser, actee);
 
     reply("CSMSG_ADDED_USER", handle->handle, channel->name, user_level_name_from_level(access_level), access_level);
     return 1 | override;
@@ -3267,7 +3277,9 @@ static CHANSERV_FUNC(cmd_clvl)
 
         victim->clvlexpiry = clvlexpiry;
         victim->lastaccess = victim->access;
-        timeq_add(clvlexpiry, chanserv_expire_tempclvl, victim);
+        if (victim->clvl_timer)
+            timeq_cancel(victim->clvl_timer);
+        victim->clvl_timer = timeq_add(clvlexpiry, chanserv_expire_tempclvl, victim);
     }
 
     /* Trying to clvl a equal/higher user */
@@ -3785,11 +3797,13 @@ static CHANSERV_FUNC(cmd_devoice)
 static int
 bad_channel_ban(struct chanNode *channel, struct userNode *user, const char *ban, unsigned int *victimCount, struct modeNode **victims)
 {
+    struct glob_matcher *matcher;
     unsigned int ii;
-    int b = 0;
+    int b = 0, res = 0;
 
     if(victimCount)
         *victimCount = 0;
+    matcher = glob_matcher_compile(ban, MATCH_USENICK);
     for(ii=0; ii<channel->members.used; ii++)
     {
         struct modeNode *mn = channel->members.list[ii];
@@ -3797,19 +3811,26 @@ bad_channel_ban(struct chanNode *channel, struct userNode *user, const char *ban
         if(IsService(mn->user))
             continue;
 
-        b = user_matches_glob(mn->user, ban, MATCH_USENICK | MATCH_VISIBLE, 0);
+        b = user_matches_matcher(mn->user, matcher, MATCH_USENICK | MATCH_VISIBLE, 0);
         if (b == -1)
-            return -1;
+        {
+            res = -1;
+            break;
+        }
         else if (b == 0)
             continue;
 
         if(protect_user(mn->user, user, channel->channel_info, false))
-            return 1;
+        {
+            res = 1;
+            break;
+        }
 
         if(victims)
             victims[(*victimCount)++] = mn;
     }
-    return 0;
+    glob_matcher_free(matcher);
+    return res;
 }
 
 int is_extban(char *b) {
@@ -4044,10 +4065,12 @@ eject_user(struct userNode *user, struct chanNode *channel, unsigned int argc, c
                     {
                         /* Delete the expiration timeq entry and
                            requeue if necessary. */
-                        timeq_del(0, expire_ban, bData, TIMEQ_IGNORE_WHEN);
+                        if(bData->expire_timer)
+                            timeq_cancel(bData->expire_timer);
+                        bData->expire_timer = NULL;
 
                         if(bData->expires)
-                            timeq_add(bData->expires, expire_ban, bData);
+                            bData->expire_timer = timeq_add(bData->expires, expire_ban, bData);
 
                         if(!cmd)
                         {
@@ -4229,8 +4252,8 @@ find_matching_bans(struct banList *bans, struct userNode *actee, const char *mas
     {
         for(ii = count = 0; ii < bans->used; ++ii)
         {
-            match[ii] = user_matches_glob(actee, bans->list[ii]->ban,
-                                          MATCH_USENICK | MATCH_VISIBLE, 0);
+            match[ii] = user_matches_matcher(actee, bans->list[ii]->matcher,
+                                             MATCH_USENICK | MATCH_VISIBLE, 0);
             if(match[ii])
                 count++;
         }
@@ -4303,7 +4326,7 @@ void expire_bans(UNUSED_ARG(void* data)) /* Real bans, not lamers */
                     /* Pull this ban out of the list */
                     banList_remove(&(channel->channel->banlist), bn);
                     jj--;
-                    free(bn);
+                    free_ban_node(bn);
                 }
             }
             /* Send the modes to IRC */
@@ -4379,7 +4402,7 @@ unban_user(struct userNode *user, struct chanNode *channel, unsigned int argc, c
         while(ban)
         {
             if(actee)
-                   for( ; ban && !user_matches_glob(actee, ban->mask, MATCH_USENICK | MATCH_VISIBLE, 0);
+                   for( ; ban && !user_matches_matcher(actee, ban->matcher, MATCH_USENICK | MATCH_VISIBLE, 0);
                  ban = ban->next);
             else
             for( ; ban && !match_ircglobs(mask, ban->mask);
@@ -5039,7 +5062,7 @@ static CHANSERV_FUNC(cmd_lamers)
     {
         if(search_u)
         {
-            if(!user_matches_glob(search_u, ban->mask, MATCH_USENICK | MATCH_VISIBLE, 0))
+            if(!user_matches_matcher(search_u, ban->matcher, MATCH_USENICK | MATCH_VISIBLE, 0))
                 continue;
         }
         else if(search)
@@ -8287,6 +8310,7 @@ chanserv_adjust_limit(void *data)
     struct chanNode *channel = cData->channel;
     unsigned int limit;
 
+    cData->limit_timer = NULL;
     if(IsSuspended(cData))
         return;
 
@@ -8306,6 +8330,14 @@ chanserv_adjust_limit(void *data)
     mod_chanmode_announce(chanserv, channel, &change);
 }
 
+static void
+chanserv_schedule_limit(struct chanData *cData)
+{
+    if(cData->limit_timer)
+        timeq_cancel(cData->limit_timer);
+    cData->limit_timer = timeq_add(now + chanserv_conf.adjust_delay, chanserv_adjust_limit, cData);
+}
+
 static void
 handle_new_channel(struct chanNode *channel, UNUSED_ARG(void *extra))
 {
@@ -8335,7 +8367,7 @@ trace_check_bans(struct userNode *user, struct chanNode *chan)
     if (chan->channel_info) {
         for(bData = chan->channel_info->bans; bData; bData = bData->next) {
 
-            if(!user_matches_glob(user, bData->mask, MATCH_USENICK, 0))
+            if(!user_matches_matcher(user, bData->matcher, MATCH_USENICK, 0))
                 continue;
 
             if(bData)
@@ -8367,7 +8399,7 @@ check_bans(struct userNode *user, const char *channel)
     {
         /* Not joining through a ban. */
         for(bData = cData->bans;
-            bData && !user_matches_glob(user, bData->mask, MATCH_USENICK, 0);
+            bData && !user_matches_matcher(user, bData->matcher, MATCH_USENICK, 0);
             bData = bData->next);
 
         if(bData)
@@ -8419,7 +8451,7 @@ channel_user_is_exempt(struct userNode *user, struct chanNode *channel)
 /* Welcome to my worst nightmare. Warning: Read (or modify)
    the code below at your own risk. */
 static int
-handle_join(struct modeNode *mNode, UNUSED_ARG(void *extra))
+handle_join(struct modeNode *mNode, int burst, UNUSED_ARG(void *extra))
 {
     struct mod_chanmode change;
     struct userNode *user = mNode->user;
@@ -8449,12 +8481,12 @@ handle_join(struct modeNode *mNode, UNUSED_ARG(void *extra))
      * full, see if they're on the banlist for the channel.  If so,
      * kickban them.
      */
-    if(user->uplink->burst && !mNode->modes)
+    if(burst && !mNode->modes)
     {
         unsigned int ii;
         for(ii = 0; ii < channel->banlist.used; ii++)
         {
-            if(user_matches_glob(user, channel->banlist.list[ii]->ban, MATCH_USENICK, 0))
+            if(user_matches_matcher(user, channel->banlist.list[ii]->matcher, MATCH_USENICK, 0))
             {
                 /* Riding a netburst.  Naughty. */
                 KickChannelUser(user, channel, chanserv, "User from far side of netsplit should have been banned - bye.");
@@ -8485,7 +8517,7 @@ handle_join(struct modeNode *mNode, UNUSED_ARG(void *extra))
         {
             /* Not joining through a ban. */
             for(bData = cData->bans;
-                bData && !user_matches_glob(user, bData->mask, MATCH_USENICK, 0);
+                bData && !user_matches_matcher(user, bData->matcher, MATCH_USENICK, 0);
                 bData = bData->next);
 
             if(bData)
@@ -8523,7 +8555,7 @@ handle_join(struct modeNode *mNode, UNUSED_ARG(void *extra))
        It will also skip DynLimit processing when the user (or srvx)
        is bursting in, because there are likely more incoming. */
     if((cData->flags & CHANNEL_DYNAMIC_LIMIT)
-       && !user->uplink->burst
+       && !burst
        && !channel->join_flooded
        && (channel->limit - channel->members.used) < chanserv_conf.adjust_threshold)
     {
@@ -8532,8 +8564,7 @@ handle_join(struct modeNode *mNode, UNUSED_ARG(void *extra))
            timers are removed so three incoming users within the delay
            results in one limit change, not three. */
 
-        timeq_del(0, chanserv_adjust_limit, cData, TIMEQ_IGNORE_WHEN);
-        timeq_add(now + chanserv_conf.adjust_delay, chanserv_adjust_limit, cData);
+        chanserv_schedule_limit(cData);
     }
 
     /* Give automodes exept during join-floods */
@@ -8599,7 +8630,7 @@ handle_join(struct modeNode *mNode, UNUSED_ARG(void *extra))
     /* If user joining normally (not during burst), apply op or voice,
      * and send greeting/userinfo as appropriate.
      */
-    if(!user->uplink->burst)
+    if(!burst)
     {
         if(modes)
         {
@@ -8720,14 +8751,14 @@ handle_auth(struct userNode *user, UNUSED_ARG(struct handle_info *old_handle), U
         if(protect_user(user, chanserv, chan->channel_info, true))
             continue;
         for(jj = 0; jj < chan->banlist.used; ++jj)
-            if(user_matches_glob(user, chan->banlist.list[jj]->ban, MATCH_USENICK, 0))
+            if(user_matches_matcher(user, chan->banlist.list[jj]->matcher, MATCH_USENICK, 0))
                 break;
         if(jj < chan->banlist.used)
             continue;
         for(ban = chan->channel_info->bans; ban; ban = ban->next)
         {
             char kick_reason[MAXLEN];
-            if(!user_matches_glob(user, ban->mask,MATCH_USENICK | MATCH_VISIBLE, 0))
+            if(!user_matches_matcher(user, ban->matcher, MATCH_USENICK | MATCH_VISIBLE, 0))
                 continue;
             change.args[0].mode = MODE_BAN;
             change.args[0].u.hostmask = ban->mask;
@@ -8782,8 +8813,7 @@ handle_part(struct modeNode *mn, UNUSED_ARG(const char *reason), UNUSED_ARG(void
            track the user count exactly, which could get annoying. */
         if((mn->channel->limit - mn->channel->members.used) > chanserv_conf.adjust_threshold + 5)
         {
-            timeq_del(0, chanserv_adjust_limit, cData, TIMEQ_IGNORE_WHEN);
-            timeq_add(now + chanserv_conf.adjust_delay, chanserv_adjust_limit, cData);
+            chanserv_schedule_limit(cData);
         }
     }
 
@@ -8979,7 +9009,7 @@ handle_nick_change(struct userNode *user, UNUSED_ARG(const char *old_nick), UNUS
             continue;
         /* Look for a matching ban already on the channel. */
         for(jj = 0; jj < channel->banlist.used; ++jj)
-            if(user_matches_glob(user, channel->banlist.list[jj]->ban, MATCH_USENICK, 0))
+            if(user_matches_matcher(user, channel->banlist.list[jj]->matcher, MATCH_USENICK, 0))
                 break;
         /* Need not act if we found one. */
         if(jj < channel->banlist.used)
@@ -8990,7 +9020,7 @@ handle_nick_change(struct userNode *user, UNUSED_ARG(const char *old_nick), UNUS
         /* Look for a matching ban in this channel. */
         for(bData = channel->channel_info->bans; bData; bData = bData->next)
         {
-            if(!user_matches_glob(user, bData->mask, MATCH_USENICK | MATCH_VISIBLE, 0))
+            if(!user_matches_matcher(user, bData->matcher, MATCH_USENICK | MATCH_VISIBLE, 0))
                 continue;
             change.args[0].u.hostmask = bData->mask;
             mod_chanmode_announce(chanserv, channel, &change);
@@ -9043,8 +9073,7 @@ handle_server_link(UNUSED_ARG(struct server *server), UNUSED_ARG(void *extra))
            && ((cData->channel->limit - cData->channel->members.used)
                < chanserv_conf.adjust_threshold))
         {
-            timeq_del(0, chanserv_adjust_limit, cData, TIMEQ_IGNORE_WHEN);
-            timeq_add(now + chanserv_conf.adjust_delay, chanserv_adjust_limit, cData);
+            chanserv_schedule_limit(cData);
         }
     }
     return 0;
@@ -9335,11 +9364,11 @@ user_read_helper(const char *key, struct record_data *rd, struct chanData *chan)
 
     uData->accessexpiry = accessexpiry ? strtoul(accessexpiry, NULL, 0) : 0;
     if (uData->accessexpiry > 0)
-        timeq_add(uData->accessexpiry, chanserv_expire_tempuser, uData);
+        uData->access_timer = timeq_add(uData->accessexpiry, chanserv_expire_tempuser, uData);
 
     uData->clvlexpiry = clvlexpiry ? strtoul(clvlexpiry, NULL, 0) : 0;
     if (uData->clvlexpiry > 0)
-        timeq_add(uData->clvlexpiry, chanserv_expire_tempclvl, uData);
+        uData->clvl_timer = timeq_add(uData->clvlexpiry, chanserv_expire_tempclvl, uData);
 
     uData->lastaccess = lastaccess;
 
@@ -10035,7 +10064,7 @@ init_chanserv(const char *nick)
     if (nick) {
         reg_server_link_func(handle_server_link, NULL);
         reg_new_channel_func(handle_new_channel, NULL);
-        reg_join_func(handle_join, NULL);
+        reg_burst_join_func(handle_join, NULL);
         reg_part_func(handle_part, NULL);
         reg_kick_func(handle_kick, NULL);
         reg_topic_func(handle_topic, NULL);
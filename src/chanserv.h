@@ -93,6 +93,7 @@ struct chanData
     time_t		visited;
     time_t 		limitAdjusted;
     time_t              ownerTransfer;
+    struct timeq_entry  *limit_timer; /* pending chanserv_adjust_limit */
 
     char		*topic;
     char		*greeting;
@@ -144,6 +145,8 @@ struct userData
     time_t              expires;
     time_t              accessexpiry;
     time_t              clvlexpiry;
+    struct timeq_entry  *access_timer; /* pending chanserv_expire_tempuser */
+    struct timeq_entry  *clvl_timer; /* pending chanserv_expire_tempclvl */
     unsigned short      lastaccess;
     unsigned short      access;
     unsigned int	present : 1;
@@ -171,12 +174,14 @@ struct adduserPending
 struct banData
 {
     char		mask[NICKLEN + USERLEN + HOSTLEN + 3];
+    struct glob_matcher *matcher; /* compiled form of mask */
     char		owner[NICKLEN+1];
     struct chanData     *channel;
 
     time_t		set;
     time_t		triggered;
     time_t              expires;
+    struct timeq_entry  *expire_timer;
 
     char		*reason;
 
@@ -30,7 +30,8 @@ void conf_register_reload(UNUSED_ARG(conf_reload_func crf)) {
 void reg_exit_func(UNUSED_ARG(exit_func_t handler)) {
 }
 
-void timeq_add(UNUSED_ARG(time_t when), UNUSED_ARG(timeq_func func), UNUSED_ARG(void *data)) {
+timeq_handle timeq_add_named(UNUSED_ARG(unsigned long when), UNUSED_ARG(timeq_func func), UNUSED_ARG(void *data), UNUSED_ARG(const char *name)) {
+    return NULL;
 }
 
 void timeq_del(UNUSED_ARG(time_t when), UNUSED_ARG(timeq_func func), UNUSED_ARG(void *data), UNUSED_ARG(int mask)) {
@@ -62,7 +62,23 @@ extern struct tm *localtime_r(const time_t *clock, struct tm *res);
 # define C99_VARMACROS 1
 #endif
 
-#if defined(WITH_MALLOC_DMALLOC)
+#if defined(WITH_MALLOC_COUNT)
+/* Only used by microbench, to count allocations per operation. */
+# include <stdlib.h>
+# include <string.h>
+# undef malloc
+# define malloc(n) count_malloc(n)
+# undef calloc
+# define calloc(m,n) count_calloc((m), (n))
+# undef realloc
+# define realloc(p,n) count_realloc((p), (n))
+# undef strdup
+# define strdup(s) count_strdup(s)
+extern void *count_malloc(size_t);
+extern void *count_calloc(size_t, size_t);
+extern void *count_realloc(void *, size_t);
+extern char *count_strdup(const char *);
+#elif defined(WITH_MALLOC_DMALLOC)
 # define DMALLOC_FUNC_CHECK 1
 # include <string.h>
 # include <dmalloc.h>
@@ -184,6 +200,11 @@ int match_ircglob(const char *text, const char *glob);
 #define MATCH_USENICK 1
 #define MATCH_VISIBLE 2
 int user_matches_glob(struct userNode *user, const char *glob, int flags, int shared);
+/* A glob parsed once (say, for a ban) and matched against many users. */
+struct glob_matcher;
+struct glob_matcher *glob_matcher_compile(const char *glob, int flags);
+void glob_matcher_free(struct glob_matcher *gm);
+int user_matches_matcher(struct userNode *user, const struct glob_matcher *gm, int flags, int shared);
 int is_overmask(char *mask);
 
 
@@ -269,6 +290,16 @@ int irccasecmp(const char *stra, const char *strb);
 int ircncasecmp(const char *stra, const char *strb, unsigned int len);
 const char *irccasestr(const char *haystack, const char *needle);
 char *ircstrlower(char *str);
+/* irccasehash() hashes a string such that irccasecmp()-equal strings
+ * always have the same hash; it folds case as it goes, so callers need
+ * not make a lower case copy */
+unsigned int irccasehash(const char *str);
+/* which case folding code is in use: "scalar", "sse2" or "avx2" */
+const char *casefold_impl(void);
+/* CRC-32C of len bytes at buf, carrying on from crc (0 to start) */
+unsigned int crc32c(unsigned int crc, const char *buf, size_t len);
+/* which CRC-32C code is in use: "slice8" or "sse4.2" */
+const char *crc32c_impl(void);
 
 DECLARE_LIST(string_buffer, char);
 void string_buffer_append_string(struct string_buffer *buf, const char *tail);
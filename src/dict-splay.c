@@ -17,13 +17,45 @@
 #include "common.h"
 #include "dict.h"
 
+/* Smallest (and initial) slot count for a hash dict; must be a power
+ * of two. */
+#define DICT_HASH_MIN_SLOTS 16
+
 /*
- *    Create new dictionary.
+ *    Create new dictionary using the configured default backend.
  */
 dict_t
 dict_new(void)
+{
+#if defined(WITH_DICT_HASH)
+    return dict_new_hash();
+#else
+    return dict_new_splay();
+#endif
+}
+
+/*
+ *    Create new dictionary backed by a splay tree.
+ */
+dict_t
+dict_new_splay(void)
+{
+    dict_t dict = calloc(1, sizeof(*dict));
+    return dict;
+}
+
+/*
+ *    Create new dictionary backed by an open-addressed hash table.
+ *    Lookups never modify the table, unlike a splay tree; the node
+ *    list is kept in insertion order and only sorted when somebody
+ *    asks for dict_first().
+ */
+dict_t
+dict_new_hash(void)
 {
     dict_t dict = calloc(1, sizeof(*dict));
+    dict->slots = calloc(DICT_HASH_MIN_SLOTS, sizeof(dict->slots[0]));
+    dict->slot_mask = DICT_HASH_MIN_SLOTS - 1;
     return dict;
 }
 
@@ -142,6 +174,206 @@ dict_dispose_node(struct dict_node *node, free_f free_keys, free_f free_data)
     free(node);
 }
 
+/*
+ *    Replace the key and data of an existing node, disposing of the
+ *    old ones.
+ */
+static void
+dict_replace_node(dict_t dict, struct dict_node *node, const char *key, void *data)
+{
+    /* maybe we don't want to overwrite it .. oh well */
+    if (dict->free_data) {
+        if (dict->free_data == free)
+            free(node->data);
+        else
+            dict->free_data(node->data);
+    }
+    if (dict->free_keys) {
+        if (dict->free_keys == free)
+            free((void*)node->key);
+        else
+            dict->free_keys((void*)node->key);
+    }
+    node->key = key;
+    node->data = data;
+}
+
+/*
+ *    Remove a node from the dictionary's first/last list.
+ */
+static void
+dict_unlink_node(dict_t dict, struct dict_node *node)
+{
+    if (node->prev) node->prev->next = node->next;
+    if (dict->first == node) dict->first = node->next;
+    if (node->next) node->next->prev = node->prev;
+    if (dict->last == node) dict->last = node->prev;
+}
+
+/*
+ *    Find the slot holding key, or the empty slot where it belongs.
+ */
+static unsigned int
+dict_hash_locate(dict_t dict, const char *key, unsigned int hash)
+{
+    unsigned int pos;
+
+    for (pos = hash & dict->slot_mask;
+         dict->slots[pos].node;
+         pos = (pos + 1) & dict->slot_mask) {
+        if ((dict->slots[pos].hash == hash)
+            && !irccasecmp(key, dict->slots[pos].node->key))
+            break;
+    }
+    return pos;
+}
+
+/*
+ *    Rebuild the slot table with new_size (a power of two) slots.
+ */
+static void
+dict_hash_resize(dict_t dict, unsigned int new_size)
+{
+    struct dict_slot *old_slots;
+    unsigned int old_size, ii, pos;
+
+    old_slots = dict->slots;
+    old_size = dict->slot_mask + 1;
+    dict->slots = calloc(new_size, sizeof(dict->slots[0]));
+    dict->slot_mask = new_size - 1;
+    for (ii = 0; ii < old_size; ++ii) {
+        if (!old_slots[ii].node)
+            continue;
+        for (pos = old_slots[ii].hash & dict->slot_mask;
+             dict->slots[pos].node;
+             pos = (pos + 1) & dict->slot_mask) ;
+        dict->slots[pos] = old_slots[ii];
+    }
+    free(old_slots);
+}
+
+static void
+dict_hash_insert(dict_t dict, const char *key, void *data)
+{
+    struct dict_node *new_node;
+    unsigned int hash, pos;
+
+    if ((dict->count + 1) * 4 > (dict->slot_mask + 1) * 3)
+        dict_hash_resize(dict, (dict->slot_mask + 1) * 2);
+    hash = irccasehash(key);
+    pos = dict_hash_locate(dict, key, hash);
+    if (dict->slots[pos].node) {
+        dict_replace_node(dict, dict->slots[pos].node, key, data);
+        return;
+    }
+    new_node = malloc(sizeof(struct dict_node));
+    new_node->key = key;
+    new_node->data = data;
+    new_node->l = new_node->r = NULL;
+    new_node->next = NULL;
+    new_node->prev = dict->last;
+    if (dict->last) {
+        dict->last->next = new_node;
+        /* Appending in key order (as saxdb loading does) keeps the
+         * list sorted for free. */
+        if (irccasecmp(dict->last->key, key) > 0)
+            dict->unsorted = 1;
+    } else {
+        dict->first = new_node;
+    }
+    dict->last = new_node;
+    dict->slots[pos].hash = hash;
+    dict->slots[pos].node = new_node;
+    dict->count++;
+}
+
+static int
+dict_hash_remove(dict_t dict, const char *key, int no_dispose)
+{
+    struct dict_node *node;
+    unsigned int hole, pos, home;
+
+    hole = dict_hash_locate(dict, key, irccasehash(key));
+    node = dict->slots[hole].node;
+    if (!node)
+        return 0;
+
+    /* Shift later members of the probe run back into the hole, so no
+     * tombstones are needed. */
+    for (pos = (hole + 1) & dict->slot_mask;
+         dict->slots[pos].node;
+         pos = (pos + 1) & dict->slot_mask) {
+        home = dict->slots[pos].hash & dict->slot_mask;
+        if (((pos - home) & dict->slot_mask) >= ((pos - hole) & dict->slot_mask)) {
+            dict->slots[hole] = dict->slots[pos];
+            hole = pos;
+        }
+    }
+    dict->slots[hole].node = NULL;
+
+    dict_unlink_node(dict, node);
+    dict->count--;
+    if (no_dispose) {
+        free(node);
+    } else {
+        dict_dispose_node(node, dict->free_keys, dict->free_data);
+    }
+    if ((dict->slot_mask + 1 > DICT_HASH_MIN_SLOTS)
+        && (dict->count * 8 < dict->slot_mask + 1))
+        dict_hash_resize(dict, (dict->slot_mask + 1) / 2);
+    return 1;
+}
+
+/*
+ *    Merge sort a hash dict's node list into key order.  Callers
+ *    should not re-start iteration over a dict while they are still
+ *    iterating over it and inserting into it, since that reorders the
+ *    list underneath the outer iterator.
+ */
+struct dict_node *
+dict_sort(dict_t dict)
+{
+    struct dict_node *list, *tail, *p, *q, *e;
+    unsigned int insize, nmerges, psize, qsize, ii;
+
+    list = dict->first;
+    tail = NULL;
+    for (insize = 1; list; insize *= 2) {
+        p = list;
+        list = tail = NULL;
+        nmerges = 0;
+        while (p) {
+            nmerges++;
+            for (q = p, psize = 0, ii = 0; (ii < insize) && q; ++ii, ++psize)
+                q = q->next;
+            qsize = insize;
+            while (psize > 0 || (qsize > 0 && q)) {
+                if (psize == 0) {
+                    e = q; q = q->next; qsize--;
+                } else if (qsize == 0 || !q || irccasecmp(p->key, q->key) <= 0) {
+                    e = p; p = p->next; psize--;
+                } else {
+                    e = q; q = q->next; qsize--;
+                }
+                if (tail)
+                    tail->next = e;
+                else
+                    list = e;
+                e->prev = tail;
+                tail = e;
+            }
+            p = q;
+        }
+        tail->next = NULL;
+        if (nmerges <= 1)
+            break;
+    }
+    dict->first = list;
+    dict->last = tail;
+    dict->unsorted = 0;
+    return list;
+}
+
 /*
  *    Insert an entry into the dictionary.
  *    Key ordering (and uniqueness) is determined by case-insensitive
@@ -154,6 +386,10 @@ dict_insert(dict_t dict, const char *key, void *data)
     if (!key)
         return;
     verify(dict);
+    if (dict->slots) {
+        dict_hash_insert(dict, key, data);
+        return;
+    }
     new_node = malloc(sizeof(struct dict_node));
     new_node->key = key;
     new_node->data = data;
@@ -190,22 +426,8 @@ dict_insert(dict_t dict, const char *key, void *data)
             dict->root->next = new_node;
 	    dict->root = new_node;
 	} else {
-	    /* maybe we don't want to overwrite it .. oh well */
-	    if (dict->free_data) {
-                if (dict->free_data == free)
-                    free(dict->root->data);
-                else
-                    dict->free_data(dict->root->data);
-            }
-            if (dict->free_keys) {
-                if (dict->free_keys == free)
-                    free((void*)dict->root->key);
-                else
-                    dict->free_keys((void*)dict->root->key);
-            }
+            dict_replace_node(dict, dict->root, key, data);
             free(new_node);
-            dict->root->key = key;
-	    dict->root->data = data;
 	    /* decrement the count since we dropped the node */
 	    dict->count--;
 	}
@@ -227,10 +449,12 @@ dict_remove2(dict_t dict, const char *key, int no_dispose)
 {
     struct dict_node *new_root, *old_root;
 
-    if (!dict->root)
-        return 0;
     if (!key) return 0;
     verify(dict);
+    if (dict->slots)
+        return dict_hash_remove(dict, key, no_dispose);
+    if (!dict->root)
+        return 0;
     dict->root = dict_splay(dict->root, key);
     if (irccasecmp(key, dict->root->key))
         return 0;
@@ -241,10 +465,7 @@ dict_remove2(dict_t dict, const char *key, int no_dispose)
         new_root = dict_splay(dict->root->l, key);
         new_root->r = dict->root->r;
     }
-    if (dict->root->prev) dict->root->prev->next = dict->root->next;
-    if (dict->first == dict->root) dict->first = dict->first->next;
-    if (dict->root->next) dict->root->next->prev = dict->root->prev;
-    if (dict->last == dict->root) dict->last = dict->last->prev;
+    dict_unlink_node(dict, dict->root);
     old_root = dict->root;
     dict->root = new_root;
     dict->count--;
@@ -266,6 +487,13 @@ void*
 dict_find(dict_t dict, const char *key, int *found)
 {
     int was_found;
+    if (dict && dict->slots && key) {
+        struct dict_node *node;
+        node = dict->slots[dict_hash_locate(dict, key, irccasehash(key))].node;
+        if (found)
+            *found = node != NULL;
+        return node ? node->data : NULL;
+    }
     if (!dict || !dict->root || !key) {
 	if (found)
             *found = 0;
@@ -292,6 +520,7 @@ dict_delete(dict_t dict)
         next = iter_next(it);
         dict_dispose_node(it, dict->free_keys, dict->free_data);
     }
+    free(dict->slots);
     free(dict);
 }
 
@@ -338,6 +567,16 @@ dict_sanity_check(dict_t dict)
     dss.bad_node = 0;
     dss.error[0] = 0;
     verify(dict);
+    if (dict->slots) {
+        struct dict_node *node;
+        for (node = dict->first; node; node = node->next) {
+            if (dict->slots[dict_hash_locate(dict, node->key, irccasehash(node->key))].node != node) {
+                snprintf(dss.error, sizeof(dss.error), "Node %p with key '%s' is not in its hash slot", (void*)node, node->key);
+                return strdup(dss.error);
+            }
+            dss.node_count++;
+        }
+    }
     if (dict->root && dict_sanity_check_node(dict->root, &dss)) {
         return strdup(dss.error);
     } else if (dss.node_count != dict->count) {
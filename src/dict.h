@@ -32,22 +32,36 @@ struct dict_node {
     struct dict_node *l, *r, *prev, *next;
 };
 
+struct dict_slot {
+    unsigned int hash;
+    struct dict_node *node;
+};
+
 struct dict {
     free_f free_keys, free_data;
     struct dict_node *root, *first, *last;
     unsigned int count;
+    /* hash table backend; slots is NULL for splay tree dicts */
+    struct dict_slot *slots;
+    unsigned int slot_mask;
+    unsigned int unsorted : 1;
 };
 
 /* "published" API */
 typedef struct dict *dict_t;
 typedef struct dict_node *dict_iterator_t;
 
-#define dict_first(DICT) ((DICT) ? (DICT)->first : NULL)
+#define dict_first(DICT) ((DICT) ? ((DICT)->unsorted ? dict_sort(DICT) : (DICT)->first) : NULL)
 #define iter_key(ITER) ((ITER)->key)
 #define iter_data(ITER) ((ITER)->data)
 #define iter_next(ITER) ((ITER)->next)
 
+/* dict_new() uses the backend selected by configure's --with-dict;
+ * dict_new_splay() and dict_new_hash() pick one explicitly.  Both
+ * iterate in irccasecmp() order. */
 dict_t dict_new(void);
+dict_t dict_new_splay(void);
+dict_t dict_new_hash(void);
 /* dict_foreach returns key of node causing halt (non-zero return from
  * iterator function) */
 const char* dict_foreach(dict_t dict, dict_iterator_f it, void *extra);
@@ -61,6 +75,8 @@ void* dict_find(dict_t dict, const char *key, int *present);
 int dict_remove2(dict_t dict, const char *key, int no_dispose);
 #define dict_remove(DICT, KEY) dict_remove2(DICT, KEY, 0)
 char *dict_sanity_check(dict_t dict);
+/* only for dict_first(): restores key order to a hash dict's list */
+struct dict_node *dict_sort(dict_t dict);
 void dict_delete(dict_t dict);
 
 #endif /* !defined(DICT_H) */
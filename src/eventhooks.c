@@ -20,115 +20,110 @@
 
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 #include "eventhooks.h"
 
+/* Hooks are kept in an array, in the order they run. */
+
+int eh_timing;
+static struct eh_func_list *hook_lists;
+
 struct eh_func_list *init_hook_func_list(struct eh_func_list *list, int defpos) {
     if ((defpos != EH_ADD_TAIL) && (defpos != EH_ADD_HEAD))
         list->add_default = EH_ADD_TAIL;
     else
         list->add_default = defpos;
-    list->head = NULL;
-    list->tail = NULL;
-    list->count = 0;
+    list->name = NULL;
+    list->list = NULL;
+    list->used = 0;
+    list->size = 0;
     list->clean = NULL;
+    list->next = NULL;
+    list->linked = 0;
 
     return list;
 }
 
-void reg_hook_func_pos(struct eh_func_list *list, eh_func_t func, void *extra, int pos) {
-    struct eh_func *newehf = malloc(sizeof(struct eh_func));
+void reg_hook_func_named(struct eh_func_list *list, eh_func_t func, void *extra, int pos, const char *name, const char *file) {
+    struct eh_func *newehf;
     int addpos = pos;
 
     if ((addpos != EH_ADD_HEAD) && (addpos != EH_ADD_TAIL))
         addpos = list->add_default;
 
-    if (newehf == NULL)
-        return;
+    if (list->used == list->size) {
+        unsigned int size = list->size ? list->size << 1 : 8;
+        newehf = realloc(list->list, size * sizeof(list->list[0]));
+        if (newehf == NULL)
+            return;
+        list->list = newehf;
+        list->size = size;
+    }
+
+    if (addpos > 0) {
+        memmove(list->list + 1, list->list, list->used * sizeof(list->list[0]));
+        newehf = &list->list[0];
+    } else
+        newehf = &list->list[list->used];
+    list->used++;
 
-    newehf->next = NULL;
     newehf->func = func;
     newehf->extra = extra;
-
-    if (list->head == NULL) {
-        list->head = newehf;
-        list->tail = newehf;
-    } else if (addpos > 0) {
-        newehf->next = list->head;
-        list->head = newehf;
-    } else {
-        list->tail->next = newehf;
-        list->tail = newehf;
+    newehf->name = name;
+    newehf->file = file;
+    newehf->calls = 0;
+    newehf->usec = 0;
+
+    if (!list->linked) {
+        list->next = hook_lists;
+        hook_lists = list;
+        list->linked = 1;
     }
-    list->count++;
-}
-
-void reg_hook_func(struct eh_func_list *list, eh_func_t func, void *extra) {
-    reg_hook_func_pos(list, func, extra, EH_ADD_DEFAULT);
 }
 
 void unreg_hook_func(struct eh_func_list *list, eh_func_t func, void *extra) {
-    struct eh_func *ehfi = list->head;
-    struct eh_func *ehfr = NULL;
-
-    if (ehfi != NULL) {
-        if ((ehfi->func == func) && (ehfi->extra == extra)) {
-            list->head = ehfi->next;
-            if (list->tail == ehfi)
-                list->tail = NULL;
-            if (list->clean != NULL)
-                list->clean(ehfi);
-            free(ehfi);
-            list->count--;
-        } else {
-            for (ehfi=list->head; ehfi!=NULL; ehfi=ehfi->next) {
-                if (ehfi->next != NULL) {
-                    if ((ehfi->next->func == func) && (ehfi->next->extra == extra)) {
-                        ehfr = ehfi->next;
-                        ehfi->next = ehfi->next->next;
-                        if (list->tail == ehfr)
-                            list->tail = ehfi;
-                        if (list->clean != NULL)
-                            list->clean(ehfr);
-                        free(ehfr);
-                        list->count--;
-                        break;
-                    }
-                }
-            }
-        }
+    unsigned int i;
+
+    for (i=0; i<list->used; i++) {
+        if ((list->list[i].func == func) && (list->list[i].extra == extra))
+            break;
     }
+    if (i == list->used)
+        return;
+    if (list->clean != NULL)
+        list->clean(&list->list[i]);
+    memmove(list->list+i, list->list+i+1, (list->used-i-1)*sizeof(list->list[0]));
+    list->used--;
 }
 
 void free_hook_func_list(struct eh_func_list *list) {
-    struct eh_func *ehfi = NULL;
-    struct eh_func *ehfn = NULL;
-    int i = 0;
-
-    if (list->head == NULL)
-        return;
-
-    for (ehfi=list->head; ehfi!=NULL; ehfi=ehfn) {
-        ehfn = ehfi->next;
-
-        if (list->clean != NULL)
-            list->clean(ehfi);
-
-        free(ehfi);
-        i++;
+    struct eh_func_list **plist;
+    unsigned int i;
+
+    if (list->clean != NULL)
+        for (i=0; i<list->used; i++)
+            list->clean(&list->list[i]);
+
+    free(list->list);
+    list->list = NULL;
+    list->used = 0;
+    list->size = 0;
+
+    if (list->linked) {
+        for (plist = &hook_lists; *plist != list; plist = &(*plist)->next)
+            assert(*plist);
+        *plist = list->next;
+        list->linked = 0;
     }
-
-    assert(i==list->count);
-
-    list->head = NULL;
-    list->tail = NULL;
-    list->count = 0;
 }
 
 void call_hook_func_args(struct eh_func_list *list, void *callextra) {
-	struct eh_func *ehfi = NULL;
+	unsigned int i;
+	int res;
 
-	for (ehfi=list->head; ehfi!=NULL; ehfi=ehfi->next) {
-		if (ehfi->func(ehfi->extra, callextra) != EH_CONT)
+	for (i=0; i<list->used; ) {
+		EH_CALL(list, i, res = list->list[i].func(list->list[i].extra, callextra));
+		if (res != EH_CONT)
 			break;
 	}
 }
@@ -136,3 +131,14 @@ void call_hook_func_args(struct eh_func_list *list, void *callextra) {
 void call_hook_func_noargs(struct eh_func_list *list) {
 	call_hook_func_args(list, NULL);
 }
+
+void eh_add_time(struct eh_func *ehf, const struct timeval *start) {
+    struct timeval stop;
+
+    gettimeofday(&stop, NULL);
+    ehf->usec += (stop.tv_sec - start->tv_sec) * 1000000 + stop.tv_usec - start->tv_usec;
+}
+
+struct eh_func_list *hook_func_lists(void) {
+    return hook_lists;
+}
@@ -21,12 +21,14 @@
 #ifndef INCLUDED_eventhooks_h
 #define INCLUDED_eventhooks_h
 
+#include <sys/time.h>
+
 #define EH_ADD_HEAD     1
 #define EH_ADD_TAIL     -1
 #define EH_ADD_DEFAULT  0
 
-#define DEFINE_EH_FUNC_LIST(l, d, cf) struct eh_func_list l = {NULL, NULL, d, 0, cf}
-#define INIT_EH_FUNC_LIST(d) {NULL, NULL, d, 0}
+#define DEFINE_EH_FUNC_LIST(l, d, cf) struct eh_func_list l = {#l, NULL, 0, 0, d, cf, NULL, 0}
+#define INIT_EH_FUNC_LIST(d) {NULL, NULL, 0, 0, d, NULL, NULL, 0}
 
 #define EH_CONT			0
 #define EH_STOP			1
@@ -36,26 +38,67 @@ struct eh_func;
 typedef int (*eh_func_t) (void *extra, void *callextra);
 typedef void (*eh_clean_func_t) (struct eh_func *ehf);
 
+/* Casts between hook function types, through the generic function
+ * pointer type so that the compiler does not warn about it. */
+#define EH_CAST(TYPE, FUNC) ((TYPE)(void (*)(void))(FUNC))
+
+/* A hook may be of any function type; whoever calls the list casts
+ * func back to it.  calls always counts, usec only while eh_timing is
+ * set. */
 struct eh_func {
-    struct eh_func *next;
     eh_func_t func;
     void *extra;
+    const char *name;
+    const char *file;
+    unsigned long calls;
+    unsigned long usec;
 };
 
 struct eh_func_list {
-    struct eh_func *head;
-    struct eh_func *tail;
+    const char *name;
+    struct eh_func *list;
+    unsigned int used;
+    unsigned int size;
     int add_default;
-    int count;
     eh_clean_func_t clean;
+    struct eh_func_list *next;  /* next list with hooks, for "stats hooks" */
+    int linked;
 };
 
+extern int eh_timing;
+
+/* Runs CALL, which should call hook N of LIST, updates that hook's
+ * counters and moves N on to the next hook.  If the hook unregistered
+ * itself, the hooks after it have moved down a slot, so N is left
+ * where it is and nothing is counted.  Loops over a list must leave
+ * advancing N to this macro. */
+#define EH_CALL(LIST, N, CALL) do { \
+    struct timeval eh_start_; \
+    eh_func_t eh_func_ = (LIST)->list[N].func; \
+    void *eh_extra_ = (LIST)->list[N].extra; \
+    if (eh_timing) \
+        gettimeofday(&eh_start_, NULL); \
+    CALL; \
+    if (((N) < (LIST)->used) \
+        && ((LIST)->list[N].func == eh_func_) \
+        && ((LIST)->list[N].extra == eh_extra_)) { \
+        (LIST)->list[N].calls++; \
+        if (eh_timing) \
+            eh_add_time(&(LIST)->list[N], &eh_start_); \
+        (N)++; \
+    } \
+} while (0)
+
 struct eh_func_list *init_hook_func_list(struct eh_func_list *list, int defpos);
-void reg_hook_func(struct eh_func_list *list, eh_func_t func, void *extra);
-void reg_hook_func_pos(struct eh_func_list *list, eh_func_t func, void *extra, int pos);
+void reg_hook_func_named(struct eh_func_list *list, eh_func_t func, void *extra, int pos, const char *name, const char *file);
+#define reg_hook_func(LIST, FUNC, EXTRA) reg_hook_func_named((LIST), (FUNC), (EXTRA), EH_ADD_DEFAULT, #FUNC, __FILE__)
+#define reg_hook_func_pos(LIST, FUNC, EXTRA, POS) reg_hook_func_named((LIST), (FUNC), (EXTRA), (POS), #FUNC, __FILE__)
 void unreg_hook_func(struct eh_func_list *list, eh_func_t func, void *extra);
 void free_hook_func_list(struct eh_func_list *list);
 void call_hook_func_noargs(struct eh_func_list *list);
 void call_hook_func_args(struct eh_func_list *list, void *callextra);
+void eh_add_time(struct eh_func *ehf, const struct timeval *start);
+/* the first list that has had hooks registered, for "stats hooks" */
+struct eh_func_list *hook_func_lists(void);
 
 #endif /* INCLUDED_eventhooks_h */
@@ -21,6 +21,7 @@
 #include "heap.h"
 #include "helpfile.h"
 #include "log.h"
+#include "maskindex.h"
 #include "saxdb.h"
 #include "timeq.h"
 #include "gline.h"
@@ -45,6 +46,8 @@
 
 static heap_t gline_heap; /* key: expiry time, data: struct gline_entry* */
 static dict_t gline_dict; /* key: target, data: struct gline_entry* */
+static maskindex_t gline_index; /* wildcard lookups for gline_find() */
+static timeq_handle gline_timer; /* pending gline_expire event, or NULL */
 
 static int
 gline_comparator(const void *a, const void *b)
@@ -66,27 +69,14 @@ free_gline_from_dict(void *data)
 static void
 free_gline(struct gline *ent)
 {
+    maskindex_remove(gline_index, ent->target, ent);
     dict_remove(gline_dict, ent->target);
 }
 
-static int
-gline_for_p(UNUSED_ARG(void *key), void *data, void *extra)
-{
-    struct gline *ge = data;
-    return !irccasecmp(ge->target, extra);
-}
-
-static int
-delete_gline_for_p(UNUSED_ARG(void *key), void *data, void *extra)
+static void
+gline_set_heap_pos(void *data, unsigned int pos)
 {
-    struct gline *ge = data;
-
-    if (!irccasecmp(ge->target, extra)) {
-        free_gline(ge);
-        return 1;
-    } else {
-        return 0;
-    }
+    ((struct gline*)data)->heap_pos = pos;
 }
 
 static void
@@ -95,6 +85,7 @@ gline_expire(UNUSED_ARG(void *data))
     time_t stopped;
     void *wraa;
 
+    gline_timer = NULL;
     stopped = 0;
     while (heap_size(gline_heap)) {
         heap_peek(gline_heap, 0, &wraa);
@@ -105,21 +96,37 @@ gline_expire(UNUSED_ARG(void *data))
         free_gline(wraa);
     }
     if (heap_size(gline_heap))
-        timeq_add(stopped, gline_expire, NULL);
+        gline_timer = timeq_add(stopped, gline_expire, NULL);
+}
+
+static void
+gline_schedule(time_t when)
+{
+    if (gline_timer)
+        timeq_cancel(gline_timer);
+    gline_timer = timeq_add(when, gline_expire, NULL);
 }
 
 int
 gline_remove(const char *target, int announce)
 {
-    int res = dict_find(gline_dict, target, NULL) ? 1 : 0;
-    if (heap_remove_pred(gline_heap, delete_gline_for_p, (char*)target)) {
-        void *argh;
-        struct gline *new_first;
-        heap_peek(gline_heap, 0, &argh);
-        if (argh) {
-            new_first = argh;
-            timeq_del(0, gline_expire, 0, TIMEQ_IGNORE_WHEN|TIMEQ_IGNORE_DATA);
-            timeq_add(new_first->expires, gline_expire, 0);
+    struct gline *ent;
+    unsigned int pos;
+    int res = 0;
+
+    if ((ent = dict_find(gline_dict, target, NULL))) {
+        pos = ent->heap_pos;
+        heap_remove_at(gline_heap, pos);
+        free_gline(ent);
+        res = 1;
+        if (pos == 0) {
+            void *argh;
+            struct gline *new_first;
+            heap_peek(gline_heap, 0, &argh);
+            if (argh) {
+                new_first = argh;
+                gline_schedule(new_first->expires);
+            }
         }
     }
     if (announce)
@@ -138,9 +145,10 @@ gline_add(const char *issuer, const char *target, unsigned long duration, const
     prev_first = argh;
     ent = dict_find(gline_dict, target, NULL);
     if (ent) {
-        heap_remove_pred(gline_heap, gline_for_p, (char*)target);
-        if (ent->expires < (time_t)(now + duration))
+        if (ent->expires < (time_t)(now + duration)) {
             ent->expires = now + duration;
+            heap_update_at(gline_heap, ent->heap_pos);
+        }
     } else {
         ent = malloc(sizeof(*ent));
         ent->issued = issued;
@@ -149,11 +157,11 @@ gline_add(const char *issuer, const char *target, unsigned long duration, const
         ent->expires = now + duration;
         ent->reason = strdup(reason);
         dict_insert(gline_dict, ent->target, ent);
+        maskindex_add(gline_index, ent->target, ent);
+        heap_insert(gline_heap, ent, ent);
     }
-    heap_insert(gline_heap, ent, ent);
     if (!prev_first || (ent->expires < prev_first->expires)) {
-	timeq_del(0, gline_expire, 0, TIMEQ_IGNORE_WHEN|TIMEQ_IGNORE_DATA);
-	timeq_add(ent->expires, gline_expire, 0);
+        gline_schedule(ent->expires);
     }
     if (announce)
         irc_gline(NULL, ent, silent);
@@ -187,7 +195,6 @@ struct gline *
 gline_find(const char *target)
 {
     struct gline *res;
-    dict_iterator_t it;
     char *alt_target;
 
     res = dict_find(gline_dict, target, NULL);
@@ -197,12 +204,9 @@ gline_find(const char *target)
     if ((target[0] == '#') || (target[0] == '&'))
         return NULL;
     else if (target[strcspn(target, "*?")]) {
-        /* Wildcard: do an obnoxiously long search. */
-        for (it = dict_first(gline_dict); it; it = iter_next(it)) {
-            res = iter_data(it);
-            if (match_ircglob(target, res->target))
-                return res;
-        }
+        /* Wildcard: look for a gline that covers it. */
+        if ((res = maskindex_find(gline_index, target)))
+            return res;
     }
     /* See if we can resolve the hostname part of the mask. */
     if ((alt_target = gline_alternate_target(target))) {
@@ -300,14 +304,16 @@ static void
 gline_db_cleanup(UNUSED_ARG(void *extra))
 {
     heap_delete(gline_heap);
+    maskindex_delete(gline_index);
     dict_delete(gline_dict);
 }
 
 void
 gline_init(void)
 {
-    gline_heap = heap_new(gline_comparator);
+    gline_heap = heap_new_indexed(gline_comparator, gline_set_heap_pos);
     gline_dict = dict_new();
+    gline_index = maskindex_new();
     dict_set_free_data(gline_dict, free_gline_from_dict);
     saxdb_register("gline", gline_saxdb_read, gline_saxdb_write);
     reg_exit_func(gline_db_cleanup, NULL);
@@ -29,6 +29,7 @@ struct gline {
     char *issuer;
     char *target;
     char *reason;
+    unsigned int heap_pos; /* slot in the expiry heap */
 };
 
 struct gline_discrim {
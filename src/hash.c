@@ -21,7 +21,9 @@
 #include "conf.h"
 #include "global.h"
 #include "hash.h"
+#include "intern.h"
 #include "log.h"
+#include "pool.h"
 
 #if defined(HAVE_LIBGEOIP)&&defined(HAVE_GEOIP_H)&&defined(HAVE_GEOIPCITY_H)
 #include <GeoIP.h>
@@ -42,10 +44,190 @@ unsigned int count_opers;
 
 static void hash_cleanup(void *extra);
 
+/* The network state objects come from typed pools, since bursts and
+ * netsplits allocate and free them by the hundred thousand.  Channels
+ * with names longer than POOL_CHANNEL_NAME are malloc()ed instead. */
+#define POOL_CHANNEL_NAME 32
+static struct pool user_pool, user_ext_pool, channel_pool, member_pool, ban_pool;
+struct userExt empty_user_ext;
+
+/* Every modeNode, indexed by (channel, user) so GetUserMode() does not
+ * have to scan member lists.  This is an open-addressed table with
+ * linear probing; removal shifts later entries back rather than
+ * leaving tombstones. */
+static struct modeNode **membership;
+static unsigned int membership_mask, membership_count;
+
+static unsigned int
+membership_hash(const struct chanNode *channel, const struct userNode *user)
+{
+    uint64_t key;
+
+    key = (uint64_t)(unsigned long)channel * 0x9E3779B97F4A7C15ULL;
+    key ^= (uint64_t)(unsigned long)user;
+    key ^= key >> 33;
+    key *= 0xFF51AFD7ED558CCDULL;
+    key ^= key >> 33;
+    return (unsigned int)key;
+}
+
+static struct modeNode *
+membership_find(const struct chanNode *channel, const struct userNode *user)
+{
+    struct modeNode *mn;
+    unsigned int pos;
+
+    if (!membership)
+        return NULL;
+    for (pos = membership_hash(channel, user) & membership_mask;
+         (mn = membership[pos]);
+         pos = (pos + 1) & membership_mask)
+        if ((mn->channel == channel) && (mn->user == user))
+            return mn;
+    return NULL;
+}
+
+static void
+membership_place(struct modeNode *mn)
+{
+    unsigned int pos;
+
+    pos = membership_hash(mn->channel, mn->user) & membership_mask;
+    while (membership[pos])
+        pos = (pos + 1) & membership_mask;
+    membership[pos] = mn;
+}
+
+static void
+membership_add(struct modeNode *mn)
+{
+    struct modeNode **old;
+    unsigned int old_size, ii;
+
+    /* Keep the load factor at or below one half. */
+    if (!membership || (membership_count + 1) * 2 > membership_mask + 1) {
+        old = membership;
+        old_size = membership ? membership_mask + 1 : 0;
+        membership_mask = old_size ? (old_size * 2 - 1) : 1023;
+        membership = calloc(membership_mask + 1, sizeof(membership[0]));
+        for (ii = 0; ii < old_size; ii++)
+            if (old[ii])
+                membership_place(old[ii]);
+        free(old);
+    }
+    membership_place(mn);
+    membership_count++;
+}
+
+static void
+membership_remove(struct modeNode *mn)
+{
+    unsigned int pos, next, home;
+
+    for (pos = membership_hash(mn->channel, mn->user) & membership_mask;
+         membership[pos] != mn;
+         pos = (pos + 1) & membership_mask)
+        assert(membership[pos]);
+    membership_count--;
+    /* Move back any later entry of the same run whose home slot is not
+     * between the hole and its current position. */
+    for (next = (pos + 1) & membership_mask;
+         membership[next];
+         next = (next + 1) & membership_mask) {
+        home = membership_hash(membership[next]->channel, membership[next]->user) & membership_mask;
+        if (((next - home) & membership_mask) >= ((next - pos) & membership_mask)) {
+            membership[pos] = membership[next];
+            pos = next;
+        }
+    }
+    membership[pos] = NULL;
+}
+
+/* Remove the entry at pos from one of the modeNode lists by moving the
+ * last entry into its place, and fix up that entry's index. */
+static void
+members_remove_at(struct modeList *list, unsigned int pos, int by_user)
+{
+    struct modeNode *last;
+
+    last = list->list[--list->used];
+    if (pos == list->used)
+        return;
+    list->list[pos] = last;
+    if (by_user)
+        last->user_pos = pos;
+    else
+        last->channel_pos = pos;
+}
+
+struct userNode *
+alloc_user_node(void)
+{
+    struct userNode *user = pool_alloc(&user_pool);
+    user->ext = &empty_user_ext;
+    return user;
+}
+
+void
+free_user_node(struct userNode *user)
+{
+    free_user_ext(user);
+    intern_release(user->ident);
+    intern_release(user->hostname);
+    pool_free(&user_pool, user);
+}
+
+struct userExt *
+user_ext(struct userNode *user)
+{
+    if (user->ext == &empty_user_ext)
+        user->ext = pool_alloc(&user_ext_pool);
+    return user->ext;
+}
+
+void
+free_user_ext(struct userNode *user)
+{
+    struct userExt *ext = user->ext;
+
+    if (ext == &empty_user_ext)
+        return;
+    intern_release(ext->fakehost);
+    intern_release(ext->country_name);
+    intern_release(ext->country_code);
+    intern_release(ext->city);
+    intern_release(ext->region);
+    intern_release(ext->postal_code);
+    free(ext->mark);
+    free(ext->version_reply);
+    free(ext->sslfp);
+    free_string_list(ext->marks);
+    pool_free(&user_ext_pool, ext);
+    user->ext = &empty_user_ext;
+}
+
+struct banNode *
+alloc_ban_node(void)
+{
+    return pool_alloc(&ban_pool);
+}
+
+void
+free_ban_node(struct banNode *ban)
+{
+    glob_matcher_free(ban->matcher);
+    pool_free(&ban_pool, ban);
+}
+
 void init_structs(void)
 {
-    channels = dict_new();
-    clients = dict_new();
+    pool_init(&user_pool, "userNode", sizeof(struct userNode));
+    pool_init(&user_ext_pool, "userExt", sizeof(struct userExt));
+    pool_init(&channel_pool, "chanNode", sizeof(struct chanNode) + POOL_CHANNEL_NAME);
+    pool_init(&member_pool, "modeNode", sizeof(struct modeNode));
+    pool_init(&ban_pool, "banNode", sizeof(struct banNode));
+    channels = dict_new_hash();
+    clients = dict_new_hash();
     servers = dict_new();
     userList_init(&curr_opers);
     count_opers = 0;
@@ -149,119 +331,136 @@ unreg_sasl_input_func(sasl_input_func_t handler, void *extra)
     sif_used--;
 }
 
+DEFINE_EH_FUNC_LIST(nuf_list, EH_ADD_TAIL, NULL);
+DEFINE_EH_FUNC_LIST(nuf_burst_list, EH_ADD_TAIL, NULL);
+
 void
-nuf_free_ehf(struct eh_func *ehf)
+reg_new_user_func_named(new_user_func_t handler, void *extra, int pos, const char *name, const char *file)
 {
-    if (ehf->extra != NULL)
-        free(ehf->extra);
+    reg_hook_func_named(&nuf_list, (eh_func_t)handler, extra, pos, name, file);
 }
 
-DEFINE_EH_FUNC_LIST(nuf_list, EH_ADD_TAIL, nuf_free_ehf);
+void
+reg_burst_new_user_func_named(burst_new_user_func_t handler, void *extra, const char *name, const char *file)
+{
+    reg_hook_func_named(&nuf_burst_list, EH_CAST(eh_func_t, handler), extra, EH_ADD_DEFAULT, name, file);
+}
 
-int
-nuf_wrapper(void *extra, void *callextra)
+/* Both of these stop early if a hook kills the user. */
+static void
+call_nuf_list(struct eh_func_list *list, struct userNode *user)
 {
-    struct funcargs *fa = (struct funcargs *)extra;
-    struct userNode *user = (struct userNode *)callextra;
+    unsigned int nn;
 
-    ((new_user_func_t)fa->func)(user, fa->extra);
+    for (nn = 0; nn < list->used; ) {
+        EH_CALL(list, nn, EH_CAST(new_user_func_t, list->list[nn].func)(user, list->list[nn].extra));
+        if (user->dead)
+            break;
+    }
+}
 
-    if (user->dead)
-        return EH_STOP;
+static void
+call_nuf_burst_list(struct userNode *user, int burst)
+{
+    struct eh_func_list *list = &nuf_burst_list;
+    unsigned int nn;
 
-    return EH_CONT;
+    for (nn = 0; nn < list->used; ) {
+        EH_CALL(list, nn, EH_CAST(burst_new_user_func_t, list->list[nn].func)(user, burst, list->list[nn].extra));
+        if (user->dead)
+            break;
+    }
 }
 
 void
-reg_new_user_func_pos(new_user_func_t handler, void *extra, int pos)
+call_new_user_funcs(struct userNode* user)
 {
-    struct funcargs *fa = malloc(sizeof(struct funcargs));
+    call_nuf_list(&nuf_list, user);
+    if (user->dead)
+        return;
+    if (user->uplink->burst && !IsLocal(user)) {
+        user->burst_pending = 1;
+        return;
+    }
+    call_nuf_burst_list(user, user->uplink->burst);
+}
 
-    fa->func = (void *)handler;
-    fa->extra = extra;
+DEFINE_EH_FUNC_LIST(ncf2_list, EH_ADD_TAIL, NULL);
 
-    reg_hook_func_pos(&nuf_list, nuf_wrapper, (void *)fa, pos);
+void
+reg_nick_change_func_named(nick_change_func_t handler, void *extra, const char *name, const char *file)
+{
+    reg_hook_func_named(&ncf2_list, EH_CAST(eh_func_t, handler), extra, EH_ADD_DEFAULT, name, file);
 }
 
-void
-reg_new_user_func(new_user_func_t handler, void *extra)
+/* Stops early if a hook kills the user. */
+static void
+call_nick_change_funcs(struct userNode *user, const char *old_nick)
 {
-    reg_new_user_func_pos(handler, extra, EH_ADD_DEFAULT);
+    unsigned int nn;
+
+    for (nn = 0; (nn < ncf2_list.used) && !user->dead; )
+        EH_CALL(&ncf2_list, nn, EH_CAST(nick_change_func_t, ncf2_list.list[nn].func)(user, old_nick, ncf2_list.list[nn].extra));
 }
 
+DEFINE_EH_FUNC_LIST(duf_list, EH_ADD_TAIL, NULL);
+DEFINE_EH_FUNC_LIST(dusf_list, EH_ADD_TAIL, NULL);
+
 void
-call_new_user_funcs(struct userNode* user)
+reg_del_user_func_named(del_user_func_t handler, void *extra, const char *name, const char *file)
 {
-    call_hook_func_args(&nuf_list, (void *)user);
+    reg_hook_func_named(&duf_list, EH_CAST(eh_func_t, handler), extra, EH_ADD_DEFAULT, name, file);
 }
 
-static nick_change_func_t *ncf2_list;
-static void **ncf2_list_extra;
-static unsigned int ncf2_size = 0, ncf2_used = 0;
-
 void
-reg_nick_change_func(nick_change_func_t handler, void *extra)
+call_del_user_funcs(struct userNode *user, struct userNode *killer, const char *why)
 {
-    if (ncf2_used == ncf2_size) {
-        if (ncf2_size) {
-            ncf2_size <<= 1;
-            ncf2_list = realloc(ncf2_list, ncf2_size*sizeof(nick_change_func_t));
-            ncf2_list_extra = realloc(ncf2_list_extra, ncf2_size*sizeof(void*));
-        } else {
-            ncf2_size = 8;
-            ncf2_list = malloc(ncf2_size*sizeof(nick_change_func_t));
-            ncf2_list_extra = malloc(ncf2_size*sizeof(void*));
-        }
+    struct userList one;
+    unsigned int i;
+
+    for (i = 0; i < duf_list.used; )
+        EH_CALL(&duf_list, i, EH_CAST(del_user_func_t, duf_list.list[i].func)(user, killer, why, duf_list.list[i].extra));
+    if (dusf_list.used) {
+        one.list = &user;
+        one.used = one.size = 1;
+        for (i = 0; i < dusf_list.used; )
+            EH_CALL(&dusf_list, i, EH_CAST(del_users_func_t, dusf_list.list[i].func)(&one, killer, why, dusf_list.list[i].extra));
     }
-    ncf2_list[ncf2_used] = handler;
-    ncf2_list_extra[ncf2_used++] = extra;
 }
 
-
-del_user_func_t *duf_list;
-void **duf_list_extra;
-unsigned int duf_size = 0, duf_used = 0;
+void
+reg_del_users_func_named(del_users_func_t handler, void *extra, const char *name, const char *file)
+{
+    reg_hook_func_named(&dusf_list, EH_CAST(eh_func_t, handler), extra, EH_ADD_DEFAULT, name, file);
+}
 
 void
-reg_del_user_func(del_user_func_t handler, void *extra)
+unreg_del_users_func(del_users_func_t handler, void *extra)
 {
-    if (duf_used == duf_size) {
-        if (duf_size) {
-            duf_size <<= 1;
-            duf_list = realloc(duf_list, duf_size*sizeof(del_user_func_t));
-            duf_list_extra = realloc(duf_list_extra, duf_size*sizeof(void*));
-        } else {
-            duf_size = 8;
-            duf_list = malloc(duf_size*sizeof(del_user_func_t));
-            duf_list_extra = malloc(duf_size*sizeof(void*));
-        }
-    }
-    duf_list[duf_used] = handler;
-    duf_list_extra[duf_used++] = extra;
+    unreg_hook_func(&dusf_list, EH_CAST(eh_func_t, handler), extra);
 }
 
+/*
+ *  Tell the del_user and del_users hooks that all of users are gone,
+ *  as when their servers split off.  The del_users hooks are called
+ *  once for the whole list.
+ */
 void
-call_del_user_funcs(struct userNode *user, struct userNode *killer, const char *why)
+call_del_users_funcs(struct userList *users, struct userNode *killer, const char *why)
 {
-    unsigned int i;
+    unsigned int i, n;
 
-    for (i = 0; i < duf_used; ++i)
-    {
-        duf_list[i](user, killer, why, duf_list_extra[i]);
-    }
+    for (n = 0; n < users->used; ++n)
+        for (i = 0; i < duf_list.used; )
+            EH_CALL(&duf_list, i, EH_CAST(del_user_func_t, duf_list.list[i].func)(users->list[n], killer, why, duf_list.list[i].extra));
+    for (i = 0; i < dusf_list.used; )
+        EH_CALL(&dusf_list, i, EH_CAST(del_users_func_t, dusf_list.list[i].func)(users, killer, why, dusf_list.list[i].extra));
 }
 
 void
 unreg_del_user_func(del_user_func_t handler, void *extra)
 {
-    unsigned int i;
-    for (i=0; i<duf_used; i++) {
-        if (duf_list[i] == handler && duf_list_extra[i] == extra) break;
-    }
-    if (i == duf_used) return;
-    memmove(duf_list+i, duf_list+i+1, (duf_used-i-1)*sizeof(duf_list[0]));
-    memmove(duf_list_extra+i, duf_list_extra+i+1, (duf_used-i-1)*sizeof(duf_list_extra[0]));
-    duf_used--;
+    unreg_hook_func(&duf_list, EH_CAST(eh_func_t, handler), extra);
 }
 
 /* reintroduces a user after it has been killed. */
@@ -289,7 +488,6 @@ void
 NickChange(struct userNode* user, const char *new_nick, int no_announce)
 {
     char *old_nick;
-    unsigned int nn;
 
     /* don't do anything if there's no change */
     old_nick = user->nick;
@@ -312,8 +510,7 @@ NickChange(struct userNode* user, const char *new_nick, int no_announce)
     /* Make callbacks for nick changes.  Do this with new nick in
      * place because that is slightly more useful.
      */
-    for (nn=0; (nn<ncf2_used) && !user->dead; nn++)
-        ncf2_list[nn](user, old_nick, ncf2_list_extra[nn]);
+    call_nick_change_funcs(user, old_nick);
     user->timestamp = now;
     if (IsLocal(user) && !no_announce)
         irc_nick(user, old_nick);
@@ -324,7 +521,6 @@ void
 SVSNickChange(struct userNode* user, const char *new_nick)
 {
     char *old_nick;
-    unsigned int nn;
 
     /* don't do anything if there's no change */
     old_nick = user->nick;
@@ -347,8 +543,7 @@ SVSNickChange(struct userNode* user, const char *new_nick)
     /* Make callbacks for nick changes.  Do this with new nick in
      * place because that is slightly more useful.
      */
-    for (nn=0; (nn<ncf2_used) && !user->dead; nn++)
-        ncf2_list[nn](user, old_nick, ncf2_list_extra[nn]);
+    call_nick_change_funcs(user, old_nick);
     user->timestamp = now;
 
     free(old_nick);
@@ -407,7 +602,10 @@ StampUser(struct userNode *user, const char *stamp, time_t timestamp)
 void
 assign_fakehost(struct userNode *user, const char *host, int announce)
 {
-    safestrncpy(user->fakehost, host, sizeof(user->fakehost));
+    struct userExt *ext = user_ext(user);
+
+    intern_release(ext->fakehost);
+    ext->fakehost = *host ? intern_stringn(host, HOSTLEN) : NULL;
     if (announce)
         irc_fakehost(user, host);
 }
@@ -438,16 +636,18 @@ set_geoip_info(struct userNode *user)
     if (cgi) {
         gir = GeoIP_record_by_name(cgi, user->hostname);
         if (gir) {
-            user->country_name = strdup(gir->country_name ? gir->country_name : "");
-            user->country_code = strdup(gir->country_code ? gir->country_code : "");
-            user->city         = strdup(gir->city ? gir->city : "");
-            user->region       = strdup(gir->region ? gir->region : "");
-            user->postal_code  = strdup(gir->postal_code ? gir->postal_code : "");
+            struct userExt *ext = user_ext(user);
+
+            ext->country_name = intern_string(gir->country_name ? gir->country_name : "");
+            ext->country_code = intern_string(gir->country_code ? gir->country_code : "");
+            ext->city         = intern_string(gir->city ? gir->city : "");
+            ext->region       = intern_string(gir->region ? gir->region : "");
+            ext->postal_code  = intern_string(gir->postal_code ? gir->postal_code : "");
 
-            user->latitude  = gir->latitude ? gir->latitude : 0;
-            user->longitude = gir->longitude ? gir->longitude : 0;
-            user->dma_code  = gir->dma_code ? gir->dma_code : 0;
-            user->area_code = gir->area_code ? gir->area_code : 0;
+            ext->latitude  = gir->latitude ? gir->latitude : 0;
+            ext->longitude = gir->longitude ? gir->longitude : 0;
+            ext->dma_code  = gir->dma_code ? gir->dma_code : 0;
+            ext->area_code = gir->area_code ? gir->area_code : 0;
 
             GeoIPRecord_delete(gir);
         }
@@ -455,7 +655,7 @@ set_geoip_info(struct userNode *user)
         return;
     } else if (gi) {
         const char *country = GeoIP_country_name_by_name(gi, user->hostname);
-        user->country_name = strdup(country ? country : "");
+        user_ext(user)->country_name = intern_string(country ? country : "");
         return;
     }
 
@@ -463,73 +663,103 @@ set_geoip_info(struct userNode *user)
 #endif
 }
 
-static new_channel_func_t *ncf_list;
-static void **ncf_list_extra;
-static unsigned int ncf_size = 0, ncf_used = 0;
+DEFINE_EH_FUNC_LIST(ncf_list, EH_ADD_TAIL, NULL);
 
 void
-reg_new_channel_func(new_channel_func_t handler, void *extra)
-{
-    if (ncf_used == ncf_size) {
-	if (ncf_size) {
-	    ncf_size <<= 1;
-	    ncf_list = realloc(ncf_list, ncf_size*sizeof(ncf_list[0]));
-        ncf_list_extra = realloc(ncf_list_extra, ncf_size*sizeof(void*));
-	} else {
-	    ncf_size = 8;
-	    ncf_list = malloc(ncf_size*sizeof(ncf_list[0]));
-        ncf_list_extra = malloc(ncf_size*sizeof(void*));
-	}
-    }
-    ncf_list[ncf_used] = handler;
-    ncf_list_extra[ncf_used++] = extra;
+reg_new_channel_func_named(new_channel_func_t handler, void *extra, const char *name, const char *file)
+{
+    reg_hook_func_named(&ncf_list, EH_CAST(eh_func_t, handler), extra, EH_ADD_DEFAULT, name, file);
 }
 
+DEFINE_EH_FUNC_LIST(jf_list, EH_ADD_TAIL, NULL);
+DEFINE_EH_FUNC_LIST(jf_burst_list, EH_ADD_TAIL, NULL);
+
 void
-jf_free_ehf(struct eh_func *ehf)
+reg_join_func_named(join_func_t handler, void *extra, int pos, const char *name, const char *file)
 {
-    if (ehf->extra != NULL)
-        free(ehf->extra);
+    reg_hook_func_named(&jf_list, (eh_func_t)handler, extra, pos, name, file);
 }
 
-DEFINE_EH_FUNC_LIST(jf_list, EH_ADD_TAIL, jf_free_ehf);
+void
+reg_burst_join_func_named(burst_join_func_t handler, void *extra, const char *name, const char *file)
+{
+    reg_hook_func_named(&jf_burst_list, EH_CAST(eh_func_t, handler), extra, EH_ADD_DEFAULT, name, file);
+}
 
-int
-jf_wrapper(void *extra, void *callextra)
+/* Both of these stop early if a hook kills the user. */
+static void
+call_jf_list(struct eh_func_list *list, struct modeNode *mNode)
 {
-    struct funcargs *fa = (struct funcargs *)extra;
-    struct modeNode *mNode = (struct modeNode *)callextra;
     struct userNode *user = mNode->user;
+    unsigned int nn;
 
-    ((join_func_t)fa->func)(mNode, fa->extra);
+    for (nn = 0; nn < list->used; ) {
+        EH_CALL(list, nn, EH_CAST(join_func_t, list->list[nn].func)(mNode, list->list[nn].extra));
+        if (user->dead)
+            break;
+    }
+}
 
-    if (user->dead)
-        return EH_STOP;
+static void
+call_jf_burst_list(struct modeNode *mNode, int burst)
+{
+    struct eh_func_list *list = &jf_burst_list;
+    struct userNode *user = mNode->user;
+    unsigned int nn;
 
-    return EH_CONT;
+    for (nn = 0; nn < list->used; ) {
+        EH_CALL(list, nn, EH_CAST(burst_join_func_t, list->list[nn].func)(mNode, burst, list->list[nn].extra));
+        if (user->dead)
+            break;
+    }
 }
 
 void
-reg_join_func_pos(join_func_t handler, void *extra, int pos)
+call_join_funcs(struct modeNode *mNode)
 {
-    struct funcargs *fa = malloc(sizeof(struct funcargs));
+    struct userNode *user = mNode->user;
 
-    fa->func = (void *)handler;
-    fa->extra = extra;
+    /* The user's server has finished bursting, but its burst hooks
+     * have not caught up with this user yet. */
+    if (user->burst_pending && !user->uplink->burst)
+        call_burst_hooks(user);
 
-    reg_hook_func_pos(&jf_list, jf_wrapper, (void *)fa, pos);
+    call_jf_list(&jf_list, mNode);
+    if (user->dead)
+        return;
+    if (user->burst_pending) {
+        mNode->burst_pending = 1;
+        return;
+    }
+    call_jf_burst_list(mNode, user->uplink->burst);
 }
 
+/*
+ *  Run the burst hooks held back for user and its channel joins.  They
+ *  are told the user arrived in a burst, so they act just as if they
+ *  had run when the user was introduced.
+ */
 void
-reg_join_func(join_func_t handler, void *extra)
+call_burst_hooks(struct userNode *user)
 {
-    reg_join_func_pos(handler, extra, EH_ADD_DEFAULT);
-}
+    struct modeNode *mNode;
+    unsigned int nn;
 
-void
-call_join_funcs(struct modeNode *mNode)
-{
-    call_hook_func_args(&jf_list, (void *)mNode);
+    if (!user->burst_pending)
+        return;
+    user->burst_pending = 0;
+    call_nuf_burst_list(user, 1);
+    /* Go backwards: a hook that kicks the user moves the last
+     * membership into the kicked one's place. */
+    for (nn = user->channels.used; nn > 0 && !user->dead; ) {
+        if (--nn >= user->channels.used)
+            continue;
+        mNode = user->channels.list[nn];
+        if (!mNode->burst_pending)
+            continue;
+        mNode->burst_pending = 0;
+        call_jf_burst_list(mNode, 1);
+    }
 }
 
 int rel_age;
@@ -560,7 +790,7 @@ wipeout_channel(struct chanNode *cNode, time_t new_time, char **modes, unsigned
 
     /* remove our old ban list, replace it with the new one */
     for (nn=0; nn<cNode->banlist.used; nn++)
-        free(cNode->banlist.list[nn]);
+        free_ban_node(cNode->banlist.list[nn]);
     cNode->banlist.used = 0;
 
     /* remove our old exe,[t list, replace it with the new one */
@@ -617,7 +847,10 @@ AddChannel(const char *name, time_t time_, const char *modes, char *banlist, cha
     safestrncpy(new_modes, modes, sizeof(new_modes));
     nn = split_line(new_modes, 0, ArrayLength(argv), argv);
     if (!(cNode = GetChannel(name))) {
-        cNode = calloc(1, sizeof(*cNode) + strlen(name));
+        if (strlen(name) <= POOL_CHANNEL_NAME)
+            cNode = pool_alloc(&channel_pool);
+        else
+            cNode = calloc(1, sizeof(*cNode) + strlen(name));
         strcpy(cNode->name, name);
         banList_init(&cNode->banlist);
         exemptList_init(&cNode->exemptlist);
@@ -642,8 +875,8 @@ AddChannel(const char *name, time_t time_, const char *modes, char *banlist, cha
 
     /* if it's a new or updated channel, make callbacks */
     if (rel_age > 0)
-        for (nn=0; nn<ncf_used; nn++)
-            ncf_list[nn](cNode, ncf_list_extra[nn]);
+        for (nn=0; nn<ncf_list.used; )
+            EH_CALL(&ncf_list, nn, EH_CAST(new_channel_func_t, ncf_list.list[nn].func)(cNode, ncf_list.list[nn].extra));
 
     /* go through list of bans and add each one */
     if (banlist && (rel_age >= 0)) {
@@ -654,10 +887,11 @@ AddChannel(const char *name, time_t time_, const char *modes, char *banlist, cha
                 nn++;
             while (banlist[nn] == ' ')
                 banlist[nn++] = 0;
-            bn = calloc(1, sizeof(*bn));
+            bn = alloc_ban_node();
             safestrncpy(bn->ban, ban, sizeof(bn->ban));
             safestrncpy(bn->who, "<unknown>", sizeof(bn->who));
             bn->set = now;
+            bn->matcher = glob_matcher_compile(bn->ban, MATCH_USENICK);
             banList_append(&cNode->banlist, bn);
         }
     }
@@ -682,26 +916,12 @@ AddChannel(const char *name, time_t time_, const char *modes, char *banlist, cha
     return cNode;
 }
 
-static del_channel_func_t *dcf_list;
-static void **dcf_list_extra;
-static unsigned int dcf_size = 0, dcf_used = 0;
+DEFINE_EH_FUNC_LIST(dcf_list, EH_ADD_TAIL, NULL);
 
 void
-reg_del_channel_func(del_channel_func_t handler, void *extra)
-{
-    if (dcf_used == dcf_size) {
-	if (dcf_size) {
-	    dcf_size <<= 1;
-	    dcf_list = realloc(dcf_list, dcf_size*sizeof(dcf_list[0]));
-        dcf_list_extra = realloc(dcf_list_extra, dcf_size*sizeof(void*));
-	} else {
-	    dcf_size = 8;
-	    dcf_list = malloc(dcf_size*sizeof(dcf_list[0]));
-        dcf_list_extra = malloc(dcf_size*sizeof(dcf_list_extra[0]));
-	}
-    }
-    dcf_list[dcf_used] = handler;
-    dcf_list_extra[dcf_used++] = extra;
+reg_del_channel_func_named(del_channel_func_t handler, void *extra, const char *name, const char *file)
+{
+    reg_hook_func_named(&dcf_list, EH_CAST(eh_func_t, handler), extra, EH_ADD_DEFAULT, name, file);
 }
 
 static void
@@ -722,7 +942,7 @@ DelChannel(struct chanNode *channel)
 
     /* delete all channel bans */
     for (n=channel->banlist.used; n>0; )
-        free(channel->banlist.list[--n]);
+        free_ban_node(channel->banlist.list[--n]);
     channel->banlist.used = 0;
 
     /* delete all channel exempts */
@@ -730,13 +950,16 @@ DelChannel(struct chanNode *channel)
         free(channel->exemptlist.list[--n]);
     channel->exemptlist.used = 0;
 
-    for (n=0; n<dcf_used; n++)
-        dcf_list[n](channel, dcf_list_extra[n]);
+    for (n=0; n<dcf_list.used; )
+        EH_CALL(&dcf_list, n, EH_CAST(del_channel_func_t, dcf_list.list[n].func)(channel, dcf_list.list[n].extra));
 
     modeList_clean(&channel->members);
     banList_clean(&channel->banlist);
     exemptList_clean(&channel->exemptlist);
-    free(channel);
+    if (strlen(channel->name) <= POOL_CHANNEL_NAME)
+        pool_free(&channel_pool, channel);
+    else
+        free(channel);
 }
 
 struct modeNode *
@@ -748,7 +971,7 @@ AddChannelUser(struct userNode *user, struct chanNode* channel)
 	if (mNode)
             return mNode;
 
-	mNode = malloc(sizeof(*mNode));
+	mNode = pool_alloc(&member_pool);
 
 	/* set up modeNode */
 	mNode->channel = channel;
@@ -761,8 +984,11 @@ AddChannelUser(struct userNode *user, struct chanNode* channel)
          * We have to do this before calling join funcs in case the
          * modeNode is manipulated (e.g. chanserv ops the user).
          */
+	mNode->channel_pos = channel->members.used;
 	modeList_append(&channel->members, mNode);
+	mNode->user_pos = user->channels.used;
 	modeList_append(&user->channels, mNode);
+	membership_add(mNode);
 
         if (channel->members.used == 1
             && !(channel->modes & MODE_REGISTERED)
@@ -779,40 +1005,18 @@ AddChannelUser(struct userNode *user, struct chanNode* channel)
 	return mNode;
 }
 
-static part_func_t *pf_list;
-static void **pf_list_extra;
-static unsigned int pf_size = 0, pf_used = 0;
+DEFINE_EH_FUNC_LIST(pf_list, EH_ADD_TAIL, NULL);
 
 void
-reg_part_func(part_func_t handler, void *extra)
-{
-    if (pf_used == pf_size) {
-	if (pf_size) {
-	    pf_size <<= 1;
-	    pf_list = realloc(pf_list, pf_size*sizeof(part_func_t));
-        pf_list_extra = realloc(pf_list_extra, pf_size*sizeof(void*));
-	} else {
-	    pf_size = 8;
-	    pf_list = malloc(pf_size*sizeof(part_func_t));
-        pf_list_extra = malloc(pf_size*sizeof(void*));
-	}
-    }
-    pf_list[pf_used] = handler;
-    pf_list_extra[pf_used++] = extra;
+reg_part_func_named(part_func_t handler, void *extra, const char *name, const char *file)
+{
+    reg_hook_func_named(&pf_list, EH_CAST(eh_func_t, handler), extra, EH_ADD_DEFAULT, name, file);
 }
 
 void
 unreg_part_func(part_func_t handler, void *extra)
 {
-    unsigned int i;
-    for (i=0; i<pf_used; i++)
-        if (pf_list[i] == handler && pf_list_extra[i] == extra)
-            break;
-    if (i == pf_used)
-        return;
-    memmove(pf_list+i, pf_list+i+1, (pf_used-i-1)*sizeof(pf_list[0]));
-    memmove(pf_list_extra+i, pf_list_extra+i+1, (pf_used-i-1)*sizeof(pf_list_extra[0]));
-    pf_used--;
+    unreg_hook_func(&pf_list, EH_CAST(eh_func_t, handler), extra);
 }
 
 void
@@ -829,11 +1033,34 @@ UnlockChannel(struct chanNode *channel)
         DelChannel(channel);
 }
 
+static void
+del_membership(struct modeNode *mNode, const char *reason, int deleting)
+{
+    struct chanNode *channel = mNode->channel;
+    unsigned int n;
+
+    /* remove modeNode from channel and user */
+    members_remove_at(&channel->members, mNode->channel_pos, 0);
+    members_remove_at(&mNode->user->channels, mNode->user_pos, 1);
+    membership_remove(mNode);
+
+    /* make callbacks */
+    for (n=0; n<pf_list.used; )
+        EH_CALL(&pf_list, n, EH_CAST(part_func_t, pf_list.list[n].func)(mNode, reason, pf_list.list[n].extra));
+
+    /* free memory */
+    pool_free(&member_pool, mNode);
+
+    /* A single check for APASS only should be enough here */
+    if (!deleting && !channel->members.used && !channel->locks
+        && !(channel->modes & MODE_REGISTERED) && !(channel->modes & MODE_APASS))
+        DelChannel(channel);
+}
+
 void
 DelChannelUser(struct userNode* user, struct chanNode* channel, const char *reason, int deleting)
 {
     struct modeNode* mNode;
-    unsigned int n;
 
     if (IsLocal(user) && reason)
         irc_part(user, channel, reason);
@@ -846,38 +1073,38 @@ DelChannelUser(struct userNode* user, struct chanNode* channel, const char *reas
     if (!mNode)
         return;
 
-    /* remove modeNode from channel and user */
-    modeList_remove(&channel->members, mNode);
-    modeList_remove(&user->channels, mNode);
+    del_membership(mNode, reason, deleting);
+}
 
-    /* make callbacks */
-    for (n=0; n<pf_used; n++)
-	pf_list[n](mNode, reason, pf_list_extra[n]);
+/*
+ *  Take user out of all of its channels, as when it quits.
+ */
+void
+DelUserChannels(struct userNode *user)
+{
+    while (user->channels.used > 0)
+        del_membership(user->channels.list[user->channels.used-1], NULL, 0);
+}
 
-    /* free memory */
-    free(mNode);
+DEFINE_EH_FUNC_LIST(kf_list, EH_ADD_TAIL, NULL);
 
-    /* A single check for APASS only should be enough here */
-    if (!deleting && !channel->members.used && !channel->locks
-        && !(channel->modes & MODE_REGISTERED) && !(channel->modes & MODE_APASS))
-        DelChannel(channel);
-}
+static void
+call_kick_funcs(struct userNode *kicker, struct userNode *victim, struct chanNode *channel)
+{
+    unsigned int n;
 
-static kick_func_t *kf_list;
-static void **kf_list_extra;
-static unsigned int kf_size = 0, kf_used = 0;
+    for (n=0; n<kf_list.used; )
+        EH_CALL(&kf_list, n, EH_CAST(kick_func_t, kf_list.list[n].func)(kicker, victim, channel, kf_list.list[n].extra));
+}
 
 void
 KickChannelUser(struct userNode* target, struct chanNode* channel, struct userNode *kicker, const char *why)
 {
-    unsigned int n;
-
     if (!target || !channel || IsService(target) || !GetUserMode(channel, target))
         return;
 
     /* This may break things, but lets see.. -Rubin */
-    for (n=0; n<kf_used; n++)
-        kf_list[n](kicker, target, channel, kf_list_extra[n]);
+    call_kick_funcs(kicker, target, channel);
 
     /* don't remove them from the channel, since the server will send a PART */
     irc_kick(kicker, target, channel, why);
@@ -891,27 +1118,14 @@ KickChannelUser(struct userNode* target, struct chanNode* channel, struct userNo
 }
 
 void
-reg_kick_func(kick_func_t handler, void *extra)
-{
-    if (kf_used == kf_size) {
-	if (kf_size) {
-	    kf_size <<= 1;
-	    kf_list = realloc(kf_list, kf_size*sizeof(kick_func_t));
-        kf_list_extra = realloc(kf_list_extra, kf_size*sizeof(void*));
-	} else {
-	    kf_size = 8;
-	    kf_list = malloc(kf_size*sizeof(kick_func_t));
-        kf_list_extra = malloc(kf_size*sizeof(void*));
-	}
-    }
-    kf_list[kf_used] = handler;
-    kf_list_extra[kf_used++] = extra;
+reg_kick_func_named(kick_func_t handler, void *extra, const char *name, const char *file)
+{
+    reg_hook_func_named(&kf_list, EH_CAST(eh_func_t, handler), extra, EH_ADD_DEFAULT, name, file);
 }
 
 void
 ChannelUserKicked(struct userNode* kicker, struct userNode* victim, struct chanNode* channel)
 {
-    unsigned int n;
     struct modeNode *mn;
 
     if (!victim || !channel || !GetUserMode(channel, victim))
@@ -921,8 +1135,7 @@ ChannelUserKicked(struct userNode* kicker, struct userNode* victim, struct chanN
     if (kicker && (mn = GetUserMode(channel, kicker)))
         mn->idle_since = now;
 
-    for (n=0; n<kf_used; n++)
-	kf_list[n](kicker, victim, channel, kf_list_extra[n]);
+    call_kick_funcs(kicker, victim, channel);
 
     DelChannelUser(victim, channel, 0, 0);
 
@@ -950,32 +1163,19 @@ int ChannelExemptExists(struct chanNode *channel, const char *exempt)
     return 0;
 }
 
-static topic_func_t *tf_list;
-static void **tf_list_extra;
-static unsigned int tf_size = 0, tf_used = 0;
+DEFINE_EH_FUNC_LIST(tf_list, EH_ADD_TAIL, NULL);
 
 void
-reg_topic_func(topic_func_t handler, void *extra)
-{
-    if (tf_used == tf_size) {
-	if (tf_size) {
-	    tf_size <<= 1;
-	    tf_list = realloc(tf_list, tf_size*sizeof(topic_func_t));
-        tf_list_extra = realloc(tf_list_extra, tf_size*sizeof(void*));
-	} else {
-	    tf_size = 8;
-	    tf_list = malloc(tf_size*sizeof(topic_func_t));
-        tf_list_extra = malloc(tf_size*sizeof(void*));
-	}
-    }
-    tf_list[tf_used] = handler;
-    tf_list_extra[tf_used++] = extra;
+reg_topic_func_named(topic_func_t handler, void *extra, const char *name, const char *file)
+{
+    reg_hook_func_named(&tf_list, EH_CAST(eh_func_t, handler), extra, EH_ADD_DEFAULT, name, file);
 }
 
 void
 SetChannelTopic(struct chanNode *channel, struct userNode *service, struct userNode *user, const char *topic, int announce)
 {
     unsigned int n;
+    int res;
     struct modeNode *mn;
     char old_topic[TOPICLEN+1];
 
@@ -996,13 +1196,15 @@ SetChannelTopic(struct chanNode *channel, struct userNode *service, struct userN
          * so don't call the tf_list functions. */
 	irc_topic(service, user, channel, topic);
     } else {
-	for (n=0; n<tf_used; n++)
+	for (n=0; n<tf_list.used; ) {
             /* A topic change handler can return non-zero to indicate
              * that it has reverted the topic change, and that further
              * hooks should not be called.
              */
-	    if (tf_list[n](user, channel, old_topic, tf_list_extra[n]))
+            EH_CALL(&tf_list, n, res = EH_CAST(topic_func_t, tf_list.list[n].func)(user, channel, old_topic, tf_list.list[n].extra));
+            if (res)
                 break;
+        }
     }
 }
 
@@ -1015,57 +1217,16 @@ GetChannel(const char *name)
 struct modeNode *
 GetUserMode(struct chanNode *channel, struct userNode *user)
 {
-    unsigned int n;
-    struct modeNode *mn = NULL;
-
     verify(channel);
-    verify(channel->members.list);
     verify(user);
-    verify(user->channels.list);
-    if (channel->members.used < user->channels.used) {
-	for (n=0; n<channel->members.used; n++) {
-            verify(channel->members.list[n]);
-	    if (user == channel->members.list[n]->user) {
-		mn = channel->members.list[n];
-		break;
-	    }
-	}
-    } else {
-	for (n=0; n<user->channels.used; n++) {
-            verify(user->channels.list[n]);
-	    if (channel == user->channels.list[n]->channel) {
-		mn = user->channels.list[n];
-		break;
-	    }
-	}
-    }
-    return mn;
+    return membership_find(channel, user);
 }
 
 struct userNode *IsInChannel(struct chanNode *channel, struct userNode *user)
 {
-    unsigned int n;
-
     verify(channel);
-    verify(channel->members.list);
     verify(user);
-    verify(user->channels.list);
-    if (channel->members.used < user->channels.used) {
-	for (n=0; n<channel->members.used; n++) {
-            verify(channel->members.list[n]);
-	    if (user == channel->members.list[n]->user) {
-                return(user);
-	    }
-	}
-    } else {
-	for (n=0; n<user->channels.used; n++) {
-            verify(user->channels.list[n]);
-	    if (channel == user->channels.list[n]->channel) {
-                return(user);
-	    }
-	}
-    }
-    return NULL;
+    return membership_find(channel, user) ? user : NULL;
 }
 
 DEFINE_LIST(userList, struct userNode*)
@@ -1089,24 +1250,24 @@ hash_cleanup(UNUSED_ARG(void *extra))
     dict_delete(clients);
     dict_delete(servers);
     userList_clean(&curr_opers);
+    free(membership);
+    membership = NULL;
+    membership_count = 0;
     count_opers = 0;
+    pool_trim_all(0);
 
     free(slf_list);
     free(slf_list_extra);
     free_hook_func_list(&nuf_list);
-    free(ncf2_list);
-    free(ncf2_list_extra);
-    free(duf_list);
-    free(duf_list_extra);
-    free(ncf_list);
-    free(ncf_list_extra);
+    free_hook_func_list(&nuf_burst_list);
+    free_hook_func_list(&ncf2_list);
+    free_hook_func_list(&duf_list);
+    free_hook_func_list(&dusf_list);
+    free_hook_func_list(&ncf_list);
     free_hook_func_list(&jf_list);
-    free(dcf_list);
-    free(dcf_list_extra);
-    free(pf_list);
-    free(pf_list_extra);
-    free(kf_list);
-    free(kf_list_extra);
-    free(tf_list);
-    free(tf_list_extra);
+    free_hook_func_list(&jf_burst_list);
+    free_hook_func_list(&dcf_list);
+    free_hook_func_list(&pf_list);
+    free_hook_func_list(&kf_list);
+    free_hook_func_list(&tf_list);
 }
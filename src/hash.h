@@ -108,7 +108,7 @@
 #define IsReggedNick(x)         ((x)->modes & FLAGS_REGNICK)
 #define IsRegistering(x)	((x)->modes & FLAGS_REGISTERING)
 #define IsDummy(x)              ((x)->modes & FLAGS_DUMMY)
-#define IsFakeHost(x)           ((x)->fakehost[0] != '\0')
+#define IsFakeHost(x)           ((x)->ext->fakehost != NULL)
 #define IsLocal(x)              ((x)->uplink == self)
 #define IsAdmin(x)              ((x)->modes & FLAGS_ADMIN)
 #define IsSSL(x)                ((x)->modes & FLAGS_SSL)
@@ -215,56 +215,67 @@ DECLARE_LIST(exemptList, struct exemptNode*);
 DECLARE_LIST(channelList, struct chanNode*);
 DECLARE_LIST(serverList, struct server*);
 
-struct userNode {
-    char *nick;                   /* Unique name of the client, nick or host */
-    char ident[USERLEN + 1];      /* Per-host identification for user */
-    char info[REALLEN + 1];       /* Free form additional client information */
-    char hostname[HOSTLEN + 1];   /* DNS name or IP address */
-    char fakehost[HOSTLEN + 1];   /* Assigned fake host */
+/* Per-user data that most users never have, or that is only looked
+ * at by WHOIS-style commands.  A user's ext points at the shared, empty
+ * empty_user_ext until user_ext() gives it a block of its own, so it
+ * may always be read but must only be written through user_ext(). */
+struct userExt {
+    const char *fakehost;         /* Assigned fake host (interned) */
     char crypthost[HOSTLEN + 30]; /* Crypted hostname */
     char cryptip[SOCKIPLEN + 30]; /* Crypted IP */
-#ifdef WITH_PROTOCOL_P10
-    char numeric[COMBO_NUMERIC_LEN+1];
-    unsigned int num_local : 18;
-#endif
-    unsigned int loc;             /* Is user connecting via LOC? */
-    unsigned int no_notice;       /* Does the users client not see notices? */
-    unsigned int dead : 1;        /* Is user waiting to be recycled? */
-    irc_in_addr_t ip;             /* User's IP address */
-    long modes;                   /* user flags +isw etc... */
 
     // sethost - reed/apples
     char sethost[USERLEN + HOSTLEN + 2]; /* 1 for '\0' and 1 for @ = 2 */
 
-    /* GeoIP Data */
-    char *country_name;
+    /* GeoIP Data (interned) */
+    const char *country_name;
 
     /* GeoIP City Data */
-    char *country_code;
-    char *city;
-    char *region;
-    char *postal_code;
+    const char *country_code;
+    const char *city;
+    const char *region;
+    const char *postal_code;
     float latitude;
     float longitude;
     int dma_code;
     int area_code;
-    
+
     char *mark;                   /* only filled if they are marked */
     char *version_reply;          /* only filled in if a version query was triggered */
     char *sslfp;                  /* only filled in if a mark SSLCLIFP is received */
 
     struct string_list *marks;    /* list of user's marks */
+};
 
-    time_t timestamp;             /* Time of last nick change */
-    time_t idle_since;
+struct userNode {
+    /* Fields used while handling most lines come first. */
+    char *nick;                   /* Unique name of the client, nick or host */
+    long modes;                   /* user flags +isw etc... */
     struct server *uplink;        /* Server that user is connected to */
+    struct handle_info *handle_info;
     struct modeList channels;     /* Vector of channels user is in */
+#ifdef WITH_PROTOCOL_P10
+    char numeric[COMBO_NUMERIC_LEN+1];
+    unsigned int num_local : 18;
+#endif
+    unsigned int dead : 1;        /* Is user waiting to be recycled? */
+    unsigned int loc : 1;         /* Is user connecting via LOC? */
+    unsigned int no_notice : 1;   /* Does the users client not see notices? */
+    unsigned int burst_pending : 1; /* Are burst hooks waiting to run? */
+    time_t timestamp;             /* Time of last nick change */
+    time_t idle_since;
+    irc_in_addr_t ip;             /* User's IP address */
+    struct userExt *ext;          /* Rarely used data, see above */
+
+    const char *ident;            /* Per-host identification for user (interned) */
+    const char *hostname;         /* DNS name or IP address (interned) */
+    char info[REALLEN + 1];       /* Free form additional client information */
     struct Privs   privs;
 
     /* from nickserv */
-    struct handle_info *handle_info;
     struct userNode *next_authed;
     struct policer auth_policer;
+    struct timeq_entry *reclaim_timer; /* pending auto-reclaim, if any */
 };
 
 #define privs(cli)             ((cli)->privs)
@@ -310,6 +321,7 @@ struct banNode {
     char ban[NICKLEN + USERLEN + HOSTLEN + 3]; /* 1 for '\0', 1 for ! and 1 for @ = 3 */
     char who[NICKLEN + 1]; /* who set ban */
     time_t set; /* time ban was set */
+    struct glob_matcher *matcher; /* compiled form of ban */
 };
 
 struct exemptNode {
@@ -323,7 +335,10 @@ struct modeNode {
     struct userNode *user;
     long modes;
     short oplevel;
+    unsigned int burst_pending : 1; /* Are burst join hooks waiting to run? */
     time_t idle_since;
+    unsigned int channel_pos; /* index in channel->members */
+    unsigned int user_pos; /* index in user->channels */
 };
 
 #define SERVERNAMEMAX 64
@@ -343,6 +358,8 @@ struct server {
     struct server *uplink;
 #ifdef WITH_PROTOCOL_P10
     struct userNode **users; /* flat indexed by numeric */
+    unsigned int burst_hook_pos; /* next users[] slot for run_burst_hooks() */
+    struct timeq_entry *burst_hook_timer; /* pending run_burst_hooks(), or NULL */
 #else
     dict_t users; /* indexed by nick */
 #endif
@@ -384,12 +401,6 @@ struct route {
     struct routeList *servers;
 };
 
-/* generic hook function args */
-struct funcargs {
-    void *func;
-    void *extra;
-};
-
 extern struct server *self;
 extern dict_t channels;
 extern dict_t clients;
@@ -417,16 +428,35 @@ void call_sasl_input_func(struct server* source ,const char *identifier, const c
 void unreg_sasl_input_func(sasl_input_func_t handler, void *extra);
 
 typedef int (*new_user_func_t) (struct userNode *user, void *extra);
-void reg_new_user_func(new_user_func_t handler, void *extra);
-void reg_new_user_func_pos(new_user_func_t handler, void *extra, int pos);
+void reg_new_user_func_named(new_user_func_t handler, void *extra, int pos, const char *name, const char *file);
+#define reg_new_user_func(HANDLER, EXTRA) reg_new_user_func_named((HANDLER), (EXTRA), EH_ADD_DEFAULT, #HANDLER, __FILE__)
+#define reg_new_user_func_pos(HANDLER, EXTRA, POS) reg_new_user_func_named((HANDLER), (EXTRA), (POS), #HANDLER, __FILE__)
 void call_new_user_funcs(struct userNode *user);
+/* Burst hooks run after the other new user and join hooks.  For
+ * users introduced by a bursting server, they are held back until
+ * the protocol code calls call_burst_hooks() after the burst.  BURST
+ * says whether the user arrived in a burst; by the time held-back
+ * hooks run, user->uplink->burst is already clear. */
+typedef int (*burst_new_user_func_t) (struct userNode *user, int burst, void *extra);
+void reg_burst_new_user_func_named(burst_new_user_func_t handler, void *extra, const char *name, const char *file);
+#define reg_burst_new_user_func(HANDLER, EXTRA) reg_burst_new_user_func_named((HANDLER), (EXTRA), #HANDLER, __FILE__)
+void call_burst_hooks(struct userNode *user);
 typedef void (*del_user_func_t) (struct userNode *user, struct userNode *killer, const char *why, void *extra);
-void reg_del_user_func(del_user_func_t handler, void *extra);
+void reg_del_user_func_named(del_user_func_t handler, void *extra, const char *name, const char *file);
+#define reg_del_user_func(HANDLER, EXTRA) reg_del_user_func_named((HANDLER), (EXTRA), #HANDLER, __FILE__)
 void call_del_user_funcs(struct userNode *user, struct userNode *killer, const char *why);
 void unreg_del_user_func(del_user_func_t handler, void *extra);
+/* del_users hooks get every user that leaves at once (such as in a
+ * netsplit) in one call; a single quit is passed as a list of one. */
+typedef void (*del_users_func_t) (struct userList *users, struct userNode *killer, const char *why, void *extra);
+void reg_del_users_func_named(del_users_func_t handler, void *extra, const char *name, const char *file);
+#define reg_del_users_func(HANDLER, EXTRA) reg_del_users_func_named((HANDLER), (EXTRA), #HANDLER, __FILE__)
+void unreg_del_users_func(del_users_func_t handler, void *extra);
+void call_del_users_funcs(struct userList *users, struct userNode *killer, const char *why);
 void ReintroduceUser(struct userNode* user);
 typedef void (*nick_change_func_t)(struct userNode *user, const char *old_nick, void *extra);
-void reg_nick_change_func(nick_change_func_t handler, void *extra);
+void reg_nick_change_func_named(nick_change_func_t handler, void *extra, const char *name, const char *file);
+#define reg_nick_change_func(HANDLER, EXTRA) reg_nick_change_func_named((HANDLER), (EXTRA), #HANDLER, __FILE__)
 void NickChange(struct userNode* user, const char *new_nick, int no_announce);
 void SVSNickChange(struct userNode* user, const char *new_nick);
 
@@ -438,12 +468,18 @@ void assign_fakehost(struct userNode *user, const char *host, int announce);
 void set_geoip_info(struct userNode *user);
 
 typedef void (*new_channel_func_t) (struct chanNode *chan, void *extra);
-void reg_new_channel_func(new_channel_func_t handler, void *extra);
+void reg_new_channel_func_named(new_channel_func_t handler, void *extra, const char *name, const char *file);
+#define reg_new_channel_func(HANDLER, EXTRA) reg_new_channel_func_named((HANDLER), (EXTRA), #HANDLER, __FILE__)
 typedef int (*join_func_t) (struct modeNode *mNode, void *extra);
-void reg_join_func_pos(join_func_t handler, void *extra, int pos);
-void reg_join_func(join_func_t handler, void *extra);
+void reg_join_func_named(join_func_t handler, void *extra, int pos, const char *name, const char *file);
+#define reg_join_func(HANDLER, EXTRA) reg_join_func_named((HANDLER), (EXTRA), EH_ADD_DEFAULT, #HANDLER, __FILE__)
+#define reg_join_func_pos(HANDLER, EXTRA, POS) reg_join_func_named((HANDLER), (EXTRA), (POS), #HANDLER, __FILE__)
+typedef int (*burst_join_func_t) (struct modeNode *mNode, int burst, void *extra);
+void reg_burst_join_func_named(burst_join_func_t handler, void *extra, const char *name, const char *file);
+#define reg_burst_join_func(HANDLER, EXTRA) reg_burst_join_func_named((HANDLER), (EXTRA), #HANDLER, __FILE__)
 typedef void (*del_channel_func_t) (struct chanNode *chan, void *extra);
-void reg_del_channel_func(del_channel_func_t handler, void *extra);
+void reg_del_channel_func_named(del_channel_func_t handler, void *extra, const char *name, const char *file);
+#define reg_del_channel_func(HANDLER, EXTRA) reg_del_channel_func_named((HANDLER), (EXTRA), #HANDLER, __FILE__)
 
 struct chanNode* AddChannel(const char *name, time_t time_, const char *modes, char *banlist, char *exemptlist);
 void LockChannel(struct chanNode *channel);
@@ -452,23 +488,38 @@ void UnlockChannel(struct chanNode *channel);
 struct modeNode* AddChannelUser(struct userNode* user, struct chanNode* channel);
 
 typedef void (*part_func_t) (struct modeNode *mn, const char *reason, void *extra);
-void reg_part_func(part_func_t handler, void *extra);
+void reg_part_func_named(part_func_t handler, void *extra, const char *name, const char *file);
+#define reg_part_func(HANDLER, EXTRA) reg_part_func_named((HANDLER), (EXTRA), #HANDLER, __FILE__)
 void unreg_part_func(part_func_t handler, void *extra);
 void DelChannelUser(struct userNode* user, struct chanNode* channel, const char *reason, int deleting);
+void DelUserChannels(struct userNode *user);
 void KickChannelUser(struct userNode* target, struct chanNode* channel, struct userNode *kicker, const char *why);
 
 typedef void (*kick_func_t) (struct userNode *kicker, struct userNode *user, struct chanNode *chan, void *extra);
-void reg_kick_func(kick_func_t handler, void *extra);
+void reg_kick_func_named(kick_func_t handler, void *extra, const char *name, const char *file);
+#define reg_kick_func(HANDLER, EXTRA) reg_kick_func_named((HANDLER), (EXTRA), #HANDLER, __FILE__)
 void ChannelUserKicked(struct userNode* kicker, struct userNode* victim, struct chanNode* channel);
 
 int ChannelBanExists(struct chanNode *channel, const char *ban);
 int ChannelExemptExists(struct chanNode *channel, const char *exempt);
 
 typedef int (*topic_func_t)(struct userNode *who, struct chanNode *chan, const char *old_topic, void *extra);
-void reg_topic_func(topic_func_t handler, void *extra);
+void reg_topic_func_named(topic_func_t handler, void *extra, const char *name, const char *file);
+#define reg_topic_func(HANDLER, EXTRA) reg_topic_func_named((HANDLER), (EXTRA), #HANDLER, __FILE__)
 void SetChannelTopic(struct chanNode *channel, struct userNode *service, struct userNode *user, const char *topic, int announce);
 struct userNode *IsInChannel(struct chanNode *channel, struct userNode *user);
 
+/* userNodes and banNodes must come from (and go back to) these */
+extern struct userExt empty_user_ext;
+struct userNode *alloc_user_node(void);
+void free_user_node(struct userNode *user);
+/* returns user's own ext block, allocating it if needed */
+struct userExt *user_ext(struct userNode *user);
+/* frees everything hanging off user's ext block */
+void free_user_ext(struct userNode *user);
+struct banNode *alloc_ban_node(void);
+void free_ban_node(struct banNode *ban);
+
 void init_structs(void);
 
 #endif
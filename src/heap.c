@@ -31,6 +31,7 @@
 
 struct heap {
     comparator_f comparator;
+    heap_index_f set_index;
     void **data;
     unsigned int data_used, data_alloc;
 };
@@ -43,12 +44,26 @@ heap_new(comparator_f comparator)
 {
     heap_t heap = malloc(sizeof(struct heap));
     heap->comparator = comparator;
+    heap->set_index = NULL;
     heap->data_used = 0;
     heap->data_alloc = 8;
     heap->data = malloc(2*heap->data_alloc*sizeof(void*));
     return heap;
 }
 
+/*
+ *  Allocate a new heap that reports each element's position through
+ *  set_index, so that it can later be removed or re-sorted without a
+ *  search.
+ */
+heap_t
+heap_new_indexed(comparator_f comparator, heap_index_f set_index)
+{
+    heap_t heap = heap_new(comparator);
+    heap->set_index = set_index;
+    return heap;
+}
+
 /*
  *  Move the element at "index" in the heap as far up the heap as is
  *  proper (i.e., as long as its parent node is less than or equal to
@@ -69,10 +84,14 @@ heap_heapify_up(heap_t heap, unsigned int idx)
         if (res > 0) break;
         heap->data[idx*2] = heap->data[parent*2];
         heap->data[idx*2+1] = heap->data[parent*2+1];
+        if (heap->set_index)
+            heap->set_index(heap->data[idx*2+1], idx);
         idx = parent;
     }
     heap->data[idx*2] = last_key;
     heap->data[idx*2+1] = last_data;
+    if (heap->set_index)
+        heap->set_index(last_data, idx);
 }
 
 /*
@@ -107,7 +126,7 @@ heap_peek(heap_t heap, void **key, void **data)
  * Push the element at "pos" down the heap as far as it will go.
  */
 static void
-heap_heapify_down(heap_t heap, int pos)
+heap_heapify_down(heap_t heap, unsigned int pos)
 {
     int res;
     unsigned int child;
@@ -125,10 +144,14 @@ heap_heapify_down(heap_t heap, int pos)
         if (res <= 0) break;
         heap->data[pos*2] = heap->data[child*2];
         heap->data[pos*2+1] = heap->data[child*2+1];
+        if (heap->set_index)
+            heap->set_index(heap->data[pos*2+1], pos);
         pos = child;
     }
     heap->data[pos*2] = last_key;
     heap->data[pos*2+1] = last_data;
+    if (heap->set_index)
+        heap->set_index(last_data, pos);
 }
 
 /*
@@ -139,6 +162,8 @@ heap_remove(heap_t heap, unsigned int idx)
 {
     /* sanity check */
     if (heap->data_used <= idx) return;
+    if (heap->set_index)
+        heap->set_index(heap->data[idx*2+1], HEAP_NO_INDEX);
     /* swap idx with last element */
     heap->data_used--;
     heap->data[idx*2] = heap->data[heap->data_used*2];
@@ -148,6 +173,28 @@ heap_remove(heap_t heap, unsigned int idx)
     if ((idx > 0) && (idx < heap->data_used)) heap_heapify_up(heap, idx);
 }
 
+/*
+ *  Remove the element at "pos", as reported to an indexed heap's
+ *  set_index function.
+ */
+void
+heap_remove_at(heap_t heap, unsigned int pos)
+{
+    heap_remove(heap, pos);
+}
+
+/*
+ *  Restore the heap ordering after the key of the element at "pos"
+ *  has changed.
+ */
+void
+heap_update_at(heap_t heap, unsigned int pos)
+{
+    if (pos >= heap->data_used) return;
+    heap_heapify_up(heap, pos);
+    heap_heapify_down(heap, pos);
+}
+
 /*
  *  Pop the topmost element from the heap (preserving the heap ordering).
  */
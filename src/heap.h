@@ -23,11 +23,17 @@
 
 typedef int (*comparator_f)(const void *a, const void *b);
 
+/* called with an element's data whenever it moves to a new slot, or
+ * with HEAP_NO_INDEX when it leaves the heap */
+typedef void (*heap_index_f)(void *data, unsigned int pos);
+#define HEAP_NO_INDEX (~0u)
+
 /* a heap is implemented using a dynamically sized array */
 typedef struct heap *heap_t;
 
 /* operations on a heap */
 heap_t heap_new(comparator_f comp);
+heap_t heap_new_indexed(comparator_f comp, heap_index_f set_index);
 void heap_insert(heap_t heap, void *key, void *data);
 void heap_peek(heap_t heap, void **key, void **data);
 void heap_pop(heap_t heap);
@@ -35,6 +41,10 @@ void heap_delete(heap_t heap);
 unsigned int heap_size(heap_t heap);
 int heap_remove_pred(heap_t heap, int (*pred)(void *key, void *data, void *extra), void *extra);
 
+/* operations on an indexed heap, by the position given to set_index */
+void heap_remove_at(heap_t heap, unsigned int pos);
+void heap_update_at(heap_t heap, unsigned int pos);
+
 /* useful comparators */
 
 /* int strcmp(const char *s1, const char *s2); from <string.h> can be used */
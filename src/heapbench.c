@@ -0,0 +1,133 @@
+/* Usage: heapbench [entries [refreshes]]
+ *
+ * Fills an expiry heap with gline-shaped entries, then refreshes and
+ * removes random entries the way gline_add() and gline_remove() do,
+ * once by predicate scan (the old code path) and once through the
+ * position index.  The predicate scan is only run for a fraction of
+ * the refreshes since it is linear in the heap size.
+ */
+
+#include "common.h"
+#include "heap.h"
+
+struct bench_entry {
+    time_t expires;
+    char target[32];
+    unsigned int heap_pos;
+};
+
+static int
+bench_comparator(const void *a, const void *b)
+{
+    const struct bench_entry *ea=a, *eb=b;
+    return ea->expires - eb->expires;
+}
+
+static void
+bench_set_heap_pos(void *data, unsigned int pos)
+{
+    ((struct bench_entry*)data)->heap_pos = pos;
+}
+
+static int
+bench_for_p(UNUSED_ARG(void *key), void *data, void *extra)
+{
+    struct bench_entry *ent = data;
+    return !strcmp(ent->target, extra);
+}
+
+static double
+elapsed(struct timeval *start)
+{
+    struct timeval stop;
+    gettimeofday(&stop, NULL);
+    return (stop.tv_sec - start->tv_sec) + (stop.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+static int
+check_heap(heap_t heap)
+{
+    struct bench_entry *ent, *prev;
+    void *data;
+
+    prev = NULL;
+    while (heap_size(heap)) {
+        heap_peek(heap, 0, &data);
+        ent = data;
+        if (prev && prev->expires > ent->expires)
+            return 0;
+        prev = ent;
+        heap_pop(heap);
+    }
+    return 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct bench_entry *entries, *ent;
+    struct timeval start;
+    unsigned int count, refreshes, scans, ii;
+    heap_t heap;
+    double secs;
+
+    count = (argc > 1) ? strtoul(argv[1], NULL, 0) : 100000;
+    refreshes = (argc > 2) ? strtoul(argv[2], NULL, 0) : count;
+    scans = refreshes / 100 ? refreshes / 100 : 1;
+    if (!count) {
+        fprintf(stderr, "usage: %s [entries [refreshes]]\n", argv[0]);
+        return 1;
+    }
+    entries = calloc(count, sizeof(*entries));
+    for (ii = 0; ii < count; ii++) {
+        entries[ii].expires = 1000000 + (random() % 86400);
+        snprintf(entries[ii].target, sizeof(entries[ii].target), "*@10.%u.%u.%u", (ii >> 16) & 255, (ii >> 8) & 255, ii & 255);
+    }
+
+    /* Old code path: remove by predicate, then re-insert. */
+    heap = heap_new(bench_comparator);
+    for (ii = 0; ii < count; ii++)
+        heap_insert(heap, entries + ii, entries + ii);
+    srandom(1);
+    gettimeofday(&start, NULL);
+    for (ii = 0; ii < scans; ii++) {
+        ent = entries + (random() % count);
+        heap_remove_pred(heap, bench_for_p, ent->target);
+        ent->expires += 3600;
+        heap_insert(heap, ent, ent);
+    }
+    secs = elapsed(&start);
+    printf("predicate refresh: %u of %u entries in %.3fs (%.2f us each)%s\n",
+           scans, count, secs, secs * 1000000.0 / scans,
+           check_heap(heap) ? "" : " HEAP ORDER BROKEN");
+    heap_delete(heap);
+
+    /* New code path: update in place through the position index. */
+    heap = heap_new_indexed(bench_comparator, bench_set_heap_pos);
+    gettimeofday(&start, NULL);
+    for (ii = 0; ii < count; ii++)
+        heap_insert(heap, entries + ii, entries + ii);
+    secs = elapsed(&start);
+    printf("indexed insert:    %u entries in %.3fs (%.2f us each)\n",
+           count, secs, secs * 1000000.0 / count);
+    srandom(1);
+    gettimeofday(&start, NULL);
+    for (ii = 0; ii < refreshes; ii++) {
+        ent = entries + (random() % count);
+        ent->expires += 3600;
+        heap_update_at(heap, ent->heap_pos);
+    }
+    secs = elapsed(&start);
+    printf("indexed refresh:   %u of %u entries in %.3fs (%.2f us each)\n",
+           refreshes, count, secs, secs * 1000000.0 / refreshes);
+    gettimeofday(&start, NULL);
+    for (ii = 0; ii < count; ii += 2)
+        heap_remove_at(heap, entries[ii].heap_pos);
+    secs = elapsed(&start);
+    printf("indexed remove:    %u entries in %.3fs (%.2f us each)%s\n",
+           (count + 1) / 2, secs, secs * 1000000.0 / ((count + 1) / 2),
+           check_heap(heap) ? "" : " HEAP ORDER BROKEN");
+    heap_delete(heap);
+    free(entries);
+    return 0;
+}
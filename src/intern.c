@@ -0,0 +1,160 @@
+/* intern.c - Shared, reference counted strings
+ * Copyright 2000-2024 Evilnet Development
+ *
+ * This file is part of x3.
+ *
+ * x3 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with srvx; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+ */
+
+#include "common.h"
+#include "intern.h"
+
+/* Strings live in a chained hash table that doubles whenever it holds
+ * as many strings as it has buckets.  The header sits right in front
+ * of the text, so a string handed out is enough to find its entry.
+ */
+
+struct interned {
+    struct interned *next;
+    unsigned int hash;
+    unsigned int refs;
+    size_t len;
+    char str[1];
+};
+
+#define INTERN_MIN_BUCKETS 1024
+#define intern_entry(STR) ((struct interned*)((STR) - offsetof(struct interned, str)))
+
+static struct interned **buckets;
+static unsigned int bucket_count;
+static unsigned int string_count;
+static unsigned long ref_count;
+static unsigned long byte_count;
+static unsigned long saved_bytes;
+static unsigned long lookups;
+static unsigned long hits;
+
+/* FNV-1a */
+static unsigned int
+intern_hash(const char *str, size_t len)
+{
+    unsigned int hash = 2166136261u;
+
+    while (len--)
+        hash = (hash ^ (unsigned char)*str++) * 16777619u;
+    return hash;
+}
+
+static void
+intern_resize(unsigned int count)
+{
+    struct interned **new_buckets, *entry, *next;
+    unsigned int ii;
+
+    new_buckets = calloc(count, sizeof(new_buckets[0]));
+    for (ii = 0; ii < bucket_count; ii++) {
+        for (entry = buckets[ii]; entry; entry = next) {
+            next = entry->next;
+            entry->next = new_buckets[entry->hash & (count - 1)];
+            new_buckets[entry->hash & (count - 1)] = entry;
+        }
+    }
+    free(buckets);
+    buckets = new_buckets;
+    bucket_count = count;
+}
+
+const char *
+intern_stringn(const char *str, size_t len)
+{
+    struct interned *entry;
+    unsigned int hash;
+
+    if (!str)
+        return NULL;
+    len = strnlen(str, len);
+    hash = intern_hash(str, len);
+    lookups++;
+    if (bucket_count) {
+        for (entry = buckets[hash & (bucket_count - 1)]; entry; entry = entry->next) {
+            if (entry->hash == hash && entry->len == len && !memcmp(entry->str, str, len)) {
+                hits++;
+                return intern_dup(entry->str);
+            }
+        }
+    }
+
+    if (string_count >= bucket_count)
+        intern_resize(bucket_count ? bucket_count << 1 : INTERN_MIN_BUCKETS);
+    entry = malloc(sizeof(*entry) + len);
+    entry->hash = hash;
+    entry->refs = 1;
+    entry->len = len;
+    memcpy(entry->str, str, len);
+    entry->str[len] = '\0';
+    entry->next = buckets[hash & (bucket_count - 1)];
+    buckets[hash & (bucket_count - 1)] = entry;
+    string_count++;
+    ref_count++;
+    byte_count += len + 1;
+    return entry->str;
+}
+
+const char *
+intern_dup(const char *str)
+{
+    struct interned *entry;
+
+    if (!str)
+        return NULL;
+    entry = intern_entry(str);
+    entry->refs++;
+    ref_count++;
+    saved_bytes += entry->len + 1;
+    return str;
+}
+
+void
+intern_release(const char *str)
+{
+    struct interned *entry, **pentry;
+
+    if (!str)
+        return;
+    entry = intern_entry(str);
+    assert(entry->refs > 0);
+    ref_count--;
+    if (--entry->refs) {
+        saved_bytes -= entry->len + 1;
+        return;
+    }
+    for (pentry = &buckets[entry->hash & (bucket_count - 1)]; *pentry != entry; pentry = &(*pentry)->next)
+        assert(*pentry);
+    *pentry = entry->next;
+    string_count--;
+    byte_count -= entry->len + 1;
+    free(entry);
+}
+
+void
+intern_get_stats(struct intern_stats *stats)
+{
+    stats->strings = string_count;
+    stats->refs = ref_count;
+    stats->bytes = byte_count;
+    stats->saved = saved_bytes;
+    stats->lookups = lookups;
+    stats->hits = hits;
+}
@@ -0,0 +1,46 @@
+/* intern.h - Shared, reference counted strings
+ * Copyright 2000-2024 Evilnet Development
+ *
+ * This file is part of x3.
+ *
+ * x3 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with srvx; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+ */
+
+#ifndef INTERN_H
+#define INTERN_H
+
+/* Many users share the same ident, host or GeoIP strings.  Interning
+ * keeps one copy of each, freed when its last reference is released.
+ * Interned strings must never be modified. */
+
+struct intern_stats {
+    unsigned int strings;       /* distinct strings held */
+    unsigned long refs;         /* references to them */
+    unsigned long bytes;        /* bytes used by the strings */
+    unsigned long saved;        /* bytes separate copies would add */
+    unsigned long lookups;
+    unsigned long hits;         /* lookups that found the string */
+};
+
+/* returns a reference to the first len characters (at most) of str */
+const char *intern_stringn(const char *str, size_t len);
+#define intern_string(STR) intern_stringn((STR), (size_t)-1)
+/* adds a reference to a string that is already interned */
+const char *intern_dup(const char *str);
+/* drops a reference; str may be NULL */
+void intern_release(const char *str);
+void intern_get_stats(struct intern_stats *stats);
+
+#endif /* !defined(INTERN_H) */
@@ -82,7 +82,15 @@ wsa_strerror(int wsa_err)
 
 #endif /* WITH_IOSET_WIN32 */
 
-#define IS_EOL(CH) ((CH) == '\n')
+#if defined(__SSE2__) && defined(HAVE_IMMINTRIN_H) && defined(__GNUC__)
+#include <immintrin.h>
+#define IOSET_SSE2 1
+#endif
+
+#define EOL_CHAR '\n'
+#define IS_EOL(CH) ((CH) == EOL_CHAR)
+/* Flush a coalescing fd early once this much output is queued. */
+#define IOSET_FLUSH_THRESHOLD 16384
 
 extern int uplink_connect(void);
 int clock_skew;
@@ -91,6 +99,16 @@ int do_reopen;
 int do_exit;
 static struct io_engine *engine;
 static struct io_fd *active_fd;
+/* Lines that wrap around the end of a receive ring are copied here
+ * by ioset_line_view(). */
+static char *line_view_buf;
+static unsigned int line_view_size;
+/* Receive buffer of an fd closed from inside its own readable_cb; a
+ * line view may still point into it until the callback returns. */
+static char *retired_recv_buf;
+/* Coalescing fds with output queued since the last flush. */
+static struct io_fd *flush_list;
+struct io_write_stats ioset_write_stats;
 
 static void
 ioq_init(struct ioq *ioq, int size) {
@@ -137,6 +155,54 @@ ioq_grow(struct ioq *ioq) {
     return new_size - ioq->put;
 }
 
+static void
+ioset_add_eol(struct io_eols *eols, unsigned int pos) {
+    if (eols->used == eols->size) {
+        if (eols->get) {
+            memmove(eols->list, eols->list + eols->get, (eols->used - eols->get) * sizeof(eols->list[0]));
+            eols->used -= eols->get;
+            eols->get = 0;
+        } else {
+            eols->size = eols->size ? eols->size << 1 : 64;
+            eols->list = realloc(eols->list, eols->size * sizeof(eols->list[0]));
+        }
+    }
+    eols->list[eols->used++] = pos;
+}
+
+/* Records every line end in a newly received, contiguous chunk of
+ * fd->recv, so lines can be handed out later without looking at their
+ * bytes again. */
+static void
+ioset_scan_eols(struct io_fd *fd, unsigned int start, unsigned int len) {
+    const char *buf = fd->recv.buf;
+    unsigned int pos = start, end = start + len;
+#if defined(IOSET_SSE2)
+    const __m128i eol = _mm_set1_epi8(EOL_CHAR);
+    unsigned int mask;
+
+    for (; pos + 16 <= end; pos += 16) {
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(buf + pos)), eol));
+        for (; mask; mask &= mask - 1)
+            ioset_add_eol(&fd->eols, pos + __builtin_ctz(mask));
+    }
+#endif
+    for (; pos < end; ++pos)
+        if (IS_EOL(buf[pos]))
+            ioset_add_eol(&fd->eols, pos);
+}
+
+/* Moves recorded line ends to where ioq_grow() put their bytes. */
+static void
+ioset_rebase_eols(struct io_fd *fd, unsigned int old_get, unsigned int old_size) {
+    unsigned int ii, pos;
+
+    for (ii = fd->eols.get; ii < fd->eols.used; ++ii) {
+        pos = fd->eols.list[ii];
+        fd->eols.list[ii] = (pos >= old_get) ? pos - old_get : pos + old_size - old_get;
+    }
+}
+
 extern struct io_engine io_engine_kevent;
 extern struct io_engine io_engine_epoll;
 extern struct io_engine io_engine_win32;
@@ -175,6 +241,8 @@ ioset_init(void)
 void
 ioset_cleanup(void) {
     engine->cleanup();
+    free(line_view_buf);
+    free(retired_recv_buf);
 }
 
 struct io_fd *
@@ -355,14 +423,35 @@ ioset_try_write(struct io_fd *fd) {
     }
 }
 
+static void
+ioset_free_recv(struct io_fd *fdp, int was_active) {
+    free(fdp->eols.list);
+    if (was_active && fdp->line_reads) {
+        free(retired_recv_buf);
+        retired_recv_buf = fdp->recv.buf;
+    } else {
+        free(fdp->recv.buf);
+    }
+}
+
 void
 ioset_close(struct io_fd *fdp, int os_close) {
+    int was_active;
+
     if (!fdp)
         return;
-    if (active_fd == fdp)
+    was_active = (active_fd == fdp);
+    if (was_active)
         active_fd = NULL;
     if (fdp->destroy_cb)
         fdp->destroy_cb(fdp);
+    /* Only now, since destroy_cb() may still write to fdp. */
+    if (fdp->flush_pending) {
+        struct io_fd **pp;
+        for (pp = &flush_list; *pp != fdp; pp = &(*pp)->next_flush) ;
+        *pp = fdp->next_flush;
+        fdp->flush_pending = 0;
+    }
 #if defined(HAVE_WSAEVENTSELECT)
     /* This is one huge kludge.  Sorry! */
     if (fdp->send.get != fdp->send.put && (os_close & 2)) {
@@ -373,7 +462,7 @@ ioset_close(struct io_fd *fdp, int os_close) {
             ioset_try_write(fdp);
     }
     free(fdp->send.buf);
-    free(fdp->recv.buf);
+    ioset_free_recv(fdp, was_active);
     if (os_close & 1)
         closesocket(fdp->fd);
 #else
@@ -388,7 +477,7 @@ ioset_close(struct io_fd *fdp, int os_close) {
             ioset_try_write(fdp);
     }
     free(fdp->send.buf);
-    free(fdp->recv.buf);
+    ioset_free_recv(fdp, was_active);
     if (os_close & 1)
         close(fdp->fd);
     engine->remove(fdp, os_close & 1);
@@ -424,27 +513,39 @@ ioset_accept(struct io_fd *listener)
     active_fd = old_active;
 }
 
+/* Sets fd->line_len from the oldest unconsumed line end. */
 static int
 ioset_find_line_length(struct io_fd *fd) {
-    unsigned int pos, max, len;
-    len = 0;
-    max = (fd->recv.put < fd->recv.get) ? fd->recv.size : fd->recv.put;
-    for (pos = fd->recv.get; pos < max; ++pos, ++len)
-        if (IS_EOL(fd->recv.buf[pos]))
-            return fd->line_len = len + 1;
-    if (fd->recv.put < fd->recv.get)
-        for (pos = 0; pos < fd->recv.put; ++pos, ++len)
-            if (IS_EOL(fd->recv.buf[pos]))
-                return fd->line_len = len + 1;
-    return fd->line_len = 0;
+    unsigned int pos;
+
+    if (fd->eols.get == fd->eols.used) {
+        fd->eols.get = fd->eols.used = 0;
+        return fd->line_len = 0;
+    }
+    pos = fd->eols.list[fd->eols.get];
+    if (pos >= fd->recv.get)
+        return fd->line_len = pos + 1 - fd->recv.get;
+    return fd->line_len = fd->recv.size + pos + 1 - fd->recv.get;
+}
+
+/* Called once the current line has been used up. */
+static void
+ioset_consume_line(struct io_fd *fd) {
+    fd->eols.get++;
+    ioset_find_line_length(fd);
 }
 
 static void
 ioset_buffered_read(struct io_fd *fd) {
+    unsigned int old_get, old_size;
     int put_avail, nbr;
 
-    if (!(put_avail = ioq_put_avail(&fd->recv)))
+    if (!(put_avail = ioq_put_avail(&fd->recv))) {
+        old_get = fd->recv.get;
+        old_size = fd->recv.size;
         put_avail = ioq_grow(&fd->recv);
+        ioset_rebase_eols(fd, old_get, old_size);
+    }
     nbr = recv(fd->fd, fd->recv.buf + fd->recv.put, put_avail, 0);
     if (nbr < 0) {
         if (errno != EAGAIN) {
@@ -461,21 +562,12 @@ ioset_buffered_read(struct io_fd *fd) {
         if (active_fd == fd)
             engine->update(fd);
     } else {
-        if (fd->line_len == 0) {
-            unsigned int pos;
-            for (pos = fd->recv.put; pos < fd->recv.put + nbr; ++pos) {
-                if (IS_EOL(fd->recv.buf[pos])) {
-                    if (fd->recv.put < fd->recv.get)
-                        fd->line_len = fd->recv.size + pos + 1 - fd->recv.get;
-                    else
-                        fd->line_len = pos + 1 - fd->recv.get;
-                    break;
-                }
-            }
-        }
+        ioset_scan_eols(fd, fd->recv.put, nbr);
         fd->recv.put += nbr;
         if (fd->recv.put == fd->recv.size)
             fd->recv.put = 0;
+        if (fd->line_len == 0)
+            ioset_find_line_length(fd);
         while (fd->line_len > 0) {
             struct io_fd *old_active;
             int died = 0;
@@ -492,6 +584,8 @@ ioset_buffered_read(struct io_fd *fd) {
             if (died)
                 break;
         }
+        free(retired_recv_buf);
+        retired_recv_buf = NULL;
     }
 }
 
@@ -522,7 +616,47 @@ ioset_line_read(struct io_fd *fd, char *dest, int max) {
     if (fd->recv.get == fd->recv.size)
         fd->recv.get = 0;
     dest[max - 1] = 0;
-    ioset_find_line_length(fd);
+    /* A line longer than max is handed out in pieces. */
+    if (max == line_len)
+        ioset_consume_line(fd);
+    else
+        ioset_find_line_length(fd);
+    return line_len;
+}
+
+int
+ioset_line_view(struct io_fd *fd, char **line) {
+    int line_len;
+    unsigned int avail;
+
+    line_len = fd->line_len;
+    if ((fd->state == IO_CLOSED) && (!ioq_get_avail(&fd->recv) ||  (line_len < 0)))
+        return 0;
+    if (line_len <= 0)
+        return line_len ? -1 : 0;
+    avail = ioq_get_avail(&fd->recv);
+    if ((unsigned int)line_len > avail) {
+        /* Only a line that wraps around the end of the ring is copied. */
+        if ((unsigned int)line_len > line_view_size) {
+            line_view_size = line_len;
+            line_view_buf = realloc(line_view_buf, line_view_size);
+        }
+        memcpy(line_view_buf, fd->recv.buf + fd->recv.get, avail);
+        assert(fd->recv.get + avail == fd->recv.size);
+        memcpy(line_view_buf + avail, fd->recv.buf, line_len - avail);
+        fd->recv.get = line_len - avail;
+        *line = line_view_buf;
+    } else {
+        *line = fd->recv.buf + fd->recv.get;
+        fd->recv.get += line_len;
+        if (fd->recv.get == fd->recv.size)
+            fd->recv.get = 0;
+    }
+    (*line)[line_len - 1] = 0;
+    /* Keep ioset_line_read()'s limit on how much the caller sees. */
+    if (line_len > MAXLEN)
+        (*line)[MAXLEN - 1] = 0;
+    ioset_consume_line(fd);
     return line_len;
 }
 
@@ -575,23 +709,56 @@ ioset_events(struct io_fd *fd, int readable, int writable)
     }
 }
 
+void
+ioset_flush(struct io_fd *fd) {
+    int wrapped;
+
+    if (fd->flush_pending) {
+        struct io_fd **pp;
+        for (pp = &flush_list; *pp != fd; pp = &(*pp)->next_flush) ;
+        *pp = fd->next_flush;
+        fd->flush_pending = 0;
+    }
+    if (fd->send.get == fd->send.put)
+        return;
+    wrapped = fd->send.put < fd->send.get;
+    ioset_write_stats.flushes++;
+    ioset_try_write(fd);
+    /* If the queue wrapped, send the part at the start of the buffer. */
+    if (wrapped && fd->send.get == 0) {
+        ioset_write_stats.flushes++;
+        ioset_try_write(fd);
+    }
+    /* Let the engine finish the job if send() came up short. */
+    if (fd->send.get != fd->send.put)
+        engine->update(fd);
+}
+
+static void
+ioset_flush_all(void) {
+    while (flush_list)
+        ioset_flush(flush_list);
+}
+
 void
 ioset_run(void) {
     extern struct io_fd *socket_io_fd;
     struct timeval timeout;
-    time_t wakey;
+    unsigned long wait;
 
     while (!quit_services) {
         while (!socket_io_fd)
             uplink_connect();
 
+        /* Send everything queued by the previous pass in one go. */
+        ioset_flush_all();
+
         /* How long to sleep? (fill in select_timeout) */
-        wakey = timeq_next();
-        if (wakey < now)
-            timeout.tv_sec = 0;
-        else
-            timeout.tv_sec = wakey - now;
-        timeout.tv_usec = 0;
+        wait = timeq_wait_msec();
+        if (wait > 3600000)
+            wait = 3600000;
+        timeout.tv_sec = wait / 1000;
+        timeout.tv_usec = (wait % 1000) * 1000;
 
         if (engine->loop(&timeout))
             continue;
@@ -633,7 +800,18 @@ ioset_write(struct io_fd *fd, const char *buf, unsigned int nbw) {
     fd->send.put += nbw;
     if (fd->send.put == fd->send.size)
         fd->send.put = 0;
-    engine->update(fd);
+    if (!fd->coalesce_writes) {
+        engine->update(fd);
+        return;
+    }
+    ioset_write_stats.writes++;
+    if (ioq_used(&fd->send) >= IOSET_FLUSH_THRESHOLD) {
+        ioset_flush(fd);
+    } else if (!fd->flush_pending) {
+        fd->flush_pending = 1;
+        fd->next_flush = flush_list;
+        flush_list = fd;
+    }
 }
 
 int
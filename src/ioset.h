@@ -31,19 +31,39 @@ struct ioq {
     unsigned int size, get, put;
 };
 
+/* Ring offsets of line ends in an fd's receive queue that have been
+ * found but not consumed yet, oldest at list[get]. */
+struct io_eols {
+    unsigned int *list;
+    unsigned int size, get, used;
+};
+
 struct io_fd {
     int fd;
     void *data;
     enum { IO_CLOSED, IO_LISTENING, IO_CONNECTING, IO_CONNECTED } state;
     unsigned int line_reads : 1;
+    unsigned int coalesce_writes : 1;
+    unsigned int flush_pending : 1;
     int line_len;
     struct ioq send;
     struct ioq recv;
+    struct io_eols eols;
     void (*accept_cb)(struct io_fd *listener, struct io_fd *new_connect);
     void (*connect_cb)(struct io_fd *fd, int error);
     void (*readable_cb)(struct io_fd *fd);
     void (*destroy_cb)(struct io_fd *fd);
+    struct io_fd *next_flush;
+};
+
+/* Counters for output on fds with coalesce_writes set; such fds only
+ * queue data in ioset_write() and are flushed once per ioset_run()
+ * pass (or when their queue gets large). */
+struct io_write_stats {
+    unsigned long writes;       /* ioset_write() calls */
+    unsigned long flushes;      /* send() calls made to flush them */
 };
+extern struct io_write_stats ioset_write_stats;
 extern int do_write_dbs;
 extern int do_reopen;
 extern int do_exit;
@@ -55,8 +75,13 @@ struct io_fd *ioset_connect(struct sockaddr *local, unsigned int sa_size, const
 void ioset_update(struct io_fd *fd);
 void ioset_run(void);
 void ioset_write(struct io_fd *fd, const char *buf, unsigned int nbw);
+void ioset_flush(struct io_fd *fd);
 int ioset_printf(struct io_fd *fd, const char *fmt, ...) PRINTF_LIKE(2, 3);
 int ioset_line_read(struct io_fd *fd, char *buf, int maxlen);
+/* Like ioset_line_read(), but points *line at the NUL-terminated line
+ * in place instead of copying it out.  The line stays valid until the
+ * readable_cb returns. */
+int ioset_line_view(struct io_fd *fd, char **line);
 void ioset_close(struct io_fd *fd, int os_close);
 void ioset_cleanup(void);
 void ioset_set_time(unsigned long new_now);
@@ -0,0 +1,353 @@
+/* iptrie.c - Radix trie of CIDR address ranges
+ * Copyright 2000-2024 Evilnet Development
+ *
+ * This file is part of x3.
+ *
+ * x3 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with srvx; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+ */
+
+#include "common.h"
+#include "iptrie.h"
+
+/* This is a path-compressed binary (Patricia) trie.  Every node keeps
+ * its own prefix, so a lookup only needs to compare addresses at the
+ * nodes it visits.  Nodes without values are glue, and only exist
+ * where two subtrees diverge.
+ */
+
+struct iptrie_value {
+    void *data;
+    struct iptrie_value *next;
+};
+
+struct iptrie_node {
+    irc_in_addr_t addr;
+    unsigned char bits;
+    struct iptrie_node *parent;
+    struct iptrie_node *child[2];
+    struct iptrie_value *values;
+};
+
+struct iptrie {
+    struct iptrie_node *root;
+    unsigned int count;
+};
+
+/*
+ *  Copy addr into out with everything past the first bits bits cleared.
+ */
+void
+iptrie_mask_addr(irc_in_addr_t *out, const irc_in_addr_t *addr, unsigned char bits)
+{
+    unsigned int ii;
+
+    *out = *addr;
+    /* IPv4 addresses show up both as ::a.b.c.d and ::ffff:a.b.c.d. */
+    if (irc_in_addr_is_ipv4(*out))
+        out->in6[5] = 65535;
+    for (ii = 0; ii < 16; ii++) {
+        if (bits >= 8)
+            bits -= 8;
+        else {
+            out->in6_8[ii] &= ~(0xff >> bits);
+            bits = 0;
+        }
+    }
+}
+
+static unsigned int
+iptrie_bit(const irc_in_addr_t *addr, unsigned int bit)
+{
+    return (addr->in6_8[bit >> 3] >> (7 - (bit & 7))) & 1;
+}
+
+/* Return how many leading bits (up to max) a and b have in common. */
+static unsigned int
+iptrie_common_bits(const irc_in_addr_t *a, const irc_in_addr_t *b, unsigned int max)
+{
+    unsigned int ii, bit;
+    unsigned char diff;
+
+    for (ii = 0; ii * 8 < max; ii++) {
+        if (!(diff = a->in6_8[ii] ^ b->in6_8[ii]))
+            continue;
+        for (bit = ii * 8; !(diff & 0x80); diff <<= 1)
+            bit++;
+        return (bit < max) ? bit : max;
+    }
+    return max;
+}
+
+static struct iptrie_node *
+iptrie_node_new(const irc_in_addr_t *addr, unsigned char bits)
+{
+    struct iptrie_node *node = calloc(1, sizeof(*node));
+    node->addr = *addr;
+    node->bits = bits;
+    return node;
+}
+
+static void
+iptrie_replace_child(iptrie_t trie, struct iptrie_node *old, struct iptrie_node *new)
+{
+    struct iptrie_node *parent = old->parent;
+
+    if (new)
+        new->parent = parent;
+    if (!parent)
+        trie->root = new;
+    else if (parent->child[0] == old)
+        parent->child[0] = new;
+    else
+        parent->child[1] = new;
+}
+
+/*
+ *  Create a new, empty trie.
+ */
+iptrie_t
+iptrie_new(void)
+{
+    return calloc(1, sizeof(struct iptrie));
+}
+
+static void
+iptrie_free_node(struct iptrie_node *node)
+{
+    struct iptrie_value *value, *next;
+
+    if (!node)
+        return;
+    iptrie_free_node(node->child[0]);
+    iptrie_free_node(node->child[1]);
+    for (value = node->values; value; value = next) {
+        next = value->next;
+        free(value);
+    }
+    free(node);
+}
+
+/*
+ *  Free a trie.  The data pointers it holds are not touched.
+ */
+void
+iptrie_delete(iptrie_t trie)
+{
+    iptrie_free_node(trie->root);
+    free(trie);
+}
+
+/*
+ *  Add data for the range addr/bits.  The same range may hold any
+ *  number of data pointers.
+ */
+void
+iptrie_insert(iptrie_t trie, const irc_in_addr_t *addr, unsigned char bits, void *data)
+{
+    struct iptrie_node *node, *next, *new, *glue;
+    struct iptrie_value *value;
+    irc_in_addr_t key;
+    unsigned int differ;
+
+    if (bits > 128)
+        bits = 128;
+    iptrie_mask_addr(&key, addr, bits);
+    value = malloc(sizeof(*value));
+    value->data = data;
+    trie->count++;
+
+    if (!trie->root) {
+        trie->root = iptrie_node_new(&key, bits);
+        trie->root->values = value;
+        value->next = NULL;
+        return;
+    }
+
+    /* Find the closest existing node, then back up to where the new
+     * prefix diverges from it. */
+    for (node = trie->root; node->bits < bits; node = next)
+        if (!(next = node->child[iptrie_bit(&key, node->bits)]))
+            break;
+    differ = iptrie_common_bits(&key, &node->addr, (node->bits < bits) ? node->bits : bits);
+    while (node->parent && node->parent->bits >= differ)
+        node = node->parent;
+
+    if (differ == bits && node->bits == bits) {
+        /* Exact match (possibly a glue node). */
+        value->next = node->values;
+        node->values = value;
+        return;
+    }
+
+    new = iptrie_node_new(&key, bits);
+    new->values = value;
+    value->next = NULL;
+    if (node->bits == differ) {
+        /* The new node is a child of node. */
+        new->parent = node;
+        node->child[iptrie_bit(&key, node->bits)] = new;
+    } else if (bits == differ) {
+        /* The new node is node's parent. */
+        iptrie_replace_child(trie, node, new);
+        new->child[iptrie_bit(&node->addr, bits)] = node;
+        node->parent = new;
+    } else {
+        /* They are siblings under a new glue node. */
+        glue = iptrie_node_new(&key, differ);
+        iptrie_mask_addr(&glue->addr, &key, differ);
+        iptrie_replace_child(trie, node, glue);
+        glue->child[iptrie_bit(&key, differ)] = new;
+        glue->child[iptrie_bit(&node->addr, differ)] = node;
+        new->parent = glue;
+        node->parent = glue;
+    }
+}
+
+/*
+ *  Remove one data pointer from the range addr/bits.  Returns non-zero
+ *  if it was found.
+ */
+int
+iptrie_remove(iptrie_t trie, const irc_in_addr_t *addr, unsigned char bits, void *data)
+{
+    struct iptrie_node *node, *child;
+    struct iptrie_value **pvalue, *value;
+    irc_in_addr_t key;
+
+    if (bits > 128)
+        bits = 128;
+    iptrie_mask_addr(&key, addr, bits);
+    for (node = trie->root; node && node->bits < bits; )
+        node = node->child[iptrie_bit(&key, node->bits)];
+    if (!node || node->bits != bits || memcmp(&node->addr, &key, sizeof(key)))
+        return 0;
+    for (pvalue = &node->values; *pvalue; pvalue = &(*pvalue)->next)
+        if ((*pvalue)->data == data)
+            break;
+    if (!(value = *pvalue))
+        return 0;
+    *pvalue = value->next;
+    free(value);
+    trie->count--;
+
+    /* Drop nodes that no longer separate anything. */
+    while (node && !node->values) {
+        struct iptrie_node *parent = node->parent;
+        if (node->child[0] && node->child[1])
+            break;
+        child = node->child[0] ? node->child[0] : node->child[1];
+        iptrie_replace_child(trie, node, child);
+        free(node);
+        node = (child || !parent) ? NULL : parent;
+    }
+    return 1;
+}
+
+unsigned int
+iptrie_size(iptrie_t trie)
+{
+    return trie->count;
+}
+
+/*
+ *  Return the data stored for exactly addr/bits, or NULL.
+ */
+void *
+iptrie_find(iptrie_t trie, const irc_in_addr_t *addr, unsigned char bits)
+{
+    struct iptrie_node *node;
+    irc_in_addr_t key;
+
+    if (bits > 128)
+        bits = 128;
+    iptrie_mask_addr(&key, addr, bits);
+    for (node = trie->root; node && node->bits < bits; )
+        node = node->child[iptrie_bit(&key, node->bits)];
+    if (!node || node->bits != bits || !node->values
+        || memcmp(&node->addr, &key, sizeof(key)))
+        return NULL;
+    return node->values->data;
+}
+
+/*
+ *  Call func for every entry whose range includes all of addr/bits,
+ *  starting with the widest.
+ */
+int
+iptrie_walk_covering(iptrie_t trie, const irc_in_addr_t *addr, unsigned char bits, iptrie_walk_f func, void *extra)
+{
+    struct iptrie_node *node;
+    struct iptrie_value *value, *next;
+    irc_in_addr_t key;
+    int res;
+
+    if (bits > 128)
+        bits = 128;
+    iptrie_mask_addr(&key, addr, bits);
+    for (node = trie->root; node && node->bits <= bits; ) {
+        if (iptrie_common_bits(&key, &node->addr, node->bits) < node->bits)
+            break;
+        for (value = node->values; value; value = next) {
+            next = value->next;
+            if ((res = func(&node->addr, node->bits, value->data, extra)))
+                return res;
+        }
+        if (node->bits == bits)
+            break;
+        node = node->child[iptrie_bit(&key, node->bits)];
+    }
+    return 0;
+}
+
+static int
+iptrie_walk_subtree(struct iptrie_node *node, iptrie_walk_f func, void *extra)
+{
+    struct iptrie_value *value, *next;
+    int res;
+
+    for (value = node->values; value; value = next) {
+        next = value->next;
+        if ((res = func(&node->addr, node->bits, value->data, extra)))
+            return res;
+    }
+    if (node->child[0] && (res = iptrie_walk_subtree(node->child[0], func, extra)))
+        return res;
+    if (node->child[1] && (res = iptrie_walk_subtree(node->child[1], func, extra)))
+        return res;
+    return 0;
+}
+
+/*
+ *  Call func for every entry whose range is part of addr/bits.
+ *  func must not change the trie.
+ */
+int
+iptrie_walk_within(iptrie_t trie, const irc_in_addr_t *addr, unsigned char bits, iptrie_walk_f func, void *extra)
+{
+    struct iptrie_node *node;
+    irc_in_addr_t key;
+
+    if (bits > 128)
+        bits = 128;
+    iptrie_mask_addr(&key, addr, bits);
+    for (node = trie->root; node && node->bits < bits; ) {
+        if (iptrie_common_bits(&key, &node->addr, node->bits) < node->bits)
+            return 0;
+        node = node->child[iptrie_bit(&key, node->bits)];
+    }
+    if (!node || iptrie_common_bits(&key, &node->addr, bits) < bits)
+        return 0;
+    return iptrie_walk_subtree(node, func, extra);
+}
@@ -0,0 +1,47 @@
+/* iptrie.h - Radix trie of CIDR address ranges
+ * Copyright 2000-2024 Evilnet Development
+ *
+ * This file is part of x3.
+ *
+ * x3 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with srvx; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+ */
+
+#ifndef IPTRIE_H
+#define IPTRIE_H
+
+/* Addresses are irc_in_addr_t with prefix lengths in the 0..128
+ * range used by irc_pton(); IPv4 addresses may be given in either of
+ * the forms irc_in_addr_is_ipv4() accepts. */
+typedef struct iptrie *iptrie_t;
+
+/* Called for each matching entry; a non-zero return stops the walk
+ * and is passed back to the caller. */
+typedef int (*iptrie_walk_f)(const irc_in_addr_t *addr, unsigned char bits, void *data, void *extra);
+
+iptrie_t iptrie_new(void);
+void iptrie_delete(iptrie_t trie);
+void iptrie_insert(iptrie_t trie, const irc_in_addr_t *addr, unsigned char bits, void *data);
+int iptrie_remove(iptrie_t trie, const irc_in_addr_t *addr, unsigned char bits, void *data);
+unsigned int iptrie_size(iptrie_t trie);
+/* returns the most recently inserted data for exactly addr/bits */
+void *iptrie_find(iptrie_t trie, const irc_in_addr_t *addr, unsigned char bits);
+/* visits entries whose range contains addr/bits, widest first */
+int iptrie_walk_covering(iptrie_t trie, const irc_in_addr_t *addr, unsigned char bits, iptrie_walk_f func, void *extra);
+/* visits entries whose range lies inside addr/bits (including itself) */
+int iptrie_walk_within(iptrie_t trie, const irc_in_addr_t *addr, unsigned char bits, iptrie_walk_f func, void *extra);
+/* clears the host bits of addr and canonicalizes IPv4 addresses */
+void iptrie_mask_addr(irc_in_addr_t *out, const irc_in_addr_t *addr, unsigned char bits);
+
+#endif /* !defined(IPTRIE_H) */
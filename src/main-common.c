@@ -1,4 +1,5 @@
 extern FILE *replay_file;
+extern int replay_bench;
 
 
 time_t boot_time;
@@ -550,7 +551,13 @@ static void
 usage(char *exe_name)
 {
     /* We can assume we have getopt_long(). */
-    printf("Usage: %s [-c config] [-r log] [-d] [-f] [-v|-h]\n"
+    printf("Usage: %s [-c config] [-r log|-b file] [-d] [-f] [-v|-h]\n"
+           " -b, --bench-replay   feed a log or P10 file as fast as possible and\n"
+           "                      report how long it took, with the time taken per\n"
+           "                      P10 token and per event hook.  Service PRIVMSG\n"
+           "                      handlers are not hooks; they are only timed as\n"
+           "                      part of their token.  Databases are read but\n"
+           "                      never written back.\n"
            " -c, --config         selects a different configuration file.\n"
            " -d, --debug          enables debug mode.\n"
            " -f, --foreground     run X3 in the foreground.\n"
@@ -142,11 +142,12 @@ int main(int argc, char *argv[])
             {"help", 0, 0, 'h'},
             {"check", 0, 0, 'k'},
             {"replay", 1, 0, 'r'},
+            {"bench-replay", 1, 0, 'b'},
             {"version", 0, 0, 'v'},
             {0, 0, 0, 0}
         };
 
-        while ((c = getopt_long(argc, argv, "c:dfhkr:v", options, NULL)) != -1) {
+        while ((c = getopt_long(argc, argv, "b:c:dfhkr:v", options, NULL)) != -1) {
             switch (c) {
             case 'c':
                 services_config = optarg;
@@ -158,6 +159,11 @@ int main(int argc, char *argv[])
                     printf("%s is an invalid configuration file.\n", services_config);
                 }
                 exit(0);
+            case 'b':
+                replay_bench = 1;
+                saxdb_readonly = 1;
+                run_as_daemon = 0;
+                /* fall through */
             case 'r':
                 replay_file = fopen(optarg, "r");
                 if (!replay_file) {
@@ -186,7 +192,9 @@ int main(int argc, char *argv[])
 
     version();
 
-    if (replay_file) {
+    if (replay_bench) {
+        replay_bench_start();
+    } else if (replay_file) {
         /* We read a line here to "prime" the replay file parser, but
          * mostly to get the right value of "now" for when we do the
          * irc_introduce. */
@@ -263,12 +271,16 @@ int main(int argc, char *argv[])
     modules_finalize();
 
     /* The first exit func to be called *should* be saxdb_write_all(). */
-    reg_exit_func(saxdb_write_all, NULL);
+    if (!saxdb_readonly)
+        reg_exit_func(saxdb_write_all, NULL);
     if (replay_file) {
         char *msg;
         log_module(MAIN_LOG, LOG_INFO, "Beginning replay...");
         srand(now);
-        replay_event_loop();
+        if (replay_bench)
+            replay_bench_loop();
+        else
+            replay_event_loop();
         if ((msg = dict_sanity_check(clients))) {
             log_module(MAIN_LOG, LOG_ERROR, "Clients insanity: %s", msg);
             free(msg);
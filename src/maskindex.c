@@ -0,0 +1,393 @@
+/* maskindex.c - Index of user@host masks
+ * Copyright 2000-2024 Evilnet Development
+ *
+ * This file is part of x3.
+ *
+ * x3 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with srvx; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+ */
+
+#include "common.h"
+#include "iptrie.h"
+#include "maskindex.h"
+
+/* How this works:
+ *
+ * A mask "user@host" with exactly one '@' can only match text that
+ * also has exactly one '@', with user matching user and host matching
+ * host.  If the host glob ends in literal characters (after its last
+ * wildcard), any matching host must end in those characters; if it
+ * does not, but starts with literal characters, any matching host must
+ * start with them.  Those literal strings are hashed so that a lookup
+ * can hash every suffix (and prefix) of the text's host in a single
+ * pass and only look at masks whose literal part has that hash.
+ * Every candidate is still checked with match_ircglob().
+ *
+ * Masks with no usable literal part ("*@*foo*"), without exactly one
+ * '@', or with escapes in the host part go on a plain list that is
+ * always searched.  Text that does not have exactly one '@' is checked
+ * against every mask.
+ */
+
+#define MASKINDEX_MAX_LEN 255
+#define MASKINDEX_MIN_BUCKETS 16
+
+enum maskindex_kind {
+    MASKINDEX_SUFFIX,
+    MASKINDEX_PREFIX,
+    MASKINDEX_OTHER
+};
+
+struct maskindex_entry {
+    char *mask;
+    char *user;                 /* user part, for CIDR entries */
+    void *data;
+    unsigned int hash;
+    unsigned short len;
+    unsigned char kind;
+    unsigned char bits;         /* CIDR prefix length, if addr is set */
+    unsigned int is_cidr : 1;
+    irc_in_addr_t addr;
+    struct maskindex_entry *next;
+    struct maskindex_entry *all_prev;
+    struct maskindex_entry *all_next;
+};
+
+struct maskindex_table {
+    struct maskindex_entry **buckets;
+    unsigned int size;
+    unsigned int count;
+    unsigned int lengths[MASKINDEX_MAX_LEN + 1];
+};
+
+struct maskindex {
+    struct maskindex_table suffix;
+    struct maskindex_table prefix;
+    struct maskindex_entry *other;
+    struct maskindex_entry *all;
+    iptrie_t cidr;
+    unsigned int count;
+};
+
+#define MASKINDEX_HASH_INIT 2166136261u
+#define MASKINDEX_HASH_STEP(HASH, CH) (((HASH) ^ (unsigned char)(CH)) * 16777619u)
+
+static unsigned int
+maskindex_hash_suffix(const char *str, unsigned int len)
+{
+    unsigned int hash = MASKINDEX_HASH_INIT;
+    while (len > 0)
+        hash = MASKINDEX_HASH_STEP(hash, str[--len]);
+    return hash;
+}
+
+static unsigned int
+maskindex_hash_prefix(const char *str, unsigned int len)
+{
+    unsigned int hash = MASKINDEX_HASH_INIT, ii;
+    for (ii = 0; ii < len; ii++)
+        hash = MASKINDEX_HASH_STEP(hash, str[ii]);
+    return hash;
+}
+
+static void
+maskindex_table_insert(struct maskindex_table *table, struct maskindex_entry *ent)
+{
+    struct maskindex_entry **pent;
+
+    if (table->count >= table->size) {
+        struct maskindex_entry **buckets, *curr, *next;
+        unsigned int size, ii;
+
+        size = table->size ? table->size * 2 : MASKINDEX_MIN_BUCKETS;
+        buckets = calloc(size, sizeof(*buckets));
+        for (ii = 0; ii < table->size; ii++) {
+            for (curr = table->buckets[ii]; curr; curr = next) {
+                next = curr->next;
+                pent = &buckets[curr->hash & (size - 1)];
+                curr->next = *pent;
+                *pent = curr;
+            }
+        }
+        free(table->buckets);
+        table->buckets = buckets;
+        table->size = size;
+    }
+    pent = &table->buckets[ent->hash & (table->size - 1)];
+    ent->next = *pent;
+    *pent = ent;
+    table->count++;
+    table->lengths[ent->len]++;
+}
+
+static void
+maskindex_unlink(struct maskindex_entry **pent, struct maskindex_entry *ent)
+{
+    for (; *pent; pent = &(*pent)->next) {
+        if (*pent == ent) {
+            *pent = ent->next;
+            return;
+        }
+    }
+}
+
+/*
+ *  Work out where a mask belongs.  On return, ent->kind, ent->hash and
+ *  ent->len are set, and ent->addr/bits if the host is a CIDR range.
+ */
+static void
+maskindex_classify(struct maskindex_entry *ent, const char *mask)
+{
+    char host[MASKINDEX_MAX_LEN + 1];
+    const char *at;
+    unsigned int len, first, last, ii;
+
+    ent->kind = MASKINDEX_OTHER;
+    ent->is_cidr = 0;
+    if (!(at = strchr(mask, '@')) || strchr(at + 1, '@'))
+        return;
+    len = strlen(at + 1);
+    if (len > MASKINDEX_MAX_LEN || strchr(at + 1, '\\'))
+        return;
+    memcpy(host, at + 1, len + 1);
+    irc_strtolower(host);
+
+    /* first is the first wildcard, last is just past the last one. */
+    first = strcspn(host, "*?");
+    last = (first < len) ? len : 0;
+    while (last > first && host[last - 1] != '*' && host[last - 1] != '?')
+        last--;
+    if (last < len) {
+        ent->kind = MASKINDEX_SUFFIX;
+        ent->len = len - last;
+        ent->hash = maskindex_hash_suffix(host + last, ent->len);
+    } else if (first > 0) {
+        ent->kind = MASKINDEX_PREFIX;
+        ent->len = first;
+        ent->hash = maskindex_hash_prefix(host, first);
+    }
+
+    if (first == len && strchr(host, '/')) {
+        unsigned char bits;
+        ii = irc_pton(&ent->addr, &bits, host);
+        if (ii && !host[ii]) {
+            ent->is_cidr = 1;
+            ent->bits = bits;
+        }
+    }
+}
+
+/*
+ *  Create a new, empty index.
+ */
+maskindex_t
+maskindex_new(void)
+{
+    maskindex_t idx = calloc(1, sizeof(struct maskindex));
+    idx->cidr = iptrie_new();
+    return idx;
+}
+
+/*
+ *  Free an index.  The data pointers it holds are not touched.
+ */
+void
+maskindex_delete(maskindex_t idx)
+{
+    struct maskindex_entry *ent, *next;
+
+    for (ent = idx->all; ent; ent = next) {
+        next = ent->all_next;
+        free(ent->mask);
+        free(ent->user);
+        free(ent);
+    }
+    free(idx->suffix.buckets);
+    free(idx->prefix.buckets);
+    iptrie_delete(idx->cidr);
+    free(idx);
+}
+
+/*
+ *  Add a mask to the index.
+ */
+void
+maskindex_add(maskindex_t idx, const char *mask, void *data)
+{
+    struct maskindex_entry *ent;
+
+    ent = calloc(1, sizeof(*ent));
+    ent->mask = strdup(mask);
+    ent->data = data;
+    maskindex_classify(ent, mask);
+    switch (ent->kind) {
+    case MASKINDEX_SUFFIX:
+        maskindex_table_insert(&idx->suffix, ent);
+        break;
+    case MASKINDEX_PREFIX:
+        maskindex_table_insert(&idx->prefix, ent);
+        break;
+    default:
+        ent->next = idx->other;
+        idx->other = ent;
+        break;
+    }
+    if (ent->is_cidr) {
+        ent->user = strdup(mask);
+        ent->user[strchr(mask, '@') - mask] = '\0';
+        iptrie_insert(idx->cidr, &ent->addr, ent->bits, ent);
+    }
+    ent->all_prev = NULL;
+    ent->all_next = idx->all;
+    if (idx->all)
+        idx->all->all_prev = ent;
+    idx->all = ent;
+    idx->count++;
+}
+
+/*
+ *  Remove the entry for mask and data from the index.
+ */
+void
+maskindex_remove(maskindex_t idx, const char *mask, void *data)
+{
+    struct maskindex_entry probe, *ent;
+    struct maskindex_table *table;
+
+    maskindex_classify(&probe, mask);
+    switch (probe.kind) {
+    case MASKINDEX_SUFFIX: table = &idx->suffix; break;
+    case MASKINDEX_PREFIX: table = &idx->prefix; break;
+    default: table = NULL; break;
+    }
+    ent = table ? (table->size ? table->buckets[probe.hash & (table->size - 1)] : NULL) : idx->other;
+    for (; ent; ent = ent->next)
+        if (ent->data == data && !irccasecmp(ent->mask, mask))
+            break;
+    if (!ent)
+        return;
+
+    if (table) {
+        maskindex_unlink(&table->buckets[ent->hash & (table->size - 1)], ent);
+        table->count--;
+        table->lengths[ent->len]--;
+    } else {
+        maskindex_unlink(&idx->other, ent);
+    }
+    if (ent->is_cidr)
+        iptrie_remove(idx->cidr, &ent->addr, ent->bits, ent);
+    if (ent->all_prev)
+        ent->all_prev->all_next = ent->all_next;
+    else
+        idx->all = ent->all_next;
+    if (ent->all_next)
+        ent->all_next->all_prev = ent->all_prev;
+    idx->count--;
+    free(ent->mask);
+    free(ent->user);
+    free(ent);
+}
+
+unsigned int
+maskindex_size(maskindex_t idx)
+{
+    return idx->count;
+}
+
+struct maskindex_cidr_search {
+    const char *user;
+    struct maskindex_entry *found;
+};
+
+static int
+maskindex_cidr_match(UNUSED_ARG(const irc_in_addr_t *addr), UNUSED_ARG(unsigned char bits), void *data, void *extra)
+{
+    struct maskindex_entry *ent = data;
+    struct maskindex_cidr_search *search = extra;
+
+    if (!match_ircglob(search->user, ent->user))
+        return 0;
+    search->found = ent;
+    return 1;
+}
+
+/*
+ *  Return the data for some mask that covers text, or NULL if there
+ *  is none.
+ */
+void *
+maskindex_find(maskindex_t idx, const char *text)
+{
+    char host[MASKINDEX_MAX_LEN + 1];
+    struct maskindex_entry *ent;
+    const char *at;
+    unsigned int len, hash, ii;
+
+    if (!(at = strchr(text, '@'))
+        || strchr(at + 1, '@')
+        || (len = strlen(at + 1)) > MASKINDEX_MAX_LEN) {
+        for (ent = idx->all; ent; ent = ent->all_next)
+            if (match_ircglob(text, ent->mask))
+                return ent->data;
+        return NULL;
+    }
+    memcpy(host, at + 1, len + 1);
+    irc_strtolower(host);
+
+    if (idx->suffix.count) {
+        hash = MASKINDEX_HASH_INIT;
+        for (ii = 1; ii <= len; ii++) {
+            hash = MASKINDEX_HASH_STEP(hash, host[len - ii]);
+            if (!idx->suffix.lengths[ii])
+                continue;
+            for (ent = idx->suffix.buckets[hash & (idx->suffix.size - 1)]; ent; ent = ent->next)
+                if (ent->len == ii && ent->hash == hash && match_ircglob(text, ent->mask))
+                    return ent->data;
+        }
+    }
+
+    if (idx->prefix.count) {
+        hash = MASKINDEX_HASH_INIT;
+        for (ii = 1; ii <= len; ii++) {
+            hash = MASKINDEX_HASH_STEP(hash, host[ii - 1]);
+            if (!idx->prefix.lengths[ii])
+                continue;
+            for (ent = idx->prefix.buckets[hash & (idx->prefix.size - 1)]; ent; ent = ent->next)
+                if (ent->len == ii && ent->hash == hash && match_ircglob(text, ent->mask))
+                    return ent->data;
+        }
+    }
+
+    for (ent = idx->other; ent; ent = ent->next)
+        if (match_ircglob(text, ent->mask))
+            return ent->data;
+
+    if (iptrie_size(idx->cidr) && (unsigned int)(at - text) <= MASKINDEX_MAX_LEN) {
+        struct maskindex_cidr_search search;
+        char user[MASKINDEX_MAX_LEN + 1];
+        irc_in_addr_t addr;
+        unsigned char bits;
+
+        if ((ii = irc_pton(&addr, &bits, host)) && !host[ii]) {
+            memcpy(user, text, at - text);
+            user[at - text] = '\0';
+            search.user = user;
+            search.found = NULL;
+            if (iptrie_walk_covering(idx->cidr, &addr, bits, maskindex_cidr_match, &search))
+                return search.found->data;
+        }
+    }
+
+    return NULL;
+}
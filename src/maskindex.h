@@ -0,0 +1,40 @@
+/* maskindex.h - Index of user@host masks
+ * Copyright 2000-2024 Evilnet Development
+ *
+ * This file is part of x3.
+ *
+ * x3 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with srvx; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+ */
+
+#ifndef MASKINDEX_H
+#define MASKINDEX_H
+
+/* A maskindex answers "which mask covers this text?" without trying
+ * every mask.  Masks are bucketed by the literal suffix or prefix of
+ * their host part, and host parts written as CIDR ranges are also kept
+ * in a radix trie so they cover the addresses (and narrower ranges)
+ * inside them.  Masks that cannot be bucketed are simply tried in
+ * turn. */
+typedef struct maskindex *maskindex_t;
+
+maskindex_t maskindex_new(void);
+void maskindex_delete(maskindex_t idx);
+void maskindex_add(maskindex_t idx, const char *mask, void *data);
+void maskindex_remove(maskindex_t idx, const char *mask, void *data);
+unsigned int maskindex_size(maskindex_t idx);
+/* returns the data of a mask that match_ircglob()s text, or NULL */
+void *maskindex_find(maskindex_t idx, const char *text);
+
+#endif /* !defined(MASKINDEX_H) */
@@ -0,0 +1,838 @@
+/* Usage: microbench [-t seconds] [benchmark ...]
+ *
+ * Times the primitives that every module leans on: dictionaries, the
+ * expiry heap, glob matching, case folding and hashing, line splitting,
+ * address and numeric conversion, database parsing and writing, and
+ * SpamServ's word lists.  With no arguments every benchmark runs;
+ * otherwise only those whose names start with one of the arguments.
+ *
+ * Each benchmark runs in rounds of a fixed number of operations, with
+ * any setup and teardown outside the timed part, until it has taken
+ * at least the given time (default 0.5s).  The output is one
+ * tab-separated line per benchmark, after header lines starting with
+ * '#', so runs from two commits can be compared with join(1) or a
+ * spreadsheet:
+ *
+ *   name  ops  ns_per_op  allocs_per_op  bytes_per_op
+ *
+ * Allocations are counted by building this program with
+ * WITH_MALLOC_COUNT, which routes malloc() and friends in the code
+ * under test through the counters below.  "make bench" builds and
+ * runs it.
+ */
+
+#include "common.h"
+#include "dict.h"
+#include "hash.h"
+#include "heap.h"
+#include "helpfile.h"
+#include "log.h"
+#include "modcmd.h"
+#include "recdb.h"
+#include "saxdb.h"
+#include "timeq.h"
+#include "wordmatch.h"
+
+/* tools.c and saxdb.c are tied in to the rest of x3; stub it out. */
+
+time_t now;
+const char *hidden_host_suffix;
+struct log_type *MAIN_LOG;
+struct language *lang_C;
+
+void log_module(UNUSED_ARG(struct log_type *lt), UNUSED_ARG(enum log_severity ls), UNUSED_ARG(const char *format), ...) { }
+const char *language_find_message(UNUSED_ARG(struct language *lang), const char *msgid) { return msgid; }
+struct chanNode *GetChannel(UNUSED_ARG(const char *name)) { return NULL; }
+void reg_exit_func(UNUSED_ARG(exit_func_t handler), UNUSED_ARG(void *extra)) { }
+void *conf_get_data(UNUSED_ARG(const char *full_path), UNUSED_ARG(enum recdb_type type)) { return NULL; }
+timeq_handle timeq_add_named(UNUSED_ARG(unsigned long when), UNUSED_ARG(timeq_func func), UNUSED_ARG(void *data), UNUSED_ARG(const char *name)) { return NULL; }
+int send_message(UNUSED_ARG(struct userNode *dest), UNUSED_ARG(struct userNode *src), UNUSED_ARG(const char *message), ...) { return 0; }
+void table_send(UNUSED_ARG(struct userNode *from), UNUSED_ARG(const char *to), UNUSED_ARG(unsigned int size), UNUSED_ARG(irc_send_func irc_send), UNUSED_ARG(struct helpfile_table table)) { }
+struct module *module_register(UNUSED_ARG(const char *name), UNUSED_ARG(struct log_type *clog), UNUSED_ARG(const char *helpfile_name), UNUSED_ARG(expand_func_t expand_help)) { return NULL; }
+struct modcmd *modcmd_register(UNUSED_ARG(struct module *module), UNUSED_ARG(const char *name), UNUSED_ARG(modcmd_func_t func), UNUSED_ARG(unsigned int min_argc), UNUSED_ARG(unsigned int flags), ...) { return NULL; }
+
+/* Allocation counters; see common.h. */
+
+#undef malloc
+#undef calloc
+#undef realloc
+#undef strdup
+
+static unsigned long alloc_calls;
+static unsigned long alloc_bytes;
+
+void *
+count_malloc(size_t size)
+{
+    alloc_calls++;
+    alloc_bytes += size;
+    return malloc(size);
+}
+
+void *
+count_calloc(size_t count, size_t size)
+{
+    alloc_calls++;
+    alloc_bytes += count * size;
+    return calloc(count, size);
+}
+
+void *
+count_realloc(void *ptr, size_t size)
+{
+    alloc_calls++;
+    alloc_bytes += size;
+    return realloc(ptr, size);
+}
+
+char *
+count_strdup(const char *str)
+{
+    size_t len = strlen(str) + 1;
+
+    alloc_calls++;
+    alloc_bytes += len;
+    return memcpy(malloc(len), str, len);
+}
+
+#define malloc(n) count_malloc(n)
+#define calloc(m,n) count_calloc((m), (n))
+#define realloc(p,n) count_realloc((p), (n))
+#define strdup(s) count_strdup(s)
+
+/* Shared test data. */
+
+#define KEY_COUNT 65536
+
+static char *keys[KEY_COUNT];           /* nick-like dictionary keys */
+static char *keys_upper[KEY_COUNT];     /* the same keys, upper cased */
+static unsigned int order[KEY_COUNT];   /* a random permutation */
+static unsigned long sink;              /* keeps results live */
+
+static unsigned int
+bench_random(void)
+{
+    static unsigned long long state = 88172645463325252ULL;
+
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return (state * 2685821657736338717ULL) >> 32;
+}
+
+static void
+bench_data_init(void)
+{
+    char buf[32];
+    unsigned int ii, jj, tmp;
+
+    for (ii = 0; ii < KEY_COUNT; ii++) {
+        snprintf(buf, sizeof(buf), "%cick%x[%u]", "NnMmKk"[ii % 6], bench_random(), ii);
+        keys[ii] = strdup(buf);
+        for (jj = 0; buf[jj]; jj++)
+            buf[jj] = toupper(buf[jj]);
+        keys_upper[ii] = strdup(buf);
+        order[ii] = ii;
+    }
+    for (ii = KEY_COUNT - 1; ii > 0; ii--) {
+        jj = bench_random() % (ii + 1);
+        tmp = order[ii];
+        order[ii] = order[jj];
+        order[jj] = tmp;
+    }
+}
+
+static unsigned long long
+bench_nsec(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (unsigned long long)tv.tv_sec * 1000000000 + tv.tv_usec * 1000;
+#endif
+}
+
+/* Dictionaries, for both backends. */
+
+static dict_t bench_dict;
+static dict_t (*bench_dict_new)(void);
+
+static void
+dict_fill(void)
+{
+    unsigned int ii;
+
+    bench_dict = bench_dict_new();
+    for (ii = 0; ii < KEY_COUNT; ii++)
+        dict_insert(bench_dict, keys[ii], keys[ii]);
+    /* A hash dict sorts itself on first iteration; do that here. */
+    dict_first(bench_dict);
+}
+
+static void
+dict_free(void)
+{
+    dict_delete(bench_dict);
+    bench_dict = NULL;
+}
+
+static void
+dict_insert_setup(void)
+{
+    bench_dict = bench_dict_new();
+}
+
+static void
+dict_insert_run(unsigned int ops)
+{
+    unsigned int ii;
+
+    for (ii = 0; ii < ops; ii++)
+        dict_insert(bench_dict, keys[order[ii]], keys[ii]);
+}
+
+static void
+dict_find_run(unsigned int ops)
+{
+    unsigned int ii;
+
+    for (ii = 0; ii < ops; ii++)
+        sink += (dict_find(bench_dict, keys_upper[order[ii]], NULL) != NULL);
+}
+
+static void
+dict_remove_run(unsigned int ops)
+{
+    unsigned int ii;
+
+    for (ii = 0; ii < ops; ii++)
+        sink += dict_remove(bench_dict, keys[order[ii]]);
+}
+
+static void
+dict_iterate_run(unsigned int ops)
+{
+    dict_iterator_t it;
+    unsigned int ii;
+
+    for (ii = 0; ii < ops; ) {
+        for (it = dict_first(bench_dict); it && ii < ops; it = iter_next(it), ii++)
+            sink += (unsigned long)iter_data(it);
+    }
+}
+
+static void dict_splay_setup(void) { bench_dict_new = dict_new_splay; dict_insert_setup(); }
+static void dict_splay_fill(void) { bench_dict_new = dict_new_splay; dict_fill(); }
+static void dict_hash_setup(void) { bench_dict_new = dict_new_hash; dict_insert_setup(); }
+static void dict_hash_fill(void) { bench_dict_new = dict_new_hash; dict_fill(); }
+
+/* The expiry heap. */
+
+static heap_t bench_heap;
+
+static void
+heap_setup(void)
+{
+    bench_heap = heap_new(ulong_comparator);
+}
+
+static void
+heap_fill(void)
+{
+    unsigned int ii;
+
+    bench_heap = heap_new(ulong_comparator);
+    for (ii = 0; ii < KEY_COUNT; ii++)
+        heap_insert(bench_heap, (void*)(unsigned long)(order[ii] + 1), NULL);
+}
+
+static void
+heap_free(void)
+{
+    heap_delete(bench_heap);
+    bench_heap = NULL;
+}
+
+static void
+heap_insert_run(unsigned int ops)
+{
+    unsigned int ii;
+
+    for (ii = 0; ii < ops; ii++)
+        heap_insert(bench_heap, (void*)(unsigned long)(order[ii] + 1), NULL);
+}
+
+static void
+heap_pop_run(unsigned int ops)
+{
+    void *key;
+    unsigned int ii;
+
+    for (ii = 0; ii < ops; ii++) {
+        heap_peek(bench_heap, &key, NULL);
+        sink += (unsigned long)key;
+        heap_pop(bench_heap);
+    }
+}
+
+/* Glob matching. */
+
+static const char *glob_texts[][2] = {
+    { "Nick1234!ident@host1234.dsl.example.net", "*!*@*.example.net" },
+    { "Nick1234!ident@host1234.dsl.example.net", "*!*@*.example.org" },
+    { "Nick1234!ident@host1234.dsl.example.net", "nick*!*@*" },
+    { "Nick1234!~ident@10.1.2.3", "*!*@10.1.*" },
+    { "Nick1234!~ident@10.1.2.3", "*!*ident@10.2.*" },
+    { "Somebody!user@cpe-1-2-3-4.cable.example.com", "*!*@cpe-*-*-*-*.cable.example.com" },
+    { "Somebody!user@cpe-1-2-3-4.cable.example.com", "*!*@host1??.*" },
+    { "LongNickName!longident@a.very.long.host.name.example.com", "*!*@*.*.*.*.*.example.com" },
+};
+
+static const char *mmatch_globs[][2] = {
+    { "*!*@*.example.net", "*!*@host1234.dsl.example.net" },
+    { "*!*@*.example.net", "*!*@*.example.org" },
+    { "*!*@*", "nick*!*@*" },
+    { "*!*@10.1.*", "*!*@10.1.2.*" },
+    { "*!*ident@*", "*!~ident@10.*" },
+    { "*!*@*.cable.example.com", "*!*@cpe-*.cable.example.com" },
+};
+
+static void
+match_ircglob_run(unsigned int ops)
+{
+    unsigned int ii;
+
+    for (ii = 0; ii < ops; ii++)
+        sink += match_ircglob(glob_texts[ii % ArrayLength(glob_texts)][0], glob_texts[ii % ArrayLength(glob_texts)][1]);
+}
+
+static void
+mmatch_run(unsigned int ops)
+{
+    unsigned int ii;
+
+    for (ii = 0; ii < ops; ii++)
+        sink += mmatch(mmatch_globs[ii % ArrayLength(mmatch_globs)][0], mmatch_globs[ii % ArrayLength(mmatch_globs)][1]);
+}
+
+static const char *user_globs[] = {
+    "*!*@*.example.net",
+    "*!*@10.1.*",
+    "*!~foo@*",
+    "Bad*!*@*",
+    "*!*@host12??.dsl.*",
+    "*!*@*.cable.example.com",
+};
+
+static struct userNode bench_user;
+static struct userExt bench_user_ext;
+
+static void
+user_setup(void)
+{
+    bench_user.nick = "Nick1234";
+    bench_user.ident = "ident";
+    bench_user.hostname = "host1234.dsl.example.net";
+    bench_user.ext = &bench_user_ext;
+    irc_pton(&bench_user.ip, NULL, "10.1.2.3");
+    strcpy(bench_user_ext.crypthost, "A1B2C3D4.dsl.example.net");
+    strcpy(bench_user_ext.cryptip, "A1B2C3D4.E5F6A7B8.C9D0E1F2.IP");
+}
+
+static void
+user_matches_glob_run(unsigned int ops)
+{
+    unsigned int ii;
+
+    for (ii = 0; ii < ops; ii++)
+        sink += user_matches_glob(&bench_user, user_globs[ii % ArrayLength(user_globs)], MATCH_USENICK, 0);
+}
+
+/* Case folding. */
+
+static void
+irccasecmp_run(unsigned int ops)
+{
+    unsigned int ii, jj;
+
+    for (ii = 0; ii < ops; ii++) {
+        jj = ii & (KEY_COUNT - 1);
+        /* Alternate equal and unequal pairs. */
+        if (ii & 1)
+            sink += irccasecmp(keys[jj], keys_upper[jj]);
+        else
+            sink += irccasecmp(keys[jj], keys[order[jj]]);
+    }
+}
+
+static void
+irc_strtolower_run(unsigned int ops)
+{
+    char buf[32];
+    unsigned int ii;
+
+    for (ii = 0; ii < ops; ii++) {
+        strcpy(buf, keys_upper[ii & (KEY_COUNT - 1)]);
+        irc_strtolower(buf);
+        sink += buf[0];
+    }
+}
+
+/* Longer strings: channel names, real names and message text. */
+static const char *long_texts[] = {
+    "#The-Longest_Channel[Name]^Anyone~Has{Ever}Seen|Here",
+    "#the-longest_channel{name}~anyone^has[ever]seen\\here",
+    "Some Person's Real Name, With Punctuation And Stuff",
+    "SOME PERSON'S REAL NAME, WITH PUNCTUATION AND STUFF",
+};
+
+static void
+irccasecmp_long_run(unsigned int ops)
+{
+    unsigned int ii;
+
+    for (ii = 0; ii < ops; ii++)
+        sink += irccasecmp(long_texts[ii & 3], long_texts[(ii & 3) ^ 1]);
+}
+
+static void
+ircncasecmp_run(unsigned int ops)
+{
+    unsigned int ii;
+
+    for (ii = 0; ii < ops; ii++)
+        sink += ircncasecmp(long_texts[ii & 3], long_texts[(ii & 3) ^ 1], 40);
+}
+
+static void
+irccasestr_run(unsigned int ops)
+{
+    static const char *needles[] = { "ANYONE", "here", "punctuation", "STUFFED" };
+    unsigned int ii;
+
+    for (ii = 0; ii < ops; ii++)
+        sink += (irccasestr(long_texts[ii & 3], needles[(ii >> 2) & 3]) != NULL);
+}
+
+static void
+irc_strtolower_long_run(unsigned int ops)
+{
+    char buf[64];
+    unsigned int ii;
+
+    for (ii = 0; ii < ops; ii++) {
+        strcpy(buf, long_texts[ii & 3]);
+        irc_strtolower(buf);
+        sink += buf[0];
+    }
+}
+
+static void
+irccasehash_run(unsigned int ops)
+{
+    unsigned int ii;
+
+    for (ii = 0; ii < ops; ii++)
+        sink += irccasehash(keys[ii & (KEY_COUNT - 1)]);
+}
+
+static void
+irccasehash_long_run(unsigned int ops)
+{
+    unsigned int ii;
+
+    for (ii = 0; ii < ops; ii++)
+        sink += irccasehash(long_texts[ii & 3]);
+}
+
+static void
+crc32c_run(unsigned int ops)
+{
+    unsigned int ii;
+
+    for (ii = 0; ii < ops; ii++)
+        sink += crc32c(0, long_texts[ii & 3], strlen(long_texts[ii & 3]));
+}
+
+/* Line splitting. */
+
+static const char *split_lines[] = {
+    "ABAAB P #channel :hello there, how is everyone doing today?",
+    "AB N Nick1234 1 1700000000 ident host1234.example.com +iwx acct AAAAAA ABAAB :Real Name",
+    "AB B #channel 1700000000 +nt ABAAA,ABAAB:o,ABAAC:v,ABAAD,ABAAE,ABAAF,ABAAG",
+    "ABAAC M #channel +ovb ABAAA ABAAB *!*@*.example.com",
+    "ABAAD J #a,#b,#c 1700000000",
+};
+
+static void
+split_line_run(unsigned int ops)
+{
+    char buf[512], *argv[MAXNUMPARAMS];
+    unsigned int ii;
+
+    for (ii = 0; ii < ops; ii++) {
+        strcpy(buf, split_lines[ii % ArrayLength(split_lines)]);
+        sink += split_line(buf, true, ArrayLength(argv), argv);
+    }
+}
+
+/* Address and numeric conversion. */
+
+static const char *ipv4_texts[] = { "10.1.2.3", "192.168.100.200", "127.0.0.1", "203.0.113.77" };
+static const char *ipv6_texts[] = { "2001:db8::1", "fe80::1:2:3:4", "2001:db8:85a3:0:0:8a2e:370:7334", "::1" };
+static irc_in_addr_t ipv4_addrs[ArrayLength(ipv4_texts)];
+static irc_in_addr_t ipv6_addrs[ArrayLength(ipv6_texts)];
+
+static void
+addr_setup(void)
+{
+    unsigned int ii;
+
+    for (ii = 0; ii < ArrayLength(ipv4_texts); ii++)
+        irc_pton(ipv4_addrs + ii, NULL, ipv4_texts[ii]);
+    for (ii = 0; ii < ArrayLength(ipv6_texts); ii++)
+        irc_pton(ipv6_addrs + ii, NULL, ipv6_texts[ii]);
+}
+
+static void
+irc_pton_v4_run(unsigned int ops)
+{
+    irc_in_addr_t addr;
+    unsigned int ii;
+
+    for (ii = 0; ii < ops; ii++)
+        sink += irc_pton(&addr, NULL, ipv4_texts[ii % ArrayLength(ipv4_texts)]);
+}
+
+static void
+irc_pton_v6_run(unsigned int ops)
+{
+    irc_in_addr_t addr;
+    unsigned int ii;
+
+    for (ii = 0; ii < ops; ii++)
+        sink += irc_pton(&addr, NULL, ipv6_texts[ii % ArrayLength(ipv6_texts)]);
+}
+
+static void
+irc_ntop_v4_run(unsigned int ops)
+{
+    char buf[IRC_NTOP_MAX_SIZE];
+    unsigned int ii;
+
+    for (ii = 0; ii < ops; ii++)
+        sink += irc_ntop(buf, sizeof(buf), ipv4_addrs + ii % ArrayLength(ipv4_addrs));
+}
+
+static void
+irc_ntop_v6_run(unsigned int ops)
+{
+    char buf[IRC_NTOP_MAX_SIZE];
+    unsigned int ii;
+
+    for (ii = 0; ii < ops; ii++)
+        sink += irc_ntop(buf, sizeof(buf), ipv6_addrs + ii % ArrayLength(ipv6_addrs));
+}
+
+static void
+inttobase64_run(unsigned int ops)
+{
+    char buf[8];
+    unsigned int ii;
+
+    for (ii = 0; ii < ops; ii++)
+        sink += inttobase64(buf, order[ii & (KEY_COUNT - 1)] * 40503u, 5)[0];
+}
+
+static void
+base64toint_run(unsigned int ops)
+{
+    static const char *numerics[] = { "ABAAB", "AB]]]", "Kx9aQ", "[]AAA", "zzzzz", "AAAAA" };
+    unsigned int ii;
+
+    for (ii = 0; ii < ops; ii++)
+        sink += base64toint(numerics[ii % ArrayLength(numerics)], 5);
+}
+
+/* Databases, with NickServ-shaped records. */
+
+static char db_name[] = "/tmp/microbench.XXXXXX";
+
+static void
+recdb_setup(void)
+{
+    FILE *file;
+    unsigned int ii;
+    int fd;
+
+    if ((fd = mkstemp(db_name)) < 0 || !(file = fdopen(fd, "w"))) {
+        perror(db_name);
+        exit(1);
+    }
+    for (ii = 0; ii < 4096; ii++)
+        fprintf(file, "\"acct%u\" { \"id\" \"%u\"; \"passwd\" \"5f4dcc3b5aa765d61d8327deb882cf99\";"
+                " \"register\" \"1642782045\"; \"lastseen\" \"1698243315\";"
+                " \"masks\" (\"*@host%u.example.com\", \"*@*.isp%u.example.net\");"
+                " \"email_addr\" \"acct%u@example.com\"; };\n", ii, ii + 1, ii, ii % 97, ii);
+    fclose(file);
+}
+
+static void
+recdb_teardown(void)
+{
+    unlink(db_name);
+    strcpy(db_name + strlen(db_name) - 6, "XXXXXX");
+}
+
+static void
+recdb_parse_run(UNUSED_ARG(unsigned int ops))
+{
+    dict_t db;
+
+    db = parse_database(db_name);
+    sink += dict_size(db);
+    free_database(db);
+}
+
+static struct string_list *bench_masks;
+
+static void
+saxdb_setup(void)
+{
+    bench_masks = alloc_string_list(2);
+    string_list_append(bench_masks, strdup("*@host1234.example.com"));
+    string_list_append(bench_masks, strdup("*@*.isp12.example.net"));
+}
+
+static void
+saxdb_teardown(void)
+{
+    free_string_list(bench_masks);
+}
+
+static void
+saxdb_write_run(unsigned int ops)
+{
+    struct saxdb_context *ctx;
+    FILE *file;
+    unsigned int ii;
+
+    if (!(file = fopen("/dev/null", "w")) || !(ctx = saxdb_open_context(file)))
+        return;
+    if (setjmp(*saxdb_jmp_buf(ctx))) {
+        saxdb_close_context(ctx, 1);
+        return;
+    }
+    for (ii = 0; ii < ops; ii++) {
+        saxdb_start_record(ctx, keys[ii], 1);
+        saxdb_write_int(ctx, "id", ii + 1);
+        saxdb_write_string(ctx, "passwd", "5f4dcc3b5aa765d61d8327deb882cf99");
+        saxdb_write_int(ctx, "register", 1642782045);
+        saxdb_write_int(ctx, "lastseen", 1698243315);
+        saxdb_write_string_list(ctx, "masks", bench_masks);
+        saxdb_write_string(ctx, "email_addr", "acct@example.com");
+        saxdb_end_record(ctx);
+    }
+    saxdb_close_context(ctx, 1);
+}
+
+/* SpamServ word lists: a channel with 500 badwords and exceptions,
+ * checked against messages that contain none of them, so every word
+ * has to be looked for.  wordlist_strstr is the strstr() per word that
+ * SpamServ used to do. */
+
+#define WORD_COUNT 500
+#define MESSAGE_COUNT 64
+
+static char *bench_words[WORD_COUNT];
+static char bench_messages[MESSAGE_COUNT][128];
+static struct wordmatch *bench_wordmatch;
+
+static void
+words_setup(void)
+{
+    unsigned int ii, jj, len;
+
+    if (bench_words[0])
+        return;
+    for (ii = 0; ii < WORD_COUNT; ii++) {
+        len = 5 + bench_random() % 6;
+        bench_words[ii] = malloc(len + 1);
+        for (jj = 0; jj < len; jj++)
+            bench_words[ii][jj] = 'a' + bench_random() % 26;
+        bench_words[ii][len] = '\0';
+    }
+    for (ii = 0; ii < MESSAGE_COUNT; ii++) {
+        len = 40 + bench_random() % 80;
+        for (jj = 0; jj < len; jj++)
+            bench_messages[ii][jj] = (bench_random() % 6) ? 'a' + bench_random() % 26 : ' ';
+        bench_messages[ii][len] = '\0';
+    }
+}
+
+static void
+wordmatch_setup(void)
+{
+    unsigned int ii;
+
+    words_setup();
+    bench_wordmatch = wordmatch_alloc();
+    for (ii = 0; ii < WORD_COUNT; ii++)
+        wordmatch_add(bench_wordmatch, bench_words[ii], 1 << (ii & 1));
+    wordmatch_compile(bench_wordmatch);
+}
+
+static void
+wordmatch_teardown(void)
+{
+    wordmatch_free(bench_wordmatch);
+}
+
+static void
+wordmatch_compile_run(unsigned int ops)
+{
+    unsigned int ii;
+
+    for (ii = 0; ii < ops; ii++) {
+        wordmatch_teardown();
+        wordmatch_setup();
+    }
+}
+
+static void
+wordmatch_scan_run(unsigned int ops)
+{
+    unsigned int ii;
+
+    for (ii = 0; ii < ops; ii++)
+        sink += wordmatch_scan(bench_wordmatch, bench_messages[ii % MESSAGE_COUNT], 1);
+}
+
+static void
+wordlist_strstr_run(unsigned int ops)
+{
+    unsigned int ii, jj;
+
+    for (ii = 0; ii < ops; ii++)
+        for (jj = 0; jj < WORD_COUNT; jj++)
+            sink += (strstr(bench_messages[ii % MESSAGE_COUNT], bench_words[jj]) != NULL);
+}
+
+/* The benchmarks.  setup and teardown may be NULL; run does ops
+ * operations.  A setup that builds a table of KEY_COUNT entries
+ * limits ops to KEY_COUNT. */
+
+struct bench {
+    const char *name;
+    unsigned int ops;
+    void (*setup)(void);
+    void (*run)(unsigned int ops);
+    void (*teardown)(void);
+};
+
+static const struct bench benches[] = {
+    { "dict_splay_insert", KEY_COUNT, dict_splay_setup, dict_insert_run, dict_free },
+    { "dict_splay_find", KEY_COUNT, dict_splay_fill, dict_find_run, dict_free },
+    { "dict_splay_remove", KEY_COUNT, dict_splay_fill, dict_remove_run, dict_free },
+    { "dict_splay_iterate", 4 * KEY_COUNT, dict_splay_fill, dict_iterate_run, dict_free },
+    { "dict_hash_insert", KEY_COUNT, dict_hash_setup, dict_insert_run, dict_free },
+    { "dict_hash_find", KEY_COUNT, dict_hash_fill, dict_find_run, dict_free },
+    { "dict_hash_remove", KEY_COUNT, dict_hash_fill, dict_remove_run, dict_free },
+    { "dict_hash_iterate", 4 * KEY_COUNT, dict_hash_fill, dict_iterate_run, dict_free },
+    { "heap_insert", KEY_COUNT, heap_setup, heap_insert_run, heap_free },
+    { "heap_pop", KEY_COUNT, heap_fill, heap_pop_run, heap_free },
+    { "match_ircglob", 1 << 18, NULL, match_ircglob_run, NULL },
+    { "mmatch", 1 << 18, NULL, mmatch_run, NULL },
+    { "user_matches_glob", 1 << 18, user_setup, user_matches_glob_run, NULL },
+    { "irccasecmp", 1 << 20, NULL, irccasecmp_run, NULL },
+    { "irc_strtolower", 1 << 20, NULL, irc_strtolower_run, NULL },
+    { "irccasecmp_long", 1 << 20, NULL, irccasecmp_long_run, NULL },
+    { "ircncasecmp", 1 << 20, NULL, ircncasecmp_run, NULL },
+    { "irccasestr", 1 << 20, NULL, irccasestr_run, NULL },
+    { "irc_strtolower_long", 1 << 20, NULL, irc_strtolower_long_run, NULL },
+    { "irccasehash", 1 << 20, NULL, irccasehash_run, NULL },
+    { "irccasehash_long", 1 << 20, NULL, irccasehash_long_run, NULL },
+    { "crc32c", 1 << 20, NULL, crc32c_run, NULL },
+    { "split_line", 1 << 20, NULL, split_line_run, NULL },
+    { "irc_pton_v4", 1 << 20, NULL, irc_pton_v4_run, NULL },
+    { "irc_pton_v6", 1 << 20, NULL, irc_pton_v6_run, NULL },
+    { "irc_ntop_v4", 1 << 20, addr_setup, irc_ntop_v4_run, NULL },
+    { "irc_ntop_v6", 1 << 20, addr_setup, irc_ntop_v6_run, NULL },
+    { "inttobase64", 1 << 20, NULL, inttobase64_run, NULL },
+    { "base64toint", 1 << 20, NULL, base64toint_run, NULL },
+    { "recdb_parse", 4096, recdb_setup, recdb_parse_run, recdb_teardown },
+    { "saxdb_write", 4096, saxdb_setup, saxdb_write_run, saxdb_teardown },
+    { "wordmatch_compile", 16, wordmatch_setup, wordmatch_compile_run, wordmatch_teardown },
+    { "wordmatch_scan", 1 << 16, wordmatch_setup, wordmatch_scan_run, wordmatch_teardown },
+    { "wordlist_strstr", 1 << 10, words_setup, wordlist_strstr_run, NULL },
+};
+
+static void
+bench_one(const struct bench *bench, unsigned long long min_nsec)
+{
+    unsigned long long start, elapsed, ops;
+    unsigned long calls, bytes;
+
+    elapsed = ops = calls = bytes = 0;
+    do {
+        if (bench->setup)
+            bench->setup();
+        alloc_calls = alloc_bytes = 0;
+        start = bench_nsec();
+        bench->run(bench->ops);
+        elapsed += bench_nsec() - start;
+        calls += alloc_calls;
+        bytes += alloc_bytes;
+        ops += bench->ops;
+        if (bench->teardown)
+            bench->teardown();
+    } while (elapsed < min_nsec);
+    printf("%s\t%llu\t%.2f\t%.3f\t%.1f\n", bench->name, ops,
+           (double)elapsed / ops, (double)calls / ops, (double)bytes / ops);
+    fflush(stdout);
+}
+
+static int
+bench_selected(const char *name, int argc, char *argv[])
+{
+    int ii;
+
+    if (!argc)
+        return 1;
+    for (ii = 0; ii < argc; ii++)
+        if (!strncmp(name, argv[ii], strlen(argv[ii])))
+            return 1;
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    double seconds = 0.5;
+    unsigned int ii;
+    int arg = 1;
+
+    if (arg + 1 < argc && !strcmp(argv[arg], "-t")) {
+        seconds = strtod(argv[arg + 1], NULL);
+        arg += 2;
+    }
+    if (arg < argc && argv[arg][0] == '-') {
+        fprintf(stderr, "usage: %s [-t seconds] [benchmark ...]\n", argv[0]);
+        return 1;
+    }
+    tools_init();
+    bench_data_init();
+    printf("# casefold %s\n", casefold_impl());
+    printf("# crc32c %s\n", crc32c_impl());
+    printf("# name\tops\tns_per_op\tallocs_per_op\tbytes_per_op\n");
+    for (ii = 0; ii < ArrayLength(benches); ii++)
+        if (bench_selected(benches[ii].name, argc - arg, argv + arg))
+            bench_one(benches + ii, seconds * 1000000000.0);
+    return (sink == 42) ? 2 : 0;
+}
@@ -340,15 +340,15 @@ pyobj_from_usernode(struct userNode* user) {
             "info", user->info,
             "hostname", user->hostname,
             "ip", irc_ntoa(&user->ip),
-            "fakehost", user->fakehost,
-            "sethost", user->sethost,
-            "crypthost", user->crypthost,
-            "cryptip", user->cryptip,
+            "fakehost", IsFakeHost(user) ? user->ext->fakehost : "",
+            "sethost", user->ext->sethost,
+            "crypthost", user->ext->crypthost,
+            "cryptip", user->ext->cryptip,
             "numeric", user->numeric,
             "loc", user->loc,
             "no_notice", user->no_notice,
-            "mark", user->mark,
-            "version_reply", user->version_reply,
+            "mark", user->ext->mark,
+            "version_reply", user->ext->version_reply,
             "account", user->handle_info ? user->handle_info->handle : NULL,
             "channels", pChanList);
 
@@ -119,6 +119,7 @@ struct sockcheck_client {
     unsigned int test_index;
     unsigned short test_rep;
     struct sockcheck_state *state;
+    timeq_handle timeout;
     unsigned int read_size, read_used, read_pos;
     char *read;
     const char **resp_state;
@@ -247,6 +248,7 @@ static void
 sockcheck_timeout_client(void *data)
 {
     struct sockcheck_client *client = data;
+    client->timeout = NULL;
     if (SOCKCHECK_DEBUG) {
         log_module(PC_LOG, LOG_INFO, "Client %s timed out.", client->addr->hostname);
     }
@@ -413,7 +415,7 @@ sockcheck_elaborate_state(struct sockcheck_client *client)
             return;
         }
     }
-    timeq_add(now + client->state->timeout, sockcheck_timeout_client, client);
+    client->timeout = timeq_add(now + client->state->timeout, sockcheck_timeout_client, client);
     if (SOCKCHECK_DEBUG) {
         log_module(PC_LOG, LOG_INFO, "Elaborated state for %s:", client->addr->hostname);
         sockcheck_print_client(client);
@@ -473,7 +475,10 @@ sockcheck_advance(struct sockcheck_client *client, unsigned int next_state)
     struct sockcheck_state *ns;
 
     verify(client);
-    timeq_del(0, sockcheck_timeout_client, client, TIMEQ_IGNORE_WHEN);
+    if (client->timeout) {
+        timeq_cancel(client->timeout);
+        client->timeout = NULL;
+    }
     if (SOCKCHECK_DEBUG) {
         unsigned int n, m;
         char buffer[201];
@@ -670,7 +675,7 @@ sockcheck_begin_test(struct sockcheck_client *client)
             continue;
         }
         io_fd->readable_cb = sockcheck_readable;
-        timeq_add(now + client->state->timeout, sockcheck_timeout_client, client);
+        client->timeout = timeq_add(now + client->state->timeout, sockcheck_timeout_client, client);
         if (SOCKCHECK_DEBUG) {
             log_module(PC_LOG, LOG_INFO, "Starting proxy check on %s:%d (test %d) with fd %d (%p).", client->addr->hostname, client->state->port, client->test_index, io_fd->fd, (void*)io_fd);
         }
@@ -107,12 +107,12 @@ int check_mark(struct svccmd *cmd, struct userNode *user, UNUSED_ARG(struct hand
     if ((webtv_conf.required_mark == 0) || IsOper(user))
         return 1;
     else {
-        if (!user->mark) {
+        if (!user->ext->mark) {
             reply("WBMSG_NOT_MARKED");
             return 0;
         }
         for (y = 0; y < webtv_conf.valid_marks->used; y++) {
-            if (!strcasecmp(webtv_conf.valid_marks->list[y], user->mark))
+            if (!strcasecmp(webtv_conf.valid_marks->list[y], user->ext->mark))
                 return 1;
         }
         reply("WBMSG_NOT_MARKED");
@@ -204,7 +204,7 @@ static MODCMD_FUNC(cmd_whois)
     target = GetUserH(argv[1]);
     if (target) {
         reply("WBMSG_WHOIS_NICKIDENT", target->nick, target->ident,
-              IsFakeHost(target) ? target->fakehost : target->hostname, target->info);
+              IsFakeHost(target) ? target->ext->fakehost : target->hostname, target->info);
 
         if ((target->channels.used <= MAX_CHANNELS_WHOIS) && !IsService(target))
             webtv_ison(cmd->parent->bot, user, target, "WBMSG_WHOIS_CHANNELS");
@@ -225,7 +225,7 @@ static MODCMD_FUNC(cmd_whois)
         if (target->handle_info)
             reply("WBMSG_WHOIS_ACCOUNT", target->nick, target->handle_info->handle);
 
-        if ((target == user) && (target->fakehost || IsHiddenHost(target))) 
+        if ((target == user) && (IsFakeHost(target) || IsHiddenHost(target))) 
             reply("WBMSG_WHOIS_REALHOST", target->nick, target->ident, target->hostname, irc_ntoa(&target->ip));
 
         if (target->handle_info) {
@@ -233,8 +233,8 @@ static MODCMD_FUNC(cmd_whois)
                reply("WBMSG_WHOIS_SWHOIS", target->nick, target->handle_info->epithet);
         }
  
-        if (target->mark)
-               reply("WBMSG_WHOIS_DNSBL", target->nick, target->mark);
+        if (target->ext->mark)
+               reply("WBMSG_WHOIS_DNSBL", target->nick, target->ext->mark);
 
         reply("WBMSG_WHOIS_END", target->nick);
     } else {
@@ -21,6 +21,7 @@
 #include "chanserv.h"
 #include "conf.h"
 #include "compat.h"
+#include "intern.h"
 #include "modcmd.h"
 #include "opserv.h"
 #include "saxdb.h"
@@ -2296,8 +2297,10 @@ modcmd_load_bots(struct dict *db, int default_nick) {
         if (desc) {
             if (!svc)
                 svc = service_register(AddLocalUser(nick, nick, hostname, desc, modes));
-            else if (hostname)
-                strcpy(svc->bot->hostname, hostname);
+            else if (hostname) {
+                intern_release(svc->bot->hostname);
+                svc->bot->hostname = intern_stringn(hostname, HOSTLEN);
+            }
             desc = database_get_data(rd->d.object, "trigger", RECDB_QSTRING);
             if (desc)
                 svc->trigger = desc[0];
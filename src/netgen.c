@@ -0,0 +1,527 @@
+/* Usage: netgen [options]
+ *
+ * Writes a synthetic network for benchmarking: a P10 netburst from a
+ * hub and its leaves, optionally followed by steady-state traffic,
+ * and a NickServ and ChanServ database whose accounts and channels
+ * match the users in the burst.  The burst is suitable for x3 -b (or,
+ * with -l, x3 -r); the database is written as a mondo database.
+ *
+ * Sizes follow the shapes seen on real networks: users are spread
+ * unevenly over servers, channel sizes fall off as 1/rank (a few huge
+ * channels, most with a handful of users), most channels have no bans
+ * but a few have many, and clones share hosts.  Everything is derived
+ * from the seed, so the same options always give the same output.
+ */
+
+#include "common.h"
+
+#ifdef HAVE_MATH_H
+#include <math.h>
+#endif
+
+#define SERVER_CAPACITY 262144  /* three base64 digits of user numeric */
+#define BURST_LINE_MAX  450     /* keep B lines well under MAXLEN */
+
+static const char b64digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789[]";
+
+static struct {
+    unsigned int servers;
+    unsigned int first_numeric;
+    unsigned int users;
+    unsigned int channels;
+    double chans_per_user;
+    unsigned int max_bans;
+    unsigned int accounts;
+    double authed;
+    unsigned int reg_channels;
+    double access_per_chan;
+    unsigned int traffic;
+    const char *services;
+    const char *password;
+    unsigned long start;
+    int log_format;
+    const char *burst_file;
+    const char *db_file;
+} opt = {
+    4, 1, 10000, 1000, 2.5, 45, 0, 0.3, 0, 8.0, 0,
+    "X3.AfterNET.Services", "laoo,rpe", 1700000000, 0, NULL, NULL
+};
+
+static unsigned long long rng_state = 88172645463325252ULL;
+static unsigned int *user_server;       /* server index of each user */
+static unsigned int *user_gen;          /* nick changes made by each user */
+static unsigned int *user_mark;         /* used to avoid duplicates */
+static unsigned int *server_users;      /* users on each server */
+static char log_prefix[64];
+
+/* xorshift64*, so output does not depend on the C library. */
+static unsigned int
+rng(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (rng_state * 2685821657736338717ULL) >> 32;
+}
+
+static unsigned int
+rng_below(unsigned int n)
+{
+    return n ? (unsigned int)(((unsigned long long)rng() * n) >> 32) : 0;
+}
+
+static double
+rng_unit(void)
+{
+    return rng() / 4294967296.0;
+}
+
+/* Index in [0, n) with weight 1/(index+1)^skew, by inverting the
+ * continuous approximation of the distribution. */
+static unsigned int
+rng_zipf(unsigned int n, double skew)
+{
+    double u = rng_unit(), x;
+
+    if (n < 2)
+        return 0;
+    if (skew == 1.0)
+        x = pow(n + 1.0, u);
+    else
+        x = pow(1.0 + u * (pow(n + 1.0, 1.0 - skew) - 1.0), 1.0 / (1.0 - skew));
+    return (x < 1.0) ? 0 : ((unsigned int)x - 1 >= n ? n - 1 : (unsigned int)x - 1);
+}
+
+static char *
+b64(unsigned int val, unsigned int digits, char *buf)
+{
+    buf[digits] = '\0';
+    while (digits--) {
+        buf[digits] = b64digits[val & 63];
+        val >>= 6;
+    }
+    return buf;
+}
+
+static char *
+server_numeric(unsigned int server, char *buf)
+{
+    return b64(opt.first_numeric + server, 2, buf);
+}
+
+/* Users are numbered so that each server's users are contiguous. */
+static unsigned int *server_first;
+
+static char *
+user_numeric(unsigned int user, char *buf)
+{
+    unsigned int server = user_server[user];
+
+    server_numeric(server, buf);
+    b64(user - server_first[server], 3, buf + 2);
+    return buf;
+}
+
+static void
+user_nick(unsigned int user, char *buf, size_t size)
+{
+    if (user_gen[user])
+        snprintf(buf, size, "user%u_%u", user, user_gen[user]);
+    else
+        snprintf(buf, size, "user%u", user);
+}
+
+static void
+emit(FILE *out, const char *format, ...)
+{
+    va_list args;
+
+    if (opt.log_format)
+        fputs(log_prefix, out);
+    va_start(args, format);
+    vfprintf(out, format, args);
+    va_end(args);
+    fputc('\n', out);
+}
+
+/* Spreads users over servers with weight 1/(server+1), filling
+ * servers in order so numerics stay dense. */
+static int
+assign_servers(void)
+{
+    unsigned int ii, server;
+
+    server_users = calloc(opt.servers, sizeof(server_users[0]));
+    server_first = calloc(opt.servers, sizeof(server_first[0]));
+    for (ii = 0; ii < opt.users; ii++) {
+        server = rng_zipf(opt.servers, 1.0);
+        while (server_users[server] >= SERVER_CAPACITY)
+            if (++server == opt.servers)
+                server = 0;
+        server_users[server]++;
+    }
+    for (ii = 1; ii < opt.servers; ii++)
+        server_first[ii] = server_first[ii-1] + server_users[ii-1];
+    user_server = malloc(opt.users * sizeof(user_server[0]));
+    for (server = 0, ii = 0; ii < opt.users; ii++) {
+        while (ii >= server_first[server] + server_users[server])
+            server++;
+        user_server[ii] = server;
+    }
+    return 0;
+}
+
+static unsigned int
+user_account(unsigned int user)
+{
+    /* A deterministic hash, so the database writer agrees. */
+    unsigned long long hash = (user + 1) * 0x9E3779B97F4A7C15ULL;
+
+    if (!opt.accounts || (hash >> 40) % 1000 >= opt.authed * 1000)
+        return 0;
+    return (hash >> 8) % opt.accounts + 1;
+}
+
+static void
+write_users(FILE *out)
+{
+    char num[8], ip[8];
+    unsigned int ii, host, account;
+
+    for (ii = 0; ii < opt.users; ii++) {
+        char srv[4];
+        /* Clones share hosts; most hosts have one user. */
+        host = rng_zipf(opt.users, 0.8);
+        account = user_account(ii);
+        server_numeric(user_server[ii], srv);
+        user_numeric(ii, num);
+        b64(0x0A000000 + host, 6, ip);
+        if (account)
+            emit(out, "%s N user%u 1 %lu id%u host%u.example.com +ir acct%u %s %s :Real user %u",
+                 srv, ii, opt.start, rng_below(opt.users / 4 + 1), host, account, ip, num, ii);
+        else
+            emit(out, "%s N user%u 1 %lu id%u host%u.example.com +i %s %s :Real user %u",
+                 srv, ii, opt.start, rng_below(opt.users / 4 + 1), host, ip, num, ii);
+    }
+}
+
+/* Channel sizes fall off as 1/rank, scaled so that there are about
+ * chans_per_user memberships per user. */
+static unsigned int
+channel_size(unsigned int chan, double scale)
+{
+    double size = scale / (chan + 1);
+
+    if (size < 1.0)
+        size = 1.0;
+    if (size > opt.users / 2 + 1)
+        size = opt.users / 2 + 1;
+    return (unsigned int)size;
+}
+
+static double
+channel_scale(void)
+{
+    double harmonic = 0.0;
+    unsigned int ii;
+
+    for (ii = 0; ii < opt.channels; ii++)
+        harmonic += 1.0 / (ii + 1);
+    return opt.users * opt.chans_per_user / harmonic;
+}
+
+static void
+write_channel(FILE *out, unsigned int chan, unsigned int size)
+{
+    char line[BURST_LINE_MAX + 64], num[8], head[64];
+    unsigned int ii, user, len, bans, ops, voices;
+    const char *mode;
+
+    /* Most channels have no bans; a few are near the limit. */
+    bans = (unsigned int)(opt.max_bans * pow(rng_unit(), 6.0));
+    ops = 1 + size / 20;
+    voices = size / 10;
+    snprintf(head, sizeof(head), "%s B #chan%u %lu", b64(opt.first_numeric, 2, num), chan, opt.start);
+    len = snprintf(line, sizeof(line), "%s +nt ", head);
+    for (ii = 0; ii < size; ii++) {
+        do {
+            user = rng_below(opt.users);
+        } while (user_mark[user] == chan + 1);
+        user_mark[user] = chan + 1;
+        user_numeric(user, num);
+        /* Members are listed plain, then voiced, then opped. */
+        if (ii == size - ops - voices && voices)
+            mode = ":v";
+        else if (ii == size - ops)
+            mode = ":o";
+        else
+            mode = "";
+        if (len + strlen(num) + 4 > BURST_LINE_MAX) {
+            line[len - 1] = '\0';
+            emit(out, "%s", line);
+            len = snprintf(line, sizeof(line), "%s ", head);
+            /* A continued list starts over in the current mode. */
+            if (!*mode && ii > size - ops - voices)
+                mode = (ii > size - ops) ? ":o" : ":v";
+        }
+        len += snprintf(line + len, sizeof(line) - len, "%s%s,", num, mode);
+    }
+    line[len - 1] = '\0';
+    if (bans) {
+        emit(out, "%s", line);
+        len = snprintf(line, sizeof(line), "%s :%%", head);
+        for (ii = 0; ii < bans; ii++) {
+            if (len + 40 > BURST_LINE_MAX) {
+                emit(out, "%s", line);
+                len = snprintf(line, sizeof(line), "%s :%%", head);
+            }
+            len += snprintf(line + len, sizeof(line) - len, "%s*!*@ban%u.chan%u.example.net",
+                            line[len - 1] == '%' ? "" : " ", ii, chan);
+        }
+    }
+    emit(out, "%s", line);
+}
+
+static void
+write_traffic(FILE *out)
+{
+    static const char *services[] = { "AuthServ", "X3", "O3" };
+    static const char *commands[] = { "help", "info #chan%u", "access #chan%u", "accountinfo user%u", "version" };
+    char num[8], nick[32], srv[4], cmd[64];
+    unsigned int *joined, ii, user, chan, pick;
+
+    joined = calloc(opt.users, sizeof(joined[0]));
+    for (ii = 0; ii < opt.traffic; ii++) {
+        user = rng_below(opt.users);
+        user_numeric(user, num);
+        chan = rng_zipf(opt.channels, 1.0);
+        pick = rng_below(100);
+        if (pick < 50) {
+            emit(out, "%s P #chan%u :message %u from user %u", num, chan, ii, user);
+        } else if (pick < 60) {
+            user_gen[user]++;
+            user_nick(user, nick, sizeof(nick));
+            emit(out, "%s N %s %lu", num, nick, opt.start + ii / 100);
+        } else if (pick < 70) {
+            emit(out, "%s J #chan%u %lu", num, chan, opt.start);
+            joined[user] = chan + 1;
+        } else if (pick < 78) {
+            if (joined[user]) {
+                emit(out, "%s L #chan%u :leaving", num, joined[user] - 1);
+                joined[user] = 0;
+            } else
+                emit(out, "%s L #chan%u", num, chan);
+        } else if (pick < 86) {
+            server_numeric(0, srv);
+            switch (rng_below(4)) {
+            case 0: emit(out, "%s M #chan%u +m", srv, chan); break;
+            case 1: emit(out, "%s M #chan%u -m", srv, chan); break;
+            case 2: emit(out, "%s M #chan%u +b *!*@spam%u.example.org", srv, chan, ii); break;
+            default: emit(out, "%s M #chan%u +l %u", srv, chan, 10 + rng_below(500)); break;
+            }
+        } else if (pick < 95) {
+            snprintf(cmd, sizeof(cmd), commands[rng_below(ArrayLength(commands))], rng_below(opt.channels));
+            emit(out, "%s P %s@%s :%s", num, services[rng_below(ArrayLength(services))], opt.services, cmd);
+        } else {
+            /* Quit and come back with the same numeric. */
+            server_numeric(user_server[user], srv);
+            emit(out, "%s Q :Quit: bye", num);
+            user_gen[user]++;
+            user_nick(user, nick, sizeof(nick));
+            emit(out, "%s N %s 1 %lu id%u reconnect%u.example.com +i AKAAAA %s :Real user %u",
+                 srv, nick, opt.start + ii / 100, user % 1000, user, num, user);
+            joined[user] = 0;
+        }
+    }
+    free(joined);
+}
+
+static int
+write_burst(FILE *out)
+{
+    char num[4], hub[4];
+    unsigned int ii;
+    double scale;
+    time_t start = opt.start;
+
+    strftime(log_prefix, sizeof(log_prefix), "[%H:%M:%S %m/%d/%Y] (info)    ", localtime(&start));
+    server_numeric(0, hub);
+    emit(out, "PASS :%s", opt.password);
+    emit(out, "SERVER hub.example.net 1 %lu %lu J10 %s]]] +h6 :Synthetic hub", opt.start, opt.start, hub);
+    for (ii = 1; ii < opt.servers; ii++)
+        emit(out, "%s S leaf%u.example.net 2 %lu %lu P10 %s]]] +h6 :Synthetic leaf",
+             hub, ii, opt.start, opt.start, server_numeric(ii, num));
+    write_users(out);
+    scale = channel_scale();
+    for (ii = 0; ii < opt.channels; ii++)
+        write_channel(out, ii, channel_size(ii, scale));
+    for (ii = opt.servers; ii > 0; ii--)
+        emit(out, "%s EB", server_numeric(ii - 1, num));
+    write_traffic(out);
+    return 0;
+}
+
+static void
+write_accounts(FILE *out)
+{
+    unsigned int ii;
+
+    fprintf(out, "\"NickServ\" {\n");
+    for (ii = 1; ii <= opt.accounts; ii++) {
+        fprintf(out, "\"acct%u\" { \"id\" \"%u\"; \"passwd\" \"5f4dcc3b5aa765d61d8327deb882cf99\"; "
+                "\"register\" \"%lu\"; \"lastseen\" \"%lu\"; \"masks\" (\"*@host%u.example.com\"); "
+                "\"email_addr\" \"acct%u@example.com\"; };\n",
+                ii, ii, opt.start - 86400 - rng_below(86400 * 1000), opt.start - rng_below(86400 * 30),
+                rng_below(opt.users), ii);
+    }
+    fprintf(out, "};\n\n");
+}
+
+static void
+write_channels(FILE *out)
+{
+    static const unsigned int levels[] = { 100, 200, 300, 400 };
+    unsigned int *account_mark, ii, jj, count, account, bans;
+
+    fprintf(out, "\"ChanServ\" {\n\"version_control\" { \"version_number\" \"2\"; };\n"
+            "\"note_types\" { };\n\"dnr\" { };\n\"channels\" {\n");
+    account_mark = calloc(opt.accounts + 1, sizeof(account_mark[0]));
+    for (ii = 0; ii < opt.reg_channels; ii++) {
+        /* Access lists are as skewed as channel sizes. */
+        count = 1 + (unsigned int)(opt.access_per_chan * -log(1.0 - rng_unit()));
+        if (count > opt.accounts)
+            count = opt.accounts;
+        fprintf(out, "\"#chan%u\" { \"registered\" \"%lu\"; \"registrar\" \"acct1\"; \"max\" \"%u\"; "
+                "\"visited\" \"%lu\";\n\"users\" {\n", ii, opt.start - 86400, count, opt.start);
+        for (jj = 0; jj < count; jj++) {
+            do {
+                account = 1 + rng_below(opt.accounts);
+            } while (account_mark[account] == ii + 1);
+            account_mark[account] = ii + 1;
+            fprintf(out, "\"acct%u\" { \"level\" \"%u\"; \"seen\" \"%lu\"; };\n", account,
+                    jj ? levels[rng_below(ArrayLength(levels))] : 500, opt.start - rng_below(86400 * 60));
+        }
+        fprintf(out, "};\n");
+        bans = (unsigned int)(opt.max_bans * pow(rng_unit(), 6.0));
+        if (bans) {
+            fprintf(out, "\"bans\" {\n");
+            for (jj = 0; jj < bans; jj++)
+                fprintf(out, "\"*!*@lamer%u.chan%u.example.net\" { \"set\" \"%lu\"; \"owner\" \"acct1\"; \"reason\" \"lamer\"; };\n",
+                        jj, ii, opt.start - 3600);
+            fprintf(out, "};\n");
+        }
+        fprintf(out, "};\n");
+    }
+    fprintf(out, "};\n};\n");
+    free(account_mark);
+}
+
+static int
+write_db(FILE *out)
+{
+    write_accounts(out);
+    write_channels(out);
+    return 0;
+}
+
+static FILE *
+open_output(const char *name)
+{
+    FILE *out;
+
+    if (!strcmp(name, "-"))
+        return stdout;
+    if (!(out = fopen(name, "w")))
+        fprintf(stderr, "Unable to open %s for writing: %s\n", name, strerror(errno));
+    return out;
+}
+
+static void
+usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [options] -b burstfile [-d dbfile]\n"
+            "  -b file   write the P10 burst (and traffic) to file, or - for stdout\n"
+            "  -d file   write matching NickServ and ChanServ databases to file\n"
+            "  -s n      servers, hub included (default %u)\n"
+            "  -n n      numeric of the hub; the rest follow (default %u)\n"
+            "  -u n      users (default %u)\n"
+            "  -c n      channels in the burst (default %u)\n"
+            "  -m x      average channels per user (default %.1f)\n"
+            "  -B n      most bans on one channel (default %u)\n"
+            "  -a n      registered accounts (default: users / 2)\n"
+            "  -A x      fraction of users authenticated (default %.1f)\n"
+            "  -r n      registered channels (default: channels)\n"
+            "  -e x      average access entries per channel (default %.1f)\n"
+            "  -t n      lines of traffic after the burst (default %u)\n"
+            "  -p pass   uplink password (default %s)\n"
+            "  -S name   services server name (default %s)\n"
+            "  -T ts     timestamp to use as now (default %lu)\n"
+            "  -x seed   random seed\n"
+            "  -l        write the burst as an x3 log, for replay\n",
+            argv0, opt.servers, opt.first_numeric, opt.users, opt.channels, opt.chans_per_user,
+            opt.max_bans, opt.authed, opt.access_per_chan, opt.traffic, opt.password, opt.services, opt.start);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int c, accounts_set = 0, reg_set = 0;
+    FILE *out;
+
+    while ((c = getopt(argc, argv, "a:A:b:B:c:d:e:lm:n:p:r:s:S:t:T:u:x:")) != -1) {
+        switch (c) {
+        case 'a': opt.accounts = strtoul(optarg, NULL, 0); accounts_set = 1; break;
+        case 'A': opt.authed = strtod(optarg, NULL); break;
+        case 'b': opt.burst_file = optarg; break;
+        case 'B': opt.max_bans = strtoul(optarg, NULL, 0); break;
+        case 'c': opt.channels = strtoul(optarg, NULL, 0); break;
+        case 'd': opt.db_file = optarg; break;
+        case 'e': opt.access_per_chan = strtod(optarg, NULL); break;
+        case 'l': opt.log_format = 1; break;
+        case 'm': opt.chans_per_user = strtod(optarg, NULL); break;
+        case 'n': opt.first_numeric = strtoul(optarg, NULL, 0); break;
+        case 'p': opt.password = optarg; break;
+        case 'r': opt.reg_channels = strtoul(optarg, NULL, 0); reg_set = 1; break;
+        case 's': opt.servers = strtoul(optarg, NULL, 0); break;
+        case 'S': opt.services = optarg; break;
+        case 't': opt.traffic = strtoul(optarg, NULL, 0); break;
+        case 'T': opt.start = strtoul(optarg, NULL, 0); break;
+        case 'u': opt.users = strtoul(optarg, NULL, 0); break;
+        case 'x': rng_state ^= strtoull(optarg, NULL, 0) * 0x9E3779B97F4A7C15ULL; break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    if (!accounts_set)
+        opt.accounts = opt.users / 2;
+    if (!reg_set)
+        opt.reg_channels = opt.channels;
+    if ((!opt.burst_file && !opt.db_file) || !opt.servers || !opt.users || !opt.channels
+        || opt.first_numeric + opt.servers > 4096) {
+        usage(argv[0]);
+        return 1;
+    }
+    if ((unsigned long)opt.servers * SERVER_CAPACITY < opt.users) {
+        fprintf(stderr, "%u servers cannot hold %u users; use -s %lu or more.\n",
+                opt.servers, opt.users, (unsigned long)(opt.users + SERVER_CAPACITY - 1) / SERVER_CAPACITY);
+        return 1;
+    }
+
+    user_gen = calloc(opt.users, sizeof(user_gen[0]));
+    user_mark = calloc(opt.users, sizeof(user_mark[0]));
+    assign_servers();
+    if (opt.burst_file) {
+        if (!(out = open_output(opt.burst_file)))
+            return 1;
+        write_burst(out);
+        if (out != stdout)
+            fclose(out);
+    }
+    if (opt.db_file) {
+        if (!(out = open_output(opt.db_file)))
+            return 1;
+        write_db(out);
+        if (out != stdout)
+            fclose(out);
+    }
+    return 0;
+}
@@ -439,6 +439,7 @@ static const struct message_entry msgtab[] = {
 
 static void nickserv_reclaim(struct userNode *user, struct nick_info *ni, enum reclaim_action action);
 static void nickserv_reclaim_p(void *data);
+static void nickserv_cancel_reclaim(struct userNode *user);
 static int nickserv_addmask(struct userNode *user, struct handle_info *hi, const char *mask);
 
 struct nickserv_config nickserv_conf;
@@ -858,12 +859,12 @@ valid_user_sslfp(struct userNode *user, struct handle_info *hi)
 
     if (!hi->sslfps->used)
         return 0;
-    if (!(user->sslfp))
+    if (!(user->ext->sslfp))
         return 0;
 
     /* If any SSL fingerprint matches, allow it. */
     for (ii=0; ii<hi->sslfps->used; ii++)
-        if (!irccasecmp(user->sslfp, hi->sslfps->list[ii]))
+        if (!irccasecmp(user->ext->sslfp, hi->sslfps->list[ii]))
             return 1;
 
     /* No valid SSL fingerprint found. */
@@ -912,26 +913,12 @@ is_secure_password(const char *handle, const char *pass, struct userNode *user)
     return 1;
 }
 
-static auth_func_t *auth_func_list;
-static void **auth_func_list_extra;
-static unsigned int auth_func_size = 0, auth_func_used = 0;
+DEFINE_EH_FUNC_LIST(auth_func_list, EH_ADD_TAIL, NULL);
 
 void
-reg_auth_func(auth_func_t func, void *extra)
+reg_auth_func_named(auth_func_t func, void *extra, const char *name, const char *file)
 {
-    if (auth_func_used == auth_func_size) {
-	if (auth_func_size) {
-	    auth_func_size <<= 1;
-	    auth_func_list = realloc(auth_func_list, auth_func_size*sizeof(auth_func_t));
-        auth_func_list_extra = realloc(auth_func_list_extra, auth_func_size*sizeof(void*));
-	} else {
-	    auth_func_size = 8;
-	    auth_func_list = malloc(auth_func_size*sizeof(auth_func_t));
-        auth_func_list_extra = malloc(auth_func_size*sizeof(void*));
-	}
-    }
-    auth_func_list[auth_func_used] = func;
-    auth_func_list_extra[auth_func_used++] = extra;
+    reg_hook_func_named(&auth_func_list, EH_CAST(eh_func_t, func), extra, EH_ADD_DEFAULT, name, file);
 }
 
 static handle_rename_func_t *rf_list;
@@ -980,7 +967,7 @@ generate_fakehost(struct handle_info *handle)
                break;
 
             if (target)
-               snprintf(buffer, sizeof(buffer), "%s", target->crypthost);
+               snprintf(buffer, sizeof(buffer), "%s", target->ext->crypthost);
             else
                strncpy(buffer, "none", sizeof(buffer));
         }
@@ -1013,8 +1000,8 @@ void send_func_list(struct userNode *user)
 
     old_info = user->handle_info;
 
-    for (n=0; n<auth_func_used; n++)
-        auth_func_list[n](user, old_info, auth_func_list_extra[n]);
+    for (n=0; n<auth_func_list.used; )
+        EH_CALL(&auth_func_list, n, EH_CAST(auth_func_t, auth_func_list.list[n].func)(user, old_info, auth_func_list.list[n].extra));
 }
 
 static void
@@ -1114,7 +1101,7 @@ set_user_handle_info(struct userNode *user, struct handle_info *hi, int stamp)
 
         /* Stop trying to kick this user off their nick */
         if ((ni = get_nick_info(user->nick)) && (ni->owner == hi)) {
-            timeq_del(0, nickserv_reclaim_p, user, TIMEQ_IGNORE_WHEN);
+            nickserv_cancel_reclaim(user);
             ni->lastseen = now;
         }
     } else {
@@ -1124,8 +1111,8 @@ set_user_handle_info(struct userNode *user, struct handle_info *hi, int stamp)
 
     /* Call auth handlers */
     if (GetUserH(user->nick)) {
-        for (n=0; n<auth_func_used; n++) {
-            auth_func_list[n](user, old_info, auth_func_list_extra[n]);
+        for (n=0; n<auth_func_list.used; ) {
+            EH_CALL(&auth_func_list, n, EH_CAST(auth_func_t, auth_func_list.list[n].func)(user, old_info, auth_func_list.list[n].extra));
             if (user->dead)
                 return;
         }
@@ -2316,10 +2303,10 @@ void nickserv_do_autoauth(struct userNode *user)
         return;
 
     /* No client certificate fingerprint, cant auto auth */
-    if (!user->sslfp)
+    if (!user->ext->sslfp)
         return;
 
-    hi = find_handleinfo_by_sslfp(user->sslfp);
+    hi = find_handleinfo_by_sslfp(user->ext->sslfp);
     if (!hi)
         return;
 
@@ -3118,9 +3105,9 @@ nickserv_addsslfp(struct userNode *user, struct handle_info *hi, const char *ssl
 
 static NICKSERV_FUNC(cmd_addsslfp)
 {
-	NICKSERV_MIN_PARMS((user->sslfp ? 1 : 2));
-    if ((argc < 2) && (user->sslfp)) {
-        int res = nickserv_addsslfp(user, user->handle_info, user->sslfp);
+	NICKSERV_MIN_PARMS((user->ext->sslfp ? 1 : 2));
+    if ((argc < 2) && (user->ext->sslfp)) {
+        int res = nickserv_addsslfp(user, user->handle_info, user->ext->sslfp);
         return res;
     } else {
         return nickserv_addsslfp(user, user->handle_info, argv[1]);
@@ -3156,9 +3143,9 @@ nickserv_delsslfp(struct svccmd *cmd, struct userNode *user, struct handle_info
 
 static NICKSERV_FUNC(cmd_delsslfp)
 {
-    NICKSERV_MIN_PARMS((user->sslfp ? 1 : 2));
-    if ((argc < 2) && (user->sslfp)) {
-        return nickserv_delsslfp(cmd, user, user->handle_info, user->sslfp);
+    NICKSERV_MIN_PARMS((user->ext->sslfp ? 1 : 2));
+    if ((argc < 2) && (user->ext->sslfp)) {
+        return nickserv_delsslfp(cmd, user, user->handle_info, user->ext->sslfp);
     } else {
         return nickserv_delsslfp(cmd, user, user->handle_info, argv[1]);
     }
@@ -5513,10 +5500,20 @@ static void
 nickserv_reclaim_p(void *data) {
     struct userNode *user = data;
     struct nick_info *ni = get_nick_info(user->nick);
+    user->reclaim_timer = NULL;
     if (ni)
         nickserv_reclaim(user, ni, nickserv_conf.auto_reclaim_action);
 }
 
+static void
+nickserv_cancel_reclaim(struct userNode *user)
+{
+    if (user->reclaim_timer) {
+        timeq_cancel(user->reclaim_timer);
+        user->reclaim_timer = NULL;
+    }
+}
+
 static int
 check_user_nick(struct userNode *user, UNUSED_ARG(void *extra)) {
     struct nick_info *ni;
@@ -5535,9 +5532,10 @@ check_user_nick(struct userNode *user, UNUSED_ARG(void *extra)) {
     }
     if (nickserv_conf.auto_reclaim_action == RECLAIM_NONE)
         return 0;
-    if (nickserv_conf.auto_reclaim_delay)
-        timeq_add(now + nickserv_conf.auto_reclaim_delay, nickserv_reclaim_p, user);
-    else
+    if (nickserv_conf.auto_reclaim_delay) {
+        nickserv_cancel_reclaim(user);
+        user->reclaim_timer = timeq_add(now + nickserv_conf.auto_reclaim_delay, nickserv_reclaim_p, user);
+    } else
         nickserv_reclaim(user, ni, nickserv_conf.auto_reclaim_action);
 
     return 0;
@@ -5693,16 +5691,22 @@ handle_nick_change(struct userNode *user, const char *old_nick, UNUSED_ARG(void
         dict_remove(nickserv_allow_auth_dict, old_nick);
         dict_insert(nickserv_allow_auth_dict, user->nick, hi);
     }
-    timeq_del(0, nickserv_reclaim_p, user, TIMEQ_IGNORE_WHEN);
+    nickserv_cancel_reclaim(user);
     check_user_nick(user, NULL);
 }
 
-void
-nickserv_remove_user(struct userNode *user, UNUSED_ARG(struct userNode *killer), UNUSED_ARG(const char *why), UNUSED_ARG(void *extra))
+static void
+nickserv_remove_users(struct userList *users, UNUSED_ARG(struct userNode *killer), UNUSED_ARG(const char *why), UNUSED_ARG(void *extra))
 {
-    dict_remove(nickserv_allow_auth_dict, user->nick);
-    timeq_del(0, nickserv_reclaim_p, user, TIMEQ_IGNORE_WHEN);
-    set_user_handle_info(user, NULL, 0);
+    struct userNode *user;
+    unsigned int nn;
+
+    for (nn = 0; nn < users->used; nn++) {
+        user = users->list[nn];
+        dict_remove(nickserv_allow_auth_dict, user->nick);
+        nickserv_cancel_reclaim(user);
+        set_user_handle_info(user, NULL, 0);
+    }
 }
 
 static struct modcmd *
@@ -6056,7 +6060,7 @@ handle_sasl_input(struct server* source ,const char *uid, const char *subcmd, co
 static void
 nickserv_db_cleanup(UNUSED_ARG(void* extra))
 {
-    unreg_del_user_func(nickserv_remove_user, NULL);
+    unreg_del_users_func(nickserv_remove_users, NULL);
     unreg_sasl_input_func(handle_sasl_input, NULL);
     userList_clean(&curr_helpers);
     policer_params_delete(nickserv_conf.auth_policer_params);
@@ -6067,8 +6071,7 @@ nickserv_db_cleanup(UNUSED_ARG(void* extra))
     dict_delete(nickserv_email_dict);
     dict_delete(nickserv_id_dict);
     dict_delete(nickserv_conf.weak_password_dict);
-    free(auth_func_list);
-    free(auth_func_list_extra);
+    free_hook_func_list(&auth_func_list);
     free(unreg_func_list);
     free(unreg_func_list_extra);
     free(rf_list);
@@ -6129,7 +6132,7 @@ init_nickserv(const char *nick)
     NS_LOG = log_register_type("NickServ", "file:nickserv.log");
     reg_new_user_func(new_user_event, NULL);
     reg_nick_change_func(handle_nick_change, NULL);
-    reg_del_user_func(nickserv_remove_user, NULL);
+    reg_del_users_func(nickserv_remove_users, NULL);
     reg_account_func(handle_account);
     reg_auth_func(handle_loc_auth_oper, NULL);
     reg_sasl_input_func(handle_sasl_input, NULL);
@@ -6233,14 +6236,14 @@ init_nickserv(const char *nick)
     dict_insert(nickserv_opt_dict, "LANGUAGE", opt_language);
     dict_insert(nickserv_opt_dict, "KARMA", opt_karma);
 
-    nickserv_handle_dict = dict_new();
+    nickserv_handle_dict = dict_new_hash();
     dict_set_free_keys(nickserv_handle_dict, free);
     dict_set_free_data(nickserv_handle_dict, free_handle_info);
 
     nickserv_id_dict = dict_new();
     dict_set_free_keys(nickserv_id_dict, free);
 
-    nickserv_nick_dict = dict_new();
+    nickserv_nick_dict = dict_new_hash();
     dict_set_free_data(nickserv_nick_dict, free);
 
     nickserv_allow_auth_dict = dict_new();
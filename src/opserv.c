@@ -24,9 +24,13 @@
 #include "common.h"
 #include "gline.h"
 #include "global.h"
+#include "ioset.h"
+#include "intern.h"
+#include "iptrie.h"
 #include "nickserv.h"
 #include "modcmd.h"
 #include "modules.h"
+#include "pool.h"
 #include "proto.h"
 #include "opserv.h"
 #include "timeq.h"
@@ -46,13 +50,16 @@
 #endif
 
 #define OPSERV_CONF_NAME "services/opserv"
+#define OPSERV_MAX_PREFIX_LIMITS 8
 
 #define KEY_ALERT_CHANNEL "alert_channel"
 #define KEY_ALERT_CHANNEL_MODES "alert_channel_modes"
 #define KEY_DEBUG_CHANNEL "debug_channel"
 #define KEY_DEBUG_CHANNEL_MODES "debug_channel_modes"
 #define KEY_UNTRUSTED_MAX "untrusted_max"
+#define KEY_UNTRUSTED_PREFIX_MAX "untrusted_prefix_max"
 #define KEY_PURGE_LOCK_DELAY "purge_lock_delay"
+#define KEY_HOOK_TIMING "hook_timing"
 #define KEY_JOIN_FLOOD_MODERATE "join_flood_moderate"
 #define KEY_JOIN_FLOOD_MODERATE_THRESH "join_flood_moderate_threshold"
 #define KEY_NICK "nick"
@@ -319,6 +326,7 @@ static const struct message_entry msgtab[] = {
     { "OSMSG_UNGAG_APPLIED", "Ungagged $b%s$b, affecting %d users." },
     { "OSMSG_UNGAG_ADDED", "Ungagged $b%s$b." },
     { "OSMSG_TIMEQ_INFO", "%u events in timeq; next in %lu seconds." },
+    { "OSMSG_HOOK_TIMING_OFF", "Hook timing is disabled; only calls are counted." },
     { "OSMSG_ALERT_EXISTS", "An alert named $b%s$b already exists." },
     { "OSMSG_UNKNOWN_REACTION", "Unknown alert reaction $b%s$b." },
     { "OSMSG_ADDED_ALERT", "Added alert named $b%s$b." },
@@ -402,6 +410,7 @@ static const struct message_entry msgtab[] = {
     { "OSMSG_UPLINK_DISABLED", "$b%s$b is a disabled or unavailable uplink." },
     { "OSMSG_UPLINK_START", "Uplink $b%s$b:" },
     { "OSMSG_UPLINK_ADDRESS", "Address: %s:%d" },
+    { "OSMSG_UPLINK_WRITES", "Output: %lu lines sent with %lu send() calls (%lu calls saved)" },
     { "OSMSG_STUPID_GLINE", "Gline %s?  Now $bthat$b would be smooth." },
     { "OSMSG_STUPID_SHUN", "Shun %s?  Now $bthat$b would be smooth." },
     { "OSMSG_ACCOUNTMASK_AUTHED", "Invalid criteria: it is impossible to match an account mask but not be authed" },
@@ -471,10 +480,12 @@ static dict_t opserv_reserved_nick_dict; /* data is struct userNode* */
 static struct string_list *opserv_bad_words;
 static dict_t opserv_exempt_channels; /* data is not used */
 static dict_t opserv_trusted_hosts; /* data is struct trusted_host* */
+static iptrie_t opserv_trusted_trie; /* data is struct trusted_host* */
 static dict_t opserv_routing_plans; /* data is struct routingPlan */
 static dict_t opserv_routing_plan_options; /* data is a dict_t key->val list*/
 static dict_t opserv_waiting_connections; /* data is struct waitingConnection */
-static dict_t opserv_hostinfo_dict; /* data is struct opserv_hostinfo* */
+static iptrie_t opserv_hostinfo_trie; /* data is struct opserv_hostinfo* */
+static const irc_in_addr_t opserv_hostinfo_any; /* ::/0, for walking the whole trie */
 static dict_t opserv_user_alerts; /* data is struct opserv_user_alert* */
 static dict_t opserv_nick_based_alerts; /* data is struct opserv_user_alert* */
 static dict_t opserv_account_based_alerts; /* data is struct opserv_user_alert* */
@@ -493,6 +504,12 @@ static struct {
     struct policer_params *join_policer_params;
     struct policer new_user_policer;
     unsigned long untrusted_max;
+    struct {
+        unsigned char bits; /* as from irc_pton(), so IPv4 is 96 + n */
+        unsigned char ipv4;
+        unsigned long limit;
+    } prefix_max[OPSERV_MAX_PREFIX_LIMITS];
+    unsigned int prefix_max_count;
     unsigned long clone_gline_duration;
     unsigned long block_gline_duration;
     unsigned long block_shun_duration;
@@ -510,6 +527,8 @@ struct trusted_host {
     unsigned long limit;
     time_t issued;
     time_t expires;
+    irc_in_addr_t addr;
+    unsigned char bits;
 };
 
 struct gag_entry {
@@ -522,17 +541,81 @@ struct gag_entry {
 
 static struct gag_entry *gagList;
 
+/* One of these exists for each client address, and for each range
+ * with a clone limit (untrusted_prefix_max) that has clients in it. */
 struct opserv_hostinfo {
     struct userList clients;
-    struct trusted_host *trusted;
+    irc_in_addr_t addr;
+    unsigned char bits;
 };
 
+static struct opserv_hostinfo *
+opserv_get_hostinfo(const irc_in_addr_t *addr, unsigned char bits)
+{
+    struct opserv_hostinfo *ohi;
+
+    if ((ohi = iptrie_find(opserv_hostinfo_trie, addr, bits)))
+        return ohi;
+    ohi = calloc(1, sizeof(*ohi));
+    userList_init(&ohi->clients);
+    iptrie_mask_addr(&ohi->addr, addr, bits);
+    ohi->bits = bits;
+    iptrie_insert(opserv_hostinfo_trie, &ohi->addr, bits, ohi);
+    return ohi;
+}
+
 static void
-opserv_free_hostinfo(void *data)
+opserv_free_hostinfo(struct opserv_hostinfo *ohi)
+{
+    iptrie_remove(opserv_hostinfo_trie, &ohi->addr, ohi->bits, ohi);
+    userList_clean(&ohi->clients);
+    free(ohi);
+}
+
+struct opserv_hostinfo_unlink {
+    struct userNode *user;
+    struct opserv_hostinfo *empty[OPSERV_MAX_PREFIX_LIMITS + 1];
+    unsigned int used;
+};
+
+static int
+opserv_hostinfo_unlink_user(UNUSED_ARG(const irc_in_addr_t *addr), UNUSED_ARG(unsigned char bits), void *data, void *extra)
+{
+    struct opserv_hostinfo *ohi = data;
+    struct opserv_hostinfo_unlink *unlink = extra;
+
+    if (userList_remove(&ohi->clients, unlink->user)
+        && !ohi->clients.used
+        && unlink->used < ArrayLength(unlink->empty))
+        unlink->empty[unlink->used++] = ohi;
+    return 0;
+}
+
+static int
+opserv_free_hostinfo_helper(UNUSED_ARG(const irc_in_addr_t *addr), UNUSED_ARG(unsigned char bits), void *data, UNUSED_ARG(void *extra))
 {
     struct opserv_hostinfo *ohi = data;
     userList_clean(&ohi->clients);
     free(ohi);
+    return 0;
+}
+
+/*
+ *  Find the narrowest trusted-host entry that covers addr.
+ */
+static int
+opserv_trusted_helper(UNUSED_ARG(const irc_in_addr_t *addr), UNUSED_ARG(unsigned char bits), void *data, void *extra)
+{
+    *(struct trusted_host**)extra = data;
+    return 0;
+}
+
+static struct trusted_host *
+opserv_find_trusted(const irc_in_addr_t *addr)
+{
+    struct trusted_host *th = NULL;
+    iptrie_walk_covering(opserv_trusted_trie, addr, 128, opserv_trusted_helper, &th);
+    return th;
 }
 
 static void
@@ -1333,7 +1416,7 @@ static MODCMD_FUNC(cmd_block)
         reply("MSG_SERVICE_IMMUNE", target->nick);
         return 0;
     }
-    if (dict_find(opserv_trusted_hosts, irc_ntoa(&target->ip), NULL)) {
+    if (opserv_find_trusted(&target->ip)) {
         reply("OSMSG_BLOCK_TRUSTED", target->nick);
         return 0;
     }
@@ -1557,7 +1640,7 @@ static MODCMD_FUNC(cmd_sblock)
         reply("MSG_SERVICE_IMMUNE", target->nick);
         return 0;
     }
-    if (dict_find(opserv_trusted_hosts, irc_ntoa(&target->ip), NULL)) {
+    if (opserv_find_trusted(&target->ip)) {
         reply("OSMSG_BLOCK_TRUSTED", target->nick);
         return 0;
     }
@@ -2180,60 +2263,60 @@ static MODCMD_FUNC(cmd_whois)
     reply("OSMSG_WHOIS_NICK", target->nick);
     reply("OSMSG_WHOIS_HOST", target->ident, target->hostname);
     if (IsFakeHost(target))
-        reply("OSMSG_WHOIS_FAKEHOST", target->fakehost);
-    reply("OSMSG_WHOIS_CRYPT_HOST", target->crypthost);
-    reply("OSMSG_WHOIS_CRYPT_IP", target->cryptip);
+        reply("OSMSG_WHOIS_FAKEHOST", target->ext->fakehost);
+    reply("OSMSG_WHOIS_CRYPT_HOST", target->ext->crypthost);
+    reply("OSMSG_WHOIS_CRYPT_IP", target->ext->cryptip);
     reply("OSMSG_WHOIS_IP", irc_ntoa(&target->ip));
 
-    if (target->city) {
-        reply("OSMSG_WHOIS_COUNTRY", target->country_name);
-        reply("OSMSG_WHOIS_COUNTRY_CODE", target->country_code);
-        reply("OSMSG_WHOIS_CITY", target->city);
-        reply("OSMSG_WHOIS_REGION", target->region);
+    if (target->ext->city) {
+        reply("OSMSG_WHOIS_COUNTRY", target->ext->country_name);
+        reply("OSMSG_WHOIS_COUNTRY_CODE", target->ext->country_code);
+        reply("OSMSG_WHOIS_CITY", target->ext->city);
+        reply("OSMSG_WHOIS_REGION", target->ext->region);
 
-        reply("OSMSG_WHOIS_POSTAL_CODE", target->postal_code);
-        reply("OSMSG_WHOIS_LATITUDE", target->latitude);
-        reply("OSMSG_WHOIS_LONGITUDE", target->longitude);
+        reply("OSMSG_WHOIS_POSTAL_CODE", target->ext->postal_code);
+        reply("OSMSG_WHOIS_LATITUDE", target->ext->latitude);
+        reply("OSMSG_WHOIS_LONGITUDE", target->ext->longitude);
         /* Only show a map url if we have a city, latitude and longitude.
          * Theres not much point of latitude and longitude coordinates are
          * returned but no city, the coordinates are useless.
          */
-        if (target->latitude && target->longitude && target->city) {
+        if (target->ext->latitude && target->ext->longitude && target->ext->city) {
             char map_url[MAXLEN];
             snprintf(map_url, sizeof(map_url), "http://www.mapquest.com/maps/map.adp?searchtype=address&formtype=address&latlongtype=decimal&latitude=%f&longitude=%f",
-                     target->latitude, target->longitude);
+                     target->ext->latitude, target->ext->longitude);
             reply("OSMSG_WHOIS_MAP", map_url);
         }
-        reply("OSMSG_WHOIS_DMA_CODE", target->dma_code);
-        reply("OSMSG_WHOIS_AREA_CODE", target->area_code);
-    } else if (target->country_name) {
-        reply("OSMSG_WHOIS_COUNTRY", target->country_name);
+        reply("OSMSG_WHOIS_DMA_CODE", target->ext->dma_code);
+        reply("OSMSG_WHOIS_AREA_CODE", target->ext->area_code);
+    } else if (target->ext->country_name) {
+        reply("OSMSG_WHOIS_COUNTRY", target->ext->country_name);
     }
-    if(target->version_reply) {
-        reply("OSMSG_WHOIS_VERSION", target->version_reply);
+    if(target->ext->version_reply) {
+        reply("OSMSG_WHOIS_VERSION", target->ext->version_reply);
     }
-    if(target->sslfp) {
-        reply("OSMSG_WHOIS_SSLFP", target->sslfp);
+    if(target->ext->sslfp) {
+        reply("OSMSG_WHOIS_SSLFP", target->ext->sslfp);
     }
-    if(target->mark) {
-        reply("OSMSG_WHOIS_MARK", target->mark);
+    if(target->ext->mark) {
+        reply("OSMSG_WHOIS_MARK", target->ext->mark);
     }
-    if(target->marks) {
+    if(target->ext->marks) {
         char markbuf[MAXLEN] = "";
         unsigned int ii = 0;
 
-        string_list_sort(user->marks);
+        string_list_sort(target->ext->marks);
 
-        for (ii=0; ii<user->marks->used; ii++)
+        for (ii=0; ii<target->ext->marks->used; ii++)
         {
-            if (markbuf[0] && strlen(markbuf) + strlen(user->marks->list[ii]) + 4 > 70) {
+            if (markbuf[0] && strlen(markbuf) + strlen(target->ext->marks->list[ii]) + 4 > 70) {
                 reply("OSMSG_WHOIS_MARKS", markbuf);
                 memset(&markbuf, 0, MAXLEN);
             }
 
             if (markbuf[0])
                 strcat(markbuf, ", ");
-            strcat(markbuf, user->marks->list[ii]);
+            strcat(markbuf, target->ext->marks->list[ii]);
         }
 
         if (markbuf[0])
@@ -2540,6 +2623,8 @@ static MODCMD_FUNC(cmd_stats_uplink) {
     uplink = cManager.uplink;
     reply("OSMSG_UPLINK_START", uplink->name);
     reply("OSMSG_UPLINK_ADDRESS", uplink->host, uplink->port);
+    reply("OSMSG_UPLINK_WRITES", ioset_write_stats.writes, ioset_write_stats.flushes,
+          ioset_write_stats.writes > ioset_write_stats.flushes ? ioset_write_stats.writes - ioset_write_stats.flushes : 0);
     return 1;
 }
 
@@ -2660,7 +2745,96 @@ static MODCMD_FUNC(cmd_stats_gags) {
 }
 
 static MODCMD_FUNC(cmd_stats_timeq) {
-    reply("OSMSG_TIMEQ_INFO", timeq_size(), timeq_next()-now);
+    struct timeq_func_stats **stats;
+    struct helpfile_table tbl;
+    unsigned int count, nn;
+    unsigned long next;
+
+    next = timeq_next();
+    reply("OSMSG_TIMEQ_INFO", timeq_size(), (next > (unsigned long)now) ? next - now : 0);
+    stats = timeq_get_func_stats(&count);
+    if (!count)
+        return 1;
+    tbl.length = count + 1;
+    tbl.width = 5;
+    tbl.flags = TABLE_NO_FREE;
+    tbl.contents = calloc(tbl.length, sizeof(*tbl.contents));
+    tbl.contents[0] = calloc(tbl.width, sizeof(**tbl.contents));
+    tbl.contents[0][0] = "Callback";
+    tbl.contents[0][1] = "Pending";
+    tbl.contents[0][2] = "Added";
+    tbl.contents[0][3] = "Run";
+    tbl.contents[0][4] = "Cancelled";
+    for (nn = 1; nn <= count; nn++) {
+        char *buffer = malloc(96);
+        tbl.contents[nn] = calloc(tbl.width, sizeof(**tbl.contents));
+        tbl.contents[nn][0] = stats[nn-1]->name;
+        tbl.contents[nn][1] = buffer;
+        snprintf(buffer, 24, "%u", stats[nn-1]->pending);
+        tbl.contents[nn][2] = buffer + 24;
+        snprintf(buffer + 24, 24, "%lu", stats[nn-1]->added);
+        tbl.contents[nn][3] = buffer + 48;
+        snprintf(buffer + 48, 24, "%lu", stats[nn-1]->run);
+        tbl.contents[nn][4] = buffer + 72;
+        snprintf(buffer + 72, 24, "%lu", stats[nn-1]->cancelled);
+    }
+    table_send(cmd->parent->bot, user->nick, 0, 0, tbl);
+    for (nn = 1; nn < tbl.length; nn++) {
+        free((char*)tbl.contents[nn][1]);
+        free(tbl.contents[nn]);
+    }
+    free(tbl.contents[0]);
+    free(tbl.contents);
+    return 1;
+}
+
+static MODCMD_FUNC(cmd_stats_hooks) {
+    struct eh_func_list *list;
+    struct helpfile_table tbl;
+    unsigned int count, nn, ii;
+    const char *file;
+
+    for (count = 0, list = hook_func_lists(); list; list = list->next)
+        count += list->used;
+    if (!count)
+        return 1;
+    tbl.length = count + 1;
+    tbl.width = 5;
+    tbl.flags = TABLE_NO_FREE;
+    tbl.contents = calloc(tbl.length, sizeof(*tbl.contents));
+    tbl.contents[0] = calloc(tbl.width, sizeof(**tbl.contents));
+    tbl.contents[0][0] = "List";
+    tbl.contents[0][1] = "Hook";
+    tbl.contents[0][2] = "Calls";
+    tbl.contents[0][3] = "Usec";
+    tbl.contents[0][4] = "Avg";
+    for (nn = 1, list = hook_func_lists(); list; list = list->next) {
+        for (ii = 0; ii < list->used; ii++, nn++) {
+            struct eh_func *ehf = &list->list[ii];
+            char *buffer = malloc(184);
+            file = strrchr(ehf->file, '/');
+            file = file ? file + 1 : ehf->file;
+            tbl.contents[nn] = calloc(tbl.width, sizeof(**tbl.contents));
+            tbl.contents[nn][0] = list->name;
+            tbl.contents[nn][1] = buffer;
+            snprintf(buffer, 112, "%s (%s)", ehf->name, file);
+            tbl.contents[nn][2] = buffer + 112;
+            snprintf(buffer + 112, 24, "%lu", ehf->calls);
+            tbl.contents[nn][3] = buffer + 136;
+            snprintf(buffer + 136, 24, "%lu", ehf->usec);
+            tbl.contents[nn][4] = buffer + 160;
+            snprintf(buffer + 160, 24, "%.2f", ehf->calls ? (double)ehf->usec / ehf->calls : 0.0);
+        }
+    }
+    table_send(cmd->parent->bot, user->nick, 0, 0, tbl);
+    for (nn = 1; nn < tbl.length; nn++) {
+        free((char*)tbl.contents[nn][1]);
+        free(tbl.contents[nn]);
+    }
+    free(tbl.contents[0]);
+    free(tbl.contents);
+    if (!eh_timing)
+        reply("OSMSG_HOOK_TIMING_OFF");
     return 1;
 }
 
@@ -2676,16 +2850,18 @@ static MODCMD_FUNC(cmd_stats_warn) {
 }
 */
 
-#if defined(WITH_MALLOC_X3)
 static MODCMD_FUNC(cmd_stats_memory) {
+    struct helpfile_table tbl;
+    struct intern_stats istats;
+    struct pool *pool;
+    unsigned int count, nn;
+
+#if defined(WITH_MALLOC_X3)
     extern unsigned long alloc_count, alloc_size;
     send_message_type(MSG_TYPE_NOXLATE, user, cmd->parent->bot,
                       "%u allocations totalling %u bytes.",
                       alloc_count, alloc_size);
-    return 1;
-}
 #elif defined(WITH_MALLOC_SLAB)
-static MODCMD_FUNC(cmd_stats_memory) {
     extern unsigned long slab_alloc_count, slab_count, slab_alloc_size;
     extern unsigned long big_alloc_count, big_alloc_size;
     send_message_type(MSG_TYPE_NOXLATE, user, cmd->parent->bot,
@@ -2694,9 +2870,60 @@ static MODCMD_FUNC(cmd_stats_memory) {
     send_message_type(MSG_TYPE_NOXLATE, user, cmd->parent->bot,
                       "%u big allocations totalling %u bytes.",
                       big_alloc_count, big_alloc_size);
+#endif
+    intern_get_stats(&istats);
+    send_message_type(MSG_TYPE_NOXLATE, user, cmd->parent->bot,
+                      "%u shared strings with %lu references, using %lu bytes and saving %lu.",
+                      istats.strings, istats.refs, istats.bytes, istats.saved);
+    send_message_type(MSG_TYPE_NOXLATE, user, cmd->parent->bot,
+                      "%lu of %lu string lookups (%lu%%) found a shared copy.",
+                      istats.hits, istats.lookups,
+                      istats.lookups ? istats.hits * 100 / istats.lookups : 0);
+    for (count = 0, pool = pool_list(); pool; pool = pool->next)
+        count++;
+    if (!count)
+        return 1;
+    tbl.length = count + 1;
+    tbl.width = 8;
+    tbl.flags = TABLE_NO_FREE;
+    tbl.contents = calloc(tbl.length, sizeof(*tbl.contents));
+    tbl.contents[0] = calloc(tbl.width, sizeof(**tbl.contents));
+    tbl.contents[0][0] = "Pool";
+    tbl.contents[0][1] = "Size";
+    tbl.contents[0][2] = "InUse";
+    tbl.contents[0][3] = "Peak";
+    tbl.contents[0][4] = "Blocks";
+    tbl.contents[0][5] = "Empty";
+    tbl.contents[0][6] = "Allocs";
+    tbl.contents[0][7] = "Frees";
+    for (nn = 1, pool = pool_list(); pool; nn++, pool = pool->next) {
+        char *buffer = malloc(168);
+        tbl.contents[nn] = calloc(tbl.width, sizeof(**tbl.contents));
+        tbl.contents[nn][0] = pool->name;
+        tbl.contents[nn][1] = buffer;
+        snprintf(buffer, 24, "%lu", (unsigned long)pool->size);
+        tbl.contents[nn][2] = buffer + 24;
+        snprintf(buffer + 24, 24, "%lu", pool->in_use);
+        tbl.contents[nn][3] = buffer + 48;
+        snprintf(buffer + 48, 24, "%lu", pool->peak);
+        tbl.contents[nn][4] = buffer + 72;
+        snprintf(buffer + 72, 24, "%u", pool->blocks);
+        tbl.contents[nn][5] = buffer + 96;
+        snprintf(buffer + 96, 24, "%u", pool->empty_blocks);
+        tbl.contents[nn][6] = buffer + 120;
+        snprintf(buffer + 120, 24, "%lu", pool->allocs);
+        tbl.contents[nn][7] = buffer + 144;
+        snprintf(buffer + 144, 24, "%lu", pool->frees);
+    }
+    table_send(cmd->parent->bot, user->nick, 0, 0, tbl);
+    for (nn = 1; nn < tbl.length; nn++) {
+        free((char*)tbl.contents[nn][1]);
+        free(tbl.contents[nn]);
+    }
+    free(tbl.contents[0]);
+    free(tbl.contents);
     return 1;
 }
-#endif
 
 static MODCMD_FUNC(cmd_dump)
 {
@@ -2814,9 +3041,11 @@ opserv_part_channel(void *data)
 static int alert_check_user(const char *key, void *data, void *extra);
 
 static int
-opserv_new_user_check(struct userNode *user, UNUSED_ARG(void *extra))
+opserv_check_user(struct userNode *user, int burst)
 {
-    struct opserv_hostinfo *ohi;
+    struct opserv_hostinfo *ohi, *prefix[OPSERV_MAX_PREFIX_LIMITS];
+    unsigned long prefix_limit[OPSERV_MAX_PREFIX_LIMITS];
+    unsigned int nn, nprefix;
     struct gag_entry *gag;
     char addr[IRC_NTOP_MAX_SIZE];
 
@@ -2836,17 +3065,20 @@ opserv_new_user_check(struct userNode *user, UNUSED_ARG(void *extra))
         }
     }
 
-    /* Add to host info struct */
+    /* Add to host info structs for the address and any limited ranges */
     irc_ntop(addr, sizeof(addr), &user->ip);
-    if (!(ohi = dict_find(opserv_hostinfo_dict, addr, NULL))) {
-        ohi = calloc(1, sizeof(*ohi));
-        dict_insert(opserv_hostinfo_dict, strdup(addr), ohi);
-        userList_init(&ohi->clients);
-    }
+    ohi = opserv_get_hostinfo(&user->ip, 128);
     userList_append(&ohi->clients, user);
+    for (nn = nprefix = 0; nn < opserv_conf.prefix_max_count; nn++) {
+        if (opserv_conf.prefix_max[nn].ipv4 != irc_in_addr_is_ipv4(user->ip))
+            continue;
+        prefix[nprefix] = opserv_get_hostinfo(&user->ip, opserv_conf.prefix_max[nn].bits);
+        prefix_limit[nprefix] = opserv_conf.prefix_max[nn].limit;
+        userList_append(&prefix[nprefix++]->clients, user);
+    }
 
     /* Only warn of new user floods outside of bursts. */
-    if (!user->uplink->burst) {
+    if (!burst) {
         if (!policer_conforms(&opserv_conf.new_user_policer, now, 10)) {
             if (!new_user_flood) {
                 new_user_flood = 1;
@@ -2878,7 +3110,7 @@ opserv_new_user_check(struct userNode *user, UNUSED_ARG(void *extra))
     if (opserv_conf.untrusted_max
         && irc_in_addr_is_valid(user->ip)
         && !irc_in_addr_is_loopback(user->ip)) {
-        struct trusted_host *th = dict_find(opserv_trusted_hosts, addr, NULL);
+        struct trusted_host *th = opserv_find_trusted(&user->ip);
         unsigned int limit = th ? th->limit : opserv_conf.untrusted_max;
 
         if (checkDefCon(DEFCON_REDUCE_SESSION) && !th)
@@ -2887,24 +3119,62 @@ opserv_new_user_check(struct userNode *user, UNUSED_ARG(void *extra))
         if (!limit) {
             /* 0 means unlimited hosts */
         } else if (ohi->clients.used == limit) {
-            unsigned int nn;
             for (nn=0; nn<ohi->clients.used; nn++)
                 send_message(ohi->clients.list[nn], opserv, "OSMSG_CLONE_WARNING");
         } else if (ohi->clients.used > limit) {
             char target[IRC_NTOP_MAX_SIZE + 3] = { '*', '@', '\0' };
             strcpy(target + 2, addr);
             gline_add(opserv->nick, target, opserv_conf.clone_gline_duration, "Excessive connections from a single host.", now, 1, 1);
+            return 0;
+        }
+
+        /* Trusted hosts are exempt from the per-network limits. */
+        for (nn = 0; !th && (nn < nprefix); nn++) {
+            ohi = prefix[nn];
+            if (ohi->clients.used == prefix_limit[nn]) {
+                unsigned int jj;
+                for (jj=0; jj<ohi->clients.used; jj++)
+                    send_message(ohi->clients.list[jj], opserv, "OSMSG_CLONE_WARNING");
+            } else if (ohi->clients.used > prefix_limit[nn]) {
+                char target[IRC_NTOP_MAX_SIZE + 8] = { '*', '@', '\0' };
+                if (irc_in_addr_is_ipv4(ohi->addr)) {
+                    irc_ntop(target + 2, sizeof(target) - 2, &ohi->addr);
+                    sprintf(target + strlen(target), "/%u", ohi->bits - 96);
+                } else
+                    irc_ntop_mask(target + 2, sizeof(target) - 2, &ohi->addr, ohi->bits);
+                gline_add(opserv->nick, target, opserv_conf.clone_gline_duration, "Excessive connections from a single network.", now, 1, 1);
+                return 0;
+            }
         }
     }
 
     return 0;
 }
 
+/* Users are checked as they arrive, ahead of the other services' new
+ * user hooks, except those from a bursting server, which wait for the
+ * burst hooks. */
+static int
+opserv_new_user_check(struct userNode *user, UNUSED_ARG(void *extra))
+{
+    if (user->uplink->burst)
+        return 0;
+    return opserv_check_user(user, 0);
+}
+
+static int
+opserv_burst_user_check(struct userNode *user, int burst, UNUSED_ARG(void *extra))
+{
+    if (!burst)
+        return 0;
+    return opserv_check_user(user, 1);
+}
+
 static void
 opserv_user_cleanup(struct userNode *user, UNUSED_ARG(struct userNode *killer), UNUSED_ARG(const char *why), UNUSED_ARG(void *extra))
 {
-    struct opserv_hostinfo *ohi;
-    char addr[IRC_NTOP_MAX_SIZE];
+    struct opserv_hostinfo_unlink unlink;
+    unsigned int nn;
 
     if (IsLocal(user)) {
         /* Try to remove it from the reserved nick dict without
@@ -2913,12 +3183,13 @@ opserv_user_cleanup(struct userNode *user, UNUSED_ARG(struct userNode *killer),
         dict_remove(opserv_reserved_nick_dict, user->nick);
         return;
     }
-    irc_ntop(addr, sizeof(addr), &user->ip);
-    if ((ohi = dict_find(opserv_hostinfo_dict, addr, NULL))) {
-        userList_remove(&ohi->clients, user);
-        if (ohi->clients.used == 0)
-            dict_remove(opserv_hostinfo_dict, addr);
-    }
+    /* The trie cannot change during the walk, so empty entries are
+     * freed afterwards. */
+    unlink.user = user;
+    unlink.used = 0;
+    iptrie_walk_covering(opserv_hostinfo_trie, &user->ip, 128, opserv_hostinfo_unlink_user, &unlink);
+    for (nn = 0; nn < unlink.used; nn++)
+        opserv_free_hostinfo(unlink.empty[nn]);
 }
 
 int
@@ -3015,7 +3286,7 @@ opserv_notice_handler(struct userNode *user, struct userNode *bot, const char *t
 }
 
 static int
-opserv_join_check(struct modeNode *mNode, UNUSED_ARG(void *extra))
+opserv_join_check(struct modeNode *mNode, int burst, UNUSED_ARG(void *extra))
 {
     struct userNode *user = mNode->user;
     struct chanNode *channel = mNode->channel;
@@ -3042,7 +3313,7 @@ opserv_join_check(struct modeNode *mNode, UNUSED_ARG(void *extra))
         return 1;
     }
 
-    if (user->uplink->burst)
+    if (burst)
         return 0;
     if (policer_conforms(&channel->join_policer, now, 1.0)) {
         channel->join_flooded = 0;
@@ -4363,6 +4634,8 @@ opserv_add_trusted_host(const char *ipaddr, unsigned int limit, const char *issu
     th->issued = issued;
     th->limit = limit;
     th->expires = expires;
+    if (irc_pton(&th->addr, &th->bits, ipaddr))
+        iptrie_insert(opserv_trusted_trie, &th->addr, th->bits, th);
     dict_insert(opserv_trusted_hosts, th->ipaddr, th);
     if (th->expires)
         timeq_add(th->expires, opserv_expire_trusted_host, th);
@@ -4372,6 +4645,7 @@ static void
 free_trusted_host(void *data)
 {
     struct trusted_host *th = data;
+    iptrie_remove(opserv_trusted_trie, &th->addr, th->bits, th);
     free(th->ipaddr);
     free(th->reason);
     free(th->issuer);
@@ -4383,6 +4657,7 @@ static MODCMD_FUNC(cmd_addtrust)
     unsigned long interval;
     char *reason, *tmp;
     irc_in_addr_t tmpaddr;
+    unsigned char bits;
     unsigned int count;
 
     if (dict_find(opserv_trusted_hosts, argv[1], NULL)) {
@@ -4390,7 +4665,7 @@ static MODCMD_FUNC(cmd_addtrust)
         return 0;
     }
 
-    if (!irc_pton(&tmpaddr, NULL, argv[1])) {
+    if (irc_pton(&tmpaddr, &bits, argv[1]) != strlen(argv[1])) {
         reply("OSMSG_BAD_IP", argv[1]);
         return 0;
     }
@@ -5730,19 +6005,19 @@ static int
 discrim_match(discrim_t discrim, struct userNode *user)
 {
     unsigned int level, i;
-    char *scmp=NULL, *dcmp=NULL;
+    const char *scmp=NULL, *dcmp=NULL;
     int markmatched = 0;
 
     if (discrim->mask_mark)
     {
         unsigned int ii = 0;
 
-        if (user->mark && match_ircglob(user->mark, discrim->mask_mark))
+        if (user->ext->mark && match_ircglob(user->ext->mark, discrim->mask_mark))
             markmatched = 1;
 
-        if (user->marks)
-            for (ii=0; ii<user->marks->used; ii++)
-                if (match_ircglob(user->marks->list[ii], discrim->mask_mark))
+        if (user->ext->marks)
+            for (ii=0; ii<user->ext->marks->used; ii++)
+                if (match_ircglob(user->ext->marks->list[ii], discrim->mask_mark))
                     markmatched = 1;
     }
 
@@ -5771,7 +6046,7 @@ discrim_match(discrim_t discrim, struct userNode *user)
            || (discrim->has_regex_ident && regexec(&discrim->regex_ident, user->ident, 0, 0, 0))
            || (discrim->has_regex_host && regexec(&discrim->regex_host, user->hostname, 0, 0, 0))
            || (discrim->has_regex_info && regexec(&discrim->regex_info, user->info, 0, 0, 0))
-           || (discrim->has_regex_version && (!user->version_reply || regexec(&discrim->regex_version, user->version_reply, 0, 0, 0)))) {
+           || (discrim->has_regex_version && (!user->ext->version_reply || regexec(&discrim->regex_version, user->ext->version_reply, 0, 0, 0)))) {
            return 0;
            }
     }
@@ -5781,7 +6056,7 @@ discrim_match(discrim_t discrim, struct userNode *user)
             || (discrim->mask_ident && !match_ircglob(user->ident, discrim->mask_ident))
             || (discrim->mask_host && !match_ircglob(user->hostname, discrim->mask_host))
             || (discrim->mask_info && !match_ircglob(user->info, discrim->mask_info))
-            || (discrim->mask_version && (!user->version_reply || !match_ircglob(user->version_reply, discrim->mask_version))) ) {
+            || (discrim->mask_version && (!user->ext->version_reply || !match_ircglob(user->ext->version_reply, discrim->mask_version))) ) {
             return 0;
         }
     }
@@ -5899,13 +6174,37 @@ discrim_match(discrim_t discrim, struct userNode *user)
         return 0;
     }
     if (discrim->min_clones > 1) {
-        struct opserv_hostinfo *ohi = dict_find(opserv_hostinfo_dict, irc_ntoa(&user->ip), NULL);
+        struct opserv_hostinfo *ohi = iptrie_find(opserv_hostinfo_trie, &user->ip, 128);
         if (!ohi || (ohi->clients.used < discrim->min_clones))
             return 0;
     }
     return 1;
 }
 
+struct discrim_ip_search {
+    discrim_t discrim;
+    struct userList *matched;
+};
+
+static int
+discrim_ip_search_helper(UNUSED_ARG(const irc_in_addr_t *addr), unsigned char bits, void *data, void *extra)
+{
+    struct discrim_ip_search *search = extra;
+    struct opserv_hostinfo *ohi = data;
+    unsigned int nn;
+
+    /* Only per-address entries; prefix entries would give duplicates. */
+    if (bits < 128)
+        return 0;
+    for (nn=0; nn<ohi->clients.used; nn++) {
+        if (search->matched->used >= search->discrim->limit)
+            return 1;
+        if (discrim_match(search->discrim, ohi->clients.list[nn]))
+            userList_append(search->matched, ohi->clients.list[nn]);
+    }
+    return 0;
+}
+
 static unsigned int
 opserv_discrim_search(discrim_t discrim, discrim_search_func dsf, void *data)
 {
@@ -5944,7 +6243,7 @@ opserv_discrim_search(discrim_t discrim, discrim_search_func dsf, void *data)
             }
         }
     } else if (discrim->ip_mask_bits == 128) {
-        struct opserv_hostinfo *ohi = dict_find(opserv_hostinfo_dict, irc_ntoa(&discrim->ip_mask), NULL);
+        struct opserv_hostinfo *ohi = iptrie_find(opserv_hostinfo_trie, &discrim->ip_mask, 128);
         if (!ohi) {
             userList_clean(&matched);
             return 0;
@@ -5954,6 +6253,11 @@ opserv_discrim_search(discrim_t discrim, discrim_search_func dsf, void *data)
                 userList_append(&matched, ohi->clients.list[nn]);
             }
         }
+    } else if (discrim->ip_mask_bits) {
+        struct discrim_ip_search search;
+        search.discrim = discrim;
+        search.matched = &matched;
+        iptrie_walk_within(opserv_hostinfo_trie, &discrim->ip_mask, discrim->ip_mask_bits, discrim_ip_search_helper, &search);
     } else {
         dict_iterator_t it;
         for (it=dict_first(clients); it && (matched.used < discrim->limit); it=iter_next(it)) {
@@ -6058,7 +6362,7 @@ is_oper_victim(struct userNode *user, struct userNode *target, int match_opers,
 static int
 is_trust_victim(struct userNode *target, int match_trusted)
 {
-    return (match_trusted || !dict_find(opserv_trusted_hosts, irc_ntoa(&target->ip), NULL));
+    return (match_trusted || !opserv_find_trusted(&target->ip));
 }
 
 static int
@@ -6247,7 +6551,7 @@ trace_domains_func(struct userNode *match, void *extra)
     irc_in_addr_t ip;
     unsigned long *count;
     unsigned int depth;
-    char *hostname;
+    const char *hostname;
     char ipmask[IRC_NTOP_MASK_MAX_SIZE];
 
     if (irc_pton(&ip, NULL, match->hostname)) {
@@ -6915,7 +7219,7 @@ alert_check_user(const char *key, void *data, void *extra)
          * TODO: maybe safer if we didn't even check react_version type alerts for the 2nd check?
          *       sort of like we only look at channel alerts on join. -Rubin
          */
-        if(!user->version_reply)
+        if(!user->ext->version_reply)
             opserv_version(user);
         break;
     case REACT_MARK:
@@ -7234,8 +7538,44 @@ opserv_conf_read(void)
 
     str = database_get_data(conf_node, KEY_UNTRUSTED_MAX, RECDB_QSTRING);
     opserv_conf.untrusted_max = str ? strtoul(str, NULL, 0) : 5;
+    opserv_conf.prefix_max_count = 0;
+    if ((child = database_get_data(conf_node, KEY_UNTRUSTED_PREFIX_MAX, RECDB_OBJECT))) {
+        unsigned int bits, jj;
+        char family[5];
+
+        for (it = dict_first(child); it; it = iter_next(it)) {
+            str = GET_RECORD_QSTRING((struct record_data*)iter_data(it));
+            if (!str
+                || (sscanf(iter_key(it), "ipv%1[46]/%u", family, &bits) != 2)
+                || (bits >= ((family[0] == '4') ? 32 : 128))) {
+                log_module(OS_LOG, LOG_ERROR, "Invalid %s entry %s; expected ipv4/<bits> or ipv6/<bits>.", KEY_UNTRUSTED_PREFIX_MAX, iter_key(it));
+                continue;
+            }
+            if (family[0] == '4')
+                bits += 96;
+            for (jj = 0; jj < opserv_conf.prefix_max_count; jj++)
+                if ((opserv_conf.prefix_max[jj].bits == bits)
+                    && (opserv_conf.prefix_max[jj].ipv4 == (family[0] == '4')))
+                    break;
+            if (jj < opserv_conf.prefix_max_count) {
+                log_module(OS_LOG, LOG_ERROR, "Ignoring duplicate %s entry %s.", KEY_UNTRUSTED_PREFIX_MAX, iter_key(it));
+                continue;
+            }
+            if (opserv_conf.prefix_max_count == OPSERV_MAX_PREFIX_LIMITS) {
+                log_module(OS_LOG, LOG_ERROR, "Ignoring %s entry %s; at most %d are supported.", KEY_UNTRUSTED_PREFIX_MAX, iter_key(it), OPSERV_MAX_PREFIX_LIMITS);
+                continue;
+            }
+            opserv_conf.prefix_max[opserv_conf.prefix_max_count].ipv4 = (family[0] == '4');
+            opserv_conf.prefix_max[opserv_conf.prefix_max_count].bits = bits;
+            opserv_conf.prefix_max[opserv_conf.prefix_max_count].limit = strtoul(str, NULL, 0);
+            if (opserv_conf.prefix_max[opserv_conf.prefix_max_count].limit)
+                opserv_conf.prefix_max_count++;
+        }
+    }
     str = database_get_data(conf_node, KEY_PURGE_LOCK_DELAY, RECDB_QSTRING);
     opserv_conf.purge_lock_delay = str ? strtoul(str, NULL, 0) : 60;
+    str = database_get_data(conf_node, KEY_HOOK_TIMING, RECDB_QSTRING);
+    eh_timing = str ? enabled_string(str) : 0;
     str = database_get_data(conf_node, KEY_JOIN_FLOOD_MODERATE, RECDB_QSTRING);
     opserv_conf.join_flood_moderate = str ? strtoul(str, NULL, 0) : 1;
     str = database_get_data(conf_node, KEY_JOIN_FLOOD_MODERATE_THRESH, RECDB_QSTRING);
@@ -7340,6 +7680,8 @@ static void
 opserv_db_init(void) {
     /* set up opserv_trusted_hosts dict */
     dict_delete(opserv_trusted_hosts);
+    if (!opserv_trusted_trie)
+        opserv_trusted_trie = iptrie_new();
     opserv_trusted_hosts = dict_new();
     dict_set_free_data(opserv_trusted_hosts, free_trusted_host);
 
@@ -7385,8 +7727,10 @@ opserv_db_cleanup(UNUSED_ARG(void* extra))
     free_string_list(opserv_bad_words);
     dict_delete(opserv_exempt_channels);
     dict_delete(opserv_trusted_hosts);
+    iptrie_delete(opserv_trusted_trie);
     unreg_del_user_func(opserv_user_cleanup, NULL);
-    dict_delete(opserv_hostinfo_dict);
+    iptrie_walk_within(opserv_hostinfo_trie, &opserv_hostinfo_any, 0, opserv_free_hostinfo_helper, NULL);
+    iptrie_delete(opserv_hostinfo_trie);
     dict_delete(opserv_nick_based_alerts);
     dict_delete(opserv_account_based_alerts);
     dict_delete(opserv_channel_alerts);
@@ -7510,6 +7854,7 @@ init_opserv(const char *nick)
     opserv_define_func("STATS BAD", cmd_stats_bad, 0, 0, 0);
     opserv_define_func("STATS GAGS", cmd_stats_gags, 0, 0, 0);
     opserv_define_func("STATS GLINES", cmd_stats_glines, 0, 0, 0);
+    opserv_define_func("STATS HOOKS", cmd_stats_hooks, 0, 0, 0);
     opserv_define_func("STATS SHUNS", cmd_stats_shuns, 0, 0, 0);
     opserv_define_func("STATS LINKS", cmd_stats_links, 0, 0, 0);
     opserv_define_func("STATS MAX", cmd_stats_max, 0, 0, 0);
@@ -7522,9 +7867,7 @@ init_opserv(const char *nick)
     opserv_define_func("STATS UPLINK", cmd_stats_uplink, 0, 0, 0);
     opserv_define_func("STATS UPTIME", cmd_stats_uptime, 0, 0, 0);
 /*    opserv_define_func("STATS WARN", cmd_stats_warn, 0, 0, 0); */
-#if defined(WITH_MALLOC_X3) || defined(WITH_MALLOC_SLAB)
     opserv_define_func("STATS MEMORY", cmd_stats_memory, 0, 0, 0);
-#endif
     opserv_define_func("TRACE", cmd_trace, 100, 0, 3);
     opserv_define_func("TRACE PRINT", NULL, 0, 0, 0);
     opserv_define_func("TRACE COUNT", NULL, 0, 0, 0);
@@ -7554,20 +7897,18 @@ init_opserv(const char *nick)
     opserv_define_func("WHOIS", cmd_whois, 0, 0, 2);
 
     opserv_reserved_nick_dict = dict_new();
-    opserv_hostinfo_dict = dict_new();
-
-    dict_set_free_keys(opserv_hostinfo_dict, free);
-    dict_set_free_data(opserv_hostinfo_dict, opserv_free_hostinfo);
+    opserv_hostinfo_trie = iptrie_new();
 
     opserv_waiting_connections = dict_new();
     dict_set_free_data(opserv_waiting_connections, opserv_free_waiting_connection);
 
     reg_new_user_func(opserv_new_user_check, NULL);
+    reg_burst_new_user_func(opserv_burst_user_check, NULL);
     reg_nick_change_func(opserv_alert_check_nick, NULL);
     reg_del_user_func(opserv_user_cleanup, NULL);
     reg_new_channel_func(opserv_channel_check, NULL); 
     reg_del_channel_func(opserv_channel_delete, NULL);
-    reg_join_func(opserv_join_check, NULL);
+    reg_burst_join_func(opserv_join_check, NULL);
     reg_auth_func(opserv_staff_alert, NULL);
     reg_auth_func(opserv_alert_check_account, NULL);
     reg_notice_func(opserv, opserv_notice_handler);
@@ -0,0 +1,199 @@
+/* pool.c - Fixed-size object pools
+ * Copyright 2000-2024 Evilnet Development
+ *
+ * This file is part of x3.
+ *
+ * x3 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with srvx; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+ */
+
+#include "common.h"
+#include "pool.h"
+
+/* Blocks are aligned to their size, so an object's block is found by
+ * masking its address.  Each block keeps its own free list; slots past
+ * "fresh" have never been handed out, so a new block does not need to
+ * be threaded (or even touched) up front.  Full blocks are on no list.
+ */
+
+/* The debugging allocators replace malloc() and free(), so they must
+ * also provide the blocks. */
+#if defined(HAVE_POSIX_MEMALIGN) && !defined(WITH_MALLOC_X3) && !defined(WITH_MALLOC_SLAB)
+# define POOL_MEMALIGN 1
+#endif
+
+/* The block header is padded out to a cache line, so the first object
+ * starts on one.  Objects are only rounded up to pointer size, not to
+ * a cache line, so that small ones stay packed; the rest may straddle
+ * lines. */
+#define POOL_ALIGN 64
+
+struct pool_block {
+    struct pool *pool;
+    struct pool_block *prev;
+    struct pool_block *next;
+    void *free;
+    unsigned int used;
+    unsigned int fresh;
+    void *base;
+};
+
+#define POOL_OFFSET ((sizeof(struct pool_block) + POOL_ALIGN - 1) & ~(POOL_ALIGN - 1))
+
+static struct pool *pools;
+
+/*
+ *  Set up pool to hand out objects of the given size.
+ */
+void
+pool_init(struct pool *pool, const char *name, size_t size)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->name = name;
+    size = (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+    pool->size = size;
+    pool->per_block = (POOL_BLOCK_SIZE - POOL_OFFSET) / size;
+    pool->next = pools;
+    pools = pool;
+}
+
+struct pool *
+pool_list(void)
+{
+    return pools;
+}
+
+static struct pool_block *
+pool_block_new(struct pool *pool)
+{
+    struct pool_block *block;
+    void *base;
+
+#if defined(POOL_MEMALIGN)
+    if (posix_memalign(&base, POOL_BLOCK_SIZE, POOL_BLOCK_SIZE))
+        return NULL;
+    block = base;
+#else
+    if (!(base = malloc(2 * POOL_BLOCK_SIZE)))
+        return NULL;
+    block = (struct pool_block*)(((unsigned long)base + POOL_BLOCK_SIZE - 1) & ~(unsigned long)(POOL_BLOCK_SIZE - 1));
+#endif
+    block->pool = pool;
+    block->prev = block->next = NULL;
+    block->free = NULL;
+    block->used = block->fresh = 0;
+    block->base = base;
+    pool->blocks++;
+    return block;
+}
+
+static void
+pool_link(struct pool *pool, struct pool_block *block)
+{
+    block->prev = NULL;
+    block->next = pool->partial;
+    if (pool->partial)
+        pool->partial->prev = block;
+    pool->partial = block;
+}
+
+static void
+pool_unlink(struct pool *pool, struct pool_block *block)
+{
+    if (block->prev)
+        block->prev->next = block->next;
+    else
+        pool->partial = block->next;
+    if (block->next)
+        block->next->prev = block->prev;
+}
+
+/*
+ *  Return a zeroed object from pool.
+ */
+void *
+pool_alloc(struct pool *pool)
+{
+    struct pool_block *block;
+    void *ptr;
+
+    if (!(block = pool->partial)) {
+        if ((block = pool->empty)) {
+            pool->empty = block->next;
+            pool->empty_blocks--;
+        } else if (!(block = pool_block_new(pool)))
+            return NULL;
+        pool_link(pool, block);
+    }
+    if ((ptr = block->free))
+        block->free = *(void**)ptr;
+    else
+        ptr = (char*)block + POOL_OFFSET + pool->size * block->fresh++;
+    if (++block->used == pool->per_block)
+        pool_unlink(pool, block);
+    pool->allocs++;
+    if (++pool->in_use > pool->peak)
+        pool->peak = pool->in_use;
+    memset(ptr, 0, pool->size);
+    return ptr;
+}
+
+/*
+ *  Give an object back to the pool it came from.
+ */
+void
+pool_free(struct pool *pool, void *ptr)
+{
+    struct pool_block *block;
+
+    if (!ptr)
+        return;
+    block = (struct pool_block*)((unsigned long)ptr & ~(unsigned long)(POOL_BLOCK_SIZE - 1));
+    assert(block->pool == pool);
+    *(void**)ptr = block->free;
+    block->free = ptr;
+    if (block->used-- == pool->per_block)
+        pool_link(pool, block);
+    if (!block->used) {
+        pool_unlink(pool, block);
+        block->next = pool->empty;
+        pool->empty = block;
+        pool->empty_blocks++;
+    }
+    pool->frees++;
+    pool->in_use--;
+}
+
+void
+pool_trim(struct pool *pool, unsigned int keep)
+{
+    struct pool_block *block;
+
+    while (pool->empty_blocks > keep) {
+        block = pool->empty;
+        pool->empty = block->next;
+        pool->empty_blocks--;
+        pool->blocks--;
+        free(block->base);
+    }
+}
+
+void
+pool_trim_all(unsigned int keep)
+{
+    struct pool *pool;
+
+    for (pool = pools; pool; pool = pool->next)
+        pool_trim(pool, keep);
+}
@@ -0,0 +1,58 @@
+/* pool.h - Fixed-size object pools
+ * Copyright 2000-2024 Evilnet Development
+ *
+ * This file is part of x3.
+ *
+ * x3 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with srvx; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+/* A pool hands out zeroed objects of one size, carved from large
+ * blocks.  Objects of a type sit next to each other, a burst costs one
+ * malloc() per block rather than one per object, and releasing an
+ * object just puts it back on its block's free list.  Blocks whose
+ * objects are all released are kept for reuse until pool_trim(). */
+struct pool_block;
+
+struct pool {
+    const char *name;
+    size_t size;
+    unsigned int per_block;
+    struct pool_block *partial; /* blocks with both live and free objects */
+    struct pool_block *empty;   /* blocks with no live objects */
+    unsigned int blocks;
+    unsigned int empty_blocks;
+    unsigned long in_use;
+    unsigned long peak;
+    unsigned long allocs;
+    unsigned long frees;
+    struct pool *next;          /* next pool passed to pool_init() */
+};
+
+/* Size of each block; objects must be a good deal smaller. */
+#define POOL_BLOCK_SIZE 65536
+
+void pool_init(struct pool *pool, const char *name, size_t size);
+void *pool_alloc(struct pool *pool);
+void pool_free(struct pool *pool, void *ptr);
+/* releases all but keep of the pool's empty blocks */
+void pool_trim(struct pool *pool, unsigned int keep);
+void pool_trim_all(unsigned int keep);
+/* the most recently initialized pool, for "stats memory" */
+struct pool *pool_list(void);
+
+#endif /* !defined(POOL_H) */
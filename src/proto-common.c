@@ -23,6 +23,7 @@
 #include "ioset.h"
 #include "log.h"
 #include "nickserv.h"
+#include "pool.h"
 #include "spamserv.h"
 #include "shun.h"
 #include "timeq.h"
@@ -36,9 +37,13 @@
 #ifdef HAVE_ARPA_INET_H
 #include <arpa/inet.h>
 #endif
+#ifdef HAVE_SYS_RESOURCE_H
+#include <sys/resource.h>
+#endif
 
 unsigned int lines_processed;
 FILE *replay_file;
+int replay_bench;
 struct io_fd *socket_io_fd;
 int force_n2k;
 const char *hidden_host_suffix;
@@ -70,20 +75,20 @@ static void call_channel_mode_funcs(struct userNode *who, struct chanNode *chann
 
 static void
 uplink_readable(struct io_fd *fd) {
-    static char buffer[MAXLEN];
+    char *line;
     char *eol;
     int pos;
 
-    pos = ioset_line_read(fd, buffer, sizeof(buffer));
+    pos = ioset_line_view(fd, &line);
     if (pos <= 0) {
         close_socket();
         return;
     }
-    if ((eol = strpbrk(buffer, "\r\n")))
+    if ((eol = strpbrk(line, "\r\n")))
         *eol = 0;
-    log_replay(MAIN_LOG, false, buffer);
+    log_replay(MAIN_LOG, false, line);
     if (cManager.uplink->state != DISCONNECTED)
-        parse_line(buffer, 0);
+        parse_line(line, 0);
     lines_processed++;
 }
 
@@ -142,6 +147,7 @@ create_socket_client(struct uplinkNode *target)
     socket_io_fd->readable_cb = uplink_readable;
     socket_io_fd->destroy_cb = socket_destroyed;
     socket_io_fd->line_reads = 1;
+    socket_io_fd->coalesce_writes = 1;
     log_module(MAIN_LOG, LOG_INFO, "Connection to server established.");
     cManager.uplink = target;
     target->state = AUTHENTICATING;
@@ -149,12 +155,42 @@ create_socket_client(struct uplinkNode *target)
     return 1;
 }
 
-void
-replay_read_line(void)
+/* Sets *when from the time stamp at the start of a log line.  Returns
+ * zero if line does not start with one. */
+static int
+replay_line_time(const char *line, time_t *when)
 {
     struct tm timestamp;
     time_t new_time;
 
+    if ((line[0] != '[')
+        || (line[3] != ':')
+        || (line[6] != ':')
+        || (line[9] != ' ')
+        || (line[12] != '/')
+        || (line[15] != '/')
+        || (line[20] != ']')
+        || (line[21] != ' '))
+        return 0;
+    timestamp.tm_hour = strtoul(line+1, NULL, 10);
+    timestamp.tm_min = strtoul(line+4, NULL, 10);
+    timestamp.tm_sec = strtoul(line+7, NULL, 10);
+    timestamp.tm_mon = strtoul(line+10, NULL, 10) - 1;
+    timestamp.tm_mday = strtoul(line+13, NULL, 10);
+    timestamp.tm_year = strtoul(line+16, NULL, 10) - 1900;
+    timestamp.tm_isdst = 0;
+    new_time = mktime(&timestamp);
+    if (new_time == -1) {
+        log_module(MAIN_LOG, LOG_ERROR, "Unable to parse time struct tm_sec=%d tm_min=%d tm_hour=%d tm_mday=%d tm_mon=%d tm_year=%d", timestamp.tm_sec, timestamp.tm_min, timestamp.tm_hour, timestamp.tm_mday, timestamp.tm_mon, timestamp.tm_year);
+    } else {
+        *when = new_time;
+    }
+    return 1;
+}
+
+void
+replay_read_line(void)
+{
     if (replay_line[0]) return;
   read_line:
     if (!fgets(replay_line, sizeof(replay_line), replay_file)) {
@@ -164,30 +200,10 @@ replay_read_line(void)
             return;
         }
     }
-    if ((replay_line[0] != '[')
-        || (replay_line[3] != ':')
-        || (replay_line[6] != ':')
-        || (replay_line[9] != ' ')
-        || (replay_line[12] != '/')
-        || (replay_line[15] != '/')
-        || (replay_line[20] != ']')
-        || (replay_line[21] != ' ')) {
+    if (!replay_line_time(replay_line, &now)) {
         log_module(MAIN_LOG, LOG_ERROR, "Unrecognized timestamp in replay file: %s", replay_line);
         goto read_line;
     }
-    timestamp.tm_hour = strtoul(replay_line+1, NULL, 10);
-    timestamp.tm_min = strtoul(replay_line+4, NULL, 10);
-    timestamp.tm_sec = strtoul(replay_line+7, NULL, 10);
-    timestamp.tm_mon = strtoul(replay_line+10, NULL, 10) - 1;
-    timestamp.tm_mday = strtoul(replay_line+13, NULL, 10);
-    timestamp.tm_year = strtoul(replay_line+16, NULL, 10) - 1900;
-    timestamp.tm_isdst = 0;
-    new_time = mktime(&timestamp);
-    if (new_time == -1) {
-        log_module(MAIN_LOG, LOG_ERROR, "Unable to parse time struct tm_sec=%d tm_min=%d tm_hour=%d tm_mday=%d tm_mon=%d tm_year=%d", timestamp.tm_sec, timestamp.tm_min, timestamp.tm_hour, timestamp.tm_mday, timestamp.tm_mon, timestamp.tm_year);
-    } else {
-        now = new_time;
-    }
 
     if (strncmp(replay_line+22, "(info) ", 7))
         goto read_line;
@@ -239,6 +255,245 @@ replay_write(char *text)
     }
 }
 
+/*
+ *  Benchmark replay: the replay file is fed to the parser as fast as
+ *  it can be read, instead of being checked against what we send.
+ *  Lines may be from a log, as for replay, or plain P10; only log lines
+ *  move the clock, so logs give the same output checksum every run.
+ */
+
+struct bench_token {
+    char name[16];
+    unsigned int *nsec;
+    unsigned int used, size;
+    unsigned long long total;
+};
+
+static struct bench_token *bench_tokens;
+static unsigned int bench_token_count, bench_token_size;
+static char *bench_next;
+static unsigned long bench_out_lines, bench_out_bytes;
+static unsigned int bench_out_sum = 2166136261u;
+
+static unsigned long long
+bench_nsec(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (unsigned long long)tv.tv_sec * 1000000000 + tv.tv_usec * 1000;
+#endif
+}
+
+/* Returns the next line to feed, or NULL at the end of the file. */
+static char *
+bench_read_line(void)
+{
+    size_t len;
+
+    while (fgets(replay_line, sizeof(replay_line), replay_file)) {
+        len = strlen(replay_line);
+        while (len && (replay_line[len-1] == '\n' || replay_line[len-1] == '\r'))
+            replay_line[--len] = '\0';
+        if (replay_line_time(replay_line, &now)) {
+            /* Only lines we received are replayed. */
+            if (!strncmp(replay_line+22, "(info)    ", 10))
+                return replay_line + 32;
+        } else if (replay_line[0] && replay_line[0] != '#')
+            return replay_line;
+    }
+    return NULL;
+}
+
+/* Reads ahead to the first line, so that a log sets the clock before
+ * anything else looks at it. */
+void
+replay_bench_start(void)
+{
+    now = time(NULL);
+    bench_next = bench_read_line();
+}
+
+static void
+bench_write(const char *text, int len)
+{
+    int ii;
+
+    for (ii = 0; ii < len; ii++)
+        bench_out_sum = (bench_out_sum ^ (unsigned char)text[ii]) * 16777619u;
+    bench_out_lines++;
+    bench_out_bytes += len;
+}
+
+/* Copies the command token of line, the word after any origin. */
+static void
+bench_line_token(const char *line, char *token, size_t size)
+{
+    const char *word;
+    size_t len;
+
+    if (line[0] == '@' && (word = strchr(line, ' ')))
+        line = word + 1;
+    len = strcspn(line, " ");
+    if (line[0] == ':' || self->uplink || len <= 2) {
+        line += len;
+        while (*line == ' ')
+            line++;
+        len = strcspn(line, " ");
+    }
+    if (len >= size)
+        len = size - 1;
+    memcpy(token, line, len);
+    token[len] = '\0';
+}
+
+static void
+bench_record(const char *token, unsigned long long nsec)
+{
+    struct bench_token *bt;
+    unsigned int ii;
+
+    for (ii = 0; ii < bench_token_count; ii++)
+        if (!strcmp(bench_tokens[ii].name, token))
+            break;
+    if (ii == bench_token_count) {
+        if (bench_token_count == bench_token_size) {
+            bench_token_size = bench_token_size ? bench_token_size << 1 : 16;
+            bench_tokens = realloc(bench_tokens, bench_token_size * sizeof(bench_tokens[0]));
+        }
+        bt = &bench_tokens[bench_token_count++];
+        memset(bt, 0, sizeof(*bt));
+        safestrncpy(bt->name, token, sizeof(bt->name));
+    }
+    bt = &bench_tokens[ii];
+    if (bt->used == bt->size) {
+        bt->size = bt->size ? bt->size << 1 : 1024;
+        bt->nsec = realloc(bt->nsec, bt->size * sizeof(bt->nsec[0]));
+    }
+    bt->nsec[bt->used++] = (nsec > UINT_MAX) ? UINT_MAX : nsec;
+    bt->total += nsec;
+}
+
+static int
+bench_nsec_compare(const void *a_, const void *b_)
+{
+    unsigned int a = *(const unsigned int*)a_, b = *(const unsigned int*)b_;
+    return (a > b) - (a < b);
+}
+
+static double
+bench_percentile(struct bench_token *bt, unsigned int pct)
+{
+    return bt->nsec[(bt->used - 1) * pct / 100] / 1000.0;
+}
+
+static void
+bench_report(unsigned long long elapsed, double cpu)
+{
+    struct eh_func_list *list;
+    struct eh_func *ehf;
+    struct bench_token *bt;
+    struct {
+        const char *file;
+        unsigned long calls;
+        unsigned long usec;
+    } modules[64];
+    unsigned int ii, jj, module_count = 0;
+    const char *file;
+    char name[128];
+
+    printf("Replayed %u lines in %.3f seconds (%.0f lines/second), %.3f seconds of CPU.\n",
+           lines_processed, elapsed / 1e9, elapsed ? lines_processed * 1e9 / elapsed : 0.0, cpu);
+#if defined(HAVE_GETRUSAGE)
+    {
+        struct rusage usage;
+        if (!getrusage(RUSAGE_SELF, &usage))
+            printf("Peak RSS: %ld KiB.\n", usage.ru_maxrss);
+    }
+#endif
+    printf("Sent %lu lines, %lu bytes, checksum %08x.\n\n", bench_out_lines, bench_out_bytes, bench_out_sum);
+
+    printf("%-12s %10s %10s %9s %9s %9s %9s\n", "Token", "Lines", "Total ms", "p50 us", "p90 us", "p99 us", "Max us");
+    for (ii = 0; ii < bench_token_count; ii++) {
+        bt = &bench_tokens[ii];
+        qsort(bt->nsec, bt->used, sizeof(bt->nsec[0]), bench_nsec_compare);
+        printf("%-12s %10u %10.1f %9.2f %9.2f %9.2f %9.2f\n", bt->name, bt->used, bt->total / 1e6,
+               bench_percentile(bt, 50), bench_percentile(bt, 90), bench_percentile(bt, 99),
+               bench_percentile(bt, 100));
+        free(bt->nsec);
+    }
+    free(bench_tokens);
+    bench_tokens = NULL;
+    bench_token_count = bench_token_size = 0;
+
+    printf("\n%-48s %10s %10s\n", "Hook", "Calls", "Total ms");
+    for (list = hook_func_lists(); list; list = list->next) {
+        for (ii = 0; ii < list->used; ii++) {
+            ehf = &list->list[ii];
+            file = strrchr(ehf->file, '/');
+            file = file ? file + 1 : ehf->file;
+            snprintf(name, sizeof(name), "%s (%s)", ehf->name, file);
+            printf("%-48s %10lu %10.1f\n", name, ehf->calls, ehf->usec / 1e3);
+            for (jj = 0; jj < module_count; jj++)
+                if (!strcmp(modules[jj].file, file))
+                    break;
+            if (jj == module_count) {
+                if (module_count == ArrayLength(modules))
+                    continue;
+                modules[module_count].file = file;
+                modules[module_count].calls = 0;
+                modules[module_count].usec = 0;
+                module_count++;
+            }
+            modules[jj].calls += ehf->calls;
+            modules[jj].usec += ehf->usec;
+        }
+    }
+
+    printf("\n%-48s %10s %10s\n", "Module", "Calls", "Total ms");
+    for (jj = 0; jj < module_count; jj++)
+        printf("%-48s %10lu %10.1f\n", modules[jj].file, modules[jj].calls, modules[jj].usec / 1e3);
+}
+
+void
+replay_bench_loop(void)
+{
+    unsigned long long start, t0;
+    clock_t cpu_start;
+    char token[16];
+    char *line;
+
+    self->link_time = self->boot = now;
+    cManager.uplink->state = AUTHENTICATING;
+    irc_introduce(cManager.uplink->password);
+    replay_connected = 1;
+    eh_timing = 1;
+
+    cpu_start = clock();
+    start = bench_nsec();
+    for (line = bench_next; line && !quit_services; line = bench_read_line()) {
+        bench_line_token(line, token, sizeof(token));
+        t0 = bench_nsec();
+        parse_line(line, 0);
+        bench_record(token, bench_nsec() - t0);
+        lines_processed++;
+        timeq_run();
+    }
+    /* Let work put off to the timeq, such as burst hooks, catch up. */
+    while (!quit_services && timeq_next() <= (unsigned long)now) {
+        now++;
+        timeq_run();
+    }
+    bench_report(bench_nsec() - start, (double)(clock() - cpu_start) / CLOCKS_PER_SEC);
+    quit_services = 1;
+}
+
 void putsock(const char *text, ...) PRINTF_LIKE(1, 2);
 
 void
@@ -260,6 +515,8 @@ putsock(const char *text, ...)
         buffer[pos++] = '\n';
         buffer[pos] = 0;
         ioset_write(socket_io_fd, buffer, pos);
+    } else if (replay_bench) {
+        bench_write(buffer, pos);
     } else {
         replay_write(buffer);
     }
@@ -639,17 +896,18 @@ mod_chanmode_apply(struct userNode *who, struct chanNode *channel, struct mod_ch
                 bn = channel->banlist.list[jj];
                 if (match_ircglobs(change->args[ii].u.hostmask, bn->ban)) {
                     banList_remove(&channel->banlist, bn);
-                    free(bn);
+                    free_ban_node(bn);
                     jj--;
                 }
             }
-            bn = calloc(1, sizeof(*bn));
+            bn = alloc_ban_node();
             safestrncpy(bn->ban, change->args[ii].u.hostmask, sizeof(bn->ban));
             if (who)
                 safestrncpy(bn->who, who->nick, sizeof(bn->who));
             else
                 safestrncpy(bn->who, "<unknown>", sizeof(bn->who));
             bn->set = now;
+            bn->matcher = glob_matcher_compile(bn->ban, MATCH_USENICK);
             banList_append(&channel->banlist, bn);
             break;
         case MODE_REMOVE|MODE_BAN:
@@ -657,8 +915,8 @@ mod_chanmode_apply(struct userNode *who, struct chanNode *channel, struct mod_ch
                 bn = channel->banlist.list[jj];
                 if (strcmp(bn->ban, change->args[ii].u.hostmask))
                     continue;
-                free(bn);
                 banList_remove(&channel->banlist, bn);
+                free_ban_node(bn);
                 break;
             }
             break;
@@ -875,28 +1133,28 @@ generate_hostmask(struct userNode *user, int options)
     if (options & GENMASK_STRICT_IDENT)
         // sethost - reed/apples
         if (IsSetHost(user)) {
-          ident = alloca(strcspn(user->sethost, "@")+2);
-          safestrncpy(ident, user->sethost, strcspn(user->sethost, "@")+1);
+          ident = alloca(strcspn(user->ext->sethost, "@")+2);
+          safestrncpy(ident, user->ext->sethost, strcspn(user->ext->sethost, "@")+1);
         }
         else
-        ident = user->ident;
+        ident = (char*)user->ident;
     else if (options & GENMASK_ANY_IDENT)
         ident = "*";
     else {
         // sethost - reed/apples
         if (IsSetHost(user)) {
-          ident = alloca(strcspn(user->sethost, "@")+3);
+          ident = alloca(strcspn(user->ext->sethost, "@")+3);
           ident[0] = '*';
-          safestrncpy(ident+1, user->sethost, strcspn(user->sethost, "@")+1);
+          safestrncpy(ident+1, user->ext->sethost, strcspn(user->ext->sethost, "@")+1);
         } else {
         ident = alloca(strlen(user->ident)+2);
         ident[0] = '*';
         strcpy(ident+1, user->ident + ((*user->ident == '~')?1:0));
     }
     }
-    hostname = user->hostname;
+    hostname = (char*)user->hostname;
     if (IsFakeHost(user) && IsHiddenHost(user) && !(options & GENMASK_NO_HIDING)) {
-        hostname = user->fakehost;
+        hostname = (char*)user->ext->fakehost;
     } else if (IsHiddenHost(user)) {
         int style = 1;
         char *data;
@@ -908,8 +1166,8 @@ generate_hostmask(struct userNode *user, int options)
             hostname = alloca(strlen(user->handle_info->handle) + strlen(hidden_host_suffix) + 2);
             sprintf(hostname, "%s.%s", user->handle_info->handle, hidden_host_suffix);
         } else if (((style == 2) || (style == 3)) && !(options & GENMASK_NO_HIDING)) {
-            hostname = alloca(strlen(user->crypthost));
-            sprintf(hostname, "%s", user->crypthost);
+            hostname = alloca(strlen(user->ext->crypthost));
+            sprintf(hostname, "%s", user->ext->crypthost);
         }
     } else if (options & GENMASK_STRICT_HOST) {
         if (options & GENMASK_BYIP)
@@ -954,7 +1212,7 @@ generate_hostmask(struct userNode *user, int options)
     }
     // sethost - reed/apples
     if (IsSetHost(user)) 
-      hostname = strchr(user->sethost, '@') + 1;
+      hostname = strchr(user->ext->sethost, '@') + 1;
 
     /* Emit hostmask */
     len = strlen(ident) + strlen(hostname) + 2;
@@ -22,6 +22,7 @@
 #include "chanserv.h"
 #include "hash.h"
 #include "helpfile.h"
+#include "intern.h"
 #include "proto-common.c"
 #include "opserv.h"
 
@@ -433,7 +434,8 @@ check_ctcp(struct userNode *user, struct userNode *bot, char *text, UNUSED_ARG(i
                     version = "";
                 /* opserv_debug("Opserv got CTCP VERSION Notice from %s: %s", user->nick, version); */
                 /* TODO: setup a ctcp_funcs thing to handle this and other CTCPS properly */
-                user->version_reply = strdup(version);
+                free(user_ext(user)->version_reply);
+                user->ext->version_reply = strdup(version);
                 /* TODO: put this in the db */
                 if(match_ircglob(version, "WebTV;*"))
                     user->no_notice = true; /* webbies cant see notices */
@@ -1136,9 +1138,9 @@ irc_topic(struct userNode *service, struct userNode *who, struct chanNode *what,
 
    if (hstr) {
       if (IsHiddenHost(who) && IsFakeHost(who))
-          safestrncpy(shost, who->fakehost, sizeof(shost));
+          safestrncpy(shost, who->ext->fakehost, sizeof(shost));
       else if (IsHiddenHost(who) && IsSetHost(who)) {
-          hostmask = strdup(who->sethost);
+          hostmask = strdup(who->ext->sethost);
           if ((host = (strrchr(hostmask, '@')))) {
               hasident = 1;
               *host++ = '\0';
@@ -1153,8 +1155,8 @@ irc_topic(struct userNode *service, struct userNode *who, struct chanNode *what,
           safestrncpy(shost, host, sizeof(shost));
       } else if (IsHiddenHost(who) && ((hhtype == 1) || (hhtype == 3)) && who->handle_info && hhstr) {
           snprintf(shost, sizeof(shost), "%s.%s", who->handle_info->handle, hhstr);
-      } else if (IsHiddenHost(who) && ((hhtype == 2) || (hhtype == 3)) && who->crypthost[0]) {
-          safestrncpy(shost, who->crypthost, sizeof(shost));
+      } else if (IsHiddenHost(who) && ((hhtype == 2) || (hhtype == 3)) && who->ext->crypthost[0]) {
+          safestrncpy(shost, who->ext->crypthost, sizeof(shost));
       } else
           safestrncpy(shost, who->hostname, sizeof(shost));
 
@@ -1191,7 +1193,7 @@ irc_numeric(struct userNode *user, unsigned int num, const char *format, ...)
 void
 irc_mark(struct userNode *user, char *mark)
 {
-    char *host = user->hostname;
+    const char *host = user->hostname;
     int type = 4;
     const char *tstr = NULL;
     unsigned int ii = 0;
@@ -1203,16 +1205,16 @@ irc_mark(struct userNode *user, char *mark)
     else
         type = 4;
 
-    if (user->marks)
-        for (ii=0; ii<user->marks->used; ii++)
-            if (!irccasecmp(user->marks->list[ii], mark))
+    if (user->ext->marks)
+        for (ii=0; ii<user->ext->marks->used; ii++)
+            if (!irccasecmp(user->ext->marks->list[ii], mark))
                 markfound = 1;
 
     if (!markfound)
     {
-        if (!user->marks)
-            user->marks = alloc_string_list(1);
-        string_list_append(user->marks, strdup(mark));
+        if (!user->ext->marks)
+            user_ext(user)->marks = alloc_string_list(1);
+        string_list_append(user->ext->marks, strdup(mark));
     }
 
     if (type >= 9)
@@ -1222,7 +1224,7 @@ irc_mark(struct userNode *user, char *mark)
     }
 
     /* TODO: Allow mark overwrite. If they are marked, and their fakehost is oldmark.hostname, update it to newmark.hostname so mark can be called multiple times. Probably requires ircd modification also */
-    if(user->mark)
+    if(user->ext->mark)
         return;
 
     /* if the mark will put us over the  host length, clip some off the left hand side
@@ -1234,7 +1236,7 @@ irc_mark(struct userNode *user, char *mark)
     putsock("%s " CMD_MARK " %s DNSBL_DATA %s", self->numeric, user->nick, mark);
 
     /* Save it in the user */
-    user->mark = strdup(mark);
+    user_ext(user)->mark = strdup(mark);
 
     /* If they are not otherwise marked, mark their host with fakehost */
     if(!IsFakeHost(user) && !IsSetHost(user) && !(IsHiddenHost(user) && user->handle_info) )
@@ -1248,7 +1250,7 @@ irc_mark(struct userNode *user, char *mark)
         putsock("%s " CMD_MODE " %s +x", self->numeric, user->nick);
         
         snprintf(fakehost, sizeof(fakehost), "%s.%s", mark, host);
-        safestrncpy(user->fakehost, fakehost, sizeof(user->fakehost));
+        assign_fakehost(user, fakehost, 0);
 
         for (n=count=0; n<user->channels.used; n++) {
             mn = user->channels.list[n];
@@ -1312,7 +1314,7 @@ static CMD_FUNC(cmd_whois)
     }
 
     if (IsFakeHost(who) && IsHiddenHost(who))
-        irc_numeric(from, RPL_WHOISUSER, "%s %s %s * :%s", who->nick, who->ident, who->fakehost, who->info);
+        irc_numeric(from, RPL_WHOISUSER, "%s %s %s * :%s", who->nick, who->ident, who->ext->fakehost, who->info);
     else if (IsHiddenHost(who) && who->handle_info && hidden_host_suffix)
         irc_numeric(from, RPL_WHOISUSER, "%s %s %s.%s * :%s", who->nick, who->ident, who->handle_info->handle, hidden_host_suffix, who->info);
     else
@@ -1433,6 +1435,45 @@ static CMD_FUNC(cmd_server)
 }
 
 
+/* How many users' burst hooks run per pass through the main loop. */
+#define BURST_HOOK_SLICE 1000
+
+static void
+run_burst_hooks(void *data)
+{
+    struct server *srv = data;
+    struct userNode *user;
+    unsigned int count = 0;
+
+    srv->burst_hook_timer = NULL;
+    while (srv->burst_hook_pos <= srv->num_mask) {
+        user = srv->users[srv->burst_hook_pos++];
+        if (!user || !user->burst_pending)
+            continue;
+        call_burst_hooks(user);
+        if (++count == BURST_HOOK_SLICE) {
+            srv->burst_hook_timer = timeq_add_msec(0, run_burst_hooks, srv);
+            return;
+        }
+    }
+}
+
+/* Start on the held-back hooks for every server below srv that has
+ * finished bursting. */
+static void
+schedule_burst_hooks(struct server *srv)
+{
+    unsigned int nn;
+
+    if (srv == self || srv->burst)
+        return;
+    timeq_cancel(srv->burst_hook_timer);
+    srv->burst_hook_pos = 0;
+    srv->burst_hook_timer = timeq_add_msec(0, run_burst_hooks, srv);
+    for (nn = 0; nn < srv->children.used; nn++)
+        schedule_burst_hooks(srv->children.list[nn]);
+}
+
 static CMD_FUNC(cmd_eob)
 {
     struct server *sender;
@@ -1457,6 +1498,7 @@ static CMD_FUNC(cmd_eob)
     }
     sender->self_burst = 0;
     recalc_bursts(sender);
+    schedule_burst_hooks(sender);
     call_server_link_funcs(sender);
     /* let auto-routing figure out if we were
      * wating on this server to link a child to it */
@@ -2116,18 +2158,20 @@ static CMD_FUNC(cmd_mark)
             return 0;
         }
         if (type >= 9) {
-            if (target->marks)
-                for (ii=0; ii<target->marks->used; ii++)
-                    if (!irccasecmp(target->marks->list[ii], argv[3]))
+            if (target->ext->marks)
+                for (ii=0; ii<target->ext->marks->used; ii++)
+                    if (!irccasecmp(target->ext->marks->list[ii], argv[3]))
                          markfound = 1;
             if (!markfound)
             {
-                if (!target->marks)
-                    target->marks = alloc_string_list(1);
-                string_list_append(target->marks, strdup(argv[3]));
+                if (!target->ext->marks)
+                    user_ext(target)->marks = alloc_string_list(1);
+                string_list_append(target->ext->marks, strdup(argv[3]));
             }
-        } else
-            target->mark = strdup(argv[3]);
+        } else {
+            free(user_ext(target)->mark);
+            target->ext->mark = strdup(argv[3]);
+        }
         return 1;
 
     }
@@ -2143,7 +2187,8 @@ static CMD_FUNC(cmd_mark)
         if(!version)
             version = "";
 
-        target->version_reply = strdup(version);
+        free(user_ext(target)->version_reply);
+        target->ext->version_reply = strdup(version);
 
         if(match_ircglob(version, "WebTV;*"))
             target->no_notice = true; /* webbies cant see notices */
@@ -2162,7 +2207,8 @@ static CMD_FUNC(cmd_mark)
         if(!sslfp)
             sslfp = "";
 
-        target->sslfp = strdup(sslfp);
+        free(user_ext(target)->sslfp);
+        target->ext->sslfp = strdup(sslfp);
 
         nickserv_do_autoauth(target);
 
@@ -2680,13 +2726,18 @@ void
 free_user(struct userNode *user)
 {
     free(user->nick);
-    free(user);
+    free_user_node(user);
 }
 
 static void
 parse_cleanup(UNUSED_ARG(void *extra))
 {
+    dict_iterator_t it;
     unsigned int nn;
+
+    /* timeq_cleanup() may already have freed pending burst hook runs. */
+    for (it = dict_first(servers); it; it = iter_next(it))
+        ((struct server *)iter_data(it))->burst_hook_timer = NULL;
     free(of_list);
     free(of_list_extra);
     free(privmsg_funcs);
@@ -2707,6 +2758,51 @@ p10_conf_reload(void) {
     his_servercomment = conf_get_data("server/his_servercomment", RECDB_QSTRING);
 }
 
+/* Jump table for the one- and two-letter P10 tokens, indexed by
+ * [first - 'A'][second ? second - 'A' + 1 : 0].  It is filled from
+ * irc_func_dict once init_parse() has registered every handler, so
+ * the dict only has to serve long command names and numerics. */
+static cmd_func_t *irc_token_funcs[26][27];
+
+static void
+build_irc_token_funcs(void)
+{
+    dict_iterator_t it;
+    const char *key;
+    unsigned int c0, c1;
+
+    memset(irc_token_funcs, 0, sizeof(irc_token_funcs));
+    for (it = dict_first(irc_func_dict); it; it = iter_next(it)) {
+        key = iter_key(it);
+        c0 = (unsigned char)key[0] - 'A';
+        if (c0 >= 26)
+            continue;
+        if (!key[1])
+            c1 = 0;
+        else if (((unsigned char)key[1] - 'A' < 26) && !key[2])
+            c1 = (unsigned char)key[1] - 'A' + 1;
+        else
+            continue;
+        irc_token_funcs[c0][c1] = iter_data(it);
+    }
+}
+
+static cmd_func_t *
+find_irc_func(const char *cmd)
+{
+    cmd_func_t *func;
+    unsigned int c0, c1;
+
+    c0 = (unsigned char)cmd[0] - 'A';
+    if (c0 < 26) {
+        c1 = cmd[1] ? (unsigned char)cmd[1] - 'A' + 1 : 0;
+        if ((c1 <= 26) && (!c1 || !cmd[2])
+            && (func = irc_token_funcs[c0][c1]))
+            return func;
+    }
+    return dict_find(irc_func_dict, cmd, NULL);
+}
+
 static void
 remove_unbursted_channel(struct chanNode *cNode, UNUSED_ARG(void *extra)) {
     if (unbursted_channels)
@@ -2753,7 +2849,7 @@ init_parse(void)
     self = AddServer(NULL, str, 0, boot_time, now, numer, desc);
     conf_register_reload(p10_conf_reload);
 
-    irc_func_dict = dict_new();
+    irc_func_dict = dict_new_hash();
     dict_insert(irc_func_dict, CMD_BOUNCER_TRANSFER, cmd_bouncer_transfer);
     dict_insert(irc_func_dict, TOK_BOUNCER_TRANSFER, cmd_bouncer_transfer);
     dict_insert(irc_func_dict, CMD_BURST, cmd_burst);
@@ -2922,6 +3018,7 @@ init_parse(void)
     dict_insert(irc_func_dict, "443", cmd_dummy); /* is already on channel (after invite?) */
     dict_insert(irc_func_dict, "461", cmd_dummy); /* Not enough parameters (after TOPIC w/ 0 args) */
     dict_insert(irc_func_dict, "467", cmd_dummy); /* Channel key already set */
+    build_irc_token_funcs();
 
     num_privmsg_funcs = 16;
     privmsg_funcs = malloc(sizeof(privmsg_func_t)*num_privmsg_funcs);
@@ -2966,7 +3063,7 @@ parse_line(char *line, int recursive)
             }
         } else
             origin = 0;
-        if ((func = dict_find(irc_func_dict, argv[cmd], NULL)))
+        if ((func = find_irc_func(argv[cmd])))
             res = func(origin, argc-cmd, argv+cmd);
     }
     if (!res) {
@@ -3114,8 +3211,34 @@ AddServer(struct server *uplink, const char *name, int hops, time_t boot, time_t
     return sNode;
 }
 
+/* How long a split server's users stay pooled before the memory is
+ * released, in case the server comes back. */
+#define POOL_RELEASE_DELAY 300
+
+static void
+release_pool_memory(UNUSED_ARG(void *data))
+{
+    pool_trim_all(0);
+}
+
+static void release_user(struct userNode *user, struct userNode *killer, int announce, const char *why);
+
+static void
+collect_server_users(struct server *serv, struct userList *users)
+{
+    unsigned int i;
+
+    for (i=0; i<serv->children.used; i++)
+        if (serv->children.list[i] != self)
+            collect_server_users(serv->children.list[i], users);
+    for (i=0; i<=serv->num_mask; i++)
+        if (serv->users[i])
+            userList_append(users, serv->users[i]);
+}
+
 void DelServer(struct server* serv, int announce, const char *message)
 {
+    struct userList departed;
     unsigned int i;
 
     /* If we receive an ERROR command before the SERVER
@@ -3128,15 +3251,33 @@ void DelServer(struct server* serv, int announce, const char *message)
     if (announce && (serv->uplink == self) && (serv != self->uplink))
         irc_squit(serv, message, NULL);
 
+    /* Everybody behind serv leaves at once.  Mark them all as dead
+     * before anyone leaves a channel, then give the hooks the whole
+     * list. */
+    userList_init(&departed);
+    collect_server_users(serv, &departed);
+    for (i=0; i<departed.used; i++) {
+        verify(departed.list[i]);
+        departed.list[i]->dead = 1;
+        wipe_adduser_pending(NULL, departed.list[i]);
+    }
+    for (i=0; i<departed.used; i++)
+        DelUserChannels(departed.list[i]);
+    call_del_users_funcs(&departed, NULL, "server delinked");
+    for (i=0; i<departed.used; i++)
+        release_user(departed.list[i], NULL, false, "server delinked");
+    userList_clean(&departed);
+
     /* must recursively remove servers linked to this one first */
     for (i=serv->children.used;i>0;)
         if (serv->children.list[--i] != self)
             DelServer(serv->children.list[i], false, NULL);
 
-    /* clean up server's user hash tables */
-    for (i=0;i<=serv->num_mask;i++)
-        if (serv->users[i])
-            DelUser(serv->users[i], NULL, false, "server delinked");
+    if (serv != self) {
+        timeq_cancel(serv->burst_hook_timer);
+        timeq_del(0, release_pool_memory, NULL, TIMEQ_IGNORE_WHEN);
+        timeq_add(now + POOL_RELEASE_DELAY, release_pool_memory, NULL);
+    }
 
     /* delete server */
     if (serv->uplink)
@@ -3266,16 +3407,14 @@ AddUser(struct server* uplink, const char *nick, const char *ident, const char *
     }
 
     /* create new usernode and set all values */
-    uNode = calloc(1, sizeof(*uNode));
+    uNode = alloc_user_node();
     uNode->nick = strdup(nick);
-    safestrncpy(uNode->ident, ident, sizeof(uNode->ident));
+    uNode->ident = intern_stringn(ident, USERLEN);
     safestrncpy(uNode->info, userinfo, sizeof(uNode->info));
-    safestrncpy(uNode->hostname, hostname, sizeof(uNode->hostname));
+    uNode->hostname = intern_stringn(hostname, HOSTLEN);
     safestrncpy(uNode->numeric, numeric, sizeof(uNode->numeric));
     irc_p10_pton(&uNode->ip, realip);
 
-    if (!uNode->crypthost && uNode->cryptip)
-        snprintf(uNode->crypthost, sizeof(uNode->crypthost), "%s", strdup(uNode->cryptip));
     uNode->idle_since = timestamp;
     uNode->timestamp = timestamp;
     modeList_init(&uNode->channels);
@@ -3323,13 +3462,19 @@ DelUser(struct userNode* user, struct userNode *killer, int announce, const char
     wipe_adduser_pending(NULL, user);
 
     /* remove user from all channels */
-    while (user->channels.used > 0)
-        DelChannelUser(user, user->channels.list[user->channels.used-1]->channel, NULL, 0);
+    DelUserChannels(user);
 
     /* Call these in reverse order so ChanServ can update presence
        information before NickServ nukes the handle_info. */
     call_del_user_funcs(user, killer, why);
 
+    release_user(user, killer, announce, why);
+}
+
+/* The rest of DelUser(), once the hooks are done with user. */
+static void
+release_user(struct userNode *user, struct userNode *killer, int announce, const char *why)
+{
     user->uplink->clients--;
     user->uplink->users[user->num_local] = NULL;
     if (IsOper(user)) {
@@ -3361,31 +3506,8 @@ DelUser(struct userNode* user, struct userNode *killer, int announce, const char
 
     modeList_clean(&user->channels);
 
-    /* Clean up version data */
-    if(user->version_reply) {
-        free(user->version_reply);
-        user->version_reply = NULL;
-    }
-
-    /* Clean up SSL fingerprint data */
-    if(user->sslfp) {
-        free(user->sslfp);
-        user->sslfp = NULL;
-    }
-
-    /* clean up mark */
-    if(user->mark) {
-        free(user->mark);
-        user->mark = NULL;
-    }
-    free_string_list(user->marks);
-    user->marks = NULL;
-
-    /* clean up geoip data if any */
-    if(user->country_code) free(user->country_code);
-    if(user->city) free(user->city);
-    if(user->region) free(user->region);
-    if(user->postal_code) free(user->postal_code);
+    /* Clean up version, SSL fingerprint, mark and geoip data */
+    free_user_ext(user);
 
     /* We don't free them, in case we try to privmsg them or something
      * (like when a stupid oper kills themself).  We just put them onto
@@ -3456,7 +3578,7 @@ void mod_usermode(struct userNode *user, const char *mode_change) {
 		cloakhost[ii] = 0;
 		while (*word == ' ')
 		    word++;
-		safestrncpy(user->crypthost, cloakhost, sizeof(user->crypthost));
+		safestrncpy(user_ext(user)->crypthost, cloakhost, sizeof(user->ext->crypthost));
 	    }
 	    break;
 	case 'c': do_user_mode(FLAGS_CLOAKIP);
@@ -3468,7 +3590,7 @@ void mod_usermode(struct userNode *user, const char *mode_change) {
 		cloakip[ii] = 0;
 		while (*word == ' ')
 		    word++;
-		safestrncpy(user->cryptip, cloakip, sizeof(user->cryptip));
+		safestrncpy(user_ext(user)->cryptip, cloakip, sizeof(user->ext->cryptip));
 	    }
 	    break;
 	// sethost - reed/apples
@@ -3484,7 +3606,7 @@ void mod_usermode(struct userNode *user, const char *mode_change) {
 		sethost[ii] = 0;
 		while (*word == ' ')
 		    word++;
-		safestrncpy(user->sethost, sethost, sizeof(user->sethost));
+		safestrncpy(user_ext(user)->sethost, sethost, sizeof(user->ext->sethost));
 	    }
 	    break;
         case 'x': do_user_mode(FLAGS_HIDDEN_HOST); break;
@@ -4090,7 +4212,7 @@ clear_chanmode(struct chanNode *channel, const char *modes)
     if ((cleared & MODE_BAN) && channel->banlist.used) {
         unsigned int i;
         for (i=0; i<channel->banlist.used; i++)
-            free(channel->banlist.list[i]);
+            free_ban_node(channel->banlist.list[i]);
         channel->banlist.used = 0;
     }
 
@@ -111,6 +111,8 @@ void reg_oper_func(oper_func_t handler, void *extra);
 /* replay silliness */
 void replay_read_line(void);
 void replay_event_loop(void);
+void replay_bench_start(void);
+void replay_bench_loop(void);
 
 /* connection maintenance */
 void irc_server(struct server *srv);
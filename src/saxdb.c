@@ -56,6 +56,7 @@ static struct saxdb *last_db;
 static struct dict *saxdbs; /* -> struct saxdb */
 static struct dict *mondo_db;
 static struct module *saxdb_module;
+int saxdb_readonly;
 
 static SAXDB_WRITER(saxdb_mondo_writer);
 static void saxdb_timed_write(void *data);
@@ -103,7 +104,7 @@ saxdb_register(const char *name, saxdb_reader_func_t *reader, saxdb_writer_func_
         db->write_interval = 1800;
     }
     /* Schedule database writes */
-    if (db->write_interval && !db->mondo_section) {
+    if (db->write_interval && !db->mondo_section && !saxdb_readonly) {
         timeq_add(now + db->write_interval, saxdb_timed_write, db);
     }
     /* Insert filename */
@@ -138,6 +139,10 @@ saxdb_write_db(struct saxdb *db) {
     time_t start, finish;
 
     assert(db->filename);
+    if (saxdb_readonly) {
+        log_module(MAIN_LOG, LOG_WARNING, "Not writing %s database: databases are read-only.", db->name);
+        return 1;
+    }
     sprintf(tmp_fname, "%s.new", db->filename);
     output = fopen(tmp_fname, "w+");
 
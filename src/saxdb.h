@@ -28,6 +28,9 @@ DECLARE_LIST(int_list, int);
 struct saxdb;
 struct saxdb_context;
 
+/* Set to make saxdb read databases but never write them back. */
+extern int saxdb_readonly;
+
 #define SAXDB_READER(NAME) int NAME(struct dict *db)
 typedef SAXDB_READER(saxdb_reader_func_t);
 
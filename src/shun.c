@@ -21,6 +21,7 @@
 #include "heap.h"
 #include "helpfile.h"
 #include "log.h"
+#include "maskindex.h"
 #include "saxdb.h"
 #include "timeq.h"
 #include "shun.h"
@@ -45,6 +46,8 @@
 
 static heap_t shun_heap; /* key: expiry time, data: struct shun_entry* */
 static dict_t shun_dict; /* key: target, data: struct shun_entry* */
+static maskindex_t shun_index; /* wildcard lookups for shun_find() */
+static timeq_handle shun_timer; /* pending shun_expire event, or NULL */
 
 static int
 shun_comparator(const void *a, const void *b)
@@ -66,27 +69,14 @@ free_shun_from_dict(void *data)
 static void
 free_shun(struct shun *ent)
 {
+    maskindex_remove(shun_index, ent->target, ent);
     dict_remove(shun_dict, ent->target);
 }
 
-static int
-shun_for_p(UNUSED_ARG(void *key), void *data, void *extra)
-{
-    struct shun *ge = data;
-    return !irccasecmp(ge->target, extra);
-}
-
-static int
-delete_shun_for_p(UNUSED_ARG(void *key), void *data, void *extra)
+static void
+shun_set_heap_pos(void *data, unsigned int pos)
 {
-    struct shun *ge = data;
-
-    if (!irccasecmp(ge->target, extra)) {
-        free_shun(ge);
-        return 1;
-    } else {
-        return 0;
-    }
+    ((struct shun*)data)->heap_pos = pos;
 }
 
 static void
@@ -95,6 +85,7 @@ shun_expire(UNUSED_ARG(void *data))
     time_t stopped;
     void *wraa;
 
+    shun_timer = NULL;
     stopped = 0;
     while (heap_size(shun_heap)) {
         heap_peek(shun_heap, 0, &wraa);
@@ -105,21 +96,37 @@ shun_expire(UNUSED_ARG(void *data))
         free_shun(wraa);
     }
     if (heap_size(shun_heap))
-        timeq_add(stopped, shun_expire, NULL);
+        shun_timer = timeq_add(stopped, shun_expire, NULL);
+}
+
+static void
+shun_schedule(time_t when)
+{
+    if (shun_timer)
+        timeq_cancel(shun_timer);
+    shun_timer = timeq_add(when, shun_expire, NULL);
 }
 
 int
 shun_remove(const char *target, int announce)
 {
-    int res = dict_find(shun_dict, target, NULL) ? 1 : 0;
-    if (heap_remove_pred(shun_heap, delete_shun_for_p, (char*)target)) {
-        void *argh;
-        struct shun *new_first;
-        heap_peek(shun_heap, 0, &argh);
-        if (argh) {
-            new_first = argh;
-            timeq_del(0, shun_expire, 0, TIMEQ_IGNORE_WHEN|TIMEQ_IGNORE_DATA);
-            timeq_add(new_first->expires, shun_expire, 0);
+    struct shun *ent;
+    unsigned int pos;
+    int res = 0;
+
+    if ((ent = dict_find(shun_dict, target, NULL))) {
+        pos = ent->heap_pos;
+        heap_remove_at(shun_heap, pos);
+        free_shun(ent);
+        res = 1;
+        if (pos == 0) {
+            void *argh;
+            struct shun *new_first;
+            heap_peek(shun_heap, 0, &argh);
+            if (argh) {
+                new_first = argh;
+                shun_schedule(new_first->expires);
+            }
         }
     }
     if (announce)
@@ -138,9 +145,10 @@ shun_add(const char *issuer, const char *target, unsigned long duration, const c
     prev_first = argh;
     ent = dict_find(shun_dict, target, NULL);
     if (ent) {
-        heap_remove_pred(shun_heap, shun_for_p, (char*)target);
-        if (ent->expires < (time_t)(now + duration))
+        if (ent->expires < (time_t)(now + duration)) {
             ent->expires = now + duration;
+            heap_update_at(shun_heap, ent->heap_pos);
+        }
     } else {
         ent = malloc(sizeof(*ent));
         ent->issued = issued;
@@ -149,11 +157,11 @@ shun_add(const char *issuer, const char *target, unsigned long duration, const c
         ent->expires = now + duration;
         ent->reason = strdup(reason);
         dict_insert(shun_dict, ent->target, ent);
+        maskindex_add(shun_index, ent->target, ent);
+        heap_insert(shun_heap, ent, ent);
     }
-    heap_insert(shun_heap, ent, ent);
     if (!prev_first || (ent->expires < prev_first->expires)) {
-	timeq_del(0, shun_expire, 0, TIMEQ_IGNORE_WHEN|TIMEQ_IGNORE_DATA);
-	timeq_add(ent->expires, shun_expire, 0);
+        shun_schedule(ent->expires);
     }
     if (announce)
         irc_shun(NULL, ent);
@@ -188,7 +196,6 @@ struct shun *
 shun_find(const char *target)
 {
     struct shun *res;
-    dict_iterator_t it;
     char *alt_target;
 
     res = dict_find(shun_dict, target, NULL);
@@ -198,12 +205,9 @@ shun_find(const char *target)
     if ((target[0] == '#') || (target[0] == '&'))
         return NULL;
     else if (target[strcspn(target, "*?")]) {
-        /* Wildcard: do an obnoxiously long search. */
-        for (it = dict_first(shun_dict); it; it = iter_next(it)) {
-            res = iter_data(it);
-            if (match_ircglob(target, res->target))
-                return res;
-        }
+        /* Wildcard: look for a shun that covers it. */
+        if ((res = maskindex_find(shun_index, target)))
+            return res;
     }
     /* See if we can resolve the hostname part of the mask. */
     if ((alt_target = shun_alternate_target(target))) {
@@ -301,14 +305,16 @@ static void
 shun_db_cleanup(UNUSED_ARG(void *extra))
 {
     heap_delete(shun_heap);
+    maskindex_delete(shun_index);
     dict_delete(shun_dict);
 }
 
 void
 shun_init(void)
 {
-    shun_heap = heap_new(shun_comparator);
+    shun_heap = heap_new_indexed(shun_comparator, shun_set_heap_pos);
     shun_dict = dict_new();
+    shun_index = maskindex_new();
     dict_set_free_data(shun_dict, free_shun_from_dict);
     saxdb_register("shun", shun_saxdb_read, shun_saxdb_write);
     reg_exit_func(shun_db_cleanup, NULL);
@@ -29,6 +29,7 @@ struct shun {
     char *issuer;
     char *target;
     char *reason;
+    unsigned int heap_pos; /* slot in the expiry heap */
 };
 
 struct shun_discrim {
@@ -27,6 +27,7 @@
 #include "saxdb.h"
 #include "timeq.h"
 #include "gline.h"
+#include "wordmatch.h"
 
 #include <ctype.h>
 
@@ -82,7 +83,6 @@ struct userNode		*spamserv;
 static struct module	*spamserv_module;
 static struct service	*spamserv_service;
 static struct log_type	*SS_LOG;
-static unsigned long	crc_table[256];
 
 dict_t registered_channels_dict;
 dict_t connected_users_dict;
@@ -101,7 +101,6 @@ const char *set_subcommands[SET_SUBCMDS_SIZE] = {"EXCEPTLEVEL", "EXCEPTADVLEVEL"
 extern struct string_list *autojoin_channels;
 static void spamserv_clear_spamNodes(struct chanNode *channel);
 static void spamserv_punish(struct chanNode *channel, struct userNode *user, time_t expires, char *reason, int ban);
-static unsigned long crc32(const char *text);
 
 #define BINARY_OPTION(arguments...)	return binary_option(arguments, user, channel, argc, argv);
 #define MULTIPLE_OPTION(arguments...)	return multiple_option(arguments, values, ArrayLength(values), user, channel, argc, argv);
@@ -286,6 +285,7 @@ spamserv_register_channel(struct chanNode *channel, struct string_list *exceptio
 	cInfo->channel = channel;
 	cInfo->exceptions = exceptions ? string_list_copy(exceptions) : alloc_string_list(1);
 	cInfo->badwords = badwords ? string_list_copy(badwords) : alloc_string_list(1);
+	cInfo->words = NULL;
 	cInfo->flags = flags;
 	cInfo->exceptlevel = 300;
 	cInfo->exceptspamlevel = 100;
@@ -317,10 +317,19 @@ spamserv_unregister_channel(struct chanInfo *cInfo)
 
 	free_string_list(cInfo->exceptions);
 	free_string_list(cInfo->badwords);
+	wordmatch_free(cInfo->words);
 	dict_remove(registered_channels_dict, cInfo->channel->name);
 	free(cInfo);
 }
 
+/* The exception or badword list changed; rebuild the matcher when it is next needed. */
+static void
+spamserv_words_changed(struct chanInfo *cInfo)
+{
+	wordmatch_free(cInfo->words);
+	cInfo->words = NULL;
+}
+
 void
 spamserv_cs_suspend(struct chanNode *channel, time_t expiry, int suspend, char *reason)
 {
@@ -443,78 +452,66 @@ get_userInfo(const char *nickname)
 	return dict_find(connected_users_dict, nickname, 0);
 }
 
-static void
-spamserv_create_spamNode(struct chanNode *channel, struct userInfo *uInfo, char *text)
+static struct spamNode*
+spamserv_find_spamNode(struct userInfo *uInfo, struct chanNode *channel)
 {
-	struct spamNode *sNode = malloc(sizeof(struct spamNode));
+	unsigned int i;
 
-	if(!sNode)
-	{
-		log_module(SS_LOG, LOG_ERROR, "Couldn't allocate memory for sNode; channel: %s; user: %s", channel->name, uInfo->user->nick);
-		return;
-	}
+	for(i = 0; i < uInfo->spamsize; i++)
+		if(uInfo->spam[i].channel == channel)
+			return &uInfo->spam[i];
 
-	sNode->channel = channel;	
-	sNode->crc32 = crc32(text);
-	sNode->count = 1;
-	sNode->next = NULL;
+	return NULL;
+}
 
-	if(uInfo->spam)
-	{
-		struct spamNode *temp = uInfo->spam;
-		
-		while(temp->next)
-			temp = temp->next;
+static void
+spamserv_create_spamNode(struct chanNode *channel, struct userInfo *uInfo, unsigned int hash)
+{
+	struct spamNode *sNode, *nodes;
+	unsigned int size;
 
-		sNode->prev = temp;
-		temp->next = sNode;
-	}
-	else
+	/* Take a free slot, or else make room for every channel the user
+	 * is in, so that no channel's last line is ever thrown away.  A
+	 * line from outside the channel may need one more. */
+	if(!(sNode = spamserv_find_spamNode(uInfo, NULL)))
 	{
-		sNode->prev = NULL;
-		uInfo->spam = sNode;
+		size = uInfo->user->channels.used;
+		if(size <= uInfo->spamsize)
+			size = uInfo->spamsize + 1;
+
+		if(!(nodes = realloc(uInfo->spam, size * sizeof(*nodes))))
+		{
+			log_module(SS_LOG, LOG_ERROR, "Couldn't allocate memory for sNode; channel: %s; user: %s", channel->name, uInfo->user->nick);
+			return;
+		}
+
+		memset(nodes + uInfo->spamsize, 0, (size - uInfo->spamsize) * sizeof(*nodes));
+		sNode = nodes + uInfo->spamsize;
+		uInfo->spam = nodes;
+		uInfo->spamsize = size;
 	}
+
+	sNode->channel = channel;
+	sNode->hash = hash;
+	sNode->count = 1;
 }
 
 static void
-spamserv_delete_spamNode(struct userInfo *uInfo, struct spamNode *sNode)
+spamserv_delete_spamNode(struct spamNode *sNode)
 {
-	if(!sNode)
-		return;
-
-	if(sNode == uInfo->spam)
-		uInfo->spam = sNode->next;
-	
-	if(sNode->next)
-		 sNode->next->prev = sNode->prev;
-	if(sNode->prev)
-		 sNode->prev->next = sNode->next;
-
-	free(sNode);
+	if(sNode)
+		sNode->channel = NULL;
 }
 
 static void
 spamserv_clear_spamNodes(struct chanNode *channel)
 {
 	struct userInfo *uInfo;
-	struct spamNode *sNode;
 	unsigned int i;
 
 	for(i = 0; i < channel->members.used; i++)
-	{
 		if((uInfo = get_userInfo(channel->members.list[i]->user->nick)))
-		{
-			if((sNode = uInfo->spam))
-			{
-				for(; sNode; sNode = sNode->next)
-					if(sNode->channel == channel)
-						break;
-					
-				if(sNode)
-					spamserv_delete_spamNode(uInfo, sNode);
-			}
-		}
-	}
+			spamserv_delete_spamNode(spamserv_find_spamNode(uInfo, channel));
 }
 
 static void
@@ -585,6 +582,7 @@ spamserv_create_user(struct userNode *user)
 
 	uInfo->user = user;
 	uInfo->spam = NULL;
+	uInfo->spamsize = 0;
 	uInfo->flood = NULL;
 	uInfo->joinflood = NULL;
 	uInfo->flags = kNode ? USER_KILLED : 0;
@@ -608,9 +606,7 @@ spamserv_delete_user(struct userInfo *uInfo)
 	if(!uInfo)
 		return;
 
-	if(uInfo->spam)
-		while(uInfo->spam)
-			spamserv_delete_spamNode(uInfo, uInfo->spam);	
+	free(uInfo->spam);
 
 	if(uInfo->flood)
 		while(uInfo->flood)
@@ -625,7 +621,7 @@ spamserv_delete_user(struct userInfo *uInfo)
 }
 
 static int
-spamserv_new_user_func(struct userNode *user, UNUSED_ARG(void *extra))
+spamserv_new_user_func(struct userNode *user, UNUSED_ARG(int burst), UNUSED_ARG(void *extra))
 {
 	if(!IsLocal(user))
 		spamserv_create_user(user);
@@ -634,7 +630,7 @@ spamserv_new_user_func(struct userNode *user, UNUSED_ARG(void *extra))
 }
 
 static void
-spamserv_del_user_func(struct userNode *user, struct userNode *killer, UNUSED_ARG(const char *why), UNUSED_ARG(void *extra))
+spamserv_del_user(struct userNode *user, struct userNode *killer)
 {
 	struct userInfo *uInfo = get_userInfo(user->nick);
 	struct killNode *kNode;
@@ -663,6 +659,15 @@ spamserv_del_user_func(struct userNode *user, struct userNode *killer, UNUSED_AR
 	spamserv_delete_user(uInfo);	
 }
 
+static void
+spamserv_del_users_func(struct userList *users, struct userNode *killer, UNUSED_ARG(const char *why), UNUSED_ARG(void *extra))
+{
+	unsigned int nn;
+
+	for(nn = 0; nn < users->used; nn++)
+		spamserv_del_user(users->list[nn], killer);
+}
+
 static void
 spamserv_nick_change_func(struct userNode *user, const char *old_nick, UNUSED_ARG(void *extra))
 {
@@ -675,7 +680,7 @@ spamserv_nick_change_func(struct userNode *user, const char *old_nick, UNUSED_AR
 }
 
 static int
-spamserv_user_join(struct modeNode *mNode, UNUSED_ARG(void *extra))
+spamserv_user_join(struct modeNode *mNode, int burst, UNUSED_ARG(void *extra))
 {
 	struct chanNode	*channel = mNode->channel;
 	struct userNode	*user = mNode->user;    
@@ -683,7 +688,7 @@ spamserv_user_join(struct modeNode *mNode, UNUSED_ARG(void *extra))
 	struct userInfo	*uInfo;
 	struct floodNode *jfNode;
 
-	if(user->uplink->burst || !(cInfo = get_chanInfo(channel->name)) || !CHECK_JOINFLOOD(cInfo) || !(uInfo = get_userInfo(user->nick)))
+	if(burst || !(cInfo = get_chanInfo(channel->name)) || !CHECK_JOINFLOOD(cInfo) || !(uInfo = get_userInfo(user->nick)))
 		return 0;
 
 	if(!(jfNode = uInfo->joinflood))
@@ -725,21 +730,12 @@ spamserv_user_part(struct modeNode *mn, UNUSED_ARG(const char *reason), UNUSED_A
 	struct userNode *user = mn->user;
 	struct chanNode *channel = mn->channel;
 	struct userInfo *uInfo;
-	struct spamNode *sNode;
 	struct floodNode *fNode;
 
 	if(user->dead || !get_chanInfo(channel->name) || !(uInfo = get_userInfo(user->nick)))
 		return;
 
-	if((sNode = uInfo->spam))
-	{
-		for(; sNode; sNode = sNode->next)
-			if(sNode->channel == channel)
-				break;
-
-		if(sNode)
-			spamserv_delete_spamNode(uInfo, sNode);
-	}
+	spamserv_delete_spamNode(spamserv_find_spamNode(uInfo, channel));
 
 	if((fNode = uInfo->flood))
 	{
@@ -756,44 +752,6 @@ spamserv_user_part(struct modeNode *mn, UNUSED_ARG(const char *reason), UNUSED_A
 /*                 Other Stuff                 */
 /***********************************************/
 
-static void
-crc32_init(void)
-{
-	unsigned long crc;
-	int i, j;
-
-	for(i = 0; i < 256; i++)
-	{
-		crc = i;
-
-		for(j = 8; j > 0; j--)
-		{
-			if(crc & 1)
-			{
-				crc = (crc >> 1) ^ 0xEDB88320L;
-			}
-			else
-			{
-				crc >>= 1;
-			}
-		}
-
-		crc_table[i] = crc;
-	}
-}
-
-static unsigned long
-crc32(const char *text)
-{
-	register unsigned long crc = 0xFFFFFFFF;
-	unsigned int c, i = 0;
-	
-	while((c = (unsigned int)text[i++]) != 0)
-		crc = ((crc >> 8) & 0x00FFFFFF) ^ crc_table[(crc^c) & 0xFF];
- 
-	return (crc^0xFFFFFFFF);
-}
-
 static void
 timeq_flood(UNUSED_ARG(void *data))
 {
@@ -1100,7 +1058,6 @@ show_memory_usage(struct userNode *user)
 	struct helpfile_table table;
 	struct chanInfo *cInfo;
 	struct userInfo *uInfo;
-	struct spamNode *sNode;
 	struct floodNode *fNode;
 	double channel_size = 0, user_size, size;
 	unsigned int spamcount = 0, floodcount = 0, i, j;
@@ -1127,7 +1084,7 @@ show_memory_usage(struct userNode *user)
 	{
 		uInfo = iter_data(it);
 
-		for(sNode = uInfo->spam; sNode; sNode = sNode->next, spamcount++);
+		spamcount += uInfo->spamsize;
 		for(fNode = uInfo->flood; fNode; fNode = fNode->next, floodcount++);
 		for(fNode = uInfo->joinflood; fNode; fNode = fNode->next, floodcount++);
 	}
@@ -1396,6 +1353,7 @@ SPAMSERV_FUNC(cmd_addexception)
 	}
 
 	string_list_append(cInfo->exceptions, strdup(argv[1]));
+	spamserv_words_changed(cInfo);
 	ss_reply("SSMSG_EXCEPTION_ADDED", argv[1]);
 
 	return 1;
@@ -1446,6 +1404,7 @@ SPAMSERV_FUNC(cmd_delexception)
 	}
 
 	string_list_delete(cInfo->exceptions, i);
+	spamserv_words_changed(cInfo);
 	ss_reply("SSMSG_EXCEPTION_DELETED", argv[1]);
 
 	return 1;
@@ -1506,6 +1465,7 @@ SPAMSERV_FUNC(cmd_addbadword)
 	}
 
 	string_list_append(cInfo->badwords, strdup(argv[1]));
+	spamserv_words_changed(cInfo);
 	ss_reply("SSMSG_BADWORD_ADDED", argv[1]);
 
 	return 1;
@@ -1556,6 +1516,7 @@ SPAMSERV_FUNC(cmd_delbadword)
 	}
 
 	string_list_delete(cInfo->badwords, i);
+	spamserv_words_changed(cInfo);
 	ss_reply("SSMSG_BADWORD_DELETED", argv[1]);
 
 	return 1;
@@ -2392,173 +2353,166 @@ static SPAMSERV_FUNC(cmd_listtrust) {
     return 1;
 }
 
-static void 
-to_lower(char *message)
+#define WORD_EXCEPTION		0x1
+#define WORD_BADWORD		0x2
+
+/* What a single pass over a channel message found. */
+struct message_scan
 {
-	unsigned int i, diff = 'a' - 'A';
+	int length;
+	int caps;		/* upper case letters */
+	unsigned int hash;	/* CRC-32C of the lowercased message */
+	unsigned int words;	/* WORD_* flags of the lists with an entry in it */
+	unsigned int advert : 1;
+};
 
-	for(i = 0; i < strlen(message); i++)
-	{
-		if((message[i] >= 'A') && (message[i] <= 'Z'))
-			message[i] = message[i] + diff;
-	}
-}
+#define ADV_TAIL(A, B, C)	(((A) << 16) | ((B) << 8) | (C))
 
-static char *
-strip_mirc_codes(char *text)
+/* Fills in scan for whichever checks are enabled on the channel,
+ * leaving text alone.  Badwords, exceptions and adverts are looked for
+ * in lower case with mIRC codes stripped (if strip_mirc_codes is set);
+ * the caps count and hash cover the whole message.  The lowercased
+ * message is copied into a local buffer, which is hashed a word at a
+ * time whenever it fills up. */
+static void
+scan_message(struct chanInfo *cInfo, const char *text, struct message_scan *scan)
 {
-	// taken from xchat and modified
-	int nc = 0, i = 0, col = 0, len = strlen(text);
-	static char new_str[MAXLEN];
+	char channelname[CHANNELLEN + 1], lower[MAXLEN], ch;
+	const char *pos;
+	unsigned int state = 0, recent = 0, nc = 0, chanlen = 0, nlower = 0, hash = 0;
+	int caps = 0, col = 0, in_chan = 0, check_words, check_adv;
 
-	while(len > 0)
+	memset(scan, 0, sizeof(*scan));
+	check_words = CHECK_BADWORDSCAN(cInfo) || CHECK_ADV(cInfo);
+	check_adv = CHECK_ADV(cInfo);
+
+	if(check_words && !cInfo->words)
 	{
-		if((col && isdigit(*text) && nc < 2) ||
-			(col && *text == ',' && isdigit(*(text + 1)) && nc < 3))
-		{
-			nc++;
+		unsigned int i;
 
-			if(*text == ',')
-				nc = 0;
+		cInfo->words = wordmatch_alloc();
+		for(i = 0; i < cInfo->exceptions->used; i++)
+			wordmatch_add(cInfo->words, cInfo->exceptions->list[i], WORD_EXCEPTION);
+		for(i = 0; i < cInfo->badwords->used; i++)
+			wordmatch_add(cInfo->words, cInfo->badwords->list[i], WORD_BADWORD);
+		wordmatch_compile(cInfo->words);
+	}
+	if(check_words)
+		scan->words = wordmatch_scan(cInfo->words, "", 0);
+
+	for(pos = text; (ch = *pos) != '\0'; pos++)
+	{
+		if((ch >= 'A') && (ch <= 'Z'))
+		{
+			caps++;
+			ch += 'a' - 'A';
 		}
-		else
+		lower[nlower++] = ch;
+		if(nlower == sizeof(lower))
+		{
+			hash = crc32c(hash, lower, nlower);
+			nlower = 0;
+		}
+		if(!check_words)
+			continue;
+
+		/* colour codes are \003, then up to two digits, then optionally
+		 * a comma and up to two more; taken from xchat */
+		if(spamserv_conf.strip_mirc_codes)
 		{
+			if(col && ((isdigit((unsigned char)ch) && nc < 2) || (ch == ',' && isdigit((unsigned char)pos[1]) && nc < 3)))
+			{
+				nc = (ch == ',') ? 0 : nc + 1;
+				continue;
+			}
+
 			col = 0;
 
-			switch(*text)
+			switch(ch)
 			{
 			case '\003':
 				col = 1;
 				nc = 0;
-				break;
+				continue;
 			case '\002':
 			case '\022':
-			case '\026':			
+			case '\026':
 			case '\031':
 			case '\037':
-				break;
-			default:
-				new_str[i] = *text;
-				i++;
+				continue;
 			}
 		}
 
-		text++;
-		len--;
-	}
-
-	new_str[i] = '\0';
+		/* an exception overrides everything else */
+		if(!(scan->words & WORD_EXCEPTION))
+			scan->words |= wordmatch_step(cInfo->words, &state, ch);
 
-	return new_str;
-}
+		if(!check_adv || scan->advert)
+			continue;
 
-static int
-is_in_exception_list(struct chanInfo *cInfo, char *message)
-{
-	unsigned int i;
+		if(in_chan)
+		{
+			/* only an advert if the channel does exist */
+			if(ch != ' ')
+			{
+				if(chanlen < sizeof(channelname))
+					channelname[chanlen++] = ch;
+				continue;
+			}
+			in_chan = 0;
+			if(chanlen < sizeof(channelname))
+			{
+				channelname[chanlen] = '\0';
+				scan->advert = GetChannel(channelname) != NULL;
+			}
+		}
+		else if(ch == '#')
+		{
+			if(!spamserv_conf.adv_chan_must_exist)
+				scan->advert = 1;
+			in_chan = 1;
+			channelname[0] = ch;
+			chanlen = 1;
+			recent = 0;
+		}
+		else
+		{
+			if((ch == '.') && (((recent & 0xFFFFFF) == ADV_TAIL('w', 'w', 'w')) || ((recent & 0xFFFFFF) == ADV_TAIL('f', 't', 'p'))))
+				scan->advert = 1;
+			else if((ch == ':') && (((recent & 0xFFFFFF) == ADV_TAIL('f', 't', 'p')) || (recent == (('h' << 24) | ADV_TAIL('t', 't', 'p')))))
+				scan->advert = 1;
+			recent = (recent << 8) | (unsigned char)ch;
+		}
+	}
 
-	for(i = 0; i < cInfo->exceptions->used; i++)
-		if(strstr(message, cInfo->exceptions->list[i]))
-			return 1;
+	if(in_chan && !scan->advert && (chanlen < sizeof(channelname)))
+	{
+		channelname[chanlen] = '\0';
+		scan->advert = GetChannel(channelname) != NULL;
+	}
 
-	return 0;
+	scan->length = pos - text;
+	scan->caps = caps;
+	scan->hash = crc32c(hash, lower, nlower);
 }
 
 static int
-is_in_badword_list(struct chanInfo *cInfo, char *message)
+check_caps(struct chanInfo *cInfo, struct message_scan *scan)
 {
-	unsigned int i;
-
-	for(i = 0; i < cInfo->badwords->used; i++)
-		if(strstr(message, cInfo->badwords->list[i]))
-			return 1;
-
-	return 0;
+	return (scan->length >= cInfo->capsmin) && (scan->caps >= cInfo->capsmin)
+		&& (scan->caps * 100 >= cInfo->capspercent * scan->length);
 }
 
 static int
-check_caps(struct chanInfo *cInfo, char *message)
+check_badwords(struct message_scan *scan)
 {
-        int c;
-
-	if ( (c = strlen(message)) >= cInfo->capsmin) {
-		int i = 0;
-		char *s = strdup(message);
-
-		do {
-			if (isupper(*s))
-				i++;
-		} while (*s++);
-
-		if (i >= cInfo->capsmin && i * 100 / c >= cInfo->capspercent)
-			return 1;
-	}
-
-	return 0;
+	return !(scan->words & WORD_EXCEPTION) && (scan->words & WORD_BADWORD);
 }
 
 static int
-check_badwords(struct chanInfo *cInfo, char *message)
+check_advertising(struct message_scan *scan)
 {
-	if(spamserv_conf.strip_mirc_codes)
-		message = strip_mirc_codes(message);
-
-	/* This needs improving */
-	if(is_in_exception_list(cInfo, message))
-		return 0;
-
-	if(is_in_badword_list(cInfo, message))
-		return 1;
-
-	return 0;
-}
-
-static int
-check_advertising(struct chanInfo *cInfo, char *message)
-{
-	unsigned int i = 0;
-
-	if(spamserv_conf.strip_mirc_codes)
-		message = strip_mirc_codes(message);
-
-	if(is_in_exception_list(cInfo, message))
-		return 0;
-
-	while(message[i] != 0)
-	{
-		if(message[i] == '#')
-		{
-			char channelname[CHANNELLEN];
-			unsigned int j = 0;
-
-			if(!spamserv_conf.adv_chan_must_exist)
-				return 1;
-
-			/* only return 1, if the channel does exist */	
-
-			while((message[i] != 0) && (message[i] != ' '))
-			{
-				channelname[j] = message[i];
-				i++;
-				j++;				
-			}
-
-			channelname[j] = '\0';
-
-			if(GetChannel(channelname))
-				return 1;
-		}
-		else if((message[i] == 'w') && (message[i+1] == 'w') && (message[i+2] == 'w') && (message[i+3] == '.'))
-			return 1;
-		else if((message[i] == 'h') && (message[i+1] == 't') && (message[i+2] == 't') && (message[i+3] == 'p') && (message[i+4] == ':'))
-			return 1;
-		else if((message[i] == 'f') && (message[i+1] == 't') && (message[i+2] == 'p') && ((message[i+3] == '.') || (message[i+3] == ':')))
-			return 1;
-
-		i++;
-	}
-
-	return 0;
+	return !(scan->words & WORD_EXCEPTION) && scan->advert;
 }
 
 static void
@@ -2600,6 +2554,7 @@ spamserv_channel_message(struct chanNode *channel, struct userNode *user, char *
 	struct spamNode *sNode;
 	struct floodNode *fNode;
         struct trusted_account *ta;
+	struct message_scan scan;
 	unsigned int violation = 0;
 	char reason[MAXLEN];
 
@@ -2628,7 +2583,9 @@ spamserv_channel_message(struct chanNode *channel, struct userNode *user, char *
         if(uData && (uData->access >= cInfo->exceptlevel))
             return;
 
-	if(CHECK_CAPSSCAN(cInfo) && check_caps(cInfo, text))
+	scan_message(cInfo, text, &scan);
+
+	if(CHECK_CAPSSCAN(cInfo) && check_caps(cInfo, &scan))
 	{
                 if(uData && (uData->access >= cInfo->exceptcapslevel))
                     return;
@@ -2663,78 +2620,63 @@ spamserv_channel_message(struct chanNode *channel, struct userNode *user, char *
 
         }
 
-	to_lower(text);
-
 	if(CHECK_SPAM(cInfo))
 	{
                 if(uData && (uData->access >= cInfo->exceptspamlevel))
                     return;
 
-		if(!(sNode = uInfo->spam))
+		if(!(sNode = spamserv_find_spamNode(uInfo, channel)))
 		{
-			spamserv_create_spamNode(channel, uInfo, text);
+			spamserv_create_spamNode(channel, uInfo, scan.hash);
 		}
 		else
 		{
-			for(; sNode; sNode = sNode->next)
-				if(sNode->channel == channel)
-					break;
-
-			if(!sNode)
+			if(scan.hash == sNode->hash)
 			{
-				spamserv_create_spamNode(channel, uInfo, text);
-			}
-			else
-			{
-				unsigned long crc = crc32(text);
+				unsigned int spamlimit = 2;
+				sNode->count++;
 
-				if(crc == sNode->crc32)
+				switch(cInfo->info[ci_SpamLimit])
 				{
-					unsigned int spamlimit = 2;
-					sNode->count++;
-
-					switch(cInfo->info[ci_SpamLimit])
-					{
-						case 'a': spamlimit = 2; break;
-						case 'b': spamlimit = 3; break;
-						case 'c': spamlimit = 4; break;
-						case 'd': spamlimit = 5; break;
-						case 'e': spamlimit = 6; break;
-					}
-
-					if(sNode->count == spamlimit)
-					{
-						uInfo->warnlevel += SPAM_WARNLEVEL;
+					case 'a': spamlimit = 2; break;
+					case 'b': spamlimit = 3; break;
+					case 'c': spamlimit = 4; break;
+					case 'd': spamlimit = 5; break;
+					case 'e': spamlimit = 6; break;
+				}
 
-						if(uInfo->warnlevel < MAX_WARNLEVEL) {
-							if (spamserv_conf.network_rules)
-								spamserv_notice(user, "SSMSG_WARNING_RULES_T", SSMSG_SPAM, spamserv_conf.network_rules);
-							else
-								spamserv_notice(user, "SSMSG_WARNING_T", SSMSG_SPAM, spamserv_conf.network_rules);
-						}
-					}
-					else if(sNode->count > spamlimit)
-					{
-						switch(cInfo->info[ci_WarnReaction])
-						{
-							case 'k': uInfo->flags |= USER_KICK; break;
-							case 'b': uInfo->flags |= USER_KICKBAN; break;
-							case 's': uInfo->flags |= USER_SHORT_TBAN; break;
-							case 'l': uInfo->flags |= USER_LONG_TBAN; break;
-							case 'd': uInfo->flags |= CHECK_KILLED(uInfo) ? USER_GLINE : USER_KILL; break;
-						}
+				if(sNode->count == spamlimit)
+				{
+					uInfo->warnlevel += SPAM_WARNLEVEL;
 
-						spamserv_delete_spamNode(uInfo, sNode);
-						uInfo->warnlevel += SPAM_WARNLEVEL;
-						violation = 1;
+					if(uInfo->warnlevel < MAX_WARNLEVEL) {
+						if (spamserv_conf.network_rules)
+							spamserv_notice(user, "SSMSG_WARNING_RULES_T", SSMSG_SPAM, spamserv_conf.network_rules);
+						else
+							spamserv_notice(user, "SSMSG_WARNING_T", SSMSG_SPAM, spamserv_conf.network_rules);
 					}
 				}
-				else
+				else if(sNode->count > spamlimit)
 				{
-					sNode->crc32 = crc;					
-					sNode->count = 1;
+					switch(cInfo->info[ci_WarnReaction])
+					{
+						case 'k': uInfo->flags |= USER_KICK; break;
+						case 'b': uInfo->flags |= USER_KICKBAN; break;
+						case 's': uInfo->flags |= USER_SHORT_TBAN; break;
+						case 'l': uInfo->flags |= USER_LONG_TBAN; break;
+						case 'd': uInfo->flags |= CHECK_KILLED(uInfo) ? USER_GLINE : USER_KILL; break;
+					}
+
+					spamserv_delete_spamNode(sNode);
+					uInfo->warnlevel += SPAM_WARNLEVEL;
+					violation = 1;
 				}
 			}
+			else
+			{
+				sNode->hash = scan.hash;
+				sNode->count = 1;
+			}
 		}
 	}
 
@@ -2790,7 +2732,7 @@ spamserv_channel_message(struct chanNode *channel, struct userNode *user, char *
 		}
 	}
 
-	if(CHECK_BADWORDSCAN(cInfo) && check_badwords(cInfo, text))
+	if(CHECK_BADWORDSCAN(cInfo) && check_badwords(&scan))
 	{
                 if(uData && (uData->access >= cInfo->exceptbadwordlevel))
                     return;
@@ -2824,7 +2766,7 @@ spamserv_channel_message(struct chanNode *channel, struct userNode *user, char *
 		}
 	}
 
-	if(CHECK_ADV(cInfo) && check_advertising(cInfo, text))
+	if(CHECK_ADV(cInfo) && check_advertising(&scan))
 	{
                 if(uData && (uData->access >= cInfo->exceptspamlevel))
                     return;
@@ -3193,6 +3135,11 @@ spamserv_db_cleanup(UNUSED_ARG(void* extra))
 {
 	dict_iterator_t it;
 
+	/* hash_cleanup() runs after this and still deletes users and
+	 * memberships, so stop listening before the dicts go away. */
+	unreg_del_users_func(spamserv_del_users_func, NULL);
+	unreg_part_func(spamserv_user_part, NULL);
+
 	while((it = dict_first(registered_channels_dict)))
 	{
 		spamserv_unregister_channel(iter_data(it));
@@ -3244,10 +3191,10 @@ init_spamserv(const char *nick)
 
 	saxdb_register("SpamServ", spamserv_saxdb_read, spamserv_saxdb_write);
 
-	reg_new_user_func(spamserv_new_user_func, NULL);
-	reg_del_user_func(spamserv_del_user_func, NULL);
+	reg_burst_new_user_func(spamserv_new_user_func, NULL);
+	reg_del_users_func(spamserv_del_users_func, NULL);
 	reg_nick_change_func(spamserv_nick_change_func, NULL);
-	reg_join_func(spamserv_user_join, NULL);
+	reg_burst_join_func(spamserv_user_join, NULL);
 	reg_part_func(spamserv_user_part, NULL);
 
 	timeq_add(now + FLOOD_TIMEQ_FREQ, timeq_flood, NULL);
@@ -3305,5 +3252,4 @@ init_spamserv(const char *nick)
 
 	reg_exit_func(spamserv_db_cleanup, NULL);
 	message_register_table(msgtab);
-	crc32_init();
 }
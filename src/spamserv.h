@@ -67,6 +67,7 @@ struct chanInfo
     struct chanNode        *channel;
     struct string_list     *exceptions;
     struct string_list     *badwords;
+    struct wordmatch       *words;     /* both lists, built when needed */
     unsigned int           exceptlevel;
     unsigned int           exceptadvlevel;
     unsigned int           exceptbadwordlevel;
@@ -141,11 +142,9 @@ struct chanInfo
 
 struct spamNode
 {
-	struct chanNode		*channel;
-	unsigned long		crc32;
+	struct chanNode		*channel;	/* NULL if the slot is free */
+	unsigned int		hash;		/* of the last line sent there */
 	unsigned int		count;
-	struct spamNode		*prev;
-	struct spamNode		*next;
 };
 
 struct floodNode
@@ -167,7 +166,8 @@ struct killNode
 struct userInfo
 {
     struct userNode		*user;
-	struct spamNode		*spam;
+	struct spamNode		*spam;		/* last line in each channel, allocated on the first one checked */
+	unsigned int		spamsize;	/* slots in spam */
 	struct floodNode	*flood;
 	struct floodNode	*joinflood;
 	unsigned int		flags : 30;
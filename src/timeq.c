@@ -19,107 +19,477 @@
  */
 
 #include "common.h"
-#include "heap.h"
 #include "timeq.h"
 
-heap_t timeq;
+/* Events live in a hierarchical timer wheel with millisecond ticks.
+ * Level 0 has one slot per millisecond for the next 256ms; each
+ * higher level has 64 slots, each as wide as the whole level below
+ * it.  Entries cascade down a level whenever the level below wraps.
+ * Events more than TIMEQ_MAX_DELTA away sit in the last slot of the
+ * top level and are re-filed each time that slot cascades. */
+#define TIMEQ_L0_BITS   8
+#define TIMEQ_LN_BITS   6
+#define TIMEQ_LEVELS    6
+#define TIMEQ_L0_SIZE   (1 << TIMEQ_L0_BITS)
+#define TIMEQ_LN_SIZE   (1 << TIMEQ_LN_BITS)
+#define TIMEQ_SHIFT(LVL) ((LVL) ? TIMEQ_L0_BITS + ((LVL) - 1) * TIMEQ_LN_BITS : 0)
+#define TIMEQ_MAX_DELTA ((((uint64_t)1) << TIMEQ_SHIFT(TIMEQ_LEVELS)) - 1)
+/* Pseudo-level for entries detached from the wheel by timeq_run(). */
+#define TIMEQ_RUNNING   TIMEQ_LEVELS
 
 struct timeq_entry {
+    /* wheel slot (or running batch) list */
+    struct timeq_entry *next;
+    struct timeq_entry **pprev;
+    /* (func, data) index chain, used by timeq_del() */
+    struct timeq_entry *hnext;
+    struct timeq_entry **hpprev;
+    uint64_t expires;
     timeq_func func;
     void *data;
+    struct timeq_func_stats *stats;
+    unsigned int level;
 };
 
+static struct timeq_entry *timeq_wheel[TIMEQ_LEVELS][TIMEQ_L0_SIZE];
+static unsigned int timeq_level_count[TIMEQ_LEVELS + 1];
+static struct timeq_entry *timeq_running_batch;
+static unsigned int timeq_count;
+static uint64_t timeq_time;
+static int timeq_running;
+
+static uint64_t timeq_next_expiry;
+static int timeq_next_valid;
+
+static struct timeq_entry **timeq_index;
+static unsigned int timeq_index_mask;
+
+static struct timeq_func_stats **timeq_stats_list;
+static unsigned int timeq_stats_used, timeq_stats_size;
+static struct timeq_func_stats **timeq_stats_table;
+static unsigned int timeq_stats_mask;
+
+static int timeq_initialized;
+
 static void
 timeq_cleanup(UNUSED_ARG(void *extra))
 {
+    unsigned int ii;
+
     timeq_del(0, 0, 0, TIMEQ_IGNORE_WHEN|TIMEQ_IGNORE_FUNC|TIMEQ_IGNORE_DATA);
-    heap_delete(timeq);
-    timeq = NULL;
+    free(timeq_index);
+    timeq_index = NULL;
+    for (ii = 0; ii < timeq_stats_used; ++ii)
+        free(timeq_stats_list[ii]);
+    free(timeq_stats_list);
+    free(timeq_stats_table);
+    timeq_stats_list = timeq_stats_table = NULL;
+    timeq_stats_used = timeq_stats_size = 0;
+    timeq_initialized = 0;
+}
+
+/*
+ *    Current time in milliseconds.  The sub-second part is only used
+ *    when the wall clock agrees with "now", which it does not while
+ *    replaying a log.
+ */
+static uint64_t
+timeq_now_msec(void)
+{
+    extern int clock_skew;
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    if ((time_t)(tv.tv_sec + clock_skew) == now)
+        return (uint64_t)now * 1000 + tv.tv_usec / 1000;
+    return (uint64_t)now * 1000;
 }
 
 static void
 timeq_init(void)
 {
-    timeq = heap_new(ulong_comparator);
+    timeq_index_mask = 255;
+    timeq_index = calloc(timeq_index_mask + 1, sizeof(timeq_index[0]));
+    timeq_stats_mask = 63;
+    timeq_stats_table = calloc(timeq_stats_mask + 1, sizeof(timeq_stats_table[0]));
+    timeq_time = timeq_now_msec();
+    timeq_initialized = 1;
     reg_exit_func(timeq_cleanup, NULL);
 }
 
-unsigned long
-timeq_next(void)
+static unsigned int
+timeq_ptr_hash(const void *func, const void *data)
 {
-    void *timep;
-    if (!timeq)
-        return ~0;
-    heap_peek(timeq, &timep, 0);
-    return (unsigned long)timep;
+    size_t val = (size_t)func ^ ((size_t)data * 2654435761u);
+    return (unsigned int)(val ^ (val >> 16));
 }
 
-void
-timeq_add(unsigned long when, timeq_func func, void *data)
+static struct timeq_func_stats *
+timeq_find_stats(timeq_func func, const char *name)
+{
+    struct timeq_func_stats *stats;
+    unsigned int pos, ii;
+
+    for (pos = timeq_ptr_hash(func, NULL) & timeq_stats_mask;
+         (stats = timeq_stats_table[pos]);
+         pos = (pos + 1) & timeq_stats_mask)
+        if (stats->func == func)
+            return stats;
+
+    stats = calloc(1, sizeof(*stats));
+    stats->func = func;
+    stats->name = name;
+    if (timeq_stats_used == timeq_stats_size) {
+        timeq_stats_size = timeq_stats_size ? timeq_stats_size * 2 : 16;
+        timeq_stats_list = realloc(timeq_stats_list, timeq_stats_size * sizeof(timeq_stats_list[0]));
+    }
+    timeq_stats_list[timeq_stats_used++] = stats;
+    if (timeq_stats_used * 2 > timeq_stats_mask + 1) {
+        free(timeq_stats_table);
+        timeq_stats_mask = timeq_stats_mask * 2 + 1;
+        timeq_stats_table = calloc(timeq_stats_mask + 1, sizeof(timeq_stats_table[0]));
+        for (ii = 0; ii < timeq_stats_used; ++ii) {
+            for (pos = timeq_ptr_hash(timeq_stats_list[ii]->func, NULL) & timeq_stats_mask;
+                 timeq_stats_table[pos];
+                 pos = (pos + 1) & timeq_stats_mask) ;
+            timeq_stats_table[pos] = timeq_stats_list[ii];
+        }
+    } else {
+        timeq_stats_table[pos] = stats;
+    }
+    return stats;
+}
+
+struct timeq_func_stats **
+timeq_get_func_stats(unsigned int *count)
+{
+    *count = timeq_stats_used;
+    return timeq_stats_list;
+}
+
+static void
+timeq_link(struct timeq_entry **head, struct timeq_entry *ent)
+{
+    ent->next = *head;
+    if (ent->next)
+        ent->next->pprev = &ent->next;
+    ent->pprev = head;
+    *head = ent;
+}
+
+static void
+timeq_unlink(struct timeq_entry *ent)
+{
+    *ent->pprev = ent->next;
+    if (ent->next)
+        ent->next->pprev = ent->pprev;
+    timeq_level_count[ent->level]--;
+}
+
+/*
+ *    File an entry in the wheel slot matching its expiry.
+ */
+static void
+timeq_file(struct timeq_entry *ent)
+{
+    uint64_t expires, delta;
+    unsigned int lvl;
+
+    expires = ent->expires;
+    if (expires < timeq_time)
+        expires = timeq_time;
+    delta = expires - timeq_time;
+    if (delta > TIMEQ_MAX_DELTA) {
+        delta = TIMEQ_MAX_DELTA;
+        expires = timeq_time + delta;
+    }
+    if (delta < TIMEQ_L0_SIZE) {
+        lvl = 0;
+        ent->level = 0;
+        timeq_link(&timeq_wheel[0][expires & (TIMEQ_L0_SIZE - 1)], ent);
+    } else {
+        for (lvl = 1; delta >> TIMEQ_SHIFT(lvl + 1); ++lvl) ;
+        ent->level = lvl;
+        timeq_link(&timeq_wheel[lvl][(expires >> TIMEQ_SHIFT(lvl)) & (TIMEQ_LN_SIZE - 1)], ent);
+    }
+    timeq_level_count[lvl]++;
+}
+
+static void
+timeq_index_grow(void)
+{
+    struct timeq_entry **old_index, *ent, *next;
+    unsigned int old_size, ii, pos;
+
+    old_index = timeq_index;
+    old_size = timeq_index_mask + 1;
+    timeq_index_mask = old_size * 2 - 1;
+    timeq_index = calloc(timeq_index_mask + 1, sizeof(timeq_index[0]));
+    for (ii = 0; ii < old_size; ++ii) {
+        for (ent = old_index[ii]; ent; ent = next) {
+            next = ent->hnext;
+            pos = timeq_ptr_hash(ent->func, ent->data) & timeq_index_mask;
+            ent->hnext = timeq_index[pos];
+            if (ent->hnext)
+                ent->hnext->hpprev = &ent->hnext;
+            ent->hpprev = &timeq_index[pos];
+            timeq_index[pos] = ent;
+        }
+    }
+    free(old_index);
+}
+
+static timeq_handle
+timeq_insert(uint64_t expires, timeq_func func, void *data, const char *name)
 {
     struct timeq_entry *ent;
-    void *w;
-    ent = malloc(sizeof(struct timeq_entry));
+    unsigned int pos;
+
+    if (!timeq_initialized)
+        timeq_init();
+    if (!timeq_count && !timeq_running) {
+        /* Nothing is waiting, so the wheel can jump straight to now. */
+        timeq_time = timeq_now_msec();
+    }
+    ent = malloc(sizeof(*ent));
+    ent->expires = expires;
     ent->func = func;
     ent->data = data;
-    w = (void*)when;
-    if (!timeq)
-        timeq_init();
-    heap_insert(timeq, w, ent);
+    ent->stats = timeq_find_stats(func, name);
+    ent->stats->added++;
+    ent->stats->pending++;
+    timeq_file(ent);
+
+    if (timeq_count >= timeq_index_mask + 1)
+        timeq_index_grow();
+    pos = timeq_ptr_hash(func, data) & timeq_index_mask;
+    ent->hnext = timeq_index[pos];
+    if (ent->hnext)
+        ent->hnext->hpprev = &ent->hnext;
+    ent->hpprev = &timeq_index[pos];
+    timeq_index[pos] = ent;
+
+    if (!timeq_count) {
+        timeq_next_expiry = expires;
+        timeq_next_valid = 1;
+    } else if (timeq_next_valid && expires < timeq_next_expiry) {
+        timeq_next_expiry = expires;
+    }
+    timeq_count++;
+    return ent;
 }
 
-struct timeq_extra {
-    unsigned long when;
-    timeq_func func;
-    void *data;
-    int mask;
-};
+timeq_handle
+timeq_add_named(unsigned long when, timeq_func func, void *data, const char *name)
+{
+    return timeq_insert((uint64_t)when * 1000, func, data, name);
+}
+
+timeq_handle
+timeq_add_msec_named(unsigned long msec, timeq_func func, void *data, const char *name)
+{
+    return timeq_insert(timeq_now_msec() + msec, func, data, name);
+}
+
+/*
+ *    Take an entry out of the queue without running it.
+ */
+static void
+timeq_forget(struct timeq_entry *ent)
+{
+    timeq_unlink(ent);
+    *ent->hpprev = ent->hnext;
+    if (ent->hnext)
+        ent->hnext->hpprev = ent->hpprev;
+    ent->stats->pending--;
+    timeq_count--;
+    if (timeq_next_valid && ent->expires <= timeq_next_expiry)
+        timeq_next_valid = 0;
+}
+
+void
+timeq_cancel(timeq_handle handle)
+{
+    if (!handle)
+        return;
+    timeq_forget(handle);
+    handle->stats->cancelled++;
+    free(handle);
+}
 
 static int
-timeq_del_matching(void *key, void *data, void *extra)
-{
-    struct timeq_entry *a = data;
-    struct timeq_extra *b = extra;
-    if (((b->mask & TIMEQ_IGNORE_WHEN) || ((unsigned long)key == b->when))
-        && ((b->mask & TIMEQ_IGNORE_FUNC) || (a->func == b->func))
-        && ((b->mask & TIMEQ_IGNORE_DATA) || (a->data == b->data))) {
-        free(data);
-        return 1;
-    } else {
-        return 0;
+timeq_matches(struct timeq_entry *ent, unsigned long when, timeq_func func, void *data, int mask)
+{
+    return ((mask & TIMEQ_IGNORE_WHEN) || (ent->expires / 1000 == when))
+        && ((mask & TIMEQ_IGNORE_FUNC) || (ent->func == func))
+        && ((mask & TIMEQ_IGNORE_DATA) || (ent->data == data));
+}
+
+static void
+timeq_del_list(struct timeq_entry *ent, unsigned long when, timeq_func func, void *data, int mask)
+{
+    struct timeq_entry *next;
+
+    for (; ent; ent = next) {
+        next = ent->next;
+        if (timeq_matches(ent, when, func, data, mask))
+            timeq_cancel(ent);
     }
 }
 
 void
 timeq_del(unsigned long when, timeq_func func, void *data, int mask)
 {
-    struct timeq_extra extra;
-    extra.when = when;
-    extra.func = func;
-    extra.data = data;
-    extra.mask = mask;
-    if (timeq)
-        heap_remove_pred(timeq, timeq_del_matching, &extra);
+    struct timeq_entry *ent, *next;
+    unsigned int lvl, idx;
+
+    if (!timeq_count)
+        return;
+    if (!(mask & (TIMEQ_IGNORE_FUNC | TIMEQ_IGNORE_DATA))) {
+        /* Exact (func, data) pairs can use the index. */
+        for (ent = timeq_index[timeq_ptr_hash(func, data) & timeq_index_mask]; ent; ent = next) {
+            next = ent->hnext;
+            if (timeq_matches(ent, when, func, data, mask))
+                timeq_cancel(ent);
+        }
+        return;
+    }
+    for (lvl = 0; lvl < TIMEQ_LEVELS; ++lvl)
+        for (idx = 0; idx < (lvl ? TIMEQ_LN_SIZE : TIMEQ_L0_SIZE); ++idx)
+            timeq_del_list(timeq_wheel[lvl][idx], when, func, data, mask);
+    timeq_del_list(timeq_running_batch, when, func, data, mask);
+}
+
+/*
+ *    Re-file entries from higher levels once the level below them
+ *    wraps around.
+ */
+static void
+timeq_cascade(void)
+{
+    struct timeq_entry *ent;
+    unsigned int lvl, idx;
+
+    for (lvl = 1; lvl < TIMEQ_LEVELS; ++lvl) {
+        idx = (timeq_time >> TIMEQ_SHIFT(lvl)) & (TIMEQ_LN_SIZE - 1);
+        while ((ent = timeq_wheel[lvl][idx])) {
+            timeq_unlink(ent);
+            timeq_file(ent);
+        }
+        if (idx)
+            break;
+    }
+}
+
+static uint64_t
+timeq_min_expiry(struct timeq_entry *ent, uint64_t best)
+{
+    for (; ent; ent = ent->next)
+        if (ent->expires < best)
+            best = ent->expires;
+    return best;
+}
+
+static uint64_t
+timeq_get_next_expiry(void)
+{
+    uint64_t best;
+    unsigned int lvl, idx, ii, first, size;
+
+    if (timeq_next_valid)
+        return timeq_next_expiry;
+    /* The first occupied slot of each level, counting from the
+     * current position, holds that level's earliest entry.  Above
+     * level 0 the current slot has already cascaded, so anything in
+     * it wrapped around from nearly a whole level ahead: look at it
+     * last. */
+    best = ~(uint64_t)0;
+    for (lvl = 0; lvl < TIMEQ_LEVELS; ++lvl) {
+        if (!timeq_level_count[lvl])
+            continue;
+        size = lvl ? TIMEQ_LN_SIZE : TIMEQ_L0_SIZE;
+        first = lvl ? 1 : 0;
+        idx = timeq_time >> TIMEQ_SHIFT(lvl);
+        for (ii = first; ii < first + size; ++ii) {
+            if (timeq_wheel[lvl][(idx + ii) & (size - 1)]) {
+                best = timeq_min_expiry(timeq_wheel[lvl][(idx + ii) & (size - 1)], best);
+                break;
+            }
+        }
+    }
+    best = timeq_min_expiry(timeq_running_batch, best);
+    timeq_next_expiry = best;
+    timeq_next_valid = 1;
+    return best;
+}
+
+unsigned long
+timeq_next(void)
+{
+    if (!timeq_count)
+        return ~0;
+    return timeq_get_next_expiry() / 1000;
+}
+
+unsigned long
+timeq_wait_msec(void)
+{
+    uint64_t next, curr;
+
+    if (!timeq_count)
+        return ~0;
+    next = timeq_get_next_expiry();
+    curr = timeq_now_msec();
+    return (next > curr) ? (unsigned long)(next - curr) : 0;
 }
 
 unsigned int
 timeq_size(void)
 {
-    return heap_size(timeq);
+    return timeq_count;
 }
 
 void
 timeq_run(void)
 {
-    void *k, *d;
     struct timeq_entry *ent;
-    while (heap_size(timeq) > 0) {
-        heap_peek(timeq, &k, &d);
-        if ((time_t)k > now)
-            break;
-        ent = d;
-        heap_pop(timeq);
-        ent->func(ent->data);
-        free(ent);
+    uint64_t target, next;
+    unsigned int lvl;
+
+    if (!timeq_count || timeq_running)
+        return;
+    timeq_running = 1;
+    target = timeq_now_msec();
+    while ((timeq_time <= target) && timeq_count) {
+        if (!(timeq_time & (TIMEQ_L0_SIZE - 1)))
+            timeq_cascade();
+        if (!timeq_level_count[0]) {
+            /* Nothing can come due before the next boundary of the
+             * lowest occupied level, so skip ahead to it. */
+            for (lvl = 1; (lvl < TIMEQ_LEVELS - 1) && !timeq_level_count[lvl]; ++lvl) ;
+            next = ((timeq_time >> TIMEQ_SHIFT(lvl)) + 1) << TIMEQ_SHIFT(lvl);
+            timeq_time = (next > target) ? target + 1 : next;
+            continue;
+        }
+
+        /* Detach this tick's slot so that events added by callbacks
+         * for "now" wait for the next tick instead of this loop. */
+        while ((ent = timeq_wheel[0][timeq_time & (TIMEQ_L0_SIZE - 1)])) {
+            timeq_unlink(ent);
+            ent->level = TIMEQ_RUNNING;
+            timeq_level_count[TIMEQ_RUNNING]++;
+            timeq_link(&timeq_running_batch, ent);
+        }
+        timeq_time++;
+        while ((ent = timeq_running_batch)) {
+            timeq_forget(ent);
+            ent->stats->run++;
+            ent->func(ent->data);
+            free(ent);
+        }
+        timeq_next_valid = 0;
     }
+    if (!timeq_count)
+        timeq_time = target + 1;
+    timeq_running = 0;
 }
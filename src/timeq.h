@@ -23,14 +23,37 @@
 
 typedef void (*timeq_func)(void *data);
 
+/* Handle for a queued event.  It is only valid until the event runs
+ * or is cancelled; holders must forget it in their callback. */
+typedef struct timeq_entry *timeq_handle;
+
+/* Per-callback counters, for "stats timeq". */
+struct timeq_func_stats {
+    timeq_func func;
+    const char *name;
+    unsigned int pending;
+    unsigned long added;
+    unsigned long run;
+    unsigned long cancelled;
+};
+
 #define TIMEQ_IGNORE_WHEN    0x01
 #define TIMEQ_IGNORE_FUNC    0x02
 #define TIMEQ_IGNORE_DATA    0x04
 
-void timeq_add(unsigned long when, timeq_func func, void *data);
+/* timeq_add() schedules an event for the absolute time WHEN (in
+ * seconds); timeq_add_msec() schedules one MSEC milliseconds from
+ * now.  Both record the callback's name for the statistics. */
+#define timeq_add(WHEN, FUNC, DATA) timeq_add_named((WHEN), (FUNC), (DATA), #FUNC)
+#define timeq_add_msec(MSEC, FUNC, DATA) timeq_add_msec_named((MSEC), (FUNC), (DATA), #FUNC)
+timeq_handle timeq_add_named(unsigned long when, timeq_func func, void *data, const char *name);
+timeq_handle timeq_add_msec_named(unsigned long msec, timeq_func func, void *data, const char *name);
+void timeq_cancel(timeq_handle handle);
 void timeq_del(unsigned long when, timeq_func func, void *data, int mask);
 unsigned long timeq_next(void);
+unsigned long timeq_wait_msec(void);
 unsigned int timeq_size(void);
 void timeq_run(void);
+struct timeq_func_stats **timeq_get_func_stats(unsigned int *count);
 
 #endif /* ndef TIMEQ_H */
@@ -0,0 +1,88 @@
+/* Usage: timeqtest
+ *
+ * Checks that the timer wheel reports the right next expiry when
+ * entries sit in different slots and levels, including ones that have
+ * wrapped around into the current slot of their level, and that
+ * events run in order as the clock moves forward.  Prints nothing and
+ * exits with status 0 if everything checks out.
+ */
+
+#include "common.h"
+#include "timeq.h"
+
+/* timeq.c only needs the clock and the exit hooks. */
+
+time_t now;
+int clock_skew;
+
+void reg_exit_func(UNUSED_ARG(exit_func_t handler), UNUSED_ARG(void *extra)) { }
+
+static unsigned long fired[8];
+static unsigned int fired_count;
+static int failures;
+
+static void
+record_event(void *data)
+{
+    if (fired_count < ArrayLength(fired))
+        fired[fired_count] = (unsigned long)data;
+    fired_count++;
+}
+
+static void
+expect_wait(const char *what, unsigned long expected)
+{
+    unsigned long wait;
+
+    wait = timeq_wait_msec();
+    if (wait != expected) {
+        fprintf(stderr, "%s: timeq_wait_msec() is %lu, expected %lu\n", what, wait, expected);
+        failures++;
+    }
+}
+
+/* Queue one event far ahead and one near, then drop the cached next
+ * expiry so that it has to be found by scanning the wheel. */
+static void
+check_pair(const char *what, unsigned long far_msec, unsigned long near_msec)
+{
+    timeq_del(0, 0, 0, TIMEQ_IGNORE_WHEN|TIMEQ_IGNORE_FUNC|TIMEQ_IGNORE_DATA);
+    timeq_add_msec(far_msec, record_event, (void*)far_msec);
+    timeq_add_msec(near_msec, record_event, (void*)near_msec);
+    timeq_cancel(timeq_add_msec(1, record_event, NULL));
+    expect_wait(what, near_msec);
+}
+
+int
+main(UNUSED_ARG(int argc), UNUSED_ARG(char *argv[]))
+{
+    unsigned long start;
+
+    /* Pick a time that the wall clock does not agree with, so that
+     * the wheel sees whole seconds only. */
+    now = start = 1000;
+
+    /* 16383ms lands in the current level 1 slot; 300ms in the next. */
+    check_pair("level 1 wrap", 16383, 300);
+    /* Nearly a whole level 2 span, against a near level 2 entry. */
+    check_pair("level 2 wrap", (1ul << 20) - 1000, 20000);
+    /* And across levels. */
+    check_pair("level 2 wrap vs level 1", (1ul << 20) - 1000, 5000);
+    check_pair("level 3 wrap vs level 1", (1ul << 26) - 1000, 5000);
+
+    /* Let the last pair run, one second at a time. */
+    while (timeq_size() && (now - start) < (1l << 17)) {
+        now++;
+        timeq_run();
+    }
+    if (fired_count != 2 || fired[0] != 5000 || fired[1] != (1ul << 26) - 1000) {
+        fprintf(stderr, "events ran out of order or not at all (%u ran)\n", fired_count);
+        failures++;
+    }
+    if (now - start != (long)((1ul << 26) - 1000 + 999) / 1000) {
+        fprintf(stderr, "last event ran at +%lds\n", (long)(now - start));
+        failures++;
+    }
+
+    return failures ? 1 : 0;
+}
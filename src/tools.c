@@ -357,54 +357,536 @@ static char irc_tolower[256];
 #undef tolower
 #define tolower(X) irc_tolower[(unsigned char)(X)]
 
+/* Case folding is done with SSE2 or AVX2 where the CPU has them.
+ * The vector code folds the same ranges that tools_init() puts in
+ * irc_tolower[]; tools_init() checks each version against the table
+ * before using it.  Every version takes explicit lengths, so nothing
+ * reads past the end of a string.
+ */
+
+#if defined(WITH_PROTOCOL_P10)
+# define FOLD_ASCII_END '^'     /* A-Z and [\]^ */
+#else
+# define FOLD_ASCII_END 'Z'
+#endif
+
+struct casefold_ops {
+    const char *name;
+    /* index of the first byte that differs after folding, or len */
+    size_t (*mismatch)(const char *stra, const char *strb, size_t len);
+    /* index of the first byte that folds to ch, or len */
+    size_t (*find)(const char *str, size_t len, char ch);
+    void (*lower)(char *str, size_t len);
+    /* mixes in the folded contents of len / 16 blocks of str */
+    unsigned long long (*hash)(const char *str, size_t len, unsigned long long hash);
+};
+
+#define CASEHASH_K1 0x9E3779B97F4A7C15ULL
+#define CASEHASH_K2 0xC2B2AE3D27D4EB4FULL
+
+static inline unsigned long long
+casehash_mix(unsigned long long hash, unsigned long long a, unsigned long long b)
+{
+    hash = (hash ^ a) * CASEHASH_K1;
+    hash = ((hash << 31) | (hash >> 33)) ^ b;
+    return hash * CASEHASH_K2;
+}
+
+static inline unsigned long long
+casehash_block(unsigned long long hash, const char *folded)
+{
+    unsigned long long a, b;
+
+    memcpy(&a, folded, sizeof(a));
+    memcpy(&b, folded + 8, sizeof(b));
+    return casehash_mix(hash, a, b);
+}
+
+static size_t
+casefold_mismatch_scalar(const char *stra, const char *strb, size_t len)
+{
+    size_t ii;
+
+    for (ii = 0; ii < len && tolower(stra[ii]) == tolower(strb[ii]); ii++) ;
+    return ii;
+}
+
+static size_t
+casefold_find_scalar(const char *str, size_t len, char ch)
+{
+    size_t ii;
+
+    for (ii = 0; ii < len && tolower(str[ii]) != ch; ii++) ;
+    return ii;
+}
+
+static void
+casefold_lower_scalar(char *str, size_t len)
+{
+    size_t ii;
+
+    for (ii = 0; ii < len; ii++)
+        str[ii] = tolower(str[ii]);
+}
+
+static unsigned long long
+casefold_hash_scalar(const char *str, size_t len, unsigned long long hash)
+{
+    char folded[16];
+    size_t ii;
+
+    for (; len >= 16; str += 16, len -= 16) {
+        for (ii = 0; ii < 16; ii++)
+            folded[ii] = tolower(str[ii]);
+        hash = casehash_block(hash, folded);
+    }
+    return hash;
+}
+
+static const struct casefold_ops casefold_scalar = {
+    "scalar",
+    casefold_mismatch_scalar,
+    casefold_find_scalar,
+    casefold_lower_scalar,
+    casefold_hash_scalar
+};
+
+#if defined(__SSE2__) && defined(HAVE_IMMINTRIN_H) && defined(__GNUC__)
+#include <immintrin.h>
+#define CASEFOLD_SSE2 1
+
+/* Adds 0x20 to bytes in the upper case ranges.  A byte is in [lo, hi]
+ * when it is below hi - lo + 1 after subtracting lo; the 0x80 bias
+ * turns that into a signed compare. */
+static inline __m128i
+casefold_sse2(__m128i v)
+{
+    __m128i upper;
+
+    upper = _mm_cmplt_epi8(_mm_add_epi8(v, _mm_set1_epi8((char)(0x80 - 'A'))),
+                           _mm_set1_epi8((char)(0x80 + FOLD_ASCII_END - 'A' + 1)));
+#if defined(WITH_PROTOCOL_P10)
+    /* Latin-1 0xc0-0xde, except 0xd7 (multiplication sign) */
+    upper = _mm_or_si128(upper, _mm_andnot_si128(
+        _mm_cmpeq_epi8(v, _mm_set1_epi8((char)0xd7)),
+        _mm_cmplt_epi8(_mm_add_epi8(v, _mm_set1_epi8((char)(0x80 - 0xc0))),
+                       _mm_set1_epi8((char)(0x80 + 0xde - 0xc0 + 1)))));
+#endif
+    return _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+static size_t
+casefold_mismatch_sse2(const char *stra, const char *strb, size_t len)
+{
+    size_t ii;
+    unsigned int mask;
+
+    for (ii = 0; ii + 16 <= len; ii += 16) {
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+            casefold_sse2(_mm_loadu_si128((const __m128i*)(stra + ii))),
+            casefold_sse2(_mm_loadu_si128((const __m128i*)(strb + ii)))));
+        if (mask != 0xffff)
+            return ii + __builtin_ctz(~mask);
+    }
+    return ii + casefold_mismatch_scalar(stra + ii, strb + ii, len - ii);
+}
+
+static size_t
+casefold_find_sse2(const char *str, size_t len, char ch)
+{
+    __m128i want = _mm_set1_epi8(ch);
+    size_t ii;
+    unsigned int mask;
+
+    for (ii = 0; ii + 16 <= len; ii += 16) {
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+            casefold_sse2(_mm_loadu_si128((const __m128i*)(str + ii))), want));
+        if (mask)
+            return ii + __builtin_ctz(mask);
+    }
+    return ii + casefold_find_scalar(str + ii, len - ii, ch);
+}
+
+static void
+casefold_lower_sse2(char *str, size_t len)
+{
+    size_t ii;
+
+    for (ii = 0; ii + 16 <= len; ii += 16)
+        _mm_storeu_si128((__m128i*)(str + ii),
+                         casefold_sse2(_mm_loadu_si128((const __m128i*)(str + ii))));
+    casefold_lower_scalar(str + ii, len - ii);
+}
+
+static unsigned long long
+casefold_hash_sse2(const char *str, size_t len, unsigned long long hash)
+{
+    char folded[16];
+
+    for (; len >= 16; str += 16, len -= 16) {
+        _mm_storeu_si128((__m128i*)folded,
+                         casefold_sse2(_mm_loadu_si128((const __m128i*)str)));
+        hash = casehash_block(hash, folded);
+    }
+    return hash;
+}
+
+static const struct casefold_ops casefold_sse2_ops = {
+    "sse2",
+    casefold_mismatch_sse2,
+    casefold_find_sse2,
+    casefold_lower_sse2,
+    casefold_hash_sse2
+};
+
+#if defined(HAVE_TARGET_AVX2)
+#define CASEFOLD_AVX2 1
+#define AVX2_FUNC __attribute__((target("avx2")))
+
+/* Each AVX2 function hands short input, and whatever is left after its
+ * 32-byte blocks, to the SSE2 version.  It clears the upper halves of
+ * the vector registers first: compilers do not always do that before a
+ * tail call, and SSE code run with dirty AVX state is much slower than
+ * anything the wider vectors save. */
+
+AVX2_FUNC static inline __m256i
+casefold_avx2(__m256i v)
+{
+    __m256i upper;
+
+    upper = _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(0x80 + FOLD_ASCII_END - 'A' + 1)),
+                              _mm256_add_epi8(v, _mm256_set1_epi8((char)(0x80 - 'A'))));
+#if defined(WITH_PROTOCOL_P10)
+    upper = _mm256_or_si256(upper, _mm256_andnot_si256(
+        _mm256_cmpeq_epi8(v, _mm256_set1_epi8((char)0xd7)),
+        _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(0x80 + 0xde - 0xc0 + 1)),
+                          _mm256_add_epi8(v, _mm256_set1_epi8((char)(0x80 - 0xc0))))));
+#endif
+    return _mm256_or_si256(v, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+}
+
+AVX2_FUNC static size_t
+casefold_mismatch_avx2(const char *stra, const char *strb, size_t len)
+{
+    size_t ii;
+    unsigned int mask;
+
+    if (len < 32)
+        return casefold_mismatch_sse2(stra, strb, len);
+    for (ii = 0; ii + 32 <= len; ii += 32) {
+        mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+            casefold_avx2(_mm256_loadu_si256((const __m256i*)(stra + ii))),
+            casefold_avx2(_mm256_loadu_si256((const __m256i*)(strb + ii)))));
+        if (mask != 0xffffffff)
+            return ii + __builtin_ctz(~mask);
+    }
+    _mm256_zeroupper();
+    return ii + casefold_mismatch_sse2(stra + ii, strb + ii, len - ii);
+}
+
+AVX2_FUNC static size_t
+casefold_find_avx2(const char *str, size_t len, char ch)
+{
+    __m256i want;
+    size_t ii;
+    unsigned int mask;
+
+    if (len < 32)
+        return casefold_find_sse2(str, len, ch);
+    want = _mm256_set1_epi8(ch);
+    for (ii = 0; ii + 32 <= len; ii += 32) {
+        mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+            casefold_avx2(_mm256_loadu_si256((const __m256i*)(str + ii))), want));
+        if (mask)
+            return ii + __builtin_ctz(mask);
+    }
+    _mm256_zeroupper();
+    return ii + casefold_find_sse2(str + ii, len - ii, ch);
+}
+
+AVX2_FUNC static void
+casefold_lower_avx2(char *str, size_t len)
+{
+    size_t ii;
+
+    if (len < 32) {
+        casefold_lower_sse2(str, len);
+        return;
+    }
+    for (ii = 0; ii + 32 <= len; ii += 32)
+        _mm256_storeu_si256((__m256i*)(str + ii),
+                            casefold_avx2(_mm256_loadu_si256((const __m256i*)(str + ii))));
+    _mm256_zeroupper();
+    casefold_lower_sse2(str + ii, len - ii);
+}
+
+AVX2_FUNC static unsigned long long
+casefold_hash_avx2(const char *str, size_t len, unsigned long long hash)
+{
+    char folded[32];
+
+    if (len < 32)
+        return casefold_hash_sse2(str, len, hash);
+    for (; len >= 32; str += 32, len -= 32) {
+        _mm256_storeu_si256((__m256i*)folded,
+                            casefold_avx2(_mm256_loadu_si256((const __m256i*)str)));
+        hash = casehash_block(hash, folded);
+        hash = casehash_block(hash, folded + 16);
+    }
+    _mm256_zeroupper();
+    return casefold_hash_sse2(str, len, hash);
+}
+
+static const struct casefold_ops casefold_avx2_ops = {
+    "avx2",
+    casefold_mismatch_avx2,
+    casefold_find_avx2,
+    casefold_lower_avx2,
+    casefold_hash_avx2
+};
+#endif /* HAVE_TARGET_AVX2 */
+#endif /* __SSE2__ */
+
+static const struct casefold_ops *casefold = &casefold_scalar;
+
+/* Checks that ops folds every byte value the way irc_tolower[] does. */
+static int
+casefold_check(const struct casefold_ops *ops)
+{
+    char all[256], folded[256];
+    unsigned int ii;
+
+    for (ii = 0; ii < 256; ii++)
+        all[ii] = folded[ii] = ii;
+    ops->lower(folded, sizeof(folded));
+    for (ii = 0; ii < 256; ii++) {
+        if (folded[ii] != tolower(all[ii])
+            || ops->find(all, sizeof(all), ii) != casefold_find_scalar(all, sizeof(all), ii))
+            return 0;
+    }
+    return ops->mismatch(all, folded, sizeof(all)) == sizeof(all)
+        && ops->hash(all, sizeof(all), 0) == casefold_hash_scalar(folded, sizeof(folded), 0);
+}
+
+static void
+casefold_init(void)
+{
+    casefold = &casefold_scalar;
+#if defined(CASEFOLD_SSE2)
+    if (casefold_check(&casefold_sse2_ops))
+        casefold = &casefold_sse2_ops;
+#if defined(CASEFOLD_AVX2)
+    if (__builtin_cpu_supports("avx2") && casefold_check(&casefold_avx2_ops))
+        casefold = &casefold_avx2_ops;
+#endif
+#endif
+}
+
+const char *
+casefold_impl(void)
+{
+    return casefold->name;
+}
+
+/* Strings shorter than this are handled inline rather than through
+ * the vector code. */
+#define CASEFOLD_MIN 16
+
 void
 irc_strtolower(char *str) {
-    char *p;
-    for(p = str;*p;p++) {
-       *p = tolower(*p);
-    }
+    size_t len = strlen(str);
+
+    if (len < CASEFOLD_MIN)
+        casefold_lower_scalar(str, len);
+    else
+        casefold->lower(str, len);
 }
 
 int
 irccasecmp(const char *stra, const char *strb) {
+    size_t lena, lenb, pos;
+
     if (!stra)
       return -1;
     if (!strb)
       return 1;
-    while (*stra && (tolower(*stra) == tolower(*strb)))
-        stra++, strb++;
-    return tolower(*stra) - tolower(*strb);
+    /* Most comparisons in a dict differ in the first byte. */
+    if (!*stra || tolower(*stra) != tolower(*strb))
+        return tolower(*stra) - tolower(*strb);
+    lena = strlen(stra);
+    lenb = strlen(strb);
+    if (lenb < lena)
+        lena = lenb;
+    if (lena < CASEFOLD_MIN)
+        pos = casefold_mismatch_scalar(stra, strb, lena);
+    else
+        pos = casefold->mismatch(stra, strb, lena);
+    return tolower(stra[pos]) - tolower(strb[pos]);
 }
 
 int
 ircncasecmp(const char *stra, const char *strb, unsigned int len) {
-    len--;
-    while (*stra && (tolower(*stra) == tolower(*strb)) && len)
-        stra++, strb++, len--;
-    return tolower(*stra) - tolower(*strb);
+    size_t lena, lenb, pos;
+
+    /* As before, a len of 0 means no limit. */
+    lena = strnlen(stra, len ? len : (size_t)-1);
+    lenb = strnlen(strb, lena);
+    if (lenb < lena)
+        lena = lenb;
+    if (lena < CASEFOLD_MIN)
+        pos = casefold_mismatch_scalar(stra, strb, lena);
+    else
+        pos = casefold->mismatch(stra, strb, lena);
+    if (len && pos == len)
+        return 0;
+    return tolower(stra[pos]) - tolower(strb[pos]);
 }
 
 const char *
 irccasestr(const char *haystack, const char *needle) {
-    unsigned int hay_len = strlen(haystack), needle_len = strlen(needle), pos;
+    size_t hay_len = strlen(haystack), needle_len = strlen(needle), pos, end;
+    char first;
+
     if (hay_len < needle_len)
         return NULL;
-    for (pos=0; pos<hay_len+1-needle_len; ++pos) {
-        if ((tolower(haystack[pos]) == tolower(*needle))
-            && !ircncasecmp(haystack+pos, needle, needle_len))
-            return haystack+pos;
+    first = tolower(*needle);
+    end = hay_len + 1 - needle_len;
+    for (pos = 0; pos < end; ++pos) {
+        pos += casefold->find(haystack + pos, end - pos, first);
+        if (pos == end)
+            break;
+        if (casefold->mismatch(haystack + pos, needle, needle_len) == needle_len)
+            return haystack + pos;
     }
     return NULL;
 }
 
+unsigned int
+irccasehash(const char *str) {
+    char tail[16];
+    size_t len = strlen(str), ii;
+    unsigned long long hash;
+
+    hash = len * CASEHASH_K2;
+    if (len >= CASEFOLD_MIN)
+        hash = casefold->hash(str, len, hash);
+    str += len & ~(size_t)15;
+    len &= 15;
+    for (ii = 0; ii < len; ii++)
+        tail[ii] = tolower(str[ii]);
+    memset(tail + len, 0, sizeof(tail) - len);
+    hash = casehash_block(hash, tail);
+    hash ^= hash >> 32;
+    hash *= CASEHASH_K1;
+    return hash ^ (hash >> 29);
+}
+
 char *
 ircstrlower(char *str) {
-    size_t ii;
-    for (ii = 0; str[ii] != '\0'; ++ii)
-        str[ii] = tolower(str[ii]);
+    irc_strtolower(str);
     return str;
 }
 
+/* CRC-32C (the Castagnoli polynomial), for when text needs a cheap,
+ * well mixed hash.  Where the CPU has the SSE4.2 crc32 instruction it
+ * does eight bytes at a time; otherwise slicing-by-8 tables do.  Both
+ * give the same result, so which is used makes no difference. */
+
+#define CRC32C_POLY 0x82F63B78
+
+static uint32_t crc32c_table[8][256];
+
+static uint32_t
+crc32c_slice8(uint32_t crc, const char *buf, size_t len)
+{
+    const unsigned char *next = (const unsigned char *)buf;
+    uint32_t word;
+
+    for (; len >= 8; len -= 8, next += 8) {
+        word = crc ^ (next[0] | (next[1] << 8) | (next[2] << 16) | ((uint32_t)next[3] << 24));
+        crc = crc32c_table[7][word & 0xff] ^ crc32c_table[6][(word >> 8) & 0xff]
+            ^ crc32c_table[5][(word >> 16) & 0xff] ^ crc32c_table[4][word >> 24]
+            ^ crc32c_table[3][next[4]] ^ crc32c_table[2][next[5]]
+            ^ crc32c_table[1][next[6]] ^ crc32c_table[0][next[7]];
+    }
+    for (; len; len--)
+        crc = crc32c_table[0][(crc ^ *next++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(HAVE_TARGET_SSE42) && defined(CASEFOLD_SSE2)
+#define CRC32C_SSE42 1
+
+__attribute__((target("sse4.2"))) static uint32_t
+crc32c_sse42(uint32_t crc, const char *buf, size_t len)
+{
+#if defined(__x86_64__)
+    unsigned long long crc64 = crc;
+    uint64_t word;
+
+    for (; len >= 8; len -= 8, buf += 8) {
+        memcpy(&word, buf, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = crc64;
+#else
+    uint32_t word;
+
+    for (; len >= 4; len -= 4, buf += 4) {
+        memcpy(&word, buf, sizeof(word));
+        crc = _mm_crc32_u32(crc, word);
+    }
+#endif
+    for (; len; len--)
+        crc = _mm_crc32_u8(crc, *buf++);
+    return crc;
+}
+#endif
+
+static uint32_t (*crc32c_func)(uint32_t crc, const char *buf, size_t len) = crc32c_slice8;
+
+static void
+crc32c_init(void)
+{
+    char check[256];
+    uint32_t crc;
+    unsigned int ii, jj;
+
+    for (ii = 0; ii < 256; ii++) {
+        for (crc = ii, jj = 0; jj < 8; jj++)
+            crc = (crc >> 1) ^ (CRC32C_POLY & -(crc & 1));
+        crc32c_table[0][ii] = crc;
+    }
+    for (ii = 0; ii < 256; ii++)
+        for (jj = 1; jj < 8; jj++)
+            crc32c_table[jj][ii] = (crc32c_table[jj - 1][ii] >> 8) ^ crc32c_table[0][crc32c_table[jj - 1][ii] & 0xff];
+    crc32c_func = crc32c_slice8;
+#if defined(CRC32C_SSE42)
+    for (ii = 0; ii < sizeof(check); ii++)
+        check[ii] = ii * 7;
+    if (__builtin_cpu_supports("sse4.2") && crc32c_sse42(~0u, check, sizeof(check)) == crc32c_slice8(~0u, check, sizeof(check)))
+        crc32c_func = crc32c_sse42;
+#else
+    (void)check;
+#endif
+}
+
+unsigned int
+crc32c(unsigned int crc, const char *buf, size_t len)
+{
+    return ~crc32c_func(~crc, buf, len);
+}
+
+const char *
+crc32c_impl(void)
+{
+#if defined(CRC32C_SSE42)
+    if (crc32c_func == crc32c_sse42)
+        return "sse4.2";
+#endif
+    return "slice8";
+}
+
 int
 split_line(char *line, int irc_colon, int argv_size, char *argv[])
 {
@@ -605,207 +1087,309 @@ int is_overmask(char *mask)
     return(match_ircglob("abcdefghijklmnopqrstuv!frcmbghilnrtoasde@apdic.yfa.dsfsdaffsdasfdasfd.abcdefghijklmnopqrstuvwxyz.asdfasfdfsdsfdasfda.ydfbe", mask));
 }
 
-int
-user_matches_glob(struct userNode *user, const char *orig_glob, int flags, int shared)
-{
-    char *tmpglob, *glob, *marker;
-    char exttype = 0;
-    int extreverse = 0, is_extended = 0, match = 0, banned = 0;
-    unsigned int count, n;
-    struct modeNode *mn;
-    struct chanNode *channel;
-    struct banNode *ban;
-
-    /* Make a writable copy of the glob */
-    glob = alloca(strlen(orig_glob)+1);
-    strcpy(glob, orig_glob);
+/* How a piece of a compiled glob is matched. */
+#define GLOB_WILD    0 /* has wildcards: use match_ircglob() */
+#define GLOB_LITERAL 1 /* no wildcards: compare case-insensitively */
+#define GLOB_ANY     2 /* only '*': matches anything */
+
+#define GLOB_ERR_NO_BANG 1
+#define GLOB_ERR_NO_AT   2
+
+struct glob_matcher {
+    /* For normal masks, the case-folded nick, ident and host parts
+     * (nick is NULL without MATCH_USENICK).  For extended bans, ext is
+     * the argument after the ':' in its original case. */
+    char *nick, *ident, *host, *ext;
+    unsigned char nick_type, ident_type, host_type;
+    unsigned char ip_host; /* host part could be an IP glob */
+    unsigned char error;
+    char exttype;
+    unsigned char extreverse;
+    char buf[1];
+};
 
-    /* Extended bans */
-    tmpglob = alloca(strlen(orig_glob)+1);
-    tmpglob = strdup(orig_glob);
+static unsigned char
+glob_part_fold(char *part)
+{
+    unsigned char type = GLOB_LITERAL, any = 1;
+
+    if (!*part)
+        return GLOB_LITERAL;
+    for (; *part; part++) {
+        if (*part == '*')
+            type = GLOB_WILD;
+        else if (*part == '?') {
+            type = GLOB_WILD;
+            any = 0;
+        } else if (*part == '\\') {
+            /* escaped characters keep their case */
+            type = GLOB_WILD;
+            any = 0;
+            if (!*++part)
+                break;
+        } else {
+            *part = tolower(*part);
+            any = 0;
+        }
+    }
+    return any ? GLOB_ANY : type;
+}
 
-    if (*tmpglob == '~') {
-        tmpglob++; /* get rid of the ~ */
+static int
+glob_part_matches(const char *text, const char *part, unsigned char type)
+{
+    switch (type) {
+    case GLOB_ANY:
+        return 1;
+    case GLOB_LITERAL:
+        while (*part && (tolower(*text) == *part))
+            text++, part++;
+        return !*part && !*text;
+    default:
+        return match_ircglob(text, part);
+    }
+}
 
-        if (*tmpglob == '!') {
-            extreverse = 1;
-            tmpglob++; /* get rid of the ! */
+/* gm must have room for strlen(glob) bytes past the end of the struct. */
+static void
+glob_matcher_init(struct glob_matcher *gm, const char *glob, int flags)
+{
+    const char *tmp;
+    char *marker;
+
+    memset(gm, 0, sizeof(*gm));
+    strcpy(gm->buf, glob);
+
+    /* Extended bans look like ~[!]<type>:<argument>. */
+    if (glob[0] == '~') {
+        tmp = glob + 1;
+        if (*tmp == '!')
+            tmp++;
+        if (*tmp && (tmp[1] == ':')) {
+            gm->extreverse = (glob[1] == '!');
+            gm->exttype = *tmp;
+            gm->ext = gm->buf + (tmp + 2 - glob);
+            return;
         }
+    }
 
-        exttype = *tmpglob;
-        tmpglob++; /* get rid of the type */
-
-        if (*tmpglob == ':') {
-            is_extended = 1;
-            tmpglob++; /* get rid of the : */
-            glob = strdup(tmpglob);
+    marker = gm->buf;
+    if (flags & MATCH_USENICK) {
+        if (!(marker = strchr(gm->buf, '!'))) {
+            gm->error = GLOB_ERR_NO_BANG;
+            return;
         }
+        gm->nick = gm->buf;
+        *marker++ = '\0';
+    }
+    gm->ident = marker;
+    if (!(marker = strchr(marker, '@'))) {
+        gm->error = GLOB_ERR_NO_AT;
+        /* keep the original text around for the error message */
+        strcpy(gm->buf, glob);
+        gm->nick = gm->ident = NULL;
+        return;
     }
+    *marker++ = '\0';
+    gm->host = marker;
+    gm->ip_host = !marker[strspn(marker, "0123456789./*?")];
+    if (gm->nick)
+        gm->nick_type = glob_part_fold(gm->nick);
+    gm->ident_type = glob_part_fold(gm->ident);
+    gm->host_type = glob_part_fold(gm->host);
+}
 
-    if (is_extended) {
-        log_module(MAIN_LOG, LOG_DEBUG, "Extended ban. T (%c) R (%d) M (%s)", exttype, extreverse, glob);
-        switch (exttype) {
-            case 'a': // account
-                if (user->handle_info) {
-                    if (extreverse) {
-                        if (0 != strcasecmp(glob, user->handle_info->handle))
-                            return 1;
-                    } else {
-                        if (0 == strcasecmp(glob, user->handle_info->handle))
-                            return 1;
-                    }
+/*
+ *  Parse glob once so it can be tested against many users with
+ *  user_matches_matcher().  flags only matters for MATCH_USENICK.
+ */
+struct glob_matcher *
+glob_matcher_compile(const char *glob, int flags)
+{
+    struct glob_matcher *gm;
+
+    gm = malloc(sizeof(*gm) + strlen(glob));
+    glob_matcher_init(gm, glob, flags);
+    return gm;
+}
+
+void
+glob_matcher_free(struct glob_matcher *gm)
+{
+    free(gm);
+}
+
+int
+user_matches_glob(struct userNode *user, const char *orig_glob, int flags, int shared)
+{
+    struct glob_matcher *gm;
+
+    gm = alloca(sizeof(*gm) + strlen(orig_glob));
+    glob_matcher_init(gm, orig_glob, flags);
+    return user_matches_matcher(user, gm, flags, shared);
+}
+
+static int
+user_matches_extban(struct userNode *user, const struct glob_matcher *gm, int flags, int shared)
+{
+    const char *glob = gm->ext;
+    int extreverse = gm->extreverse, match = 0, banned = 0;
+    unsigned int n;
+    struct modeNode *mn;
+    struct chanNode *channel;
+    struct banNode *ban;
+
+    log_module(MAIN_LOG, LOG_DEBUG, "Extended ban. T (%c) R (%d) M (%s)", gm->exttype, extreverse, glob);
+    switch (gm->exttype) {
+        case 'a': // account
+            if (user->handle_info) {
+                if (extreverse) {
+                    if (0 != strcasecmp(glob, user->handle_info->handle))
+                        return 1;
                 } else {
-                    if (extreverse)
+                    if (0 == strcasecmp(glob, user->handle_info->handle))
                         return 1;
                 }
-                return match_ircglob(user->hostname, glob);
-            case 'c': // another channel
-                if (!strstr(glob, "#"))
-                    return -1;
+            } else {
+                if (extreverse)
+                    return 1;
+            }
+            return match_ircglob(user->hostname, glob);
+        case 'c': // another channel
+            if (!strstr(glob, "#"))
+                return -1;
 
-                if (extreverse) {
-                    for (n=count=0; n<user->channels.used; n++) {
-                        mn = user->channels.list[n];
-                        match = 0;
-
-                        if (*glob == '#') {
-                            if (0 == strcasecmp(glob, mn->channel->name))
-                                match = 1;
-                        } else {
-                            if (0 == strcasecmp(glob+1, mn->channel->name)) {
-                                if ((*glob == '@') && (mn->modes & MODE_CHANOP))
-                                    match = 1;
-                                else if ((*glob == '%') && (mn->modes & MODE_HALFOP))
-                                    match = 1;
-                                else if ((*glob == '+') && (mn->modes & MODE_VOICE))
-                                    match = 1;
-                             }
-                        }
-
-                        if (match == 0)
-                            banned = 1;
-                        else {
-                            banned = 0;
-                            break;
-                        }
-                    }
+            for (n=0; n<user->channels.used; n++) {
+                mn = user->channels.list[n];
+                match = 0;
+
+                if (*glob == '#') {
+                    if (0 == strcasecmp(glob, mn->channel->name))
+                        match = 1;
                 } else {
-                    for (n=count=0; n<user->channels.used; n++) {
-                        mn = user->channels.list[n];
-                        match = 0;
-
-                        if (*glob == '#') {
-                            if (0 == strcasecmp(glob, mn->channel->name))
-                                match = 1;
-                        } else {
-                            if (0 == strcasecmp(glob+1, mn->channel->name)) {
-                                if ((*glob == '@') && (mn->modes & MODE_CHANOP))
-                                    match = 1;
-                                else if ((*glob == '%') && (mn->modes & MODE_HALFOP))
-                                    match = 1;
-                                else if ((*glob == '+') && (mn->modes & MODE_VOICE))
-                                    match = 1;
-                             }
-                        }
-
-                        if (match == 1)
-                            banned = 1;
-                    }
+                    if (0 == strcasecmp(glob+1, mn->channel->name)) {
+                        if ((*glob == '@') && (mn->modes & MODE_CHANOP))
+                            match = 1;
+                        else if ((*glob == '%') && (mn->modes & MODE_HALFOP))
+                            match = 1;
+                        else if ((*glob == '+') && (mn->modes & MODE_VOICE))
+                            match = 1;
+                     }
                 }
 
-                if (banned)
-                    return 1;
-                else
-                    return match_ircglob(user->hostname, glob);
-            case 'j':
-                 if (shared == 0) {
-                     if (*glob != '#')
-                         return -1;
-                     if ((channel = GetChannel(glob))) {
-                         for (n = 0; n < channel->banlist.used; n++) {
-                             ban = channel->banlist.list[n];
-                             if (user_matches_glob(user, ban->ban, flags, 1))
-                                 return 1;
-                         }
+                if (extreverse) {
+                    if (match == 0)
+                        banned = 1;
+                    else {
+                        banned = 0;
+                        break;
+                    }
+                } else if (match == 1)
+                    banned = 1;
+            }
+
+            if (banned)
+                return 1;
+            else
+                return match_ircglob(user->hostname, glob);
+        case 'j':
+             if (shared == 0) {
+                 if (*glob != '#')
+                     return -1;
+                 if ((channel = GetChannel(glob))) {
+                     for (n = 0; n < channel->banlist.used; n++) {
+                         ban = channel->banlist.list[n];
+                         if (ban->matcher
+                             ? user_matches_matcher(user, ban->matcher, flags, 1)
+                             : user_matches_glob(user, ban->ban, flags, 1))
+                             return 1;
                      }
                  }
-                 return match_ircglob(user->hostname, glob);
-            case 'n': /* this is handled ircd side */
-                return match_ircglob(user->hostname, glob);
-            case 'q': /* this is handled ircd side */
-                return match_ircglob(user->hostname, glob);
-            case 't': /* this is handled ircd side */
-                return match_ircglob(user->hostname, glob);
-            case 'R': /* this is handled ircd side */
-                return match_ircglob(user->hostname, glob);
-            case 'm': // mute by mark
-                 if(user->mark && !strcmp(glob, user->mark)) 
-                    return true;
-                else 
-                    return false;
-                
-            case 'M': // mute by mark unless authed
-                return false; // can never match a logged in user
-
-            default:
-                return -1;
-        }
-    }
+             }
+             return match_ircglob(user->hostname, glob);
+        case 'n': /* this is handled ircd side */
+            return match_ircglob(user->hostname, glob);
+        case 'q': /* this is handled ircd side */
+            return match_ircglob(user->hostname, glob);
+        case 't': /* this is handled ircd side */
+            return match_ircglob(user->hostname, glob);
+        case 'R': /* this is handled ircd side */
+            return match_ircglob(user->hostname, glob);
+        case 'm': // mute by mark
+             if(user->ext->mark && !strcmp(glob, user->ext->mark)) 
+                return true;
+            else 
+                return false;
+            
+        case 'M': // mute by mark unless authed
+            return false; // can never match a logged in user
 
-    /* Check the nick, if it's present */
-    if (flags & MATCH_USENICK) {
-        if (!(marker = strchr(glob, '!'))) {
-            log_module(MAIN_LOG, LOG_ERROR, "user_matches_glob(\"%s\", \"%s\", %d) called, and glob doesn't include a '!'", user->nick, orig_glob, flags);
-            return 0;
-        }
-        *marker = 0;
-        if (!match_ircglob(user->nick, glob)) return 0;
-        glob = marker + 1;
+        default:
+            return -1;
     }
-    /* Check the ident */
-    if (!(marker = strchr(glob, '@'))) {
-        log_module(MAIN_LOG, LOG_ERROR, "user_matches_glob(\"%s\", \"%s\", %d) called, and glob doesn't include an '@'", user->nick, orig_glob, flags);
+}
+
+int
+user_matches_matcher(struct userNode *user, const struct glob_matcher *gm, int flags, int shared)
+{
+    const char *glob;
+
+    if (gm->ext)
+        return user_matches_extban(user, gm, flags, shared);
+
+    if (gm->error == GLOB_ERR_NO_BANG) {
+        log_module(MAIN_LOG, LOG_ERROR, "user_matches_glob(\"%s\", \"%s\", %d) called, and glob doesn't include a '!'", user->nick, gm->buf, flags);
+        return 0;
+    } else if (gm->error == GLOB_ERR_NO_AT) {
+        log_module(MAIN_LOG, LOG_ERROR, "user_matches_glob(\"%s\", \"%s\", %d) called, and glob doesn't include an '@'", user->nick, gm->buf, flags);
         return 0;
     }
-    *marker = 0;
-    if (!match_ircglob(user->ident, glob))
+
+    /* Check the nick, if it's present */
+    if (gm->nick && !glob_part_matches(user->nick, gm->nick, gm->nick_type))
         return 0;
-    glob = marker + 1;
+    /* Check the ident */
+    if (!glob_part_matches(user->ident, gm->ident, gm->ident_type))
+        return 0;
+    /* Every host form below matches a bare '*'. */
+    if (gm->host_type == GLOB_ANY)
+        return 1;
+    glob = gm->host;
     /* Check for a fakehost match. */
-    if (IsFakeHost(user) && match_ircglob(user->fakehost, glob))
+    if (IsFakeHost(user) && glob_part_matches(user->ext->fakehost, glob, gm->host_type))
         return 1;
 
     /* Check for a sethost (S:lines) */
-    if (IsSetHost(user) && match_ircglob(user->sethost, glob))
+    if (IsSetHost(user) && glob_part_matches(user->ext->sethost, glob, gm->host_type))
         return 1;
 
     /* Check for an account match. */
     if (hidden_host_suffix && user->handle_info) {
         char hidden_host[HOSTLEN+1];
         snprintf(hidden_host, sizeof(hidden_host), "%s.%s", user->handle_info->handle, hidden_host_suffix);
-        if (match_ircglob(hidden_host, glob))
+        if (glob_part_matches(hidden_host, glob, gm->host_type))
             return 1;
     }
 
     /* Match crypt hostname */
-    if (match_ircglob(user->crypthost, glob))
+    if (glob_part_matches(user->ext->crypthost, glob, gm->host_type))
         return 1;
 
     /* Match crypt IP */
-    if (match_ircglob(user->cryptip, glob))
+    if (glob_part_matches(user->ext->cryptip, glob, gm->host_type))
         return 1;
 
     /* If only matching the visible hostnames, bail early. */
     if ((flags & MATCH_VISIBLE) && IsHiddenHost(user)
         && (IsFakeHost(user) || (hidden_host_suffix && user->handle_info) ||
-            user->crypthost || user->cryptip))
+            user->ext->crypthost || user->ext->cryptip))
         return 0;
     /* If it might be an IP glob, test that. */
-    if (!glob[strspn(glob, "0123456789./*?")]
-        && match_ircglob(irc_ntoa(&user->ip), glob))
+    if (gm->ip_host
+        && glob_part_matches(irc_ntoa(&user->ip), glob, gm->host_type))
         return 1;
     /* None of the above; could only be a hostname match. */
-    return match_ircglob(user->hostname, glob);
+    return glob_part_matches(user->hostname, glob, gm->host_type);
 }
 
 int
@@ -1261,6 +1845,8 @@ tools_init(void)
     for (upr=0xd8, lwr=0xf8; lwr <= 0xfe; ++upr, ++lwr)
         tolower(upr) = lwr;
 #endif
+    casefold_init();
+    crc32c_init();
     str_tab.size = 1001;
     str_tab.list = calloc(str_tab.size, sizeof(str_tab.list[0]));
 }
@@ -0,0 +1,200 @@
+/* wordmatch.c - Find any of a set of words in a string
+ * Copyright 2000-2024 Evilnet Development
+ *
+ * This file is part of x3.
+ *
+ * x3 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with srvx; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+ */
+
+#include "common.h"
+#include "wordmatch.h"
+
+/* This is an Aho-Corasick automaton, compiled to a table so that a
+ * scan does one lookup per byte of text.  The words form a trie whose
+ * states are numbered from 0 (the root).  While words are added, each
+ * state keeps its children in a linked list of edges.
+ *
+ * Compiling gives each byte that appears in some word its own class,
+ * with every other byte in class 0, and fills in the row of next
+ * states for each state: a state's own edges, and for every other
+ * class, whatever its failure state (the state for the longest proper
+ * suffix of its text that is also in the trie) would do.  Each state's
+ * out flags include those of its failure state, so a scan only looks
+ * at the state it is in.
+ */
+
+struct wordmatch {
+    unsigned int states;
+    unsigned int alloc_states;
+    unsigned int *out;
+
+    /* while adding: first edge of each state, and for each edge its
+     * byte, target state and next sibling */
+    unsigned int edges;
+    unsigned int alloc_edges;
+    unsigned int *first;
+    unsigned char *edge_ch;
+    unsigned int *edge_next;
+    unsigned int *edge_sib;
+
+    /* once compiled: the next state from s on byte ch is
+     * next[s * classes + class_of[ch]] */
+    unsigned int classes;
+    unsigned int *next;
+    unsigned char class_of[256];
+};
+
+#define NO_EDGE (~0u)
+
+struct wordmatch *
+wordmatch_alloc(void)
+{
+    struct wordmatch *wm;
+
+    wm = calloc(1, sizeof(*wm));
+    wm->alloc_states = 16;
+    wm->out = calloc(wm->alloc_states, sizeof(wm->out[0]));
+    wm->first = malloc(wm->alloc_states * sizeof(wm->first[0]));
+    wm->first[0] = NO_EDGE;
+    wm->states = 1;
+    return wm;
+}
+
+static unsigned int
+wordmatch_new_state(struct wordmatch *wm, unsigned int parent, unsigned char ch)
+{
+    unsigned int state;
+
+    if (wm->states == wm->alloc_states) {
+        wm->alloc_states <<= 1;
+        wm->out = realloc(wm->out, wm->alloc_states * sizeof(wm->out[0]));
+        wm->first = realloc(wm->first, wm->alloc_states * sizeof(wm->first[0]));
+    }
+    if (wm->edges == wm->alloc_edges) {
+        wm->alloc_edges = wm->alloc_edges ? wm->alloc_edges << 1 : 16;
+        wm->edge_ch = realloc(wm->edge_ch, wm->alloc_edges * sizeof(wm->edge_ch[0]));
+        wm->edge_next = realloc(wm->edge_next, wm->alloc_edges * sizeof(wm->edge_next[0]));
+        wm->edge_sib = realloc(wm->edge_sib, wm->alloc_edges * sizeof(wm->edge_sib[0]));
+    }
+    state = wm->states++;
+    wm->out[state] = 0;
+    wm->first[state] = NO_EDGE;
+    wm->edge_ch[wm->edges] = ch;
+    wm->edge_next[wm->edges] = state;
+    wm->edge_sib[wm->edges] = wm->first[parent];
+    wm->first[parent] = wm->edges++;
+    return state;
+}
+
+void
+wordmatch_add(struct wordmatch *wm, const char *word, unsigned int flags)
+{
+    unsigned int state, edge;
+    unsigned char ch;
+
+    assert(!wm->next);
+    for (state = 0; (ch = *word) != '\0'; word++) {
+        for (edge = wm->first[state]; edge != NO_EDGE; edge = wm->edge_sib[edge])
+            if (wm->edge_ch[edge] == ch)
+                break;
+        state = (edge != NO_EDGE) ? wm->edge_next[edge] : wordmatch_new_state(wm, state, ch);
+    }
+    wm->out[state] |= flags;
+}
+
+void
+wordmatch_compile(struct wordmatch *wm)
+{
+    unsigned int *fail, *queue, *row;
+    unsigned int state, edge, head, tail, child, cls;
+
+    assert(!wm->next);
+    wm->classes = 1;
+    for (edge = 0; edge < wm->edges; edge++)
+        if (!wm->class_of[wm->edge_ch[edge]])
+            wm->class_of[wm->edge_ch[edge]] = wm->classes++;
+    wm->next = calloc(wm->states * wm->classes, sizeof(wm->next[0]));
+
+    /* Fill in the rows breadth first, so the row of each state's
+     * failure state is done before the state's own. */
+    fail = calloc(wm->states, sizeof(fail[0]));
+    queue = malloc(wm->states * sizeof(queue[0]));
+    head = tail = 0;
+    for (edge = wm->first[0]; edge != NO_EDGE; edge = wm->edge_sib[edge]) {
+        child = wm->edge_next[edge];
+        wm->next[wm->class_of[wm->edge_ch[edge]]] = child;
+        wm->out[child] |= wm->out[0];
+        queue[tail++] = child;
+    }
+    while (head < tail) {
+        state = queue[head++];
+        row = wm->next + state * wm->classes;
+        memcpy(row, wm->next + fail[state] * wm->classes, wm->classes * sizeof(row[0]));
+        for (edge = wm->first[state]; edge != NO_EDGE; edge = wm->edge_sib[edge]) {
+            child = wm->edge_next[edge];
+            cls = wm->class_of[wm->edge_ch[edge]];
+            fail[child] = row[cls];
+            row[cls] = child;
+            wm->out[child] |= wm->out[fail[child]];
+            queue[tail++] = child;
+        }
+    }
+    free(queue);
+    free(fail);
+
+    free(wm->first);
+    free(wm->edge_ch);
+    free(wm->edge_next);
+    free(wm->edge_sib);
+    wm->first = wm->edge_next = wm->edge_sib = NULL;
+    wm->edge_ch = NULL;
+}
+
+void
+wordmatch_free(struct wordmatch *wm)
+{
+    if (!wm)
+        return;
+    free(wm->out);
+    free(wm->first);
+    free(wm->edge_ch);
+    free(wm->edge_next);
+    free(wm->edge_sib);
+    free(wm->next);
+    free(wm);
+}
+
+unsigned int
+wordmatch_scan(const struct wordmatch *wm, const char *text, unsigned int stop)
+{
+    unsigned int state, found;
+
+    assert(wm->next);
+    found = wm->out[0];
+    if (wm->states == 1)
+        return found;
+    for (state = 0; *text && !(found & stop); text++) {
+        state = wm->next[state * wm->classes + wm->class_of[(unsigned char)*text]];
+        found |= wm->out[state];
+    }
+    return found;
+}
+
+unsigned int
+wordmatch_step(const struct wordmatch *wm, unsigned int *state, char ch)
+{
+    *state = wm->next[*state * wm->classes + wm->class_of[(unsigned char)ch]];
+    return wm->out[*state];
+}
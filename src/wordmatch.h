@@ -0,0 +1,46 @@
+/* wordmatch.h - Find any of a set of words in a string
+ * Copyright 2000-2024 Evilnet Development
+ *
+ * This file is part of x3.
+ *
+ * x3 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with srvx; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+ */
+
+#ifndef WORDMATCH_H
+#define WORDMATCH_H
+
+/* A word matcher answers "which of these words occur in this text?"
+ * in one pass over the text, however many words there are.  Each word
+ * carries flag bits, and a scan returns the flags of every word it
+ * found.  Words are matched byte for byte, like strstr().
+ *
+ * Add the words, compile, then scan as often as needed.  Adding words
+ * after compiling is not supported; build a new matcher instead. */
+
+struct wordmatch;
+
+struct wordmatch *wordmatch_alloc(void);
+void wordmatch_add(struct wordmatch *wm, const char *word, unsigned int flags);
+void wordmatch_compile(struct wordmatch *wm);
+void wordmatch_free(struct wordmatch *wm);
+/* returns the flags of the words found in text, stopping early once
+ * any of the stop flags has been found */
+unsigned int wordmatch_scan(const struct wordmatch *wm, const char *text, unsigned int stop);
+/* feeds text one byte at a time: start with *state set to 0 and the
+ * flags from wordmatch_scan(wm, "", 0), and add in what each call
+ * returns */
+unsigned int wordmatch_step(const struct wordmatch *wm, unsigned int *state, char ch);
+
+#endif /* !defined(WORDMATCH_H) */